@@ -2,8 +2,10 @@
 
 #include "quic/address.hpp"
 #include "quic/btstream.hpp"
+#include "quic/buffer_pool.hpp"
 #include "quic/connection.hpp"
 #include "quic/context.hpp"
+#include "quic/coro.hpp"
 #include "quic/crypto.hpp"
 #include "quic/datagram.hpp"
 #include "quic/endpoint.hpp"
@@ -12,10 +14,18 @@
 #include "quic/format.hpp"
 #include "quic/formattable.hpp"
 #include "quic/gnutls_crypto.hpp"
+#include "quic/jobs.hpp"
+#include "quic/loop.hpp"
 #include "quic/messages.hpp"
 #include "quic/network.hpp"
 #include "quic/opt.hpp"
+#include "quic/qlog.hpp"
+#include "quic/shm.hpp"
+#include "quic/simulated.hpp"
+#include "quic/stats.hpp"
 #include "quic/stream.hpp"
+#include "quic/stream_buffer.hpp"
+#include "quic/timer_wheel.hpp"
 #include "quic/types.hpp"
 #include "quic/udp.hpp"
 #include "quic/utils.hpp"
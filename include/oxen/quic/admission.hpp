@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "address.hpp"
+#include "expiring_store.hpp"
+#include "opt.hpp"
+
+namespace oxen::quic
+{
+    // Counters of an endpoint's inbound handshake admission decisions (see
+    // opt::handshake_admission).
+    struct admission_stats
+    {
+        size_t pending{0};             // inbound handshakes currently in progress
+        uint64_t accepted{0};          // Initials that got a connection
+        uint64_t retried{0};           // Initials answered with a Retry because of load
+        uint64_t dropped_pending{0};   // Initials dropped because max_pending was reached
+        uint64_t dropped_prefix{0};    // Initials dropped by the per-prefix rate limit
+    };
+
+    // Decides, for each Initial packet that would create a new inbound connection, whether to
+    // accept it, make the client validate its address first, or drop it; and keeps count of the
+    // handshakes that are in progress.  Used by Endpoint; not thread-safe.
+    class admission_control
+    {
+      public:
+        using clock = std::chrono::steady_clock;
+
+        enum class decision
+        {
+            accept,
+            retry,
+            drop,
+        };
+
+        explicit admission_control(opt::handshake_admission limits = opt::handshake_admission{});
+
+        // `validated` is true if the Initial carried a valid Retry or NEW_TOKEN token, i.e. the
+        // client has already proven that it can receive at its address.
+        decision admit(const Address& remote, bool validated, clock::time_point now = clock::now());
+
+        void handshake_started() { _stats.pending++; }
+        void handshake_finished()
+        {
+            if (_stats.pending > 0)
+                _stats.pending--;
+        }
+
+        const admission_stats& stats() const { return _stats; }
+
+        // Number of Initials from `remote`'s prefix dropped by the per-prefix limit recently (for
+        // as long as the prefix's rate state is kept).
+        uint64_t prefix_dropped(const Address& remote);
+
+      private:
+        struct token_bucket
+        {
+            double tokens;
+            clock::time_point last;
+            uint64_t dropped{0};
+
+            bool take(double rate, double burst, clock::time_point now);
+        };
+
+        opt::handshake_admission limits;
+        token_bucket global;
+        expiring_store<token_bucket> prefixes;
+        admission_stats _stats;
+
+        // The /24 or /48 network of the address, as bytes
+        static ustring prefix(const Address& a);
+    };
+}  // namespace oxen::quic
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <oxenc/bt.h>
 
 #include "endpoint.hpp"
@@ -18,8 +20,23 @@ namespace oxen::quic
     // enough to hold `MAX_REQ_LEN` followed by a `:`.
     inline constexpr size_t MAX_REQ_LEN_ENCODED = 9;  // "10000000:"
 
+    // Request and response bodies given with a keep-alive are queued on the stream as-is, rather
+    // than being copied into the encoded request, if they are larger than this.
+    inline constexpr size_t MAX_COPIED_BODY = 1024;
+
     class BTRequestStream;
 
+    namespace opt
+    {
+        // BTRequestStream constructor option: lets the messages given to handlers refer directly to
+        // the stream's receive buffer, instead of each getting a copy of its data, when a request
+        // arrives within a single chunk of stream data.  Handlers must then be done with a message
+        // by the time they return, or copy it (moving it isn't enough) to keep it; accessing a
+        // borrowed message's data after that throws.
+        struct borrowed_messages
+        {};
+    }  // namespace opt
+
     // Exception type to throw from a handler to have a method-not-found error returned as a
     // response to the message.  The `what()` value is not actually used: we send back a string that
     // includes the requested method name in the error.  The main use of this exception is when
@@ -30,6 +47,10 @@ namespace oxen::quic
         const char* what() const noexcept override { return "endpoint does not exist"; }
     };
 
+    // A request or response received on a BTRequestStream.  On a stream created with
+    // opt::borrowed_messages the message given to a handler may refer directly to the stream's
+    // receive buffer, and so its data is only accessible until the handler returns: to keep the
+    // message around for longer it must be copied (not moved).
     struct message
     {
         friend class BTRequestStream;
@@ -37,7 +58,18 @@ namespace oxen::quic
 
       private:
         int64_t req_id;
-        bstring data;
+
+        // The message data: either a view of `owned`, or (for messages received entirely within a
+        // single chunk of stream data) of the stream's receive buffer itself.  Borrowed data is
+        // only valid until the stream processes its next chunk of data, which happens after the
+        // message handler returns; `borrow_gen` and `gen` let us detect (and throw on) any use of
+        // the data after that, rather than reading freed memory.  Copying a message always copies
+        // borrowed data.  (The generation is atomic as a borrowed message can be, wrongly but
+        // detectably, used from another thread).
+        bstring owned;
+        bstring_view data;
+        std::shared_ptr<const std::atomic<uint64_t>> borrow_gen;
+        uint64_t gen{0};
 
         // We keep the locations of variables fields as relative positions inside `data` *rather*
         // than using std::string_view members because the string_views are more difficult to
@@ -56,14 +88,37 @@ namespace oxen::quic
         //   as the connection closing.
         message(BTRequestStream& bp, bstring req, bool is_timeout = false);
 
+        // Constructs a message borrowing `req`, which remains valid while `*borrow_gen == gen`.
+        message(BTRequestStream& bp, bstring_view req, std::shared_ptr<const std::atomic<uint64_t>> borrow_gen);
+
+        void parse();
+
+        const std::byte* bytes() const
+        {
+            if (borrow_gen && borrow_gen->load(std::memory_order_acquire) != gen)
+                throw std::logic_error{"BT message data is no longer available; copy the message to keep it"};
+            return data.data();
+        }
+
       public:
         inline static constexpr auto TYPE_REPLY = "R"sv;
         inline static constexpr auto TYPE_ERROR = "E"sv;
         inline static constexpr auto TYPE_COMMAND = "C"sv;
 
-        void respond(bstring_view body, bool error = false) const;
+        message(const message& m);
+        message(message&& m);
+
+        void respond(bstring_view body, bool error = false) const { respond(body, nullptr, error); }
         void respond(std::string_view body, bool error = false) const { respond(convert_sv<std::byte>(body), error); }
 
+        // Responds with a body that is kept alive by `keep_alive` until it has been sent, instead of
+        // being copied (see MAX_COPIED_BODY).
+        void respond(bstring_view body, std::shared_ptr<void> keep_alive, bool error = false) const;
+        void respond(std::string_view body, std::shared_ptr<void> keep_alive, bool error = false) const
+        {
+            respond(convert_sv<std::byte>(body), std::move(keep_alive), error);
+        }
+
         const bool timed_out{false};
         bool is_error() const { return type() == TYPE_ERROR; }
 
@@ -83,21 +138,21 @@ namespace oxen::quic
         template <typename Char = char, typename = std::enable_if_t<sizeof(Char) == 1>>
         std::basic_string_view<Char> view() const
         {
-            return {reinterpret_cast<const Char*>(data.data()), data.size()};
+            return {reinterpret_cast<const Char*>(bytes()), data.size()};
         }
 
         int64_t rid() const { return req_id; }
         std::string_view type() const
         {
-            return {reinterpret_cast<const char*>(data.data()) + req_type.first, req_type.second};
+            return {reinterpret_cast<const char*>(bytes()) + req_type.first, req_type.second};
         }
-        std::string_view endpoint() const { return {reinterpret_cast<const char*>(data.data()) + ep.first, ep.second}; }
+        std::string_view endpoint() const { return {reinterpret_cast<const char*>(bytes()) + ep.first, ep.second}; }
         std::string endpoint_str() const { return std::string{endpoint()}; }
 
         template <typename Char = char, typename = std::enable_if_t<sizeof(Char) == 1>>
         std::basic_string_view<Char> body() const
         {
-            return {reinterpret_cast<const Char*>(data.data()) + req_body.first, req_body.second};
+            return {reinterpret_cast<const Char*>(bytes()) + req_body.first, req_body.second};
         }
 
         template <typename Char = char, typename = std::enable_if_t<sizeof(Char) == 1>>
@@ -121,7 +176,16 @@ namespace oxen::quic
     {
         // parsed request data
         int64_t req_id;
+
+        // The encoded request: the length prefix and bt-list header, followed by the body and the
+        // list terminator unless the body is being sent separately (see `body_keep_alive`).
         std::string data;
+
+        // Body that is sent as its own buffer rather than copied into `data`, and whatever keeps
+        // it alive.  Only set for bodies given with a keep-alive that are over MAX_COPIED_BODY.
+        bstring_view body;
+        std::shared_ptr<void> body_keep_alive;
+
         std::function<void(message)> cb = nullptr;
         BTRequestStream& return_sender;
 
@@ -134,28 +198,62 @@ namespace oxen::quic
 
         bool is_empty() const { return data.empty() && total_len == 0; }
 
+        // `header` is the bt-list encoding of the request up to (and including) the length prefix
+        // of `body`.
         template <typename... Opt>
-        sent_request(BTRequestStream& bp, std::string_view d, int64_t rid, Opt&&... opts) :
-                req_id{rid}, return_sender{bp}, total_len{d.size()}, req_time{get_time()}, expiry{req_time}
+        sent_request(BTRequestStream& bp, std::string_view header, bstring_view b, int64_t rid, Opt&&... opts) :
+                sent_request{nullptr, bp, header, b, rid, std::forward<Opt>(opts)...}
+        {}
+
+        // Same as above, but appends the encoded request (always including the body) onto `out`
+        // rather than into `data`.  Used to encode several requests into a single buffer.
+        template <typename... Opt>
+        sent_request(
+                std::string& out, BTRequestStream& bp, std::string_view header, bstring_view b, int64_t rid, Opt&&... opts) :
+                sent_request{&out, bp, header, b, rid, std::forward<Opt>(opts)...}
+        {}
+
+        // Queues the encoded request on the stream
+        void queue() &&;
+
+      private:
+        template <typename... Opt>
+        sent_request(
+                std::string* out, BTRequestStream& bp, std::string_view header, bstring_view b, int64_t rid, Opt&&... opts) :
+                req_id{rid},
+                return_sender{bp},
+                total_len{header.size() + b.size() + 1},
+                req_time{get_time()},
+                expiry{req_time}
         {
             if (total_len > MAX_REQ_LEN)
                 throw std::invalid_argument{"Request body too long!"};
 
             ((void)handle_req_opts(std::forward<Opt>(opts)), ...);
-            data = oxenc::bt_serialize(d);
             expiry += timeout.value_or(DEFAULT_TIMEOUT);
-        }
-
-        bool is_expired(time_point now) const { return expiry < now; }
 
-        message to_timeout() && { return {return_sender, ""_bs, true}; }
-
-        std::string_view view() { return {data}; }
-        std::string payload() && { return std::move(data); }
+            bool copy_body = out || !body_keep_alive || b.size() <= MAX_COPIED_BODY;
+            if (!out)
+            {
+                out = &data;
+                data.reserve(MAX_REQ_LEN_ENCODED + header.size() + (copy_body ? b.size() + 1 : 0));
+            }
+            *out += std::to_string(total_len);
+            *out += ':';
+            *out += header;
+            if (copy_body)
+            {
+                *out += to_sv(b);
+                *out += 'e';
+                body_keep_alive.reset();
+            }
+            else
+                body = b;
+        }
 
-      private:
         void handle_req_opts(std::function<void(message)> func) { cb = std::move(func); }
         void handle_req_opts(std::chrono::milliseconds exp) { timeout = exp; }
+        void handle_req_opts(std::shared_ptr<void> keep_alive) { body_keep_alive = std::move(keep_alive); }
 
         template <typename Opt>
         void handle_req_opts(std::optional<Opt> option)
@@ -170,22 +268,66 @@ namespace oxen::quic
         friend class TestHelper;
 
       private:
-        // outgoing requests awaiting response
-        // We use shared_ptr's so we can lambda capture it, though it is not actually shared
-        std::deque<std::shared_ptr<sent_request>> sent_reqs;
+        // Maximum number of completed request objects kept around for reuse
+        static constexpr size_t REQ_POOL_MAX = 64;
+
+        // An outgoing request awaiting a response, along with the wheel timer that times it out.
+        // These are recycled through `req_pool` rather than being allocated for each request.
+        struct pending_request
+        {
+            BTRequestStream& stream;
+            int64_t req_id{-1};
+            std::function<void(message)> cb;
+            wheel_timer timer;
+
+            pending_request(BTRequestStream& s, timer_wheel& wheel);
+
+            static void on_timeout(void* self);
+        };
 
-        std::unordered_map<std::string, std::function<void(message)>> func_map;
+        // Outgoing requests awaiting a response, indexed by request ID relative to `req_base`.
+        // Request IDs are handed out in increasing order, so new requests go at (or, if issued
+        // concurrently from different threads, near) the back.  Slots are released from either
+        // end as they empty out; the slots of commands sent without a callback are never filled.
+        std::deque<std::unique_ptr<pending_request>> pending_reqs;
+        int64_t req_base{0};
+        size_t num_reqs{0};
+
+        std::vector<std::unique_ptr<pending_request>> req_pool;
+
+        struct command_handler
+        {
+            std::string endpoint;
+            std::function<void(message)> func;
+        };
+
+        // Registered command handlers, in order of registration, and the index from endpoint name
+        // to position in `handlers`.  The handlers are kept in a deque so that the index can key on
+        // views of their (never moved) endpoint names, letting incoming commands be looked up by the
+        // endpoint name as it appears in the request.
+        std::deque<command_handler> handlers;
+        std::unordered_map<std::string_view, size_t> handler_index;
         std::function<void(message)> generic_handler;
 
         bstring buf;
         std::string size_buf;
 
+        // Set by opt::borrowed_messages
+        bool borrow_messages{false};
+
+        // Generation of the data passed to receive(), for detecting use of message that borrowed
+        // it (see message::borrow_gen); incremented after any receive() that lent data out.
+        std::shared_ptr<std::atomic<uint64_t>> recv_gen;
+        bool lent{false};
+
         size_t current_len{0};
 
         std::atomic<int64_t> next_rid{0};
 
         friend struct sent_request;
+        friend class command_batch;
         friend class Network;
+        friend class Loop;
 
       protected:
         template <typename... Opt>
@@ -195,6 +337,8 @@ namespace oxen::quic
         }
 
       public:
+        ~BTRequestStream() override;
+
         std::weak_ptr<BTRequestStream> weak_from_this()
         {
             return std::dynamic_pointer_cast<BTRequestStream>(shared_from_this());
@@ -212,17 +356,22 @@ namespace oxen::quic
                 Opt&&... opts:
                     std::function<void(message)> cb - callback to be executed if expecting response
                     std::chrono::milliseconds timeout - request timeout (defaults to 10 seconds)
+                    std::shared_ptr<void> keep_alive - keeps `body` alive until it has been sent, so
+                        that large bodies can be sent without being copied (see MAX_COPIED_BODY)
         */
         template <typename... Opt>
         void command(std::string ep, bstring_view body, Opt&&... opts)
         {
             auto rid = next_rid++;
-            auto req = std::make_shared<sent_request>(*this, encode_command(ep, rid, body), rid, std::forward<Opt>(opts)...);
+            sent_request req{*this, encode_command(ep, rid, body.size()), body, rid, std::forward<Opt>(opts)...};
 
-            if (req->cb)
-                endpoint.call([this, r = std::move(req)]() { send(sent_reqs.emplace_back(std::move(r))->view()); });
+            if (req.cb)
+                endpoint.call([this, req = std::move(req)]() mutable {
+                    track_request(req.req_id, std::move(req.cb), req.expiry);
+                    std::move(req).queue();
+                });
             else
-                send(std::move(*req).payload());
+                std::move(req).queue();
         }
         // Same as above, but takes a regular string_view
         template <typename... Opt>
@@ -231,10 +380,15 @@ namespace oxen::quic
             command(std::move(ep), convert_sv<std::byte>(body), std::forward<Opt>(opts)...);
         }
 
-        void respond(int64_t rid, bstring_view body, bool error = false);
+        void respond(int64_t rid, bstring_view body, bool error = false) { respond(rid, body, nullptr, error); }
+
+        // Same as above, but with a keep-alive for body, which then doesn't get copied if it is
+        // large (see MAX_COPIED_BODY).
+        void respond(int64_t rid, bstring_view body, std::shared_ptr<void> keep_alive, bool error = false);
 
         /// Registers an individual endpoint to be recognized by this BTRequestStream object.  Can be
-        /// called multiple times to set up multiple commands.  See also register_generic_handler.
+        /// called multiple times to set up multiple commands; registering an already registered
+        /// endpoint replaces its handler.  See also register_generic_handler.
         void register_handler(std::string endpoint, std::function<void(message)>);
 
         /// Registered (or replaces) the generic handler that is invoked if the requested endpoint
@@ -244,16 +398,23 @@ namespace oxen::quic
         /// exception if the endpoint in this message should be considered not found.
         void register_generic_handler(std::function<void(message)> request_handler);
 
+        /// Returns the number of buffers (commands and responses, possibly coalesced) queued on
+        /// the stream that the remote hasn't acknowledged yet.  Like IOChannel::unsent() this reads
+        /// the count last published by the event loop, without going into it.
         size_t num_pending() const;
 
+        /// Returns the number of requests sent on this stream that are still awaiting a response
+        /// (or timeout).
+        size_t num_requests() const;
+
       protected:
-        void check_timeouts() override;
-        void check_timeouts(std::optional<std::chrono::steady_clock::time_point> now);
 
         void receive(bstring_view data) override;
 
         void closed(uint64_t app_code) override;
 
+        void dropped() override;
+
       private:
         // Optional constructor argument: stream close callback
         void handle_bp_opt(std::function<void(Stream&, uint64_t)> close_cb);
@@ -262,16 +423,92 @@ namespace oxen::quic
         // is equivalent to calling register_command_fallback() with the lambda.
         void handle_bp_opt(std::function<void(message m)> request_handler);
 
+        // Optional constructor argument: see opt::borrowed_messages
+        void handle_bp_opt(opt::borrowed_messages);
+
         void handle_input(message msg);
 
+        // Starts tracking a request awaiting a response, timing it out at `expiry`
+        void track_request(int64_t rid, std::function<void(message)> cb, time_point expiry);
+
+        // Removes and returns the pending request with ID `rid`, or nullptr if there isn't one
+        std::unique_ptr<pending_request> take_request(int64_t rid);
+
+        // Returns a removed request to the pool and invokes its callback with `msg`
+        void finish_request(std::unique_ptr<pending_request> req, message msg);
+
+        // Times out all pending requests
+        void timeout_requests();
+
+        // Discards all pending requests, cancelling their timers, without invoking their callbacks
+        void cancel_requests();
+
         void process_incoming(std::string_view req);
 
-        std::string encode_command(std::string_view endpoint, int64_t rid, bstring_view body);
+        // Returns the bt-list encoding of a command or response, up to the start of its body
+        std::string encode_command(std::string_view endpoint, int64_t rid, size_t body_len);
 
-        std::string encode_response(int64_t rid, bstring_view body, bool error);
+        std::string encode_response(int64_t rid, size_t body_len, bool error);
 
         size_t parse_length(std::string_view req);
 
-        size_t num_pending_impl() const { return user_buffers.size(); }
+        size_t num_requests_impl() const { return num_reqs; }
+    };
+
+    // Builder for sending a burst of commands on a BTRequestStream together: the commands are
+    // encoded back-to-back into a single buffer as they are added, and send() then submits them
+    // all with a single trip to the event loop (and so a single buffer on the stream).  Response
+    // callbacks and timeouts work exactly as they do for BTRequestStream::command, except that
+    // bodies are always copied into the batch.  A batch is not thread-safe, but can be reused
+    // after sending.
+    //
+    //     command_batch batch{*stream};
+    //     for (auto& [ep, body] : requests)
+    //         batch.command(ep, body, response_handler);
+    //     batch.send();
+    class command_batch
+    {
+      public:
+        explicit command_batch(BTRequestStream& s) : stream{s} {}
+
+        // Adds a command to the batch; takes the same options as BTRequestStream::command (a
+        // keep-alive is accepted, but doesn't prevent the body being copied).
+        template <typename... Opt>
+        command_batch& command(std::string_view ep, bstring_view body, Opt&&... opts)
+        {
+            auto rid = stream.next_rid++;
+            auto header = stream.encode_command(ep, rid, body.size());
+            sent_request req{data, stream, header, body, rid, std::forward<Opt>(opts)...};
+            if (req.cb)
+                reqs.push_back({rid, std::move(req.cb), req.expiry});
+            count++;
+            return *this;
+        }
+        template <typename... Opt>
+        command_batch& command(std::string_view ep, std::string_view body, Opt&&... opts)
+        {
+            return command(ep, convert_sv<std::byte>(body), std::forward<Opt>(opts)...);
+        }
+
+        // Number of commands in the batch, and the number of bytes they encode to
+        size_t size() const { return count; }
+        size_t bytes() const { return data.size(); }
+        bool empty() const { return count == 0; }
+
+        // Sends all the commands added since the last send(), leaving the batch empty
+        void send();
+
+      private:
+        struct request
+        {
+            int64_t rid;
+            std::function<void(message)> cb;
+            time_point expiry;
+        };
+
+        BTRequestStream& stream;
+        std::string data;
+        std::vector<request> reqs;
+        size_t count{0};
     };
 }  // namespace oxen::quic
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    namespace detail
+    {
+        struct buffer_pool_core;
+
+        // Header stored immediately before the data of each pooled buffer
+        struct pooled_slot
+        {
+            buffer_pool_core* core;
+            pooled_slot* next_free;
+            uint32_t refs;
+            uint32_t size;
+
+            std::byte* data() { return reinterpret_cast<std::byte*>(this + 1); }
+        };
+
+        void release_slot(pooled_slot* slot);
+    }  // namespace detail
+
+    // Handle to a fixed-capacity buffer obtained from a buffer_pool.  Copying a handle shares the
+    // underlying buffer (by bumping its reference count) rather than copying the data; when the
+    // last handle goes away the buffer is returned to its pool's free list for reuse.
+    //
+    // Reference counting is not atomic: handles to buffers of a pool must only be used from the
+    // thread that owns the pool (typically the event loop thread of the endpoint or socket that
+    // created it).
+    class pooled_buffer
+    {
+      public:
+        pooled_buffer() = default;
+
+        pooled_buffer(const pooled_buffer& other) : slot{other.slot}
+        {
+            if (slot)
+                ++slot->refs;
+        }
+        pooled_buffer(pooled_buffer&& other) noexcept : slot{std::exchange(other.slot, nullptr)} {}
+
+        pooled_buffer& operator=(const pooled_buffer& other)
+        {
+            if (this != &other)
+            {
+                reset();
+                slot = other.slot;
+                if (slot)
+                    ++slot->refs;
+            }
+            return *this;
+        }
+        pooled_buffer& operator=(pooled_buffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                slot = std::exchange(other.slot, nullptr);
+            }
+            return *this;
+        }
+
+        ~pooled_buffer() { reset(); }
+
+        explicit operator bool() const { return slot != nullptr; }
+
+        std::byte* data() { return slot ? slot->data() : nullptr; }
+        const std::byte* data() const { return slot ? slot->data() : nullptr; }
+
+        // The size of the data in the buffer; this is set by the owner (e.g. after a read into the
+        // buffer) and cannot be larger than capacity().
+        size_t size() const { return slot ? slot->size : 0; }
+        void resize(size_t n)
+        {
+            assert(slot && n <= capacity());
+            slot->size = static_cast<uint32_t>(n);
+        }
+
+        size_t capacity() const;
+
+        bstring_view view() const { return {data(), size()}; }
+
+        // Number of handles currently sharing this buffer.
+        size_t use_count() const { return slot ? slot->refs : 0; }
+
+        void reset()
+        {
+            if (slot && --slot->refs == 0)
+                detail::release_slot(slot);
+            slot = nullptr;
+        }
+
+      private:
+        friend class buffer_pool;
+        explicit pooled_buffer(detail::pooled_slot* s) : slot{s} {}
+
+        detail::pooled_slot* slot = nullptr;
+    };
+
+    // Slab allocator of fixed-size, reference-counted buffers.  Buffers are carved out of slabs of
+    // `slab_count` buffers each, allocated on demand; released buffers go onto a free list and are
+    // handed out again by later `acquire()` calls, so that once a pool has grown to its working
+    // set size acquiring and releasing buffers involves no allocation at all.
+    //
+    // Outstanding buffers keep the pool's memory alive, so it is safe to destroy the pool while
+    // some of its buffers are still in use.  Like pooled_buffer, the pool is not thread-safe.
+    class buffer_pool
+    {
+      public:
+        explicit buffer_pool(size_t buffer_size, size_t slab_count = 32);
+        ~buffer_pool();
+
+        buffer_pool(const buffer_pool&) = delete;
+        buffer_pool& operator=(const buffer_pool&) = delete;
+        buffer_pool(buffer_pool&&) = delete;
+        buffer_pool& operator=(buffer_pool&&) = delete;
+
+        // Returns a buffer (with size 0) from the free list, allocating a new slab if the free list
+        // is empty.
+        pooled_buffer acquire();
+
+        // Acquires a buffer and copies `data` into it.  Throws std::length_error if `data` is larger
+        // than buffer_size().
+        pooled_buffer copy(bstring_view data);
+
+        // Like copy(), except that data larger than buffer_size() is copied into a one-off buffer
+        // of its own (of exactly the data's size) rather than one from this pool.
+        pooled_buffer copy_any(bstring_view data);
+
+        // The capacity of each buffer of this pool.
+        size_t buffer_size() const;
+
+        // Total number of buffers allocated by this pool (in use or free).
+        size_t allocated() const;
+
+        // Number of buffers currently on the free list.
+        size_t available() const;
+
+      private:
+        detail::buffer_pool_core* core;
+    };
+
+}  // namespace oxen::quic
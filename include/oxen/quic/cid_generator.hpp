@@ -0,0 +1,90 @@
+#pragma once
+
+#include <gnutls/crypto.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Source of the connection IDs an endpoint issues for its connections (see
+    // opt::connection_id_generator).  By default endpoints use random 20-byte CIDs; a generator
+    // lets CIDs carry information for whatever routes packets to the endpoint, such as a QUIC-LB
+    // load balancer.
+    //
+    // All CIDs from one generator must have the same length, because the length of the
+    // destination CID of short header packets is not on the wire: the endpoint has to know it.
+    //
+    // `generate` is called from the event loop thread of each endpoint using the generator, so
+    // must be thread-safe if a generator is shared between endpoints.
+    class cid_generator
+    {
+      public:
+        virtual ~cid_generator() = default;
+
+        // Length of every CID this generator produces; must be in [1, 20].
+        virtual size_t length() const = 0;
+
+        // Writes a new CID of `length()` bytes to `cid`.  Returns false on failure.
+        virtual bool generate(uint8_t* cid) = 0;
+    };
+
+    // Generates connection IDs in the format of the QUIC-LB draft (draft-ietf-quic-load-balancers),
+    // so that a QUIC-LB load balancer configured with the same parameters can route every packet
+    // of a connection to this server, even after the client migrates.  A CID is:
+    //
+    //     first octet | server ID | nonce
+    //
+    // where the top three bits of the first octet are the config ID (so a load balancer can tell
+    // old and new configurations apart while rotating), and the rest of the octet is random or,
+    // with `self_encode_length`, the number of CID bytes after it.  The nonce is random.
+    //
+    // With a key, the server ID and nonce are encrypted (so that observers cannot link CIDs of the
+    // same server, or tell servers apart); only the single-pass AES-128-ECB variant is supported,
+    // which requires the server ID and nonce to add up to exactly 16 bytes.
+    class quic_lb_cid_generator : public cid_generator
+    {
+      public:
+        // config_id is in [0, 6] (7 is reserved for unroutable CIDs), server_id is 1 to 15 bytes,
+        // nonce_len is 4 to 18 bytes, with server_id and nonce together at most 19 bytes.  `key`
+        // is empty for plaintext CIDs, or a 16-byte AES-128 key.
+        //
+        // Throws std::invalid_argument if any of these do not hold.
+        quic_lb_cid_generator(
+                uint8_t config_id,
+                ustring_view server_id,
+                size_t nonce_len,
+                ustring_view key = {},
+                bool self_encode_length = false);
+        ~quic_lb_cid_generator() override;
+
+        quic_lb_cid_generator(const quic_lb_cid_generator&) = delete;
+        quic_lb_cid_generator& operator=(const quic_lb_cid_generator&) = delete;
+
+        size_t length() const override { return 1 + server_id.size() + nonce_len; }
+
+        bool generate(uint8_t* cid) override;
+
+        // Extracts the server ID from a CID, as a load balancer with this configuration would.
+        // Returns nullopt if the CID has the wrong length or the config ID does not match.
+        std::optional<ustring> decode_server_id(ustring_view cid) const;
+
+        uint8_t config() const { return config_id; }
+
+      private:
+        const uint8_t config_id;
+        const ustring server_id;
+        const size_t nonce_len;
+        const bool self_encode_length;
+
+        gnutls_cipher_hd_t cipher{nullptr};
+        mutable std::mutex cipher_mutex;
+
+        // Single AES-128-ECB block operation, in place
+        bool crypt_block(uint8_t* block, bool encrypt) const;
+    };
+}  // namespace oxen::quic
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OXEN_LIBQUIC_CID_MAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "connection_ids.hpp"
+
+namespace oxen::quic
+{
+    // Open-addressing hash table keyed by quic_cid, used by Endpoint to demultiplex incoming
+    // packets to their connection with (usually) a single probe into contiguous memory.
+    //
+    // The layout follows the "Swiss table" design: alongside the slot array is an array of control
+    // bytes, one per slot, that is either EMPTY, DELETED (a tombstone), or holds the low 7 bits of
+    // the hash of the slot's key.  The table is split into aligned groups of 16 slots; a lookup
+    // hashes the key once, then scans the control bytes of one group at a time (with a single SSE2
+    // compare where available) and only compares the keys of slots whose 7 bits match.  Probing
+    // stops at the first group that contains an EMPTY slot.
+    //
+    // Keys are hashed with a per-table random seed: most CIDs are ones we generated ourselves, but
+    // initial DCIDs are chosen by the remote, so the hash must not be predictable.
+    //
+    // Values must be trivially copyable (the endpoint stores Connection pointers).  Pointers
+    // returned by find/emplace are invalidated by any subsequent insertion.  Not thread-safe.
+    template <typename T>
+    class cid_map
+    {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+
+        friend class TestHelper;
+
+      public:
+        static constexpr size_t GROUP_SIZE = 16;
+
+        cid_map()
+        {
+            if (gnutls_rnd(GNUTLS_RND_NONCE, &seed, sizeof(seed)) != 0)
+                seed = reinterpret_cast<uintptr_t>(this);
+        }
+
+        cid_map(const cid_map&) = delete;
+        cid_map& operator=(const cid_map&) = delete;
+        cid_map(cid_map&&) = delete;
+        cid_map& operator=(cid_map&&) = delete;
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        size_t capacity() const { return n_groups * GROUP_SIZE; }
+
+        // Returns a pointer to the value stored for `cid`, or nullptr if not present.
+        T* find(const quic_cid& cid)
+        {
+            if (!count)
+                return nullptr;
+            auto h = hash(cid);
+            auto h2 = static_cast<int8_t>(h & 0x7f);
+            for (probe p{h >> 7, n_groups - 1};; p.next())
+            {
+                auto* ctrl = group_ctrl(p.group);
+                for (auto m = match(ctrl, h2); m; m &= m - 1)
+                {
+                    auto& s = slots[p.group * GROUP_SIZE + lowest_bit(m)];
+                    if (s.key == cid)
+                        return &s.value;
+                }
+                if (match(ctrl, EMPTY))
+                    return nullptr;
+            }
+        }
+        const T* find(const quic_cid& cid) const { return const_cast<cid_map*>(this)->find(cid); }
+
+        bool contains(const quic_cid& cid) const { return find(cid) != nullptr; }
+
+        // Inserts `cid` -> `value` if `cid` is not already present.  Returns a pointer to the stored
+        // value (either the new one or the existing one) and true if the value was inserted.
+        std::pair<T*, bool> emplace(const quic_cid& cid, T value)
+        {
+            if (auto* v = find(cid))
+                return {v, false};
+            return {insert_new(cid, value), true};
+        }
+
+        // Inserts or replaces the value stored for `cid`.
+        T* insert_or_assign(const quic_cid& cid, T value)
+        {
+            auto [v, inserted] = emplace(cid, value);
+            if (!inserted)
+                *v = value;
+            return v;
+        }
+
+        // Removes `cid`; returns true if it was present.
+        bool erase(const quic_cid& cid)
+        {
+            if (!count)
+                return false;
+            auto h = hash(cid);
+            auto h2 = static_cast<int8_t>(h & 0x7f);
+            for (probe p{h >> 7, n_groups - 1};; p.next())
+            {
+                auto* ctrl = group_ctrl(p.group);
+                for (auto m = match(ctrl, h2); m; m &= m - 1)
+                {
+                    auto i = lowest_bit(m);
+                    if (slots[p.group * GROUP_SIZE + i].key == cid)
+                    {
+                        // If this group still has an EMPTY slot then it has never been full (slots
+                        // only become EMPTY again on rehash), so no probe has ever continued past it
+                        // and we can free the slot outright rather than leaving a tombstone.
+                        if (match(ctrl, EMPTY))
+                            ctrl[i] = EMPTY;
+                        else
+                        {
+                            ctrl[i] = DELETED;
+                            tombstones++;
+                        }
+                        count--;
+                        return true;
+                    }
+                }
+                if (match(ctrl, EMPTY))
+                    return false;
+            }
+        }
+
+        void clear()
+        {
+            if (n_groups)
+                std::memset(group_ctrl(0), EMPTY, capacity());
+            count = 0;
+            tombstones = 0;
+        }
+
+        // Ensures that `n` elements can be stored without a rehash.
+        void reserve(size_t n)
+        {
+            if (n > max_load())
+                rehash(groups_for(n));
+        }
+
+      private:
+        static constexpr int8_t EMPTY = -128;  // 0b10000000
+        static constexpr int8_t DELETED = -2;  // 0b11111110
+
+        struct slot
+        {
+            quic_cid key;
+            T value;
+        };
+
+        // Triangular probing over the groups; with a power-of-two group count this visits every
+        // group exactly once.
+        struct probe
+        {
+            size_t group;
+            size_t mask;
+            size_t stride = 0;
+
+            probe(size_t h, size_t m) : group{h & m}, mask{m} {}
+
+            void next()
+            {
+                stride++;
+                group = (group + stride) & mask;
+            }
+        };
+
+        struct alignas(GROUP_SIZE) ctrl_group
+        {
+            int8_t ctrl[GROUP_SIZE];
+        };
+
+        std::unique_ptr<ctrl_group[]> ctrl_storage;
+        std::unique_ptr<slot[]> slots;
+        size_t n_groups = 0;
+        size_t count = 0;
+        size_t tombstones = 0;
+        uint64_t seed = 0;
+
+        int8_t* group_ctrl(size_t g) { return ctrl_storage[g].ctrl; }
+
+        // Maximum number of used (full or deleted) slots before we rehash: 7/8 of the capacity.
+        size_t max_load() const { return capacity() - capacity() / 8; }
+
+        static size_t groups_for(size_t n)
+        {
+            size_t g = 1;
+            while (g * GROUP_SIZE - g * GROUP_SIZE / 8 < n)
+                g <<= 1;
+            return g;
+        }
+
+        static uint64_t load64(const uint8_t* p)
+        {
+            uint64_t x;
+            std::memcpy(&x, p, sizeof(x));
+            return x;
+        }
+
+        static uint64_t mix(uint64_t a, uint64_t b)
+        {
+#ifdef __SIZEOF_INT128__
+            auto r = static_cast<unsigned __int128>(a) * b;
+            return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+            uint64_t x = a ^ (b * 0x9e3779b97f4a7c15ULL);
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+#endif
+        }
+
+        // Hashes every byte of the CID, its length, and the seed.  A CID is at most 20 bytes, so
+        // this covers it with (at most) three 8-byte words: the first and last 8 bytes (which
+        // overlap for CIDs shorter than 16 bytes) and, for CIDs longer than 16 bytes, the middle 8
+        // bytes starting at byte 8.  The words are folded in through two keyed wide multiplies.
+        uint64_t hash(const quic_cid& cid) const
+        {
+            const auto len = cid.datalen;
+            uint64_t a = 0, b = 0, c = 0;
+            if (len >= 8)
+            {
+                a = load64(cid.data);
+                b = load64(cid.data + len - 8);
+                if (len > 16)
+                    c = load64(cid.data + 8);
+            }
+            else
+                for (size_t i = 0; i < len; i++)
+                    a |= uint64_t{cid.data[i]} << (8 * i);
+            const auto seed2 = (seed >> 17) | (seed << 47);
+            auto h = mix(a ^ seed ^ 0x243f6a8885a308d3ULL, c ^ seed2 ^ 0xa4093822299f31d0ULL);
+            return mix(h ^ b ^ 0x082efa98ec4e6c89ULL, (len * 0x13198a2e03707344ULL) ^ seed2);
+        }
+
+        static unsigned lowest_bit(uint32_t m)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctz(m));
+#else
+            unsigned i = 0;
+            while (!(m & 1))
+            {
+                m >>= 1;
+                i++;
+            }
+            return i;
+#endif
+        }
+
+        // Returns a bitmask of the positions in the (16-byte aligned) group of control bytes at
+        // `ctrl` that are equal to `c`.
+        static uint32_t match(const int8_t* ctrl, int8_t c)
+        {
+#ifdef OXEN_LIBQUIC_CID_MAP_SSE2
+            auto g = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c))));
+#else
+            uint32_t m = 0;
+            for (unsigned i = 0; i < GROUP_SIZE; i++)
+                m |= uint32_t{ctrl[i] == c} << i;
+            return m;
+#endif
+        }
+
+        // Returns a bitmask of the EMPTY or DELETED positions of the group.
+        static uint32_t match_free(const int8_t* ctrl)
+        {
+#ifdef OXEN_LIBQUIC_CID_MAP_SSE2
+            // EMPTY and DELETED are the only control values with the high bit set
+            auto g = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+            return static_cast<uint32_t>(_mm_movemask_epi8(g));
+#else
+            uint32_t m = 0;
+            for (unsigned i = 0; i < GROUP_SIZE; i++)
+                m |= uint32_t{ctrl[i] < 0} << i;
+            return m;
+#endif
+        }
+
+        // Inserts a key known not to be present.
+        T* insert_new(const quic_cid& cid, T value)
+        {
+            if (count + tombstones + 1 > max_load())
+                // If most of the used slots are tombstones then rehashing at the same size is enough
+                // to reclaim them; otherwise grow.
+                rehash(count + 1 > max_load() / 2 ? std::max<size_t>(n_groups * 2, 1) : n_groups);
+
+            auto h = hash(cid);
+            for (probe p{h >> 7, n_groups - 1};; p.next())
+            {
+                auto* ctrl = group_ctrl(p.group);
+                if (auto m = match_free(ctrl))
+                {
+                    auto i = lowest_bit(m);
+                    if (ctrl[i] == DELETED)
+                        tombstones--;
+                    ctrl[i] = static_cast<int8_t>(h & 0x7f);
+                    auto& s = slots[p.group * GROUP_SIZE + i];
+                    s.key = cid;
+                    s.value = value;
+                    count++;
+                    return &s.value;
+                }
+            }
+        }
+
+        void rehash(size_t new_groups)
+        {
+            auto old_ctrl = std::move(ctrl_storage);
+            auto old_slots = std::move(slots);
+            auto old_cap = capacity();
+
+            ctrl_storage.reset(new ctrl_group[new_groups]);
+            slots.reset(new slot[new_groups * GROUP_SIZE]);
+            n_groups = new_groups;
+            std::memset(group_ctrl(0), EMPTY, capacity());
+
+            auto* octrl = old_ctrl ? old_ctrl[0].ctrl : nullptr;
+            count = 0;
+            tombstones = 0;
+            for (size_t i = 0; i < old_cap; i++)
+                if (octrl[i] >= 0)
+                    insert_new(old_slots[i].key, old_slots[i].value);
+        }
+    };
+
+}  // namespace oxen::quic
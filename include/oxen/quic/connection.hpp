@@ -7,12 +7,16 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <stdexcept>
 
 #include "connection_ids.hpp"
 #include "context.hpp"
 #include "format.hpp"
+#include "stats.hpp"
+#include "stream_table.hpp"
+#include "timer_wheel.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
@@ -148,6 +152,18 @@ namespace oxen::quic
 
         virtual void send_datagram(bstring_view data, std::shared_ptr<void> keep_alive = nullptr) = 0;
 
+        /// Sends a batch of datagrams at once: this costs a single trip into the event loop no
+        /// matter how many datagrams there are, and the datagrams all share the one `keep_alive`
+        /// (which is released once the last of them has been sent).  Small datagrams queued
+        /// together like this get packed into shared QUIC packets where they fit.
+        virtual void send_datagrams(
+                const bstring_view* data, size_t count, std::shared_ptr<void> keep_alive = nullptr) = 0;
+
+        void send_datagrams(const std::vector<bstring_view>& data, std::shared_ptr<void> keep_alive = nullptr)
+        {
+            send_datagrams(data.data(), data.size(), std::move(keep_alive));
+        }
+
         virtual Endpoint& endpoint() = 0;
         virtual const Endpoint& endpoint() const = 0;
 
@@ -167,7 +183,8 @@ namespace oxen::quic
         // appended (e.g.  path_impl); these versions in the base class wrap the _impl call in a
         // call_get to return the value synchronously.  Generally external application code should
         // use this, and internal quic code (already in the event loop thread) should use the _impl
-        // ones directly.
+        // ones directly.  (The stream counts and get_max_datagram_size() are the exception: they
+        // read copies that the event loop publishes whenever they change, and so are lock-free).
 
         /// Returns the number of streams that are currently open
         size_t num_streams_active();
@@ -197,6 +214,22 @@ namespace oxen::quic
         /// remote() separately).
         Address remote();
 
+        /// Returns an estimate of the memory, in bytes, held by this connection's own libquic state:
+        /// the Connection object itself, its stream and datagram objects and buffers, and any
+        /// outgoing packets being held while the socket is blocked.  This does not include queued
+        /// stream or datagram data (which lives in the buffers given to send), nor the internal
+        /// allocations of ngtcp2 and GnuTLS.
+        size_t resident_bytes();
+
+        /// Returns true if the connection is currently hibernating (see opt::hibernate).
+        bool is_hibernating();
+
+        /// Returns the connection's transport statistics: RTT estimates, congestion state, path MTU,
+        /// and packet counters.  Unlike most accessors this does not go through the event loop: it
+        /// returns the snapshot the loop last published (after every send pass), so it is cheap to
+        /// call from any thread, including for periodic polling by a monitoring thread.
+        virtual connection_stats stats() const = 0;
+
         /// Returns the maximum datagram size accepted by this connection.  This depends on the
         /// negotiated QUIC connection and can change over time, but will generally be somewhere in
         /// the 1150-1450 range when not using datagram splitting on the connection, or double that
@@ -224,6 +257,35 @@ namespace oxen::quic
 
         virtual void close_connection(uint64_t error_code = 0) = 0;
 
+        /// Corks the connection: new stream and datagram data queued on the connection no longer
+        /// triggers an immediate send until the matching uncork(), so that a burst of small writes
+        /// (possibly across several streams) goes out in a single send pass of fully packed
+        /// packets.  Calls nest: sending resumes when the last cork is removed.  Corking only delays
+        /// sends triggered by newly queued data; anything else the connection sends in the meantime
+        /// (acks, retransmissions, etc.) will still carry whatever queued data fits.
+        ///
+        /// Like sends, these are queued into the event loop, so they take effect in order with
+        /// sends made from the same thread.  See also `scoped_cork`.
+        virtual void cork() = 0;
+        virtual void uncork() = 0;
+
+        /// Sets high and low watermarks on the connection's total buffered send data: the data
+        /// queued on all of its streams that the remote has not yet acknowledged.  When that total
+        /// reaches `high` bytes `cb` is called with `writable` false, and once it has then drained
+        /// to `low` bytes or less, with `writable` true.  The callback is invoked in the event loop
+        /// thread, straight away if the connection is already at or above `high`.  A `high` of 0
+        /// removes the watermarks.  See also Stream::set_watermarks.
+        ///
+        /// Throws std::invalid_argument if `low` is not less than `high`.
+        virtual void set_watermarks(size_t high, size_t low, connection_watermark_callback cb) = 0;
+
+        /// Returns the total send data buffered on the connection's streams
+        size_t buffered_bytes();
+
+        /// Returns false if the connection's buffered send data has reached its high watermark and
+        /// not yet drained to its low watermark.
+        bool is_writable();
+
         virtual ~connection_interface();
 
       protected:
@@ -239,12 +301,39 @@ namespace oxen::quic
         virtual const Address& remote_impl() const { return path_impl().remote; }
         // Returns 0 if datagrams are not available
         virtual size_t get_max_datagram_size_impl() = 0;
+        virtual size_t resident_bytes_impl() const = 0;
+        virtual bool is_hibernating_impl() const = 0;
+        virtual size_t buffered_bytes_impl() const = 0;
+        virtual bool is_writable_impl() const = 0;
+
+        // Copies of the stream counts and max datagram size for the public accessors, kept up to
+        // date by the Connection
+        std::atomic<size_t> _published_streams_active{0};
+        std::atomic<size_t> _published_streams_pending{0};
+        std::atomic<size_t> _published_max_datagram_size{0};
+    };
+
+    /// RAII helper that keeps a connection corked (see `connection_interface::cork()`) for the
+    /// lifetime of the object.
+    class scoped_cork
+    {
+        std::shared_ptr<connection_interface> conn;
+
+      public:
+        explicit scoped_cork(connection_interface& c) : conn{c.shared_from_this()} { conn->cork(); }
+        ~scoped_cork() { conn->uncork(); }
+
+        scoped_cork(const scoped_cork&) = delete;
+        scoped_cork& operator=(const scoped_cork&) = delete;
     };
 
     class Connection : public connection_interface
     {
         friend class TestHelper;
+        friend class IOChannel;
+        friend class Stream;
         friend struct rotating_buffer;
+        friend struct fragment_buffer;
 
       public:
         // Non-movable/non-copyable; you must always hold a Connection in a shared_ptr
@@ -285,6 +374,11 @@ namespace oxen::quic
 
         void packet_io_ready();
 
+        // Called when new application data (stream or datagram) has been queued: triggers a send
+        // just like packet_io_ready(), unless the connection is corked, in which case the send is
+        // deferred until it is uncorked.
+        void app_data_ready();
+
         TLSSession* get_session() const;
 
         ustring_view remote_key() const override;
@@ -292,6 +386,13 @@ namespace oxen::quic
         Direction direction() const override { return dir; }
 
         size_t num_streams_active_impl() const override { return _streams.size(); }
+        // Publishes the stream counts; called after anything that adds or removes streams
+        void streams_changed();
+        size_t resident_bytes_impl() const override;
+        bool is_hibernating_impl() const override { return _hibernating; }
+        connection_stats stats() const override { return _stats.load(); }
+        size_t buffered_bytes_impl() const override { return _buffered; }
+        bool is_writable_impl() const override { return !_watermarks.blocked; }
         size_t num_streams_pending_impl() const override { return pending_streams.size(); }
 
         void halt_events();
@@ -301,6 +402,11 @@ namespace oxen::quic
         void set_draining() { draining = true; }
         stream_data_callback get_default_data_callback() const;
 
+        // Returns the timestamp to give ngtcp2 for an event at `ts`: ngtcp2 requires timestamps to
+        // never go backwards, which kernel receive timestamps (see read_packet) otherwise can, relative
+        // to the times we've already used for writes and expiries.
+        uint64_t ngtcp2_ts(uint64_t ts) { return _last_ts = std::max(_last_ts, ts); }
+
         bool is_outbound() const override { return _is_outbound; }
         bool is_inbound() const override { return not is_outbound(); }
         std::string direction_str() override { return is_inbound() ? "SERVER"s : "CLIENT"s; }
@@ -328,6 +434,10 @@ namespace oxen::quic
 
         void send_datagram(bstring_view data, std::shared_ptr<void> keep_alive = nullptr) override;
 
+        void send_datagrams(
+                const bstring_view* data, size_t count, std::shared_ptr<void> keep_alive = nullptr) override;
+        using connection_interface::send_datagrams;
+
         void close_connection(uint64_t error_code = 0) override;
 
         // This mutator is called from the gnutls code after cert verification (if it is successful)
@@ -352,6 +462,10 @@ namespace oxen::quic
 
         int server_handshake_completed();
 
+        // Called by the TLS session when a client receives a new session ticket; stores it (with
+        // our 0-RTT transport parameters) in the endpoint's session cache, if it has one.
+        void store_session_ticket(ustring tls_data);
+
         int server_path_validation(const ngtcp2_path* path);
 
         void set_new_path(Path new_path);
@@ -360,6 +474,11 @@ namespace oxen::quic
 
         void set_close_quietly() override;
 
+        void cork() override;
+        void uncork() override;
+
+        void set_watermarks(size_t high, size_t low, connection_watermark_callback cb) override;
+
         bool closing_quietly() const { return _close_quietly; }
 
         // Called when the endpoint drops its shared pointer to this Connection, to have this
@@ -388,6 +507,10 @@ namespace oxen::quic
 
         Endpoint& _endpoint;
         std::shared_ptr<IOContext> context;
+        // Where the connection's streams and datagrams allocate their internal buffers from (see
+        // opt::memory_resource); each of them also holds a reference, to keep it alive for as long
+        // as they need it.
+        std::shared_ptr<std::pmr::memory_resource> _memory;
         Direction dir;
         bool _is_outbound;
 
@@ -411,29 +534,118 @@ namespace oxen::quic
 
         ustring remote_pubkey;
 
+        // Set on outbound connections that resumed a cached session and so may send 0-RTT data
+        bool _attempted_0rtt{false};
+
+        // Sets up resumption from the endpoint's session cache for a new outbound connection
+        void try_resume_session();
+
+        // A resumed session skips the certificate exchange, and with it the usual verification
+        // callback, so once the handshake completes we verify the key remembered by the session.
+        bool validate_resumed_session();
+
         struct connection_deleter
         {
             inline void operator()(ngtcp2_conn* c) const { ngtcp2_conn_del(c); }
         };
 
+        // Set if qlog output is enabled (see opt::qlog).  Declared before `conn` so that it
+        // outlives the ngtcp2 connection that writes to it.
+        std::shared_ptr<qlog_trace> _qlog;
+
         // underlying ngtcp2 connection object
         std::unique_ptr<ngtcp2_conn, connection_deleter> conn;
 
         std::shared_ptr<TLSCreds> tls_creds;
         std::unique_ptr<TLSSession> tls_session;
 
-        event_ptr packet_retransmit_timer;
+        std::optional<wheel_timer> packet_retransmit_timer;
         event_ptr packet_io_trigger;
 
+        // Set once the connection is closing or draining, to remove it from the endpoint
+        std::optional<wheel_timer> removal_timer;
+
         void on_packet_io_ready();
+        void make_packet_io_trigger();
+
+        // Hibernation (see opt::hibernate): `_activity` counts application activity, which the
+        // hibernate timer checks for once per hibernation period while the connection is awake.
+        std::optional<wheel_timer> hibernate_timer;
+        uint64_t _activity{0};
+        uint64_t _activity_checked{0};
+        bool _hibernating{false};
+
+        // Called on any application activity; wakes the connection if it is hibernating
+        void note_activity();
+        void check_hibernation();
+        void hibernate();
+        void wake();
+
+        // Transport statistics: the counters we keep ourselves live in `_counters`; update_stats()
+        // adds ngtcp2's state to them and publishes the lot to `_stats` for lock-free reading.
+        connection_stats _counters;
+        atomic_snapshot<connection_stats> _stats;
+        void update_stats();
+
+        // Latest timestamp given to any ngtcp2 call on this connection; see ngtcp2_ts()
+        uint64_t _last_ts{0};
+
+        // Current cork() nesting depth, and whether data was queued while corked
+        int _cork_depth{0};
+        bool _cork_pending{false};
+
+        // Total buffered send data of the connection's streams, and its watermarks
+        size_t _buffered{0};
+        watermarks _watermarks;
+        connection_watermark_callback watermark_cb;
+
+        // The congestion window: ngtcp2's estimate of the path's bandwidth-delay product, and so
+        // roughly how much unsent stream data is worth keeping queued.
+        uint64_t send_window_estimate() const;
+
+        // Called by streams whenever their buffered send data changes
+        void stream_buffered_changed(Stream& s, size_t size);
+        void update_watermarks();
 
         struct pkt_tx_timer_updater;
-        bool send(pkt_tx_timer_updater* pkt_updater = nullptr);
+        bool send(std::byte* buf, size_t* bufsize, pkt_tx_timer_updater* pkt_updater = nullptr);
 
         void flush_packets(std::chrono::steady_clock::time_point tp);
 
-        std::array<std::byte, MAX_PMTUD_UDP_PAYLOAD * DATAGRAM_BATCH_SIZE> send_buffer;
-        std::array<size_t, DATAGRAM_BATCH_SIZE> send_buffer_size;
+        // The byte rate cap of one class of send data (see opt::send_share): a token bucket that
+        // holds up to 20ms worth of the rate (or a few packets, if more).  A rate of 0 never limits.
+        struct send_rate_cap
+        {
+            uint64_t rate{0};
+            double tokens{0};
+            std::chrono::steady_clock::time_point last{};
+
+            void refill(std::chrono::steady_clock::time_point now);
+            bool allows() const { return rate == 0 || tokens > 0; }
+            void spend(size_t bytes)
+            {
+                if (rate)
+                    tokens -= static_cast<double>(bytes);
+            }
+            // How long until allows() will be true again
+            std::chrono::nanoseconds wait() const;
+        };
+        send_rate_cap _datagram_cap, _stream_cap;
+        // Packets written for each class since both last had something to send, for WEIGHTED sharing.
+        // These carry over between flushes, which can be just a packet or two each when sending is
+        // ack-clocked.
+        size_t _datagram_share_packets = 0, _stream_share_packets = 0;
+        // Set up if either is capped, to flush again once a capped class can send again
+        std::optional<wheel_timer> send_cap_timer;
+
+        // Packets are built in the loop's shared send_scratch; if the socket blocks before they are
+        // all sent then the unsent ones are moved here until it becomes writeable again.
+        struct blocked_packets
+        {
+            std::vector<std::byte> buf;
+            std::array<size_t, DATAGRAM_BATCH_SIZE> sizes;
+        };
+        std::unique_ptr<blocked_packets> blocked;
         uint8_t send_ecn = 0;
         size_t n_packets = 0;
 
@@ -456,9 +668,16 @@ namespace oxen::quic
 
         std::shared_ptr<Stream> get_stream_impl(int64_t id) override;
 
-        // holds a mapping of active streams
-        std::map<int64_t, std::shared_ptr<Stream>> _streams;
-        std::map<int64_t, std::shared_ptr<Stream>> _stream_queue;
+        // holds the active streams, and the incoming streams queued (by queue_incoming_stream)
+        // ahead of the remote opening them
+        stream_table<Stream> _streams;
+        stream_table<Stream> _stream_queue;
+
+        // Intrusive list of the streams that need periodic check_timeouts() calls (see
+        // Stream::has_timeouts())
+        Stream* timeout_streams{nullptr};
+        void watch_timeouts(Stream& s);
+        void unwatch_timeouts(Stream& s);
 
         int64_t next_incoming_stream_id = is_outbound() ? 1 : 0;
 
@@ -470,11 +689,7 @@ namespace oxen::quic
         // streams are added to the back and popped from the front (FIFO)
         std::deque<std::shared_ptr<Stream>> pending_streams;
 
-        int init(
-                ngtcp2_settings& settings,
-                ngtcp2_transport_params& params,
-                ngtcp2_callbacks& callbacks,
-                std::chrono::nanoseconds handshake_timeout);
+        int init(ngtcp2_settings& settings, ngtcp2_transport_params& params, std::chrono::nanoseconds handshake_timeout);
 
         io_result read_packet(const Packet& pkt);
 
@@ -493,9 +708,16 @@ namespace oxen::quic
         int stream_opened(int64_t id);
         int stream_ack(int64_t id, size_t size);
         int stream_receive(int64_t id, bstring_view data, bool fin);
+
+        // Extends the flow control credit of a stream in manual consumption mode (and of the
+        // connection) by up to `bytes` of the stream's unconsumed data
+        void stream_consumed(Stream& s, uint64_t bytes);
         void stream_execute_close(Stream& s, uint64_t app_code);
         void stream_closed(int64_t id, uint64_t app_code);
         void close_all_streams();
+        // Tells every stream that the connection is going away without closing it (see
+        // Stream::dropped); used for quiet closes, and by drop_streams
+        void notify_streams_dropped();
         void check_pending_streams(uint64_t available);
         int recv_datagram(bstring_view data, bool fin);
         int ack_datagram(uint64_t dgram_id);
@@ -521,6 +743,11 @@ namespace oxen::quic
         // externally.
         void check_stream_timeouts();
 
+        // Called (from Endpoint) when the connection starts closing or draining to have the endpoint
+        // delete it at `when`, replacing any previously scheduled removal.  Should not be called
+        // externally.
+        void schedule_removal(std::chrono::steady_clock::time_point when);
+
         ~Connection() override;
     };
 
@@ -66,6 +66,17 @@ namespace oxen::quic
 
         static quic_cid random();
 
+        // Generates a random CID carrying a routing byte that steers packets addressed to it to
+        // member `route` of an SO_REUSEPORT endpoint group of `route_count` members; see
+        // `set_route`.
+        static quic_cid random(size_t route, size_t route_count);
+
+        // Overwrites the first byte of the given CID data (the "routing byte") with a random value
+        // `b` satisfying `b % route_count == route`.  The kernel reuseport steering program attached
+        // to an endpoint group uses exactly this to pick the socket of an incoming packet.
+        // `route_count` must be in [1, 256] and `route` less than it.
+        static void set_route(uint8_t* cid_data, size_t route, size_t route_count);
+
         std::string to_string() const;
     };
     template <>
@@ -23,6 +23,24 @@ namespace oxen::quic
         std::optional<std::chrono::nanoseconds> handshake_timeout{std::nullopt};
         // idle timeout
         std::chrono::milliseconds idle_timeout{DEFAULT_IDLE_TIMEOUT};
+        // hibernation period; 0 means never hibernate
+        std::chrono::milliseconds hibernate{0ms};
+        // qlog output, if enabled
+        std::shared_ptr<qlog_writer> qlog;
+        // receive flow control windows
+        uint64_t stream_recv_window{DEFAULT_STREAM_RECV_WINDOW};
+        uint64_t conn_recv_window{DEFAULT_CONN_RECV_WINDOW};
+        // whether the above were given explicitly (with opt::receive_window)
+        bool recv_window_set{false};
+        // receive window growth limits; 0 means the default (or, if recv_window_set, the windows
+        // themselves)
+        uint64_t max_stream_recv_window{0};
+        uint64_t max_conn_recv_window{0};
+        // congestion control, and the initial RTT estimate (0 means ngtcp2's default)
+        CongestionControl cc_algo{CongestionControl::CUBIC};
+        std::chrono::microseconds initial_rtt{0};
+        // datagram/stream send sharing; see opt::send_share
+        opt::send_share send_share{};
         // datagram support
         bool datagram_support{false};
         // datagram splitting support
@@ -63,7 +81,13 @@ namespace oxen::quic
         void handle_ioctx_opt(opt::max_streams ms);
         void handle_ioctx_opt(opt::keep_alive ka);
         void handle_ioctx_opt(opt::idle_timeout ito);
+        void handle_ioctx_opt(opt::hibernate hib);
+        void handle_ioctx_opt(opt::qlog ql);
         void handle_ioctx_opt(opt::handshake_timeout hto);
+        void handle_ioctx_opt(opt::receive_window rw);
+        void handle_ioctx_opt(opt::max_receive_window mrw);
+        void handle_ioctx_opt(opt::congestion_control cc);
+        void handle_ioctx_opt(opt::send_share ss);
         void handle_ioctx_opt(stream_data_callback func);
         void handle_ioctx_opt(stream_open_callback func);
         void handle_ioctx_opt(stream_close_callback func);
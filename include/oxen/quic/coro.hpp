@@ -0,0 +1,284 @@
+#pragma once
+
+// C++20 coroutine interface to streams, datagrams, BT requests and connecting.  The library itself
+// is built as C++17, so everything here is header-only and only available to code compiled with
+// coroutine support; otherwise this header is empty.
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "btstream.hpp"
+#include "datagram.hpp"
+#include "endpoint.hpp"
+#include "stream.hpp"
+
+namespace oxen::quic::coro
+{
+    // The awaitables below all resume the awaiting coroutine in the event loop thread of the
+    // endpoint involved, from inside the library callback that completes them, so that a
+    // coroutine running on the loop never changes threads and a pipeline of awaits involves no
+    // cross-thread hops at all.  A coroutine started elsewhere can move itself onto the loop first
+    // with `co_await coro::on_loop(endpoint)`.
+    //
+    // A reader (stream_reader, datagram_reader) supports one waiting coroutine at a time, and must
+    // only be awaited from the event loop thread.
+
+    // Minimal eager, fire-and-forget coroutine type for writing coroutines that use the awaitables
+    // below:
+    //
+    //     coro::task fetch(std::shared_ptr<BTRequestStream> bt)
+    //     {
+    //         auto m = co_await coro::request(*bt, "ping", "");
+    //         ...
+    //     }
+    //
+    // The coroutine starts running immediately and frees itself once it finishes.  As with
+    // std::thread, an exception escaping the coroutine terminates the program.
+    struct task
+    {
+        struct promise_type
+        {
+            task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    // Awaitable that resumes the coroutine in the endpoint's event loop thread (without suspending
+    // at all if it is already running there).
+    class on_loop
+    {
+        Endpoint& ep;
+
+      public:
+        explicit on_loop(Endpoint& ep) : ep{ep} {}
+
+        bool await_ready() const { return ep.in_event_loop(); }
+        void await_suspend(std::coroutine_handle<> h) { ep.call_soon([h] { h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+
+    // Awaitable that sends a BT request and resumes with its response (which is always an owned
+    // copy, so it can be held across later awaits).  As with a response callback, the message has
+    // `timed_out` set if no response arrived in time (or the stream closed first).  `opts` are any
+    // of the BTRequestStream::command options other than the callback.
+    template <typename... Opt>
+    class request
+    {
+        BTRequestStream& stream;
+        std::string ep;
+        bstring_view body;
+        std::tuple<Opt...> opts;
+        std::optional<message> response;
+
+      public:
+        request(BTRequestStream& s, std::string ep, bstring_view body, Opt... opts) :
+                stream{s}, ep{std::move(ep)}, body{body}, opts{std::move(opts)...}
+        {}
+        request(BTRequestStream& s, std::string ep, std::string_view body, Opt... opts) :
+                request{s, std::move(ep), convert_sv<std::byte>(body), std::move(opts)...}
+        {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            std::apply(
+                    [&](auto&... o) {
+                        stream.command(
+                                std::move(ep),
+                                body,
+                                std::function<void(message)>{[this, h](message m) {
+                                    response.emplace(m);
+                                    h.resume();
+                                }},
+                                std::move(o)...);
+                    },
+                    opts);
+        }
+        message await_resume() { return std::move(*response); }
+    };
+
+    template <typename... Opt>
+    request(BTRequestStream&, std::string, bstring_view, Opt...) -> request<Opt...>;
+    template <typename... Opt>
+    request(BTRequestStream&, std::string, std::string_view, Opt...) -> request<Opt...>;
+
+    // Awaitable that resumes once the stream's send buffer has drained (see Stream::when_drained),
+    // with true, or with false if the stream closed first.
+    class drained
+    {
+        Stream& stream;
+        bool result{false};
+
+      public:
+        explicit drained(Stream& s) : stream{s} {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            stream.when_drained([this, h](Stream&, bool d) {
+                result = d;
+                h.resume();
+            });
+        }
+        bool await_resume() const noexcept { return result; }
+    };
+
+    // Awaitable that makes an outbound connection (taking the same arguments as Endpoint::connect)
+    // through Endpoint::connect_async, and resumes in the event loop thread once the connection
+    // object exists, without blocking the calling thread.  Throws std::runtime_error if the
+    // connection could not be created.
+    template <typename... Opt>
+    class connect
+    {
+        Endpoint& ep;
+        RemoteAddress remote;
+        std::tuple<Opt...> opts;
+        std::shared_ptr<connection_interface> conn;
+
+      public:
+        connect(Endpoint& ep, RemoteAddress remote, Opt... opts) :
+                ep{ep}, remote{std::move(remote)}, opts{std::move(opts)...}
+        {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            std::apply(
+                    [&](auto&... o) {
+                        ep.connect_async(
+                                std::move(remote),
+                                [this, h](std::shared_ptr<connection_interface> c) {
+                                    conn = std::move(c);
+                                    h.resume();
+                                },
+                                std::move(o)...);
+                    },
+                    opts);
+        }
+        std::shared_ptr<connection_interface> await_resume()
+        {
+            if (!conn)
+                throw std::runtime_error{"Failed to create outbound connection"};
+            return std::move(conn);
+        }
+    };
+
+    template <typename... Opt>
+    connect(Endpoint&, RemoteAddress, Opt...) -> connect<Opt...>;
+
+    namespace detail
+    {
+        // Queue of received items shared between a reader and the callbacks it hands out
+        template <typename T>
+        struct reader_state
+        {
+            std::deque<T> items;
+            bool closed{false};
+            std::coroutine_handle<> waiting;
+
+            void push(T item)
+            {
+                items.push_back(std::move(item));
+                wake();
+            }
+            void close()
+            {
+                closed = true;
+                wake();
+            }
+            void wake()
+            {
+                if (auto h = std::exchange(waiting, nullptr))
+                    h.resume();
+            }
+        };
+
+        template <typename T>
+        class read_awaitable
+        {
+            std::shared_ptr<reader_state<T>> st;
+
+          public:
+            explicit read_awaitable(std::shared_ptr<reader_state<T>> st) : st{std::move(st)} {}
+
+            bool await_ready() const noexcept { return !st->items.empty() || st->closed; }
+            void await_suspend(std::coroutine_handle<> h) { st->waiting = h; }
+            std::optional<T> await_resume()
+            {
+                if (st->items.empty())
+                    return std::nullopt;
+                auto item = std::move(st->items.front());
+                st->items.pop_front();
+                return item;
+            }
+        };
+    }  // namespace detail
+
+    // Collects the data received on a stream so that it can be read with `co_await`.  Pass the
+    // reader's callbacks when opening (or accepting) the stream:
+    //
+    //     coro::stream_reader reader;
+    //     auto s = conn->open_stream<Stream>(reader.data_callback(), reader.close_callback());
+    //     while (auto data = co_await reader.read())
+    //         ...
+    //
+    // read() resumes with the next piece of received data, or with nullopt once the stream has
+    // closed and all of its data has been read.  Data not yet read is buffered without limit, so
+    // for large transfers combine this with Stream::set_manual_consume.
+    class stream_reader
+    {
+        std::shared_ptr<detail::reader_state<bstring>> st = std::make_shared<detail::reader_state<bstring>>();
+        std::shared_ptr<uint64_t> _close_code = std::make_shared<uint64_t>(0);
+
+      public:
+        stream_data_callback data_callback() const
+        {
+            return [st = st](Stream&, bstring_view data) { st->push(bstring{data}); };
+        }
+        stream_close_callback close_callback() const
+        {
+            return [st = st, code = _close_code](Stream&, uint64_t error_code) {
+                *code = error_code;
+                st->close();
+            };
+        }
+
+        detail::read_awaitable<bstring> read() const { return detail::read_awaitable<bstring>{st}; }
+
+        // The stream's close code, once read() has returned nullopt
+        uint64_t close_code() const { return *_close_code; }
+    };
+
+    // As stream_reader, but for datagrams: pass data_callback() as the connection's datagram
+    // callback.  read() resumes with the next received datagram; it only returns nullopt after
+    // close() has been called (e.g. from the connection's closed callback).
+    class datagram_reader
+    {
+        std::shared_ptr<detail::reader_state<bstring>> st = std::make_shared<detail::reader_state<bstring>>();
+
+      public:
+        dgram_data_callback data_callback() const
+        {
+            return [st = st](dgram_interface&, bstring data) { st->push(std::move(data)); };
+        }
+
+        // Wakes the reader with nullopt once all received datagrams have been read; must be called
+        // from the event loop thread.
+        void close() { st->close(); }
+
+        detail::read_awaitable<bstring> read() const { return detail::read_awaitable<bstring>{st}; }
+    };
+}  // namespace oxen::quic::coro
+
+#endif
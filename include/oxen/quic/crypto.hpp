@@ -39,6 +39,9 @@ namespace oxen::quic
         virtual void set_expected_remote_key(ustring key) = 0;
         virtual ~TLSSession() = default;
         virtual int send_session_ticket() = 0;
+        // Sets (client) session resumption data from a previous session; returns false if invalid
+        virtual bool set_resumption_data(ustring_view data) = 0;
+        virtual bool is_resumed() const = 0;
     };
 
 }  // namespace oxen::quic
@@ -3,6 +3,7 @@
 #include "connection_ids.hpp"
 #include "iochannel.hpp"
 #include "messages.hpp"
+#include "opt.hpp"
 #include "udp.hpp"
 #include "utils.hpp"
 
@@ -54,6 +55,18 @@ namespace oxen::quic
     // IO callbacks
     using dgram_data_callback = std::function<void(dgram_interface&, bstring)>;
 
+    // Alternatives to dgram_data_callback that avoid allocating and copying an owning bstring for
+    // every received datagram.  The view given to a dgram_data_view_callback is only valid for the
+    // duration of the callback.  A dgram_data_pooled_callback instead takes ownership of a buffer
+    // from the endpoint's datagram buffer pool (or, for a datagram too large for the pool's buffers,
+    // such as a reassembled fragmented one, a one-off buffer of its own); as with any pooled_buffer,
+    // it must only be used or released from the endpoint's event loop thread.
+    //
+    // Only one kind of datagram callback can be given to an endpoint; if several are specified then
+    // the last one wins.
+    using dgram_data_view_callback = std::function<void(dgram_interface&, bstring_view)>;
+    using dgram_data_pooled_callback = std::function<void(dgram_interface&, pooled_buffer)>;
+
     using dgram_buffer = std::deque<std::pair<uint16_t, std::pair<bstring_view, std::shared_ptr<void>>>>;
 
     class DatagramIO : public IOChannel
@@ -62,10 +75,15 @@ namespace oxen::quic
       protected:
         // Construct via net.make_shared<DatagramIO>(...)
         friend class Network;
+        friend class Loop;
         DatagramIO(Connection& c, Endpoint& e, dgram_data_callback data_cb = nullptr);
 
       public:
         dgram_data_callback dgram_data_cb;
+        dgram_data_view_callback dgram_view_cb;
+        dgram_data_pooled_callback dgram_pooled_cb;
+
+        bool has_data_cb() const { return dgram_data_cb || dgram_view_cb || dgram_pooled_cb; }
 
         /// Datagram Numbering:
         /// Each datagram ID is comprised of a 16 bit quantity consisting of a 14 bit counter, and
@@ -139,15 +157,34 @@ namespace oxen::quic
         ///
         rotating_buffer recv_buffer;
         // dgram_buffer send_buffer;
-        buffer_que send_buffer;
+        buffer_que send_buffer{_memory.get()};
+
+        /// The fragmentation settings, if the endpoint uses opt::fragment_datagrams.  Fragmented
+        /// datagrams are numbered with their own 16-bit message ID (wrapping around), which is only
+        /// used to match up the fragments of a datagram and need not be unique long-term.
+        const std::optional<opt::fragment_datagrams> _fragmentation;
+        uint16_t _next_msg_id{0};
+
+        /// Holds the fragments of partially received fragmented datagrams
+        fragment_buffer frag_buffer;
 
         prepared_datagram pending_datagram(bool r) override;
 
+        // Queues all of the given datagrams for sending in a single trip into the event loop, all
+        // sharing the one keep-alive.
+        void send_batch(std::vector<bstring_view> data, std::shared_ptr<void> keep_alive);
+
         bool is_stream() const override { return false; }
 
         std::optional<bstring> to_buffer(bstring_view data, uint16_t dgid);
 
-        int datagrams_stored() const { return recv_buffer.datagrams_stored(); };
+        // Takes a received datagram (including its fragment header) on a fragmenting connection.
+        // Returns the payload of a datagram that was sent whole (as a view into `data`) or the
+        // reassembled datagram (in `reassembled`) once its last needed fragment arrives, or
+        // nullopt if there is nothing to deliver yet.
+        std::optional<bstring_view> from_fragment(bstring_view data, std::optional<bstring>& reassembled);
+
+        int datagrams_stored() const { return recv_buffer.datagrams_stored() + frag_buffer.datagrams_stored(); };
 
         int64_t stream_id() const override;
 
@@ -161,13 +198,20 @@ namespace oxen::quic
 
         void send_impl(bstring_view data, std::shared_ptr<void> keep_alive) override;
 
+        // Queues a datagram for sending (from within the event loop); returns false (after logging
+        // a warning) if it is too large to be sent.
+        bool enqueue(bstring_view data, std::shared_ptr<void> keep_alive, size_t max_size);
+
+        // Queues the fragments (and parity fragment, if enabled) of a datagram when fragmenting
+        void enqueue_fragments(bstring_view data, std::shared_ptr<void> keep_alive, size_t max_size);
+
         bool is_closing_impl() const override;
         bool sent_fin() const override;
         void set_fin(bool) override;
         size_t unsent_impl() const override;
         bool has_unsent_impl() const override;
         void wrote(size_t) override;
-        std::vector<ngtcp2_vec> pending() override;
+        size_t pending(ngtcp2_vec* bufs, size_t max) override;
     };
 
 }  // namespace oxen::quic
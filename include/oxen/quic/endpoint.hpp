@@ -16,8 +16,11 @@ extern "C"
 
 #include <event2/event.h>
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <list>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <optional>
@@ -25,15 +28,24 @@ extern "C"
 #include <random>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "admission.hpp"
+#include "cid_map.hpp"
 #include "connection.hpp"
 #include "context.hpp"
+#include "expiring_store.hpp"
 #include "network.hpp"
 #include "udp.hpp"
 #include "utils.hpp"
 
 namespace oxen::quic
 {
+    // GnuTLS anti-replay callback (see gnutls_session.cpp)
+    extern "C" int anti_replay_db_add_func(
+            void* dbf, time_t exp_time, const gnutls_datum_t* key, const gnutls_datum_t* data);
+
     template <typename... Opt>
     static constexpr void check_for_tls_creds()
     {
@@ -42,7 +54,7 @@ namespace oxen::quic
                 "Endpoint listen/connect require exactly one std::shared_ptr<TLSCreds> argument");
     }
 
-    class Endpoint : public std::enable_shared_from_this<Endpoint>
+    class Endpoint : public std::enable_shared_from_this<Endpoint>, private PacketSink
     {
       public:
         // Non-movable/non-copyable; you must always hold a Endpoint in a shared_ptr
@@ -55,20 +67,33 @@ namespace oxen::quic
         connection_closed_callback connection_close_cb;
 
         template <typename... Opt>
-        Endpoint(Network& n, const Address& listen_addr, Opt&&... opts) : net{n}, _local{listen_addr}
+        Endpoint(Network& n, const Address& listen_addr, Opt&&... opts) :
+                net{n}, _loop{n.assign_loop()}, _local{listen_addr}
         {
+            (take_transport_opt(opts), ...);
             _init_internals();
             ((void)handle_ep_opt(std::forward<Opt>(opts)), ...);
             if (_static_secret.empty())
                 _static_secret = make_static_secret();
         }
 
+        template <typename... Opt>
+        Endpoint(Network& n, endpoint_group_member member, const Address& listen_addr, Opt&&... opts) :
+                net{n}, _loop{member.loop}, _local{listen_addr}, _group_index{member.index}, _group_size{member.size}
+        {
+            (take_transport_opt(opts), ...);
+            _init_internals();
+            ((void)handle_ep_opt(std::forward<Opt>(opts)), ...);
+            if (_static_secret.empty())
+                _static_secret = std::move(member.static_secret);
+        }
+
         template <typename... Opt>
         void listen(Opt&&... opts)
         {
             check_for_tls_creds<Opt...>();
 
-            net.call_get([&opts..., this]() mutable {
+            call_get([&opts..., this]() mutable {
                 if (inbound_ctx)
                     throw std::logic_error{"Cannot call listen() more than once"};
 
@@ -85,57 +110,65 @@ namespace oxen::quic
         {
             check_for_tls_creds<Opt...>();
 
-            std::promise<std::shared_ptr<Connection>> p;
-            auto f = p.get_future();
-
-            if (!remote.is_addressable())
-                throw std::invalid_argument("Address must be addressible to connect");
-
-            if (_local.is_ipv6() && !remote.is_ipv6())
-                remote.map_ipv4_as_ipv6();
-
-            Path _path = Path{_local, remote};
-
-            net.call([&opts..., &p, path = _path, this, remote_pk = std::move(remote).get_remote_key()]() mutable {
-                try
-                {
-                    // initialize client context and client tls context simultaneously
-                    outbound_ctx = std::make_shared<IOContext>(Direction::OUTBOUND, std::forward<Opt>(opts)...);
-                    _set_context_globals(outbound_ctx);
-
-                    auto next_rid = next_reference_id();
-
-                    for (;;)
-                    {
-                        // emplace random CID into lookup keyed to unique reference ID
-                        if (auto [it_a, res_a] = conn_lookup.emplace(quic_cid::random(), next_rid); res_a)
-                        {
-                            if (auto [it_b, res_b] = conns.emplace(next_rid, nullptr); res_b)
-                            {
-                                it_b->second = Connection::make_conn(
-                                        *this,
-                                        next_rid,
-                                        it_a->first,
-                                        quic_cid::random(),
-                                        std::move(path),
-                                        outbound_ctx,
-                                        outbound_alpns,
-                                        handshake_timeout,
-                                        remote_pk);
-
-                                p.set_value(it_b->second);
-                                return;
-                            }
-                        }
-                    }
-                }
-                catch (...)
-                {
-                    p.set_exception(std::current_exception());
-                }
+            auto path = outbound_path(remote);
+            // The context only depends on the options, so is built here rather than on the loop
+            auto ctx = std::make_shared<IOContext>(Direction::OUTBOUND, std::forward<Opt>(opts)...);
+
+            return call_get([&]() -> std::shared_ptr<connection_interface> {
+                return _connect(std::move(path), std::move(ctx), std::move(remote).get_remote_key());
             });
+        }
+
+        // Same as `connect`, but returns immediately rather than waiting for the event loop to
+        // construct the connection: `on_connect` is called in the event loop thread with the new
+        // connection once it exists, or with nullptr if creating it failed.  (The connection itself
+        // is still establishing at that point, as with `connect`).  Invalid addresses still throw
+        // straight away.
+        template <typename... Opt>
+        void connect_async(RemoteAddress remote, connect_callback on_connect, Opt&&... opts)
+        {
+            check_for_tls_creds<Opt...>();
 
-            return f.get();
+            auto path = outbound_path(remote);
+            auto ctx = std::make_shared<IOContext>(Direction::OUTBOUND, std::forward<Opt>(opts)...);
+
+            call([this,
+                  path = std::move(path),
+                  ctx = std::move(ctx),
+                  remote_pk = std::move(remote).get_remote_key(),
+                  cb = std::move(on_connect)]() mutable {
+                auto conn = _try_connect(std::move(path), std::move(ctx), std::move(remote_pk));
+                if (cb)
+                    cb(std::move(conn));
+            });
+        }
+
+        // Connects to each of `remotes` in one go, with all of the connections sharing the same
+        // options (and a single context built from them) and created in a single trip to the
+        // event loop, which makes this much cheaper than separate `connect` calls when opening many
+        // connections at once.  Returns the connections in the same order as `remotes`, with
+        // nullptr for any that could not be created; throws (without connecting to any of them) if
+        // any address is invalid.
+        template <typename... Opt>
+        std::vector<std::shared_ptr<connection_interface>> connect_many(
+                std::vector<RemoteAddress> remotes, Opt&&... opts)
+        {
+            check_for_tls_creds<Opt...>();
+
+            std::vector<Path> paths;
+            paths.reserve(remotes.size());
+            for (auto& r : remotes)
+                paths.push_back(outbound_path(r));
+
+            auto ctx = std::make_shared<IOContext>(Direction::OUTBOUND, std::forward<Opt>(opts)...);
+
+            return call_get([&] {
+                std::vector<std::shared_ptr<connection_interface>> conns;
+                conns.reserve(remotes.size());
+                for (size_t i = 0; i < remotes.size(); i++)
+                    conns.push_back(_try_connect(std::move(paths[i]), ctx, std::move(remotes[i]).get_remote_key()));
+                return conns;
+            });
         }
 
         // query a list of all active inbound and outbound connections paired with a conn_interface
@@ -151,60 +184,124 @@ namespace oxen::quic
 
         int datagram_bufsize() const { return _rbufsize; }
 
+        // The fragmentation settings, if datagrams were enabled via opt::fragment_datagrams
+        const std::optional<opt::fragment_datagrams>& datagram_fragmentation() const { return _fragmentation; }
+
         Splitting splitting_policy() const { return _policy; }
 
+        // The largest UDP payload this endpoint's connections send (see opt::max_udp_payload)
+        size_t max_udp_payload() const { return _max_udp_payload; }
+
         void close_connection(Connection& conn, io_error ec = io_error{0}, std::optional<std::string> msg = std::nullopt);
 
-        void close_conns(std::optional<Direction> d = std::nullopt);
+        // How many connections close_conns closes per trip around the event loop
+        static constexpr size_t CLOSE_BATCH_SIZE = 256;
+
+        // Closes all of the endpoint's connections (or just those of direction `d`).  This works
+        // through the connections in batches, queuing their close packets to go out together
+        // (with sendmmsg/GSO), and returns to the event loop between batches so that closing a
+        // great many connections doesn't hold up the loop.  If `max_time` is non-zero then
+        // connections not yet closed when it runs out are dropped without a close packet (with
+        // their close callbacks getting CONN_SHUTDOWN_TIMEOUT): their remotes only find out when
+        // their idle timeouts expire.
+        void close_conns(std::optional<Direction> d = std::nullopt, std::chrono::milliseconds max_time = 0ms);
 
         std::shared_ptr<connection_interface> get_conn(ConnectionID rid);
 
+        // The call/call_get/call_soon methods dispatch to the event loop that this endpoint is
+        // pinned to (which, for a multi-loop Network, is not necessarily the Network's primary
+        // loop).
         template <typename... Args>
         void call(Args&&... args)
         {
-            net.call(std::forward<Args>(args)...);
+            _loop.call(std::forward<Args>(args)...);
         }
 
         template <typename... Args>
         auto call_get(Args&&... args)
         {
-            return net.call_get(std::forward<Args>(args)...);
+            return _loop.call_get(std::forward<Args>(args)...);
         }
 
         template <typename... Args>
         void call_soon(Args&&... args)
         {
-            net.call_soon(std::forward<Args>(args)...);
+            _loop.call_soon(std::forward<Args>(args)...);
         }
 
-        // Shortcut for calling net.make_shared<T> to make a std::shared_ptr<T> that has destruction
-        // synchronized to the network event loop.
+        // Shortcut for calling make_shared<T> on the endpoint's loop to make a std::shared_ptr<T>
+        // that has destruction synchronized to the endpoint's event loop.
         template <typename T, typename... Args>
         std::shared_ptr<T> make_shared(Args&&... args)
         {
-            return net.make_shared<T>(std::forward<Args>(args)...);
+            return _loop.make_shared<T>(std::forward<Args>(args)...);
         }
 
         bool in_event_loop() const;
 
+        // Returns the index of the Network event loop this endpoint is pinned to.
+        size_t loop_index() const { return _loop.index(); }
+
+        // Returns the UDP send method currently used by this endpoint's socket (or other packet
+        // transport, see opt::packet_transport).
+        SendBackend send_backend() const { return socket->send_backend(); }
+
+        // Returns true if this endpoint is a member of an SO_REUSEPORT endpoint group.
+        bool in_group() const { return _group_size > 1; }
+
+        // Returns this endpoint's index in its endpoint group (0 if not in a group).
+        size_t group_index() const { return _group_index; }
+
+        // Returns the counters of this endpoint's inbound handshake load shedding (see
+        // opt::handshake_admission).
+        admission_stats handshake_admission_stats();
+
+        // Returns how many recent Initials from `remote`'s source prefix were dropped by the
+        // per-prefix rate limit.
+        uint64_t handshake_prefix_dropped(const Address& remote);
+
+        // Returns this endpoint's transport statistics: its socket's traffic counters (including
+        // short batch writes and sends blocked by a full socket buffer), and the packets lost over
+        // all of its connections.  Lock-free and callable from any thread; see also
+        // connection_interface::stats().
+        endpoint_stats stats() const;
+
         // Returns a random value suitable for use as the Endpoint static secret value.
         static ustring make_static_secret();
 
       private:
         friend class Network;
         friend class Connection;
+        friend class BTRequestStream;
+        friend class GNUTLSSession;
+        friend int anti_replay_db_add_func(void*, time_t, const gnutls_datum_t*, const gnutls_datum_t*);
         friend struct Callbacks;
+        friend struct rotating_buffer;
+        friend struct fragment_buffer;
         friend class TestHelper;
 
         Network& net;
+        Loop& _loop;
         Address _local;
-        event_ptr expiry_timer;
-        std::unique_ptr<UDPSocket> socket;
+        size_t _group_index{0};
+        size_t _group_size{1};
+        std::shared_ptr<cid_generator> _cid_generator;
+        std::optional<wheel_timer> expiry_timer;
+        std::unique_ptr<PacketTransport> socket;
+        opt::packet_transport::factory_t _transport_factory;
+        opt::socket_options _socket_options;
+        size_t _max_udp_payload{MAX_PMTUD_UDP_PAYLOAD};
+        // The sizes path MTU discovery probes for, largest first; empty to use ngtcp2's defaults
+        std::vector<uint16_t> _pmtud_probes;
         bool _accepting_inbound{false};
         bool _datagrams{false};
         bool _packet_splitting{false};
         Splitting _policy{Splitting::NONE};
         int _rbufsize{4096};
+        std::optional<opt::fragment_datagrams> _fragmentation;
+        // Makes the memory resource of each new connection (see opt::memory_resource); unset to use
+        // the global heap
+        opt::memory_resource::factory_t _memory_factory;
 
         uint64_t _next_rid{0};
 
@@ -213,29 +310,122 @@ namespace oxen::quic
         std::shared_ptr<IOContext> outbound_ctx;
         std::shared_ptr<IOContext> inbound_ctx;
 
+        admission_control admission;
+        // Inbound connections still handshaking, as counted by `admission`
+        std::unordered_set<ConnectionID> pending_handshakes;
+
+        // Set if connections are pooled by remote pubkey (see opt::connection_pooling)
+        std::optional<opt::connection_pooling> _pooling;
+        std::map<ustring, ConnectionID, std::less<>> pool;
+
+        // Losses over all connections, past and present (updated by Connection::update_stats)
+        std::atomic<uint64_t> _packets_lost{0};
+        std::atomic<uint64_t> _bytes_lost{0};
+
         std::vector<ustring> outbound_alpns;
         std::vector<ustring> inbound_alpns;
         std::chrono::nanoseconds handshake_timeout{DEFAULT_HANDSHAKE_TIMEOUT};
 
-        std::map<ustring, ustring> anti_replay_db;
-        std::map<ustring, ustring> encoded_transport_params;
-        std::map<ustring, ustring> path_validation_tokens;
+        // Storage for the halves of split datagrams waiting to be reassembled, shared by all of the
+        // endpoint's connections.  (Both pools are sized from the max UDP payload, and so are
+        // created by _init_internals).
+        std::optional<buffer_pool> datagram_pool;
+
+        // Storage for received datagrams handed off to a dgram_data_pooled_callback; these can be
+        // reassembled split datagrams, and so twice the size of a single packet payload.  Anything
+        // larger (such as a reassembled fragmented datagram) gets a one-off buffer instead.
+        std::optional<buffer_pool> datagram_recv_pool;
+
+        // How long a 0-RTT ClientHello is accepted for (enforced by GnuTLS), and so how long its
+        // anti-replay entry has to be remembered
+        static constexpr auto ANTI_REPLAY_WINDOW = 10s;
+        static constexpr size_t MAX_ANTI_REPLAY_ENTRIES = 100'000;
+        expiring_store<> anti_replay_db{ANTI_REPLAY_WINDOW, MAX_ANTI_REPLAY_ENTRIES};
+
+        // Address validation tokens received from servers, keyed by server pubkey.  Servers only
+        // accept tokens for PATH_TOKEN_LIFETIME (see verify_token), so older ones are useless.
+        static constexpr auto PATH_TOKEN_LIFETIME = 1h;
+        static constexpr size_t MAX_PATH_TOKENS = 10'000;
+        expiring_store<ustring> path_validation_tokens{PATH_TOKEN_LIFETIME, MAX_PATH_TOKENS};
+
+        // Client session ticket store for 0-RTT resumption (see opt::session_resumption); null if
+        // resumption is not enabled
+        std::shared_ptr<session_cache> _session_cache;
+
+        // Server session resumption state, shared by all inbound sessions and set up by listen():
+        // the session ticket encryption key (derived from the static secret, so that tickets stay
+        // valid across restarts that keep the same secret) and 0-RTT anti-replay protection.
+        ustring _ticket_key;
+        gnutls_datum_t _ticket_key_datum{nullptr, 0};
+        std::unique_ptr<gnutls_anti_replay_st, void (*)(gnutls_anti_replay_t)> _anti_replay{
+                nullptr, gnutls_anti_replay_deinit};
 
-        const std::shared_ptr<event_base>& get_loop() { return net.loop(); }
+        const gnutls_datum_t& session_ticket_key() const { return _ticket_key_datum; }
+        gnutls_anti_replay_t anti_replay() const { return _anti_replay.get(); }
+        void _init_session_resumption();
 
-        const std::unique_ptr<UDPSocket>& get_socket() { return socket; }
+        const std::shared_ptr<event_base>& get_loop() { return _loop.loop(); }
+
+        timer_wheel& timers() { return _loop.timers(); }
+
+        const std::unique_ptr<PacketTransport>& get_socket() { return socket; }
+
+        // Returns the memory resource for a new connection's internal buffers.  Must be called in
+        // the event loop.
+        std::shared_ptr<std::pmr::memory_resource> connection_memory();
 
         // Does the non-templated bit of `listen()`
         void _listen();
 
+        // Validates an outbound connection's remote address (throwing std::invalid_argument if it
+        // isn't usable) and returns the path to it.  Called from the caller's thread.
+        Path outbound_path(RemoteAddress& remote) const;
+
+        // Does the non-templated bit of `connect()`: creates the outbound connection, using (and
+        // keeping as `outbound_ctx`) the given context.  Must be called in the event loop.
+        std::shared_ptr<Connection> _connect(Path path, std::shared_ptr<IOContext> ctx, ustring remote_pk);
+
+        // Same as `_connect`, but logs any failure and returns nullptr rather than throwing
+        std::shared_ptr<connection_interface> _try_connect(Path path, std::shared_ptr<IOContext> ctx, ustring remote_pk);
+
         void handle_ep_opt(opt::enable_datagrams dc);
+        void handle_ep_opt(opt::fragment_datagrams fd);
         void handle_ep_opt(opt::outbound_alpns alpns);
         void handle_ep_opt(opt::inbound_alpns alpns);
         void handle_ep_opt(opt::handshake_timeout timeout);
         void handle_ep_opt(dgram_data_callback dgram_cb);
+        void handle_ep_opt(dgram_data_view_callback dgram_cb);
+        void handle_ep_opt(dgram_data_pooled_callback dgram_cb);
         void handle_ep_opt(connection_established_callback conn_established_cb);
         void handle_ep_opt(connection_closed_callback conn_closed_cb);
         void handle_ep_opt(opt::static_secret ssecret);
+        void handle_ep_opt(opt::session_resumption resumption);
+        void handle_ep_opt(opt::handshake_admission limits);
+        void handle_ep_opt(opt::connection_id_generator gen);
+        void handle_ep_opt(opt::connection_pooling pooling);
+        void handle_ep_opt(opt::memory_resource mem);
+        // Already taken by take_transport_opt
+        void handle_ep_opt(const opt::packet_transport&) {}
+        void handle_ep_opt(const opt::socket_options&) {}
+        void handle_ep_opt(const opt::max_udp_payload&) {}
+
+        // The packet transport, socket options, and max payload have to be known before
+        // _init_internals() creates the socket and buffers, so the constructors pick them out of
+        // the options ahead of the rest.
+        template <typename Opt>
+        void take_transport_opt(const Opt& o)
+        {
+            if constexpr (std::is_same_v<remove_cvref_t<Opt>, opt::packet_transport>)
+            {
+                if (in_group())
+                    throw std::invalid_argument{"opt::packet_transport cannot be used by endpoint group members"};
+                _transport_factory = o.factory;
+            }
+            else if constexpr (std::is_same_v<remove_cvref_t<Opt>, opt::socket_options>)
+                _socket_options = o;
+            else if constexpr (std::is_same_v<remove_cvref_t<Opt>, opt::max_udp_payload>)
+                set_max_udp_payload(o.size);
+        }
 
         // Takes a std::optional-wrapped option that does nothing if the optional is empty,
         // otherwise passes it through to the above.  This is here to allow runtime-dependent
@@ -249,6 +439,14 @@ namespace oxen::quic
 
         void handle_packet(Packet&& pkt);
 
+        // PacketSink interface: dispatches a batch of received packets to their connections.
+        void handle_packets(Packet* pkts, size_t n) override;
+
+        // Finds the connection for an incoming packet with the given DCID, or (if we are accepting
+        // inbound connections and this is a valid initial packet) creates one.  Returns nullptr if
+        // the packet should be dropped.
+        Connection* connection_for_packet(const Packet& pkt, quic_cid& dcid);
+
         /// Attempts to send up to `n_pkts` packets to an address over this endpoint's socket.
         ///
         /// Upon success, updates n_pkts to 0 and returns an io_result with `.success()` true.
@@ -267,24 +465,43 @@ namespace oxen::quic
         /// `.blocked()` false).
         io_result send_packets(const Path& path, std::byte* buf, size_t* bufsize, uint8_t ecn, size_t& n_pkts);
 
+        /// Same as send_packets (with the same handling of `buf`/`bufsize`/`n_pkts` and the same
+        /// meaning of the return value), except that the packets are normally just added to the
+        /// endpoint's egress batch rather than sent right away; see `flush_egress()`.  Packets that
+        /// fail to send once the batch is flushed are just dropped (i.e. lost).
+        io_result queue_packets(const Path& path, std::byte* buf, size_t* bufsize, uint8_t ecn, size_t& n_pkts);
+
         void drop_connection(Connection& conn, io_error err);
 
         dgram_data_callback dgram_recv_cb;
+        dgram_data_view_callback dgram_recv_view_cb;
+        dgram_data_pooled_callback dgram_recv_pooled_cb;
+
+        // Called when an inbound connection finishes its handshake (or is deleted without finishing
+        // it), to stop counting it as pending for admission control
+        void inbound_handshake_finished(Connection& conn);
+
+        // Returns the pooled connection to `remote_key` if there is one that isn't closing.
+        std::shared_ptr<Connection> pooled_conn(ustring_view remote_key);
+
+        // Adds a newly established inbound connection to the pool, when deduplicating.  Returns
+        // false if it duplicates an outbound connection that wins over it, in which case it is
+        // being closed.
+        bool pool_inbound(Connection& conn);
+
+        // Removes a connection being deleted from the pool
+        void unpool(Connection& conn);
 
         void delete_connection(Connection& conn);
         void drain_connection(Connection& conn);
 
         void connection_established(connection_interface& conn);
 
-        int validate_anti_replay(ustring key, ustring data, time_t exp);
+        int validate_anti_replay(ustring_view key);
 
-        void store_0rtt_transport_params(ustring remote_pk, ustring encoded_params);
+        void store_path_validation_token(ustring_view remote_pk, ustring token);
 
-        std::optional<ustring> get_0rtt_transport_params(ustring remote_pk);
-
-        void store_path_validation_token(ustring remote_pk, ustring token);
-
-        std::optional<ustring> get_path_validation_token(ustring remote_pk);
+        std::optional<ustring> get_path_validation_token(ustring_view remote_pk);
 
         void initial_association(Connection& conn);
 
@@ -298,8 +515,22 @@ namespace oxen::quic
 
         ConnectionID next_reference_id();
 
+        // Generates a new local CID, from the endpoint's CID generator if it has one, otherwise
+        // random; for endpoint group members the CID carries this endpoint's routing byte.
+        quic_cid make_cid() const;
+
+        // Fills in a new local CID of `cid_length()` bytes, as make_cid does.  Returns false on
+        // failure.
+        bool generate_cid(uint8_t* data) const;
+
+        // Length of the local CIDs this endpoint issues, which it needs to know to parse short
+        // header packets.
+        size_t cid_length() const { return _cid_generator ? _cid_generator->length() : NGTCP2_MAX_CIDLEN; }
+
         void _init_internals();
         void _init_static_secret();
+        // Validates and sets the max UDP payload, and the PMTUD probe sizes leading up to it
+        void set_max_udp_payload(size_t size);
 
         bool verify_retry_token(const Packet& pkt, ngtcp2_pkt_hd* hdr, ngtcp2_cid* ocid);
 
@@ -311,7 +542,17 @@ namespace oxen::quic
 
         void _set_context_globals(std::shared_ptr<IOContext>& ctx);
 
-        void _close_conns(std::optional<Direction> d);
+        // Does the work of close_conns; `deadline` is zero for no time limit.  `done`, if set, is
+        // called once the last connection has been closed.
+        void _close_conns(
+                std::optional<Direction> d,
+                std::chrono::steady_clock::time_point deadline = {},
+                std::function<void()> done = nullptr);
+        void _close_conns_batch(
+                std::shared_ptr<std::vector<ConnectionID>> ids,
+                size_t pos,
+                std::chrono::steady_clock::time_point deadline,
+                std::function<void()> done);
 
         void _close_connection(Connection& conn, io_error ec, std::string msg);
 
@@ -338,11 +579,11 @@ namespace oxen::quic
         ///     client.dcid == server.scid
         /// with each side randomizing their own scid.
         ///
-        ///     Internally, the connection is assigned a unique reference ID. All possible CID's at which
-        /// the endpoint can be reached are keyed to that reference ID in `conn_lookup`, allowing for rapid
-        /// access to the unique reference ID by which the connection pointer can be found.
-        /// The primary Connection
-        /// instance is stored as a shared_ptr indexd by scid
+        ///     Internally, the connection is assigned a unique reference ID, by which the owning shared_ptr
+        /// of the Connection is stored in `conns`. All possible CID's at which the endpoint can be reached
+        /// are keyed directly to the Connection pointer in `conn_lookup`, a flat open-addressing table, so
+        /// that demultiplexing an incoming packet is a single hash probe; a connection's CIDs are all
+        /// removed from `conn_lookup` before the connection itself is removed from `conns`.
         ///
         ///     When closing (we closed) or draining (they closed) connections, they must be kept around for a short period
         /// of time to allow for any lagging packets to be caught. The unique reference ID is keyed to removal time formatted
@@ -350,12 +591,42 @@ namespace oxen::quic
         ///
         std::map<ConnectionID, std::shared_ptr<Connection>> conns;
 
-        std::unordered_map<quic_cid, ConnectionID> conn_lookup;
+        // Values are null for CIDs reserved for a connection that is still being constructed
+        cid_map<Connection*> conn_lookup;
 
-        std::map<std::chrono::steady_clock::time_point, ConnectionID> draining_closing;
+        // Incremented whenever a CID or connection is removed from the above, so that a batch of
+        // incoming packets knows when a connection it looked up earlier in the batch may be gone.
+        uint64_t lookup_generation{0};
 
         std::optional<quic_cid> handle_packet_connid(const Packet& pkt);
 
+        // Egress batch: packets that connections produce during one event loop iteration get
+        // collected here (via queue_packets) and then sent all together, with a single sendmmsg
+        // call covering all of their different destinations, once the loop gets to the
+        // `egress_flush` event.  This is what keeps servers with many low-rate connections from
+        // having to make one send syscall for every packet or two.
+        struct egress_run
+        {
+            Path path;
+            uint8_t ecn;
+            size_t n_pkts;
+        };
+        std::vector<std::byte> egress_buf;  // Sized for a full batch of max-size packets
+        std::array<size_t, DATAGRAM_BATCH_SIZE> egress_sizes;
+        std::vector<egress_run> egress_runs;
+        size_t egress_pkts{0};
+        size_t egress_bytes{0};
+        // Set when the socket blocked while flushing; nothing more is queued until it unblocks
+        bool egress_blocked{false};
+        event_ptr egress_flush;
+
+        // Sends the queued egress batch.  If the socket blocks, the remainder stays queued (and
+        // gets sent once the socket becomes writeable again); packets that fail to send are dropped.
+        void flush_egress();
+
+        // Drops the first `n` packets of the egress batch
+        void egress_consume(size_t n);
+
         // Less efficient wrapper around send_packets that takes care of queuing the packet if the
         // socket is blocked.  This is for rare, one-shot packets only (regular data packets go via
         // more efficient direct send_packets calls with custom resend logic).
@@ -368,6 +639,9 @@ namespace oxen::quic
 
         void send_version_negotiation(const ngtcp2_version_cid& vid, const Path& p);
 
+        // How often check_timeouts() sweeps the endpoint's streams for timed out requests
+        static constexpr std::chrono::milliseconds STREAM_TIMEOUT_INTERVAL{250};
+
         void check_timeouts();
 
         Connection* accept_initial_connection(const Packet& pkt);
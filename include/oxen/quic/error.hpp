@@ -50,6 +50,12 @@ namespace oxen::quic
     inline constexpr uint64_t CONN_SEND_FAIL = ERROR_BASE + 1002;
     // Connection closing because it reached idle timeout
     inline constexpr uint64_t CONN_IDLE_CLOSED = ERROR_BASE + 1003;
+    // Connection closed because it duplicates another one between the same endpoints (see
+    // opt::connection_pooling)
+    inline constexpr uint64_t CONN_DUPLICATE = ERROR_BASE + 1004;
+    // Connection dropped, without a close packet, because closing the endpoint's connections ran
+    // past its time limit (see Endpoint::close_conns)
+    inline constexpr uint64_t CONN_SHUTDOWN_TIMEOUT = ERROR_BASE + 1005;
 
     inline std::string quic_strerror(uint64_t e)
     {
@@ -73,6 +79,10 @@ namespace oxen::quic
                 return "Error - Failed to send packet"s;
             case CONN_IDLE_CLOSED:
                 return "Connection closed by idle timeout"s;
+            case CONN_DUPLICATE:
+                return "Connection closed as a duplicate"s;
+            case CONN_SHUTDOWN_TIMEOUT:
+                return "Connection dropped by shutdown timeout"s;
             default:
                 return "Application error code " + std::to_string(e);
         }
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <gnutls/crypto.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <variant>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Bounded map from byte-string keys that forgets its entries after a while, used by Endpoint
+    // for the state that remotes can make it accumulate: the 0-RTT anti-replay database, and the
+    // address validation tokens received from servers.
+    //
+    // Entries live in two generations.  New entries go into the current one; once it is `lifetime`
+    // old the previous generation is dropped wholesale and the current one takes its place.  An
+    // entry is thus kept for at least `lifetime` and less than twice that, and expiry costs nothing
+    // per entry.  Each generation holds at most `max_entries` entries, so memory stays bounded no
+    // matter how fast entries arrive.
+    //
+    // Keys are stored only as a 64-bit hash (with a per-store random seed, since keys are chosen
+    // by remotes), so lookups are a single hash of the key plus a constant-time table probe, and
+    // keys that collide are treated as equal.  Both of the endpoint's uses tolerate that: a false
+    // match costs at most an extra round trip.  Uses that can't (such as GNUTLSCreds' key verify
+    // cache) store the full key as the value and compare it on lookup.
+    //
+    // Not thread-safe.
+    template <typename V = std::monostate>
+    class expiring_store
+    {
+      public:
+        using clock = std::chrono::steady_clock;
+
+        expiring_store(clock::duration lifetime, size_t max_entries) : lifetime{lifetime}, max_entries{max_entries}
+        {
+            if (gnutls_rnd(GNUTLS_RND_NONCE, &seed, sizeof(seed)) != 0)
+                seed = reinterpret_cast<uintptr_t>(this);
+        }
+
+        // Adds `key` if it is not already present.  Returns false, without storing anything, if it
+        // was present or if the current generation is full: callers such as anti-replay have to
+        // remember every key for the full lifetime, so a full store refuses new keys rather than
+        // forgetting old ones early.
+        bool insert(ustring_view key, V value = {}, clock::time_point now = clock::now())
+        {
+            rotate(now);
+            auto h = hash(key);
+            if (gens[1 - cur].count(h) || gens[cur].size() >= max_entries)
+                return false;
+            return gens[cur].emplace(h, std::move(value)).second;
+        }
+
+        // Stores `value` for `key`, replacing any existing value.  If the current generation is
+        // full this rotates early (dropping the oldest entries) to make room.
+        void insert_or_assign(ustring_view key, V value, clock::time_point now = clock::now())
+        {
+            rotate(now);
+            auto h = hash(key);
+            gens[1 - cur].erase(h);
+            if (gens[cur].size() >= max_entries && !gens[cur].count(h))
+                advance(now);
+            gens[cur].insert_or_assign(h, std::move(value));
+        }
+
+        // Returns a pointer to the value stored for `key`, or nullptr if there is none.  The
+        // pointer is invalidated by any later call other than find.
+        V* find(ustring_view key, clock::time_point now = clock::now())
+        {
+            rotate(now);
+            auto h = hash(key);
+            for (auto* g : {&gens[cur], &gens[1 - cur]})
+                if (auto it = g->find(h); it != g->end())
+                    return &it->second;
+            return nullptr;
+        }
+
+        bool contains(ustring_view key, clock::time_point now = clock::now()) { return find(key, now); }
+
+        void erase(ustring_view key)
+        {
+            auto h = hash(key);
+            gens[0].erase(h);
+            gens[1].erase(h);
+        }
+
+        // Number of entries held, including ones in the previous generation that are past
+        // `lifetime` but have not been dropped yet.
+        size_t size() const { return gens[0].size() + gens[1].size(); }
+
+        void clear()
+        {
+            gens[0].clear();
+            gens[1].clear();
+        }
+
+      private:
+        clock::duration lifetime;
+        size_t max_entries;
+        uint64_t seed = 0;
+
+        std::array<std::unordered_map<uint64_t, V>, 2> gens;
+        size_t cur = 0;
+        clock::time_point started{};
+
+        // Starts a new current generation, dropping the previous one
+        void advance(clock::time_point now)
+        {
+            cur = 1 - cur;
+            gens[cur].clear();
+            started = now;
+        }
+
+        void rotate(clock::time_point now)
+        {
+            if (now - started < lifetime)
+                return;
+            if (now - started >= 2 * lifetime)
+            {
+                // Nothing has been stored for a whole lifetime, so everything has expired
+                gens[cur].clear();
+                advance(now);
+            }
+            else
+                // The new generation starts when the old one ended (not now), so that an entry
+                // never outlives the current generation by more than one lifetime
+                advance(started + lifetime);
+        }
+
+        static uint64_t mix(uint64_t x)
+        {
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        uint64_t hash(ustring_view key) const
+        {
+            uint64_t h = seed ^ (key.size() * 0x9e3779b97f4a7c15ULL);
+            size_t i = 0;
+            for (; i + 8 <= key.size(); i += 8)
+            {
+                uint64_t block;
+                std::memcpy(&block, key.data() + i, 8);
+                h = mix(h ^ block) + seed;
+            }
+            uint64_t tail = 0;
+            // (An empty key can have a null data pointer, which memcpy mustn't get even for 0 bytes)
+            if (i < key.size())
+                std::memcpy(&tail, key.data() + i, key.size() - i);
+            return mix(h ^ tail ^ 0x243f6a8885a308d3ULL);
+        }
+    };
+}  // namespace oxen::quic
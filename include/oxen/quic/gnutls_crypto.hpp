@@ -3,10 +3,12 @@
 #include <oxenc/base64.h>
 #include <oxenc/hex.h>
 
+#include <mutex>
 #include <optional>
 #include <variant>
 
 #include "crypto.hpp"
+#include "expiring_store.hpp"
 #include "utils.hpp"
 
 namespace oxen::quic
@@ -23,6 +25,8 @@ namespace oxen::quic
     {
         int cert_verify_callback_gnutls(gnutls_session_t g_session);
 
+        int anti_replay_db_add_func(void* dbf, time_t exp_time, const gnutls_datum_t* key, const gnutls_datum_t* data);
+
         void gnutls_log(int level, const char* str);
 
         struct gnutls_log_setter
@@ -137,7 +141,10 @@ namespace oxen::quic
         {
             if (auto path = fs::u8path(input); fs::exists(path))
             {
-                format = (str_tolower(path.extension().u8string()) == ".pem") ? GNUTLS_X509_FMT_PEM : GNUTLS_X509_FMT_DER;
+                // (u8string() returns a std::u8string when compiled as C++20)
+                auto ext = path.extension().u8string();
+                format = (str_tolower(std::string{ext.begin(), ext.end()}) == ".pem") ? GNUTLS_X509_FMT_PEM
+                                                                                       : GNUTLS_X509_FMT_DER;
                 source = std::move(path);
             }
             else if (bool pem = starts_with(input, "-----"); pem || (starts_with(input, "\x30") && input.size() >= 48))
@@ -230,7 +237,8 @@ namespace oxen::quic
             if (auto* p = std::get_if<fs::path>(&source))
             {
 #ifdef _WIN32
-                u8path_buf = p->u8string();
+                auto u8 = p->u8string();
+                u8path_buf.assign(u8.begin(), u8.end());
                 return u8path_buf.c_str();
 #else
                 return p->c_str();
@@ -250,6 +258,15 @@ namespace oxen::quic
         // Construct from raw Ed25519 keys
         GNUTLSCreds(std::string ed_seed, std::string ed_pubkey);
 
+        struct verified_keys
+        {
+            std::mutex mutex;
+            // The values are the full key + alpn, checked on lookup: the store only keys on a hash,
+            // and a collision mustn't let an unverified key be accepted
+            expiring_store<ustring> keys;
+        };
+        std::unique_ptr<verified_keys> verified;
+
       public:
         gnutls_pcert_st pcrt;
         gnutls_privkey_t pkey;
@@ -262,12 +279,24 @@ namespace oxen::quic
 
         key_verify_callback key_verify;
 
-        gnutls_priority_t priority_cache;
+        // Parsed once at construction and shared by every session made from these credentials
+        gnutls_priority_t priority_cache{nullptr};
 
         void load_keys(x509_loader& seed, x509_loader& pk);
 
         void set_key_verify_callback(key_verify_callback cb) { key_verify = std::move(cb); }
 
+        // Remembers the keys (and ALPNs) that the key verify callback accepted for `lifetime`, so
+        // that reconnecting peers are accepted without calling it again.  Only worthwhile if the
+        // callback is expensive (and its answer does not change within `lifetime`); the peer still
+        // has to prove that it holds the key in every handshake.  Shared by all users of these
+        // credentials, and thread-safe.
+        void enable_key_verify_cache(std::chrono::seconds lifetime = 1min, size_t max_entries = 10'000);
+
+        // Calls the key verify callback (or accepts, if there is none), consulting the cache set up
+        // by enable_key_verify_cache, if any.
+        bool verify_key(ustring_view key, ustring_view alpn) const;
+
         static std::shared_ptr<GNUTLSCreds> make(
                 std::string remote_key, std::string remote_cert, std::string local_cert = "", std::string ca_arg = "");
 
@@ -285,8 +314,9 @@ namespace oxen::quic
 
       private:
         gnutls_session_t session;
-        gnutls_datum_t session_ticket_key;
-        gnutls_anti_replay_t anti_replay;
+        // Server only: shared by all of the endpoint's inbound sessions (see Endpoint)
+        const gnutls_datum_t* session_ticket_key{nullptr};
+        gnutls_anti_replay_t anti_replay{nullptr};
 
         bool is_client;
 
@@ -307,7 +337,7 @@ namespace oxen::quic
 
         void* get_anti_replay() const override { return anti_replay; }
 
-        const void* get_session_ticket_key() const override { return &session_ticket_key; }
+        const void* get_session_ticket_key() const override { return session_ticket_key; }
 
         bool get_early_data_accepted() const override
         {
@@ -322,6 +352,10 @@ namespace oxen::quic
 
         int send_session_ticket() override;
 
+        bool set_resumption_data(ustring_view data) override;
+
+        bool is_resumed() const override { return gnutls_session_is_resumed(session); }
+
         void set_expected_remote_key(ustring key) override { _expected_remote_key(key); }
     };
 
@@ -1,4 +1,8 @@
 #pragma once
+
+#include <atomic>
+#include <memory_resource>
+
 #include "connection_ids.hpp"
 #include "messages.hpp"
 #include "utils.hpp"
@@ -31,13 +35,14 @@ namespace oxen::quic
         virtual std::shared_ptr<Stream> get_stream() = 0;
         virtual int64_t stream_id() const = 0;
 
-        // These public methods are intended for access from anywhere and invoke a call_get to
-        // synchronously get their value.  (Subclasses provide implementations by overriding the
-        // protected _impl versions of these methods).
-        bool is_empty() const;
-        size_t unsent() const;
-        bool has_unsent() const;
-        bool is_closing() const;
+        // These public methods are intended for access from anywhere.  Rather than going into the
+        // event loop they return the values the loop last published (see publish_state()), which
+        // takes nanoseconds; the values reflect everything the loop has done so far, but not calls
+        // still queued for it (such as a send() made from another thread just before).
+        bool is_empty() const { return _published_empty.load(std::memory_order_relaxed); }
+        size_t unsent() const { return _published_unsent.load(std::memory_order_relaxed); }
+        bool has_unsent() const { return _published_has_unsent.load(std::memory_order_relaxed); }
+        bool is_closing() const { return _published_closing.load(std::memory_order_relaxed); }
 
         // These are call_get-proxied to return the value from the Connection object.  They throw if
         // the Connection object no longer exists.
@@ -68,19 +73,31 @@ namespace oxen::quic
       protected:
         friend class Connection;
         friend struct rotating_buffer;
+        friend struct fragment_buffer;
 
         Connection* _conn;
 
+        // The connection's memory resource (see opt::memory_resource), for the channel's internal
+        // buffers
+        std::shared_ptr<std::pmr::memory_resource> _memory;
+
         // This is the (single) send implementation that implementing classes must provide; other
         // calls to send are converted into calls to this.
         virtual void send_impl(bstring_view, std::shared_ptr<void> keep_alive) = 0;
 
-        virtual std::vector<ngtcp2_vec> pending() = 0;
+        // Fills up to `max` iovecs with the channel's data that is waiting to be sent, returning the
+        // number of iovecs filled.
+        virtual size_t pending(ngtcp2_vec* bufs, size_t max) = 0;
         virtual prepared_datagram pending_datagram(bool) = 0;
         virtual bool sent_fin() const = 0;
         virtual void set_fin(bool) = 0;
         virtual void wrote(size_t) = 0;
 
+        // Send priority of the channel (see Stream::set_priority), used by the connection send
+        // scheduler.
+        uint8_t _urgency{DEFAULT_URGENCY};
+        bool _incremental{true};
+
         // Does the actual implementation: these methods may only be called internally, from code
         // already inside the event loop thread.  (The public non-_impl versions of these methods
         // are simply wrappers that use call_get to invoke these _impl versions).
@@ -89,6 +106,14 @@ namespace oxen::quic
         virtual bool has_unsent_impl() const = 0;
         virtual bool is_closing_impl() const = 0;
 
+        // Copies of the _impl values for the public accessors; subclasses call publish_state()
+        // (from the event loop) whenever one of them may have changed.
+        std::atomic<bool> _published_empty{true};
+        std::atomic<size_t> _published_unsent{0};
+        std::atomic<bool> _published_has_unsent{false};
+        std::atomic<bool> _published_closing{false};
+        virtual void publish_state();
+
         // Wraps an IOChannel (or derived type) accessor member function pointer in a call_get for
         // synchronous access that always returns by value (even if the member function returns by
         // reference).
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace oxen::quic
+{
+    // Move-only type-erased `void()` callable used for event loop jobs.  Unlike std::function this
+    // stores callables of up to INLINE_SIZE bytes (which covers nearly every lambda we post to the
+    // loop: a few pointers, a shared_ptr keep-alive, and maybe a bstring_view) directly inside the
+    // object, so that posting a job does not require a heap allocation.  Larger (or throwing-move)
+    // callables fall back to a heap allocation.
+    class Job
+    {
+      public:
+        static constexpr size_t INLINE_SIZE = 64;
+
+        Job() = default;
+
+        template <
+                typename F,
+                typename D = std::decay_t<F>,
+                std::enable_if_t<!std::is_same_v<D, Job> && std::is_invocable_r_v<void, D&>, int> = 0>
+        Job(F&& f)
+        {
+            if constexpr (fits_inline<D>)
+            {
+                new (&storage) D(std::forward<F>(f));
+                ops = &inline_ops<D>;
+            }
+            else
+            {
+                *reinterpret_cast<D**>(&storage) = new D(std::forward<F>(f));
+                ops = &heap_ops<D>;
+            }
+        }
+
+        Job(Job&& other) noexcept { take(other); }
+
+        Job& operator=(Job&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                take(other);
+            }
+            return *this;
+        }
+
+        Job(const Job&) = delete;
+        Job& operator=(const Job&) = delete;
+
+        ~Job() { reset(); }
+
+        explicit operator bool() const { return ops != nullptr; }
+
+        void operator()()
+        {
+            assert(ops);
+            ops->invoke(&storage);
+        }
+
+        void reset()
+        {
+            if (ops)
+            {
+                ops->destroy(&storage);
+                ops = nullptr;
+            }
+        }
+
+      private:
+        struct job_ops
+        {
+            void (*invoke)(void*);
+            // Move-constructs into dst from src, and destroys src
+            void (*relocate)(void* src, void* dst) noexcept;
+            void (*destroy)(void*) noexcept;
+        };
+
+        template <typename D>
+        static constexpr bool fits_inline = sizeof(D) <= INLINE_SIZE && alignof(D) <= alignof(std::max_align_t) &&
+                                            std::is_nothrow_move_constructible_v<D>;
+
+        template <typename D>
+        static constexpr job_ops inline_ops{
+                [](void* p) { (*static_cast<D*>(p))(); },
+                [](void* src, void* dst) noexcept {
+                    new (dst) D(std::move(*static_cast<D*>(src)));
+                    static_cast<D*>(src)->~D();
+                },
+                [](void* p) noexcept { static_cast<D*>(p)->~D(); }};
+
+        template <typename D>
+        static constexpr job_ops heap_ops{
+                [](void* p) { (**static_cast<D**>(p))(); },
+                [](void* src, void* dst) noexcept { *static_cast<D**>(dst) = *static_cast<D**>(src); },
+                [](void* p) noexcept { delete *static_cast<D**>(p); }};
+
+        void take(Job& other) noexcept
+        {
+            if (other.ops)
+            {
+                other.ops->relocate(&other.storage, &storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+
+        std::aligned_storage_t<INLINE_SIZE, alignof(std::max_align_t)> storage;
+        const job_ops* ops = nullptr;
+    };
+
+    // Bounded lock-free multi-producer, single-consumer FIFO ring of Jobs (a Vyukov-style bounded
+    // queue: each slot carries a sequence number that tells producers and the consumer whether the
+    // slot is free or filled for the current lap around the ring).  Producers never take a lock;
+    // `try_push` fails (rather than blocking) when the ring is full.
+    class job_ring
+    {
+      public:
+        // `capacity` must be a power of 2.
+        explicit job_ring(size_t capacity) : mask{capacity - 1}, slots{new slot[capacity]}
+        {
+            assert(capacity >= 2 && (capacity & mask) == 0);
+            for (size_t i = 0; i < capacity; i++)
+                slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+        // Returns the number of jobs currently in the ring (including any still being pushed).
+        // Must only be called from the consumer thread.
+        size_t size() const { return tail.load(std::memory_order_relaxed) - head; }
+
+        // Pushes a job onto the ring.  May be called from any thread.  Returns false (and leaves
+        // `job` untouched) if the ring is full.
+        bool try_push(Job& job)
+        {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            slot* s;
+            for (;;)
+            {
+                s = &slots[pos & mask];
+                auto seq = s->seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0)
+                {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;  // full
+                else
+                    pos = tail.load(std::memory_order_relaxed);
+            }
+            s->job = std::move(job);
+            s->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Pops the next job off the ring, if any.  Must only be called from the single consumer
+        // thread.
+        bool try_pop(Job& out)
+        {
+            auto& s = slots[head & mask];
+            if (s.seq.load(std::memory_order_acquire) != head + 1)
+                return false;
+            out = std::move(s.job);
+            s.seq.store(head + mask + 1, std::memory_order_release);
+            ++head;
+            return true;
+        }
+
+      private:
+        struct slot
+        {
+            std::atomic<size_t> seq;
+            Job job;
+        };
+
+        const size_t mask;
+        std::unique_ptr<slot[]> slots;
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) size_t head{0};
+    };
+}  // namespace oxen::quic
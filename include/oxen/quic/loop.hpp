@@ -0,0 +1,232 @@
+#pragma once
+
+#include <event2/event.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "jobs.hpp"
+#include "stats.hpp"
+#include "timer_wheel.hpp"
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Scratch space that connections build their outgoing packets in.  Everything pinned to a loop
+    // runs on the loop's thread, and a connection only needs this while it is writing out a batch
+    // of packets, so all of a loop's connections share one of these rather than each carrying
+    // their own.
+    struct send_scratch
+    {
+        // Grown (by Loop::scratch) to a full batch of the largest packets of the loop's endpoints
+        std::vector<std::byte> buf;
+        std::array<size_t, DATAGRAM_BATCH_SIZE> sizes;
+        // iovecs of the stream data offered to ngtcp2 for each packet; a stream with more buffers
+        // than this queued just gets offered the rest on another pass.
+        std::array<ngtcp2_vec, 64> stream_iovecs;
+    };
+
+    class loop_instrumentation;
+
+    // Scheduling and memory placement settings for the event loop threads that a Network starts;
+    // see Network(size_t, loop_thread_options).  Anything the OS refuses (e.g. SCHED_FIFO without
+    // CAP_SYS_NICE or an RLIMIT_RTPRIO allowance) is logged as a warning and the loop runs without
+    // it.  Only supported on Linux; elsewhere the settings are ignored with a warning.
+    struct loop_thread_options
+    {
+        // CPUs to pin the loop threads to: loop `i` is pinned to the CPUs in `cpus[i % cpus.size()]`
+        // (an empty entry leaves that loop unpinned).  Empty leaves all loops unpinned.  For
+        // instance, to line four loops up with NIC receive queues whose interrupts (and RPS/XPS)
+        // are steered to CPUs 2, 4, 6 and 8, use {{2}, {4}, {6}, {8}}, with an endpoint_group.
+        std::vector<std::vector<unsigned>> cpus;
+
+        // If true, a pinned loop thread switches to local memory allocation (MPOL_LOCAL) before it
+        // allocates its timer wheel and packet scratch space, and the packet buffers and socket of
+        // each endpoint pinned to it are allocated from the loop thread too, so that all of them
+        // end up on the NUMA node of the loop's CPUs.  No effect on unpinned loops.
+        bool numa_local{true};
+
+        // If non-zero, the loop threads run under SCHED_FIFO at this priority (1-99).  Note that
+        // a real-time loop that never blocks can starve everything else on its CPUs.
+        int realtime_priority{0};
+    };
+
+    // Receives the stats of one event loop for each reporting period (see
+    // Network::enable_loop_stats).  Called from that loop's thread.
+    using loop_stats_callback = std::function<void(const loop_stats& stats)>;
+
+    // A single libevent event loop, plus the job queue used to post work into it from other
+    // threads.  A Network owns one or more of these; every Endpoint (and everything the Endpoint
+    // owns: connections, streams, datagram handlers, timers) is pinned to exactly one Loop and only
+    // ever touched from that Loop's thread.
+    class Loop
+    {
+      public:
+        // Number of jobs that can be queued in the lock-free job ring before posting falls back to
+        // a mutex-protected overflow queue.
+        static constexpr size_t JOB_RING_SIZE = 1024;
+
+        // Wraps a pre-existing event_base that is driven by some external thread.
+        Loop(std::shared_ptr<::event_base> loop_ptr, std::thread::id loop_thread_id);
+
+        // Creates a new event_base along with a thread to run it.  `index` tells the loops of a
+        // multi-loop Network apart, in logging and in picking each loop's entry of `opts.cpus`.
+        explicit Loop(size_t index = 0, const loop_thread_options& opts = {});
+
+        ~Loop();
+
+        Loop(const Loop&) = delete;
+        Loop& operator=(const Loop&) = delete;
+        Loop(Loop&&) = delete;
+        Loop& operator=(Loop&&) = delete;
+
+        const std::shared_ptr<::event_base>& loop() const { return ev_loop; }
+
+        size_t index() const { return _index; }
+
+        // True if the loop thread is pinned and allocates from its local NUMA node, in which case
+        // things pinned to this loop should allocate their buffers from the loop thread.
+        bool numa_local() const { return _numa_local; }
+
+        // The timer wheel driving the timers of everything pinned to this loop.  Must only be used
+        // from within the loop thread.
+        timer_wheel& timers() { return *wheel; }
+
+        // The packet building space shared by everything pinned to this loop, with room for a full
+        // batch of packets of up to `max_payload` bytes.  Must only be used from within the loop
+        // thread, and not held across returns to the loop.
+        send_scratch& scratch(size_t max_payload = MAX_PMTUD_UDP_PAYLOAD)
+        {
+            if (auto size = max_payload * DATAGRAM_BATCH_SIZE; _scratch->buf.size() < size)
+                _scratch->buf.resize(size);
+            return *_scratch;
+        }
+
+        bool in_event_loop() const;
+
+        /// Posts a function to the event loop, to be called when the event loop is next free.  This
+        /// is lock-free (unless the job ring is full) and, if the loop already has a wakeup pending,
+        /// doesn't touch libevent at all.
+        void call_soon(Job f);
+
+        /// Calls a function: if this is called from within the event loop thread, the function is
+        /// called immediately; otherwise it is forwarded to `call_soon`.
+        template <typename Callable>
+        void call(Callable&& f)
+        {
+            if (in_event_loop())
+                f();
+            else
+                call_soon(std::forward<Callable>(f));
+        }
+
+        /// Calls a function and synchronously obtains its return value.  If called from within the
+        /// event loop, the function is called and returned immediately, otherwise a promise/future
+        /// is used with `call_soon` to block until the event loop comes around and calls the
+        /// function.
+        template <typename Callable, typename Ret = decltype(std::declval<Callable>()())>
+        Ret call_get(Callable&& f)
+        {
+            if (in_event_loop())
+                return f();
+
+            std::promise<Ret> prom;
+            auto fut = prom.get_future();
+            call_soon([&f, &prom] {
+                try
+                {
+                    if constexpr (!std::is_void_v<Ret>)
+                        prom.set_value(f());
+                    else
+                    {
+                        f();
+                        prom.set_value();
+                    }
+                }
+                catch (...)
+                {
+                    prom.set_exception(std::current_exception());
+                }
+            });
+            return fut.get();
+        }
+
+        // Returns a pointer deleter that defers the actual destruction call to this event loop.
+        template <typename T>
+        auto loop_deleter()
+        {
+            return [this](T* ptr) { call([ptr] { delete ptr; }); };
+        }
+
+        // Similar in concept to std::make_shared<T>, but it creates the shared pointer with a
+        // custom deleter that dispatches actual object destruction to this event loop for thread
+        // safety.
+        template <typename T, typename... Args>
+        std::shared_ptr<T> make_shared(Args&&... args)
+        {
+            auto* ptr = new T{std::forward<Args>(args)...};
+            return std::shared_ptr<T>{ptr, loop_deleter<T>()};
+        }
+
+        // Starts collecting loop_stats, reporting them to `cb` every `period`, or stops if `cb` is
+        // empty.  Callbacks and dispatches taking at least `slow` (if non-zero) are logged as
+        // warnings.  Must be called from the loop thread; see Network::enable_loop_stats.
+        void set_stats(loop_stats_callback cb, std::chrono::milliseconds period, std::chrono::microseconds slow);
+
+        // Returns true if this Loop owns (and will join) its own event loop thread.
+        bool owns_thread() const { return loop_thread.has_value(); }
+
+        // Tells the event loop to stop: immediately (without processing pending events) if
+        // `immediate` is true, otherwise once all currently active events have been processed.
+        // Does nothing if this Loop wraps an externally managed event_base.
+        void stop(bool immediate = false);
+
+        // Blocks until the loop thread has exited (if this Loop owns a thread).
+        void join();
+
+      private:
+        size_t _index{0};
+        std::shared_ptr<::event_base> ev_loop;
+        std::optional<std::thread> loop_thread;
+        std::thread::id loop_thread_id;
+
+        // Both allocated on the loop thread (after any pinning), except when wrapping an event_base
+        std::unique_ptr<timer_wheel> wheel;
+        std::unique_ptr<send_scratch> _scratch;
+        bool _numa_local{false};
+
+        // Set while loop stats are enabled; declared after (so destroyed before) the timer wheel
+        std::unique_ptr<loop_instrumentation> _instr;
+        // Replaced collectors, kept alive until the next job queue pass: set_stats runs inside
+        // scoped timers that hold on to the collector it replaces.
+        std::vector<std::unique_ptr<loop_instrumentation>> _retired_instr;
+        // Mirrors whether _instr is set, for call_soon to know whether to timestamp jobs
+        std::atomic<bool> _timing_jobs{false};
+
+        event_ptr job_waker;
+        std::atomic<bool> wake_pending{false};
+        job_ring job_queue{JOB_RING_SIZE};
+
+        // Jobs posted while the ring is full go here instead; while this is non-empty *all* newly
+        // posted jobs go here (rather than the ring) to preserve ordering.
+        std::atomic<bool> overflowing{false};
+        std::queue<Job> overflow_queue;
+        std::mutex overflow_mutex;
+
+        void setup_job_waker();
+
+        void wake();
+
+        void process_job_queue();
+    };
+}  // namespace oxen::quic
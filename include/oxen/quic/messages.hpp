@@ -1,6 +1,12 @@
 #pragma once
 
+#include <deque>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
 #include "address.hpp"
+#include "buffer_pool.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
@@ -8,7 +14,7 @@ namespace oxen::quic
 {
     class DatagramIO;
 
-    enum class dgram { STANDARD = 0, OVERSIZED = 1 };
+    enum class dgram { STANDARD = 0, OVERSIZED = 1, FRAGMENT = 2 };
 
     struct outbound_dgram
     {
@@ -25,7 +31,8 @@ namespace oxen::quic
     struct prepared_datagram
     {
         uint64_t id;                  // internal ID for ngtcp2
-        std::array<uint8_t, 2> dgid;  // optional transmitted ID buffer (for packet splitting)
+        // optional transmitted ID buffer (for packet splitting) or fragment header (for fragmentation)
+        std::array<uint8_t, FRAGMENT_HEADER_SIZE> dgid;
         std::array<ngtcp2_vec, 2> bufs;
         size_t bufs_len;  // either 1 or 2 depending on how much of data is populated
         // is the datagram_storage container empty after sending this payload?
@@ -40,15 +47,12 @@ namespace oxen::quic
         uint16_t id{0};
         // -1 = payload, 1 = addendum
         int8_t part{0};
-        uint16_t data_size{0};
-        std::array<std::byte, MAX_PMTUD_UDP_PAYLOAD> data;
+        pooled_buffer data;
 
         received_datagram() = default;
-        explicit received_datagram(uint16_t dgid, bstring_view d) :
-                id{dgid}, part{(dgid % 4 == 2) ? int8_t{-1} : int8_t{1}}, data_size{static_cast<uint16_t>(d.size())}
-        {
-            std::memcpy(data.data(), d.data(), data_size);
-        }
+        explicit received_datagram(uint16_t dgid, pooled_buffer d) :
+                id{dgid}, part{(dgid % 4 == 2) ? int8_t{-1} : int8_t{1}}, data{std::move(d)}
+        {}
     };
 
     struct datagram_storage
@@ -58,15 +62,21 @@ namespace oxen::quic
         std::optional<bstring_view> payload, addendum;
         std::shared_ptr<void> keep_alive;
         dgram type;
+        // Fragment header to send ahead of the payload (FRAGMENT only)
+        std::array<uint8_t, FRAGMENT_HEADER_SIZE> header{};
+        uint8_t header_len{0};
 
         static datagram_storage make(
                 bstring_view pload, uint16_t d_id, std::shared_ptr<void> data, dgram type, size_t max_size = 0);
 
+        static datagram_storage make_fragment(
+                bstring_view frag, uint16_t msg_id, ustring_view header, std::shared_ptr<void> data);
+
         bool empty() const { return !(payload || addendum); }
 
         outbound_dgram fetch(bool b);
 
-        size_t size() const { return payload->length() + addendum->length(); }
+        size_t size() const { return (payload ? payload->length() : 0) + (addendum ? addendum->length() : 0); }
 
       private:
         explicit datagram_storage(bstring_view pload, uint16_t p_id, std::shared_ptr<void> data) :
@@ -84,6 +94,16 @@ namespace oxen::quic
         {}
     };
 
+    // Reassembly state for split datagrams: holds the first-arriving half of each split datagram
+    // until its other half arrives.  Waiting halves are indexed by their datagram index (the ID
+    // without the split bits) modulo the buffer size, which is divided into four rows; as the
+    // incoming IDs advance, the row two behind the current one is cleared so that halves that
+    // never get matched are eventually dropped.  (See DatagramIO::recv_buffer for details).
+    //
+    // Nothing is allocated until split datagrams actually arrive: the index holds only the
+    // currently waiting halves, and their data lives in the endpoint's shared datagram buffer pool
+    // (and goes back to it when matched or cleared).  The index is allocated from the connection's
+    // memory resource (see opt::memory_resource).
     struct rotating_buffer
     {
         int row{0}, col{0}, last_cleared{-1};
@@ -96,25 +116,100 @@ namespace oxen::quic
         explicit rotating_buffer() = delete;
         explicit rotating_buffer(DatagramIO& _d);
 
-        std::array<std::vector<std::unique_ptr<received_datagram>>, 4> buf;
-
         std::optional<bstring> receive(bstring_view data, uint16_t dgid);
         void clear_row(int index);
         int datagrams_stored() const;
+
+        // Approximate memory currently held by the buffer, including the waiting halves' data
+        size_t resident_bytes() const;
+
+        // Drops all waiting halves and frees the index memory (for a hibernating connection)
+        void release();
+
+      private:
+        // Waiting halves, keyed by datagram index modulo bufsize
+        std::pmr::unordered_map<uint16_t, received_datagram> held;
+        // Keys stored into each row since it was last cleared (some of which might have been
+        // matched and removed since)
+        std::array<std::pmr::vector<uint16_t>, 4> row_keys;
     };
 
+    // Reassembly state for fragmented datagrams (see opt::fragment_datagrams).  Fragments are
+    // held, keyed by message ID, until all of a datagram's data fragments have arrived -- or all
+    // but one of them plus the parity fragment, from which the missing one gets rebuilt.  At most
+    // `max_pending` datagrams are tracked at once, dropping the oldest when a new one arrives.
+    //
+    // Completed datagrams stay tracked (without their data) until they age out in the same way, so
+    // that late fragments of them (typically a parity fragment that wasn't needed) get ignored
+    // rather than starting a new datagram that can never complete.
+    //
+    // Like rotating_buffer, the index is allocated from the connection's memory resource.
+    struct fragment_buffer
+    {
+        DatagramIO& datagram;
+        const size_t max_pending;
+
+        explicit fragment_buffer() = delete;
+        explicit fragment_buffer(DatagramIO& _d, size_t max_pending);
+
+        // Takes a received fragment (without its header); returns the reassembled datagram once
+        // it is complete.  `index` is the fragment index, which is `count` for the parity fragment.
+        std::optional<bstring> receive(bstring_view data, uint16_t msg_id, uint8_t index, uint8_t count);
+
+        // Number of datagrams waiting on more fragments
+        int datagrams_stored() const;
+
+        // Number of datagrams that have been rebuilt from a parity fragment
+        size_t datagrams_recovered() const { return recovered; }
+
+        // Approximate memory currently held by the buffer, including the held fragments' data
+        size_t resident_bytes() const;
+
+        // Drops all held fragments and frees the index memory (for a hibernating connection)
+        void release();
+
+      private:
+        struct partial
+        {
+            uint8_t count{0};
+            uint8_t have{0};
+            bool done{false};
+            uint64_t received{0};  // bitmask of the data fragments we have
+            std::vector<pooled_buffer> frags;
+            pooled_buffer parity;
+        };
+
+        std::pmr::unordered_map<uint16_t, partial> pending;
+        // Message IDs in `pending`, oldest first
+        std::pmr::deque<uint16_t> order;
+        size_t recovered{0};
+
+        std::optional<bstring> assemble(partial& p);
+    };
+
+    // The datagram send queue, allocated from the given memory resource (see
+    // opt::memory_resource), which must outlive it.
     struct buffer_que
     {
-        std::deque<datagram_storage> buf{};
+        std::pmr::deque<datagram_storage> buf;
+
+        explicit buffer_que(std::pmr::memory_resource* mem = std::pmr::new_delete_resource()) : buf{mem} {}
 
         bool empty() const { return buf.empty(); }
         size_t size() const { return buf.size(); }
+        // Total payload bytes of the queued datagrams
+        size_t bytes() const { return _bytes; }
 
         void drop_front(bool b);
 
         prepared_datagram prepare(bool b, int is_splitting);
 
         void emplace(bstring_view pload, uint16_t p_id, std::shared_ptr<void> data, dgram type, size_t max_size = 0);
+
+        void emplace_fragment(bstring_view frag, uint16_t msg_id, ustring_view header, std::shared_ptr<void> data);
+
+      private:
+        size_t _bytes{0};
     };
 
 }  // namespace oxen::quic
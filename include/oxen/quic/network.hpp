@@ -7,22 +7,49 @@
 #include <future>
 #include <memory>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "context.hpp"
 #include "crypto.hpp"
+#include "loop.hpp"
 #include "utils.hpp"
 
 namespace oxen::quic
 {
     class Endpoint;
 
-    class Network
+    // Describes the position of an endpoint within an SO_REUSEPORT endpoint group; see
+    // Network::endpoint_group().
+    struct endpoint_group_member final
     {
-        using Job = std::function<void()>;
+        Loop& loop;
+        size_t index;
+        size_t size;
+        // Default static secret shared by all group members; all members must use the same secret
+        // so that retry and stateless reset tokens issued by one member verify on the others.
+        ustring static_secret;
+    };
 
+    class Network
+    {
       public:
         Network(std::shared_ptr<::event_base> loop_ptr, std::thread::id loop_thread_id);
+
+        // Creates a network with a single, internally managed event loop thread.
         Network();
+
+        // Creates a network with a pool of `loop_threads` internally managed event loop threads.
+        // Each endpoint created by this network is pinned to one of these loops (assigned in
+        // round-robin order); all of the endpoint's connections, streams and callbacks run on that
+        // loop's thread.  Distinct endpoints can thus be processed concurrently on different cores.
+        // Passing 0 uses `std::thread::hardware_concurrency()` loops.
+        explicit Network(size_t loop_threads);
+
+        // As above, with the loop threads pinned to CPUs, set up for NUMA-local allocation, and/or
+        // run at real-time priority as given by `opts`.
+        Network(size_t loop_threads, loop_thread_options opts);
+
         ~Network();
 
         template <typename... Opt>
@@ -34,14 +61,74 @@ namespace oxen::quic
             return *it;
         }
 
+        // Creates a group of `count` endpoints all bound to the same local address using
+        // SO_REUSEPORT, each pinned to a different event loop (wrapping around if `count` exceeds
+        // the number of loops; 0 means one endpoint per loop).  The kernel steers each incoming
+        // packet to the group member owning the destination connection ID (via a routing byte that
+        // the members embed in every CID they issue), so that a single listening port can be
+        // served by all loops in parallel without any cross-thread hand-off.  New inbound
+        // connections land on whichever member the client's random initial DCID steers to.
+        //
+        // The given options are applied to every member; `listen()` must be called on each member
+        // to accept connections.  Requires Linux; throws if reuseport steering is unavailable.
+        template <typename... Opt>
+        std::vector<std::shared_ptr<Endpoint>> endpoint_group(const Address& local_addr, size_t count, Opt&&... opts)
+        {
+            if (count == 0)
+                count = loops.size();
+            if (count > 256)
+                throw std::invalid_argument{"Endpoint groups are limited to 256 members"};
+
+            auto secret = make_group_secret();
+            std::vector<std::shared_ptr<Endpoint>> group;
+            group.reserve(count);
+            Address bind_addr = local_addr;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto& ep = group.emplace_back(std::make_shared<Endpoint>(
+                        *this, endpoint_group_member{*loops[i % loops.size()], i, count, secret}, bind_addr, opts...));
+                endpoint_map.insert(ep);
+                // Subsequent members bind to whatever port the first one actually got
+                bind_addr = ep->local();
+            }
+
+            return group;
+        }
+
         void set_shutdown_immediate(bool b = true) { shutdown_immediate = b; }
 
+        // Caps how long the graceful shutdown on destruction spends closing connections: all the
+        // endpoints close their connections concurrently (see Endpoint::close_conns), and whatever
+        // connections are still open once `timeout` has passed are dropped without sending close
+        // packets.  0 (the default) means no limit.
+        void set_shutdown_timeout(std::chrono::milliseconds timeout) { shutdown_timeout = timeout; }
+
+        // Enables event loop instrumentation: every `period`, each of the network's loops calls `cb`
+        // (from the loop's own thread) with its loop_stats for that period: a histogram of the time
+        // spent in each dispatch from the loop, job queue depths and wait times, and the time spent
+        // in each type of user callback.  If `slow` is non-zero, every callback or dispatch that
+        // takes at least that long is also logged as a warning, to track down whatever is stalling
+        // the loop.  Calling this again replaces the previous settings (and starts a new period).
+        //
+        // While disabled (the default) this costs nothing beyond a thread-local pointer check.
+        void enable_loop_stats(
+                loop_stats_callback cb,
+                std::chrono::milliseconds period = 1s,
+                std::chrono::microseconds slow = std::chrono::microseconds{0});
+
+        // Stops loop instrumentation.  Stats for partial periods are not reported.
+        void disable_loop_stats();
+
+        // Returns the number of event loops (and thus loop threads) this network is running.
+        size_t num_loops() const { return loops.size(); }
+
         // Returns a pointer deleter that defers the actual destruction call to this network
-        // object's event loop.
+        // object's (primary) event loop.
         template <typename T>
         auto network_deleter()
         {
-            return [this](T* ptr) { call([ptr] { delete ptr; }); };
+            return primary_loop().loop_deleter<T>();
         }
 
         // Similar in concept to std::make_shared<T>, but it creates the shared pointer with a
@@ -50,80 +137,55 @@ namespace oxen::quic
         template <typename T, typename... Args>
         std::shared_ptr<T> make_shared(Args&&... args)
         {
-            auto* ptr = new T{std::forward<Args>(args)...};
-            return std::shared_ptr<T>{ptr, network_deleter<T>()};
+            return primary_loop().make_shared<T>(std::forward<Args>(args)...);
         }
 
       private:
         std::atomic<bool> running{false};
         std::atomic<bool> shutdown_immediate{false};
-        std::shared_ptr<::event_base> ev_loop;
-        std::optional<std::thread> loop_thread;
-        std::thread::id loop_thread_id;
+        std::chrono::milliseconds shutdown_timeout{0};
 
-        std::unordered_set<std::shared_ptr<Endpoint>> endpoint_map;
+        // The first loop is the "primary" loop, used for Network-level calls; endpoints are
+        // distributed across all of them.
+        std::vector<std::unique_ptr<Loop>> loops;
+        std::atomic<size_t> next_loop{0};
 
-        event_ptr job_waker;
-        std::queue<Job> job_queue;
-        std::mutex job_queue_mutex;
+        std::unordered_set<std::shared_ptr<Endpoint>> endpoint_map;
 
         friend class Endpoint;
         friend class Connection;
         friend class Stream;
 
-        const std::shared_ptr<::event_base>& loop() const { return ev_loop; }
+        Loop& primary_loop() const { return *loops.front(); }
+
+        // Returns the loop that the next new endpoint should be pinned to.
+        Loop& assign_loop();
 
-        void setup_job_waker();
+        static ustring make_group_secret();
 
-        bool in_event_loop() const;
+        const std::shared_ptr<::event_base>& loop() const { return primary_loop().loop(); }
 
-        /// Posts a function to the event loop, to be called when the event loop is next free.
-        void call_soon(std::function<void()> f);
+        bool in_event_loop() const { return primary_loop().in_event_loop(); }
 
-        /// Calls a function: if this is called from within the event loop thread, the function is
-        /// called immediately; otherwise it is forwarded to `call_soon`.
+        /// Posts a function to the primary event loop, to be called when the event loop is next
+        /// free.
+        void call_soon(Job f) { primary_loop().call_soon(std::move(f)); }
+
+        /// Calls a function: if this is called from within the primary event loop thread, the
+        /// function is called immediately; otherwise it is forwarded to `call_soon`.
         template <typename Callable>
         void call(Callable&& f)
         {
-            if (in_event_loop())
-                f();
-            else
-                call_soon(std::forward<Callable>(f));
+            primary_loop().call(std::forward<Callable>(f));
         }
 
-        /// Calls a function and synchronously obtains its return value.  If called from within the
-        /// event loop, the function is called and returned immediately, otherwise a promise/future
-        /// is used with `call_soon` to block until the event loop comes around and calls the
-        /// function.
+        /// Calls a function on the primary event loop and synchronously obtains its return value.
         template <typename Callable, typename Ret = decltype(std::declval<Callable>()())>
         Ret call_get(Callable&& f)
         {
-            if (in_event_loop())
-                return f();
-
-            std::promise<Ret> prom;
-            auto fut = prom.get_future();
-            call_soon([&f, &prom] {
-                try
-                {
-                    if constexpr (!std::is_void_v<Ret>)
-                        prom.set_value(f());
-                    else
-                    {
-                        f();
-                        prom.set_value();
-                    }
-                }
-                catch (...)
-                {
-                    prom.set_exception(std::current_exception());
-                }
-            });
-            return fut.get();
+            return primary_loop().call_get(std::forward<Callable>(f));
         }
 
-        void process_job_queue();
-
         void close_gracefully();
 
         void close_immediate();
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
 
 #include "address.hpp"
+#include "cid_generator.hpp"
 #include "crypto.hpp"
+#include "qlog.hpp"
+#include "session_cache.hpp"
 #include "types.hpp"
 
+struct event_base;
+
+namespace oxen::quic
+{
+    class PacketSink;
+    class PacketTransport;
+}  // namespace oxen::quic
+
 namespace oxen::quic::opt
 {
     using namespace std::chrono_literals;
@@ -32,6 +46,38 @@ namespace oxen::quic::opt
         explicit keep_alive(std::chrono::milliseconds val) : time{val} {}
     };
 
+    // If non-zero, a connection that has had no application activity -- no open streams, and no
+    // stream data or datagrams sent or received -- for this long (checked once per period, so it
+    // can take up to twice as long) "hibernates": it gives up the memory it only needs while
+    // active, such as its packet I/O event, datagram reassembly state, and spare stream table
+    // storage.  These are recreated as needed on the next send or received packet, so hibernation
+    // is invisible to the application.  Keep-alive PINGs (see keep_alive) are not activity, so a
+    // connection kept open only by keep-alives stays hibernating.  (The ngtcp2 and GnuTLS state of
+    // the connection is not affected).
+    struct hibernate
+    {
+        std::chrono::milliseconds idle{0ms};
+        hibernate() = default;
+        explicit hibernate(std::chrono::milliseconds val) : idle{val} {}
+    };
+
+    // Enables qlog tracing of connections: ngtcp2's qlog events for each connection are written,
+    // asynchronously (see qlog_writer), to a `.sqlog` file in the given directory or passed to a
+    // callback.  Pass the same writer to several connect/listen calls (or endpoints) to share its
+    // output thread.  This is cheap enough to leave on in production, unlike trace logging.
+    struct qlog
+    {
+        std::shared_ptr<qlog_writer> writer;
+
+        explicit qlog(std::shared_ptr<qlog_writer> w) : writer{std::move(w)}
+        {
+            if (!writer)
+                throw std::invalid_argument{"opt::qlog requires a qlog_writer"};
+        }
+        explicit qlog(std::filesystem::path directory) : writer{std::make_shared<qlog_writer>(std::move(directory))} {}
+        explicit qlog(qlog_callback callback) : writer{std::make_shared<qlog_writer>(std::move(callback))} {}
+    };
+
     // Can be used to override the default (30s) maximum idle timeout for a connection.  Note that
     // this is negotiated during connection establishment, and the lower value advertised by each
     // side will be used for the connection.  Can be 0 to disable idle timeout entirely, but such an
@@ -44,6 +90,26 @@ namespace oxen::quic::opt
         explicit idle_timeout(std::chrono::milliseconds val) : timeout{val} {}
     };
 
+    // Sets the receive flow control windows advertised to the remote: how much data it may send on
+    // each stream, and on the connection as a whole, beyond what we have consumed.  For streams in
+    // manual consumption mode (see Stream::set_manual_consume) this bounds how much received but
+    // unconsumed data can pile up.  A connection window of 0 uses the default or, if larger, the
+    // stream window.  The windows given here are also the most they grow to (see
+    // max_receive_window), unless larger maximums are given with opt::max_receive_window.
+    struct receive_window
+    {
+        uint64_t stream{DEFAULT_STREAM_RECV_WINDOW};
+        uint64_t connection{DEFAULT_CONN_RECV_WINDOW};
+        receive_window() = default;
+        explicit receive_window(uint64_t stream_window, uint64_t connection_window = 0) :
+                stream{stream_window},
+                connection{connection_window ? connection_window : std::max(DEFAULT_CONN_RECV_WINDOW, stream_window)}
+        {
+            if (stream == 0)
+                throw std::invalid_argument{"receive_window: stream window must be non-zero"};
+        }
+    };
+
     /// This can be initialized a few different ways. Simply passing a default constructed struct
     /// to Network::Endpoint(...) will enable datagrams without packet-splitting. From there, pass
     /// `Splitting::ACTIVE` to the constructor to enable packet-splitting.
@@ -53,13 +119,16 @@ namespace oxen::quic::opt
     /// must be perfectly divisible by 4
     ///
     /// In some use cases, the user may want the receive data as a string view or a string literal.
-    /// The default is string literal; setting
+    /// The default is string literal (via a dgram_data_callback); passing a dgram_data_view_callback
+    /// or a dgram_data_pooled_callback to the endpoint instead avoids allocating a string for each
+    /// received datagram.
     ///
     /// The max size of a transmittable datagram can be queried directly from connection_interface::
     /// get_max_datagram_size(). At connection initialization, ngtcp2 will default this value to 1200.
     /// The actual value is negotiated upwards via path discovery, reaching a theoretical maximum of
-    /// NGTCP2_MAX_PMTUD_UDP_PAYLOAD_SIZE (1452), or near it, per datagram. Please note that enabling
-    /// datagram splitting will double whatever value is returned.
+    /// NGTCP2_MAX_PMTUD_UDP_PAYLOAD_SIZE (1452), or near it, per datagram (or up to the endpoint's
+    /// opt::max_udp_payload, if raised). Please note that enabling datagram splitting will double
+    /// whatever value is returned.
     ///
     /// Note: this setting CANNOT be changed for an endpoint after creation, it must be
     /// destroyed and re-initialized with the desired settings.
@@ -84,6 +153,42 @@ namespace oxen::quic::opt
         }
     };
 
+    /// Enables datagrams with N-way fragmentation, as an alternative to the two-way packet splitting
+    /// of `enable_datagrams{Splitting::ACTIVE}`: a datagram too large for a single packet is split
+    /// into as many fragments as it needs, up to `max_fragments`, each of which is sent as its own
+    /// QUIC datagram and reassembled by the receiver.  The largest sendable datagram is thus about
+    /// `max_fragments` times the path MTU.  Each fragment carries a 4-byte header; datagrams that
+    /// fit in a single packet are sent whole with just a 1-byte header.
+    ///
+    /// With `fec` enabled each fragmented datagram is followed by one XOR parity fragment, which
+    /// lets the receiver rebuild the datagram when any single one of its fragments is lost (at the
+    /// cost of one extra packet per fragmented datagram).
+    ///
+    /// `max_pending` limits how many partially received datagrams each connection holds at once;
+    /// beyond that the oldest incomplete datagram is dropped.
+    ///
+    /// Both sides of a connection must use the same datagram mode.  Like enable_datagrams, this
+    /// CANNOT be changed for an endpoint after creation; if both are given the last one is used.
+    struct fragment_datagrams
+    {
+        int max_fragments{DEFAULT_DATAGRAM_FRAGMENTS};
+        bool fec{false};
+        int max_pending{DEFAULT_FRAGMENTS_PENDING};
+
+        explicit fragment_datagrams(
+                int max_fragments = DEFAULT_DATAGRAM_FRAGMENTS,
+                bool fec = false,
+                int max_pending = DEFAULT_FRAGMENTS_PENDING) :
+                max_fragments{max_fragments}, fec{fec}, max_pending{max_pending}
+        {
+            if (max_fragments < 1 || max_fragments > MAX_DATAGRAM_FRAGMENTS)
+                throw std::out_of_range{
+                        "max_fragments must be between 1 and " + std::to_string(MAX_DATAGRAM_FRAGMENTS)};
+            if (max_pending < 1)
+                throw std::out_of_range{"max_pending must be positive"};
+        }
+    };
+
     // supported ALPNs for outbound connections
     struct outbound_alpns
     {
@@ -98,6 +203,154 @@ namespace oxen::quic::opt
         explicit inbound_alpns(std::vector<ustring> alpns = {}) : alpns{std::move(alpns)} {}
     };
 
+    // Selects the congestion controller for a connection's sending (CUBIC by default) and the RTT
+    // it assumes before the first sample; a non-zero `initial_rtt` replaces ngtcp2's default (333ms)
+    // and sets how soon early packets are deemed lost, so should be at least the expected RTT.
+    // BBR paces to its bandwidth estimate rather than reacting to every loss, so it usually suits
+    // long, fast links with some random loss much better than CUBIC does (see also
+    // max_receive_window for such links).  Only the sending side's controller matters.
+    struct congestion_control
+    {
+        CongestionControl algorithm{CongestionControl::CUBIC};
+        std::chrono::microseconds initial_rtt{0};
+        congestion_control() = default;
+        explicit congestion_control(CongestionControl algo, std::chrono::microseconds initial_rtt = 0us) :
+                algorithm{algo}, initial_rtt{initial_rtt}
+        {}
+    };
+
+    // How a connection divides its sending between datagrams and stream data when it has both to
+    // send, so that latency-sensitive datagrams don't queue behind bulk stream data (or the other
+    // way around):
+    //  - ROUND_ROBIN (the default): the datagram queue takes turns with the streams of the same
+    //    urgency (see Stream::set_priority; datagrams have the default urgency), a packet per turn.
+    //  - STRICT: queued datagrams always go out ahead of any stream data, so that they only ever
+    //    wait on the congestion window; a steady flood of datagrams starves the streams, though.
+    //  - WEIGHTED: datagrams get `weight` (between 0 and 1) of the packets, and the streams the
+    //    rest, for as long as both have something to send; either gets all of the packets while
+    //    the other has nothing.
+    //
+    // Independently of that, `datagram_rate` and `stream_rate` cap the bytes per second of
+    // datagram and stream data sent (0 for no cap).  A class that reaches its cap waits, leaving
+    // the packets to the other one, until the cap allows more; up to 20ms worth of a cap can go
+    // out in a burst after a quiet spell.
+    struct send_share
+    {
+        DatagramShare policy{DatagramShare::ROUND_ROBIN};
+        double weight{0.5};
+        uint64_t datagram_rate{0};
+        uint64_t stream_rate{0};
+
+        send_share() = default;
+        explicit send_share(
+                DatagramShare policy, double weight = 0.5, uint64_t datagram_rate = 0, uint64_t stream_rate = 0) :
+                policy{policy}, weight{weight}, datagram_rate{datagram_rate}, stream_rate{stream_rate}
+        {
+            if (!(weight >= 0 && weight <= 1))
+                throw std::invalid_argument{"send_share: weight must be between 0 and 1"};
+        }
+    };
+
+    // Limits how large the receive windows may grow.  ngtcp2 grows a window (starting from the
+    // receive_window value) when the remote is sending fast enough to be limited by it, up to these
+    // maximums; the defaults of 16MiB per stream and 24MiB per connection cap a single stream at
+    // about 16MiB per RTT (roughly 670Mbit/s at a 200ms RTT), so faster links with long RTTs need
+    // larger values: at least the bandwidth-delay product of the link.  0 leaves a default alone
+    // (which, if opt::receive_window is given, is that window: explicit windows don't grow).
+    struct max_receive_window
+    {
+        uint64_t stream{0};
+        uint64_t connection{0};
+        max_receive_window() = default;
+        explicit max_receive_window(uint64_t stream_window, uint64_t connection_window = 0) :
+                stream{stream_window}, connection{connection_window ? connection_window : stream_window}
+        {}
+    };
+
+    // Settings for an endpoint's UDP socket (with opt::packet_transport, these are passed on to the
+    // transport factory, which may or may not use them).  The receive
+    // buffer is what absorbs bursts of incoming packets while the event loop is busy; when it is
+    // full the kernel drops packets, which on Linux are counted in the endpoint's socket stats
+    // (`receive_dropped`).  A buffer size of 0 leaves the system default (around 200kB on Linux).
+    // Sizes above the system maximum (net.core.rmem_max/wmem_max on Linux) need CAP_NET_ADMIN; an
+    // endpoint that doesn't have it gets the maximum instead, with a warning.
+    //
+    // If non-zero, `busy_poll` sets SO_BUSY_POLL (Linux only): reads that find the socket empty
+    // poll the network device's queue for up to that long, trading CPU for lower latency.  Raising
+    // it above net.core.busy_read also needs CAP_NET_ADMIN.
+    //
+    // `rx_timestamps` (Linux only) has the kernel timestamp each packet as it arrives
+    // (SO_TIMESTAMPING), and that time, rather than the time the event loop gets around to reading
+    // the packet, is what connections hand to ngtcp2: RTT samples then don't include our own
+    // loop delays.  How long packets waited is exported in the socket stats (`receive_delay_us`).
+    // HARDWARE uses the NIC's timestamps where it provides them (falling back to the kernel's
+    // otherwise); that needs hardware timestamping turned on for the interface (e.g. with
+    // hwstamp_ctl, which needs CAP_NET_ADMIN) and its clock synchronized to the system clock (e.g.
+    // with phc2sys).
+    struct socket_options
+    {
+        size_t receive_buffer{0};
+        size_t send_buffer{0};
+        std::chrono::microseconds busy_poll{0};
+        RxTimestamps rx_timestamps{RxTimestamps::NONE};
+        socket_options() = default;
+        explicit socket_options(size_t receive_buffer, size_t send_buffer = 0, std::chrono::microseconds busy_poll = 0us) :
+                receive_buffer{receive_buffer}, send_buffer{send_buffer}, busy_poll{busy_poll}
+        {}
+    };
+
+    // Raises the largest UDP payload an endpoint's connections will send above the default
+    // MAX_PMTUD_UDP_PAYLOAD (1452), for networks with a larger MTU such as 9000-byte jumbo frame
+    // datacenter networks, or loopback.  Path MTU discovery then probes up to this size (through
+    // the common MTUs in between), so connections over paths that can't carry it still settle on
+    // whatever they can.  The endpoint's packet and receive buffers are sized to match.  Must be
+    // between MIN_UDP_PAYLOAD (1200) and MAX_JUMBO_UDP_PAYLOAD (8952).
+    //
+    // An endpoint advertises its max to its peers (as its max_udp_payload_size transport parameter)
+    // and they never send it anything larger, so each direction of a connection uses packets of up
+    // to the smaller of the two ends' settings: both ends have to set this for large packets to be
+    // used in either direction.
+    struct max_udp_payload
+    {
+        size_t size{MAX_PMTUD_UDP_PAYLOAD};
+        explicit max_udp_payload(size_t size) : size{size} {}
+    };
+
+    // Has the library-internal buffers of an endpoint's connections allocated from a
+    // std::pmr::memory_resource instead of the global heap: stream send queues (and the arena
+    // chunks small writes are coalesced into), datagram send queues, and split and fragmented
+    // datagram reassembly state.  These are only ever allocated and freed on the endpoint's loop
+    // thread, so the resource doesn't need to be synchronized (e.g. an
+    // std::pmr::unsynchronized_pool_resource per loop).
+    //
+    // Either the one resource is used by all of the endpoint's connections, or `per_connection` is
+    // called (on the loop thread) to make a new resource for each connection, which is released
+    // once the connection and all of its streams are gone; that allows e.g. a monotonic arena for
+    // short-lived connections, freed all at once.  (A monotonic resource never reuses freed
+    // memory, though, so long-lived connections with a lot of traffic want a pool).
+    //
+    // Data passed to send() and received data handed to callbacks are unaffected: those are
+    // allocated by (and freed on) the application's own threads.
+    struct memory_resource
+    {
+        using factory_t = std::function<std::shared_ptr<std::pmr::memory_resource>()>;
+
+        factory_t per_connection;
+
+        explicit memory_resource(std::shared_ptr<std::pmr::memory_resource> shared)
+        {
+            if (!shared)
+                throw std::invalid_argument{"opt::memory_resource requires a memory resource"};
+            per_connection = [r = std::move(shared)] { return r; };
+        }
+
+        explicit memory_resource(factory_t per_connection) : per_connection{std::move(per_connection)}
+        {
+            if (!this->per_connection)
+                throw std::invalid_argument{"opt::memory_resource requires a memory resource factory"};
+        }
+    };
+
     struct handshake_timeout
     {
         std::chrono::nanoseconds timeout;
@@ -123,4 +376,135 @@ namespace oxen::quic::opt
         }
     };
 
+    // Enables 0-RTT session resumption for an endpoint's outbound connections: session tickets
+    // received from remotes are stored in the given cache (keyed by remote pubkey), and later
+    // connections to a remote with a stored ticket resume that session, sending any stream data
+    // queued before the handshake completes as early (0-RTT) data.  If the remote rejects the early
+    // data, the streams it was sent on are closed.  Endpoints always issue tickets to inbound
+    // connections, so this is only needed on the connecting side.
+    struct session_resumption
+    {
+        std::shared_ptr<session_cache> cache;
+        explicit session_resumption(std::shared_ptr<session_cache> c = std::make_shared<memory_session_cache>()) :
+                cache{std::move(c)}
+        {
+            if (!cache)
+                throw std::invalid_argument{"opt::session_resumption requires a session cache"};
+        }
+    };
+
+    // Controls how an endpoint sheds inbound handshake load, so that a flood of Initial packets
+    // cannot make it allocate a connection (and do TLS work) for each of them.  Endpoints always
+    // apply these limits to inbound connections; the defaults only kick in well above normal
+    // load.
+    //
+    // - Once `retry_pending` handshakes are in progress, or new connection attempts arrive faster
+    //   than `retry_rate` per second, clients that have not yet proven their address get a
+    //   stateless Retry (an address validation token signed with the endpoint's static secret)
+    //   instead of a connection; only when they come back with the token is anything allocated.
+    // - Beyond `max_pending` handshakes in progress, Initials are dropped outright.
+    // - If `prefix_rate` is non-zero, each source prefix (/24 for IPv4, /48 for IPv6) may make at
+    //   most that many connection attempts per second (with bursts of up to `prefix_burst`);
+    //   Initials beyond that are dropped.
+    //
+    // See Endpoint::handshake_admission_stats for counters of the shedding.
+    struct handshake_admission
+    {
+        size_t retry_pending;
+        double retry_rate;
+        size_t max_pending;
+        double prefix_rate;
+        double prefix_burst;
+
+        explicit handshake_admission(
+                size_t retry_pending = 256,
+                double retry_rate = 1000,
+                size_t max_pending = 4096,
+                double prefix_rate = 0,
+                double prefix_burst = 0) :
+                retry_pending{retry_pending},
+                retry_rate{retry_rate},
+                max_pending{max_pending},
+                prefix_rate{prefix_rate},
+                prefix_burst{prefix_burst > 0 ? prefix_burst : prefix_rate}
+        {
+            if (max_pending < 1 || retry_rate <= 0 || prefix_rate < 0)
+                throw std::invalid_argument{"opt::handshake_admission: invalid limits"};
+        }
+    };
+
+    // Makes an endpoint issue the connection IDs produced by the given generator (for example a
+    // quic_lb_cid_generator, for servers behind a QUIC-LB load balancer) rather than random ones.
+    // This applies to the CIDs of both its inbound and outbound connections, and to the CIDs it
+    // sends in Retry packets.  Cannot be used on members of an endpoint group, whose CIDs carry a
+    // routing byte of their own.
+    struct connection_id_generator
+    {
+        std::shared_ptr<cid_generator> generator;
+        explicit connection_id_generator(std::shared_ptr<cid_generator> g) : generator{std::move(g)}
+        {
+            if (!generator || generator->length() < 1 || generator->length() > NGTCP2_MAX_CIDLEN)
+                throw std::invalid_argument{"opt::connection_id_generator requires a generator of 1- to 20-byte CIDs"};
+        }
+    };
+
+    // Makes an endpoint reuse its connections: `connect` to a remote pubkey that the endpoint
+    // already has an outbound connection to (established or still handshaking) returns that
+    // connection rather than making a new one, so that concurrent connects to the same remote
+    // share a single handshake.  Connections are pooled by remote pubkey alone, so the address and
+    // options (TLS credentials, callbacks, ...) passed to such a `connect` are ignored.  Closing
+    // connections are never reused.
+    //
+    // Given the endpoint's own pubkey, this also deduplicates the connections two endpoints make
+    // to each other at the same time: inbound connections are pooled too, once their handshake
+    // completes, and of an inbound and an outbound connection to the same remote, the one initiated
+    // by the side with the (bytewise) lower pubkey is kept and the other is closed with
+    // CONN_DUPLICATE.  Both sides make the same choice, so exactly one connection survives, as long
+    // as both endpoints enable this.
+    struct connection_pooling
+    {
+        std::optional<ustring> local_key;
+
+        connection_pooling() = default;
+        explicit connection_pooling(ustring_view local_pubkey) : local_key{local_pubkey}
+        {
+            if (local_key->empty())
+                throw std::invalid_argument{"opt::connection_pooling: local pubkey cannot be empty"};
+        }
+        explicit connection_pooling(std::string_view local_pubkey) : connection_pooling{to_usv(local_pubkey)} {}
+    };
+
+    // Runs an endpoint over something other than a UDP socket: `factory` is invoked (on the
+    // endpoint's loop, while the endpoint is being constructed) with the loop, the endpoint's bind
+    // address, the sink to deliver received packets to, and the endpoint's opt::socket_options
+    // and opt::max_udp_payload size (for transports with a socket of their own), and returns the
+    // transport to use in place of a UDPSocket.  A factory can also leave out the last two.  See
+    // SimulatedNetwork::transport() for an in-memory network.  Cannot be used by members of an
+    // endpoint group, which depend on SO_REUSEPORT sockets.
+    struct packet_transport
+    {
+        using factory_t = std::function<std::unique_ptr<PacketTransport>(
+                event_base*, const Address&, PacketSink&, const socket_options&, size_t max_udp_payload)>;
+        using simple_factory_t = std::function<std::unique_ptr<PacketTransport>(event_base*, const Address&, PacketSink&)>;
+
+        factory_t factory;
+        explicit packet_transport(factory_t f) : factory{std::move(f)}
+        {
+            if (!factory)
+                throw std::invalid_argument{"opt::packet_transport requires a transport factory"};
+        }
+        explicit packet_transport(simple_factory_t f) : packet_transport{ignoring_socket_settings(std::move(f))} {}
+
+      private:
+        static factory_t ignoring_socket_settings(simple_factory_t f)
+        {
+            if (!f)
+                return nullptr;
+            return [f = std::move(f)](
+                           event_base* loop, const Address& addr, PacketSink& sink, const socket_options&, size_t) {
+                return f(loop, addr, sink);
+            };
+        }
+    };
+
 }  // namespace oxen::quic::opt
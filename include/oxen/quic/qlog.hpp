@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "jobs.hpp"
+
+namespace oxen::quic
+{
+    // Receives qlog output when a qlog_writer is constructed with a callback rather than a
+    // directory.  `trace_id` identifies the connection (see qlog_writer); `data` is the next piece
+    // of its JSON-SEQ qlog trace, and `fin` is set on the last call for the trace (which may have
+    // empty data).  Called from the writer's background thread.
+    using qlog_callback = std::function<void(std::string_view trace_id, std::string_view data, bool fin)>;
+
+    class qlog_writer;
+    class qlog_trace;
+
+    namespace detail
+    {
+        // What a qlog_writer's background thread works with.  The thread (and any trace with output
+        // still queued) shares ownership of this, so that the thread can finish writing everything
+        // out after the qlog_writer itself is gone.
+        struct qlog_output
+        {
+            qlog_output(std::filesystem::path directory, qlog_callback callback, size_t ring_size) :
+                    directory{std::move(directory)}, callback{std::move(callback)}, ring{ring_size}
+            {}
+
+            const std::filesystem::path directory;
+            const qlog_callback callback;
+
+            job_ring ring;
+            std::atomic<uint64_t> dropped{0};
+
+            std::atomic<bool> stopping{false};
+            std::mutex sleep_mutex;
+            std::condition_variable sleep_cv;
+
+            // The writer thread: outputs queued chunks until stopped, then drains the rest
+            void run();
+            // Writer thread: outputs a chunk of a trace
+            void write(qlog_trace& trace, std::string_view data, bool fin);
+        };
+    }  // namespace detail
+
+    // The qlog output of one connection.  ngtcp2's serialized events are gathered into chunks on
+    // the connection's event loop thread and handed to the writer's thread for output.
+    class qlog_trace : public std::enable_shared_from_this<qlog_trace>
+    {
+      public:
+        qlog_trace(std::shared_ptr<detail::qlog_output> output, std::string id) :
+                output{std::move(output)}, id{std::move(id)}
+        {}
+        ~qlog_trace();
+
+        qlog_trace(const qlog_trace&) = delete;
+        qlog_trace& operator=(const qlog_trace&) = delete;
+
+        const std::string& trace_id() const { return id; }
+
+        // Appends ngtcp2 qlog output; called from the connection's event loop thread.
+        void write(const void* data, size_t len, bool fin);
+
+        // Submits whatever is left as the end of the trace (if ngtcp2 has not already ended it).
+        void finish() { write(nullptr, 0, true); }
+
+      private:
+        friend struct detail::qlog_output;
+
+        const std::shared_ptr<detail::qlog_output> output;
+        const std::string id;
+
+        // Output not yet submitted to the writer; only accessed from the event loop thread
+        std::string pending;
+        bool finished{false};
+
+        // Open output file, in directory mode; only accessed from the writer thread
+        std::FILE* file{nullptr};
+
+        void submit(bool fin);
+    };
+
+    // Asynchronous qlog (draft-ietf-quic-qlog) output for connections created with opt::qlog.
+    // Event loops never block on qlog output: each connection collects ngtcp2's serialized events
+    // and passes them on in chunks, through a lock-free ring, to a background thread that writes
+    // them out.  If the writer falls so far behind that the ring fills up, chunks are dropped (and
+    // counted, see `dropped()`) rather than stalling the loop; a trace with dropped chunks will
+    // have a corrupt record at each gap.
+    //
+    // Traces are identified by the hex original destination connection ID of the connection
+    // followed by "_client" or "_server", which matches the ODCID that ngtcp2 writes into the
+    // trace (and is the same on both ends of a connection).
+    //
+    // One writer (and thread) can be shared by any number of connections, endpoints, and Networks.
+    // Destroying the writer (which happens when the last connection or context using it goes
+    // away, often on an event loop thread) doesn't wait for the thread: it is left to write out
+    // everything still queued in the background, and then exits.
+    class qlog_writer
+    {
+      public:
+        // Chunk size at which a connection's output is passed to the writer thread
+        static constexpr size_t CHUNK_SIZE = 16 * 1024;
+        static constexpr size_t DEFAULT_RING_SIZE = 1024;
+        // How often the writer thread checks for new output when idle
+        static constexpr auto POLL_INTERVAL = std::chrono::milliseconds{50};
+
+        // Writes each trace to `<directory>/<trace id>.sqlog`.  The directory must exist.
+        // `ring_size` (a power of 2) is the number of chunks that can be waiting for output.
+        explicit qlog_writer(std::filesystem::path directory, size_t ring_size = DEFAULT_RING_SIZE);
+
+        // Passes each trace's output to `callback` (on the writer's thread).
+        explicit qlog_writer(qlog_callback callback, size_t ring_size = DEFAULT_RING_SIZE);
+
+        ~qlog_writer();
+
+        qlog_writer(const qlog_writer&) = delete;
+        qlog_writer& operator=(const qlog_writer&) = delete;
+
+        // Returns the number of chunks of qlog output dropped because the ring was full.
+        uint64_t dropped() const { return output->dropped.load(std::memory_order_relaxed); }
+
+        // Starts a new trace for a connection
+        std::shared_ptr<qlog_trace> start_trace(std::string id)
+        {
+            return std::make_shared<qlog_trace>(output, std::move(id));
+        }
+
+      private:
+        std::shared_ptr<detail::qlog_output> output;
+        std::thread thread;
+    };
+}  // namespace oxen::quic
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Everything a client needs to resume a session with a remote, and send it early (0-RTT) data
+    struct session_ticket
+    {
+        ustring tls_data;          // TLS session resumption data (containing the ticket itself)
+        ustring transport_params;  // the remote's transport parameters, as remembered for 0-RTT
+        std::chrono::system_clock::time_point received;
+    };
+
+    // Client-side store of session tickets, keyed by remote pubkey, that an endpoint given one
+    // (via opt::session_resumption) stores the tickets received on its outbound connections in, and
+    // uses to resume later connections to the same remote with 0-RTT.
+    //
+    // Methods are called from the event loop thread of each endpoint using the cache, so must be
+    // thread-safe if a cache is shared between endpoints.
+    class session_cache
+    {
+      public:
+        virtual ~session_cache() = default;
+
+        // Stores `ticket` for `remote_key`, replacing any ticket previously stored for it
+        virtual void store(ustring_view remote_key, session_ticket ticket) = 0;
+
+        // Returns the ticket stored for `remote_key`, if there is a usable one
+        virtual std::optional<session_ticket> load(ustring_view remote_key) = 0;
+
+        // Drops any ticket stored for `remote_key` (called when resuming with it failed)
+        virtual void remove(ustring_view remote_key) = 0;
+    };
+
+    // In-memory session_cache holding tickets for up to `max_entries` remotes (dropping the least
+    // recently stored beyond that) for up to `max_age` each, which can be saved to and loaded from
+    // a file so that reconnects after a restart can still be resumed.
+    class memory_session_cache : public session_cache
+    {
+      public:
+        // Matches the default lifetime that GnuTLS servers give their tickets
+        static constexpr std::chrono::seconds DEFAULT_MAX_AGE = std::chrono::hours{6};
+
+        explicit memory_session_cache(size_t max_entries = 10'000, std::chrono::seconds max_age = DEFAULT_MAX_AGE);
+
+        void store(ustring_view remote_key, session_ticket ticket) override;
+        std::optional<session_ticket> load(ustring_view remote_key) override;
+        void remove(ustring_view remote_key) override;
+
+        // Number of tickets currently stored (including any that have expired but not yet been
+        // dropped)
+        size_t size() const;
+
+        // Writes all unexpired tickets to `path`, replacing it.  Throws std::runtime_error on
+        // failure.
+        void save(const std::filesystem::path& path) const;
+
+        // Adds the unexpired tickets from a file written by `save`.  Does nothing if the file does
+        // not exist; throws std::runtime_error if it cannot be read or parsed.
+        void load_file(const std::filesystem::path& path);
+
+      private:
+        const size_t max_entries;
+        const std::chrono::seconds max_age;
+
+        mutable std::mutex mutex;
+        // Least recently stored first
+        std::list<std::pair<ustring, session_ticket>> entries;
+        std::map<ustring, decltype(entries)::iterator, std::less<>> index;
+
+        bool expired(const session_ticket& t, std::chrono::system_clock::time_point now) const;
+        void store_locked(ustring key, session_ticket ticket);
+    };
+}  // namespace oxen::quic
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+
+#include "opt.hpp"
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Settings of a shm_transport.
+    struct shm_options
+    {
+        // Size, in bytes, of each direction's ring of packets.  A sender that finds the ring full
+        // blocks (as it would on a full socket buffer) until the other side has caught up.  Rounded
+        // up to a power of 2.
+        size_t ring_size{4_Mi};
+
+        // If set, only accept channels from processes running as the same user as us.  Since a
+        // channel's peer announces the address it sends from, a process that could set up channels
+        // with us could claim to be any local endpoint and have that endpoint's packets delivered
+        // to it instead; with this restriction it has to be one already able to interfere with our
+        // processes.
+        bool same_user_only{true};
+    };
+
+    // Returns an endpoint option (an opt::packet_transport) that attaches an endpoint to a UDP
+    // socket with a same-host fast path: packets to loopback peers that are also using
+    // shm_transport bypass the kernel's network stack, and are instead exchanged through a pair of
+    // shared memory rings with eventfd wakeups (which are only needed when the receiving side has
+    // gone idle, so a busy flow makes very few syscalls).  Everything else goes out over the UDP
+    // socket as usual, and the endpoint and its connections work exactly the same either way: a
+    // peer is addressed by its UDP address, and packets it sends through the rings arrive on the
+    // same path as they would over UDP.  (They are still QUIC packets, so they are still
+    // encrypted).
+    //
+    // A channel is set up by the first packet sent to a loopback peer, through a Linux abstract
+    // namespace socket named after the peer's UDP port (and so only reaching peers in the same
+    // network namespace), and is closed when either side goes away, after which packets go back to
+    // using UDP.  Peers that don't use shm_transport (or that refuse the channel) just get UDP.
+    //
+    // Only available on Linux; elsewhere this gives a plain UDP socket.
+    opt::packet_transport shm_transport(shm_options opts = {});
+}  // namespace oxen::quic
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <utility>
+
+#include "address.hpp"
+#include "opt.hpp"
+#include "udp.hpp"
+
+namespace oxen::quic
+{
+    class SimulatedSocket;
+
+    // The impairments of one direction of a simulated link.  Each packet sent over the link is,
+    // in order:
+    // - dropped with probability `loss`;
+    // - if `bandwidth` is set, queued behind the packets already being sent on the link, and
+    //   dropped instead if that queue already holds more than `queue_limit` bytes (like a
+    //   router's tail-drop buffer);
+    // - delayed by `delay` plus a uniformly random `[0, jitter]`.  Jitter never makes a packet
+    //   overtake an earlier one on the same link (one held up by jitter delays those behind it,
+    //   as a queue would), so packets are only reordered through:
+    // - `reorder`: the probability of a packet being held back an extra `reorder_delay`, letting
+    //   the packets that follow it overtake it.
+    struct link_conditions
+    {
+        std::chrono::microseconds delay{0};
+        std::chrono::microseconds jitter{0};
+        double loss{0.0};
+        double reorder{0.0};
+        std::chrono::microseconds reorder_delay{std::chrono::milliseconds{10}};
+        // Link rate in bytes per second; 0 for unlimited
+        uint64_t bandwidth{0};
+        size_t queue_limit{256 * 1024};
+    };
+
+    // Totals of what happened to the packets sent over a SimulatedNetwork
+    struct simulated_network_stats
+    {
+        uint64_t sent{0};
+        uint64_t delivered{0};      // Made it through the link (and delivered, or about to be)
+        uint64_t lost{0};           // Dropped by `link_conditions::loss`
+        uint64_t queue_dropped{0};  // Dropped because the link's queue was full
+        uint64_t reordered{0};      // Held back by `link_conditions::reorder`
+        uint64_t unroutable{0};     // Sent to a port that nothing is bound to
+    };
+
+    // An in-memory network that endpoints can be attached to instead of UDP sockets (by passing
+    // `transport()` as an endpoint option), with configurable delay, jitter, loss, reordering, and
+    // bandwidth on each direction of each link.  Endpoints on the network can be on the same or on
+    // different event loops and Networks, but can only talk to each other.
+    //
+    // Sockets on it are identified by port alone: every bind gets a distinct port (an ephemeral one
+    // if binding to port 0), and packets go to whatever is bound to their destination port; the IP
+    // addresses are only carried along (a socket bound to an any address sends from the IP that
+    // the packet is addressed to, as if it were on the same host).
+    //
+    // All random choices come from a generator seeded with `seed`, so a run that sends the same
+    // packets in the same order makes the same loss and delay decisions.  Packets are delivered in
+    // real time, however, by timers on the receiving loop: ngtcp2 and the event loops run on the
+    // monotonic clock, so there is no virtual clock to skip ahead with.
+    class SimulatedNetwork : public std::enable_shared_from_this<SimulatedNetwork>
+    {
+      public:
+        // Constructs a shared network (it must be held in a shared_ptr); `defaults` are the
+        // conditions of every link not given others with `set_link`.
+        static std::shared_ptr<SimulatedNetwork> make(link_conditions defaults = {}, uint64_t seed = 0)
+        {
+            return std::shared_ptr<SimulatedNetwork>{new SimulatedNetwork{defaults, seed}};
+        }
+
+        SimulatedNetwork(const SimulatedNetwork&) = delete;
+        SimulatedNetwork& operator=(const SimulatedNetwork&) = delete;
+
+        // Returns the endpoint option that attaches an endpoint to this network
+        opt::packet_transport transport();
+
+        // Replaces the default conditions (applying to every link not set with `set_link`)
+        void set_conditions(link_conditions c);
+
+        // Sets the conditions for packets sent from `from` to `to` (only the ports matter).  Can be
+        // changed at any time, e.g. to simulate a link degrading partway through a test.
+        void set_link(const Address& from, const Address& to, link_conditions c);
+
+        simulated_network_stats stats() const;
+
+      private:
+        friend class SimulatedSocket;
+
+        SimulatedNetwork(link_conditions defaults, uint64_t seed) : defaults{defaults}, rng{seed} {}
+
+        struct link_state
+        {
+            // Set by set_link; otherwise the network's defaults apply
+            std::optional<link_conditions> conditions;
+            // Time by which the link will have finished sending everything queued on it, and the
+            // latest arrival time so far (which later non-reordered packets can't precede)
+            std::chrono::steady_clock::time_point busy_until{};
+            std::chrono::steady_clock::time_point last_arrival{};
+        };
+
+        mutable std::mutex mutex;
+        link_conditions defaults;
+        std::mt19937_64 rng;
+        simulated_network_stats _stats;
+        std::unordered_map<uint16_t, SimulatedSocket*> sockets;
+        std::map<std::pair<uint16_t, uint16_t>, link_state> links;
+        uint16_t next_port{40000};
+
+        // Binds a socket to `addr`, returning it with the port filled in; throws if taken
+        Address bind(SimulatedSocket& sock, Address addr);
+        void unbind(const SimulatedSocket& sock);
+
+        // Sends copies of a batch of packets from `sock` (see PacketTransport::send)
+        void send(
+                const SimulatedSocket& sock,
+                const PacketTransport::send_run* runs,
+                size_t n_runs,
+                const std::byte* bufs,
+                const size_t* bufsize);
+
+        link_state& link(uint16_t from, uint16_t to);
+    };
+}  // namespace oxen::quic
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "types.hpp"
+
+namespace oxen::quic
+{
+    using namespace std::literals;
+
+    // Holds a copy of a trivially copyable T that one thread (the event loop) updates and any
+    // thread can read without locking (a seqlock): the writer never waits, and a reader only
+    // retries if it raced with a write.  Reads return the value from one complete write, never a
+    // mix of two.
+    template <typename T>
+    class atomic_snapshot
+    {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(uint64_t) == 0);
+        static constexpr size_t N = sizeof(T) / sizeof(uint64_t);
+
+        std::atomic<uint64_t> seq{0};
+        std::array<std::atomic<uint64_t>, N> words{};
+
+      public:
+        // Must only be called from one thread at a time
+        void store(const T& val)
+        {
+            std::array<uint64_t, N> w;
+            std::memcpy(w.data(), &val, sizeof(T));
+            auto s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < N; i++)
+                words[i].store(w[i], std::memory_order_relaxed);
+            seq.store(s + 2, std::memory_order_release);
+        }
+
+        // Returns the last stored value (or a zero-filled T, if nothing has been stored yet)
+        T load() const
+        {
+            std::array<uint64_t, N> w;
+            for (;;)
+            {
+                auto s = seq.load(std::memory_order_acquire);
+                if (s & 1)
+                    continue;  // write in progress
+                for (size_t i = 0; i < N; i++)
+                    w[i] = words[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == s)
+                    break;
+            }
+            T val;
+            std::memcpy(static_cast<void*>(&val), w.data(), sizeof(T));
+            return val;
+        }
+    };
+
+    // Transport statistics of a connection (see connection_interface::stats()).  Updated whenever
+    // the connection sends or processes packets.
+    struct connection_stats
+    {
+        // ngtcp2's round trip time estimates
+        std::chrono::nanoseconds smoothed_rtt{0};
+        std::chrono::nanoseconds min_rtt{0};
+        std::chrono::nanoseconds latest_rtt{0};
+        std::chrono::nanoseconds rtt_variance{0};
+
+        // Congestion controller the connection was set up with (see opt::congestion_control)
+        CongestionControl cc_algo{CongestionControl::CUBIC};
+
+        // Congestion control state, in bytes
+        uint64_t cwnd{0};
+        uint64_t ssthresh{0};
+        uint64_t bytes_in_flight{0};
+
+        // Largest UDP payload currently sent on the path (i.e. the result of path MTU discovery)
+        uint64_t max_udp_payload{0};
+
+        // QUIC packets (and their total size) handed to the endpoint to send, and received
+        uint64_t packets_sent{0};
+        uint64_t bytes_sent{0};
+        uint64_t packets_received{0};
+        uint64_t bytes_received{0};
+
+        // Packets (and bytes) that ngtcp2 declared lost.  Only available with ngtcp2 1.4.0 or
+        // newer; always 0 with older versions.
+        uint64_t packets_lost{0};
+        uint64_t bytes_lost{0};
+
+        // Number of times sending stalled because the socket was blocked
+        uint64_t send_blocked{0};
+    };
+
+    // Histogram of non-negative integer samples in power-of-2 buckets: bucket 0 counts samples of
+    // 0 and 1, and bucket i > 0 counts samples in [2^i, 2^(i+1)), except for the last bucket, which
+    // counts everything from 2^(BUCKETS-1) up.
+    struct log2_histogram
+    {
+        static constexpr size_t BUCKETS = 32;
+
+        std::array<uint64_t, BUCKETS> buckets{};
+        uint64_t count{0};
+        uint64_t sum{0};
+        uint64_t max{0};
+
+        void add(uint64_t value)
+        {
+            size_t b = 0;
+            for (auto v = value >> 1; v && b < BUCKETS - 1; v >>= 1)
+                b++;
+            buckets[b]++;
+            count++;
+            sum += value;
+            if (value > max)
+                max = value;
+        }
+
+        double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+        // Returns an upper bound for the `q` quantile (e.g. 0.99 for the 99th percentile) of the
+        // samples: the top of the bucket it falls into (capped at the largest sample).
+        uint64_t quantile(double q) const
+        {
+            uint64_t seen = 0;
+            for (size_t b = 0; b < BUCKETS; b++)
+            {
+                seen += buckets[b];
+                if (seen > 0 && seen >= q * count)
+                    return b == BUCKETS - 1 ? max : std::min<uint64_t>(max, (uint64_t{2} << b) - 1);
+            }
+            return max;
+        }
+    };
+
+    // Counters of a UDP socket's traffic
+    struct socket_stats
+    {
+        uint64_t packets_sent{0};
+        uint64_t bytes_sent{0};
+        uint64_t packets_received{0};
+        uint64_t bytes_received{0};
+
+        // Batch sends (sendmmsg, GSO, or io_uring) that sent some but not all of their packets
+        uint64_t short_writes{0};
+        // Sends that were (wholly or partially) refused with EAGAIN because the socket buffer was
+        // full
+        uint64_t send_blocked{0};
+        // Incoming packets the kernel dropped because the socket's receive buffer was full (Linux
+        // only; see opt::socket_options).  The kernel reports these along with the next packet
+        // that does make it in, so drops only show up once packets are being received again.
+        uint64_t receive_dropped{0};
+        // With kernel receive timestamps enabled (see opt::socket_options::rx_timestamps): how long
+        // received packets waited, in microseconds, between their arrival and being read from the
+        // socket.
+        log2_histogram receive_delay_us;
+        // With shm_transport: how many of the packets sent and received (included in the totals
+        // above) went through shared memory channels rather than the UDP socket
+        uint64_t shm_packets_sent{0};
+        uint64_t shm_packets_received{0};
+    };
+
+    // Statistics of an endpoint (see Endpoint::stats()): its socket's counters, plus totals over
+    // all of its connections, past and present.
+    struct endpoint_stats
+    {
+        socket_stats socket;
+        uint64_t packets_lost{0};
+        uint64_t bytes_lost{0};
+    };
+
+    // Types of user callbacks whose run time is accounted for in loop_stats.  The times are
+    // inclusive: the BT request handlers invoked while a BTRequestStream processes stream data, for
+    // instance, count towards both `bt_request` and `stream_data`.
+    enum class loop_callback : uint8_t
+    {
+        stream_data,  // Stream data callbacks (and Stream::receive overrides)
+        datagram,     // Datagram receive callbacks
+        bt_request,   // BTRequestStream endpoint and generic request handlers
+        connection,   // Connection established and closed callbacks
+        job,          // Jobs posted to the loop with call_soon (or call/call_get from other threads)
+        _count
+    };
+
+    constexpr std::string_view to_string(loop_callback c)
+    {
+        switch (c)
+        {
+            case loop_callback::stream_data:
+                return "stream data"sv;
+            case loop_callback::datagram:
+                return "datagram"sv;
+            case loop_callback::bt_request:
+                return "BT request"sv;
+            case loop_callback::connection:
+                return "connection"sv;
+            case loop_callback::job:
+                return "job"sv;
+            default:
+                return "unknown"sv;
+        }
+    }
+
+    // Number of calls and time spent in callbacks of one type
+    struct callback_time
+    {
+        uint64_t calls{0};
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds max{0};
+    };
+
+    // Event loop instrumentation covering one reporting period (see Network::enable_loop_stats).
+    //
+    // libevent has no hooks around its loop iterations, so instead of iteration times this measures
+    // "dispatches": each call into libquic from the loop (processing the job queue, reading from a
+    // socket, firing timers, sending a connection's packets, ...).  Since everything pinned to the
+    // loop happens in some dispatch, a slow dispatch is exactly the delay that everything else on
+    // the loop suffers, and `busy` over `period` is the fraction of the time the loop was working.
+    struct loop_stats
+    {
+        size_t loop_index{0};
+
+        // Length of the reporting period, and how much of it was spent in dispatches
+        std::chrono::nanoseconds period{0};
+        std::chrono::nanoseconds busy{0};
+
+        // Duration of each dispatch, in microseconds
+        log2_histogram dispatch_us;
+        // Time that jobs posted with call_soon waited before starting, in microseconds
+        log2_histogram job_wait_us;
+        // Number of queued jobs found each time the loop processed its job queue
+        log2_histogram job_queue_depth;
+
+        std::array<callback_time, static_cast<size_t>(loop_callback::_count)> callbacks{};
+
+        // Callbacks and dispatches that took longer than the slow callback threshold
+        uint64_t slow{0};
+
+        double utilization() const { return period.count() > 0 ? static_cast<double>(busy.count()) / period.count() : 0.0; }
+
+        const callback_time& operator[](loop_callback c) const { return callbacks[static_cast<size_t>(c)]; }
+        callback_time& operator[](loop_callback c) { return callbacks[static_cast<size_t>(c)]; }
+    };
+}  // namespace oxen::quic
@@ -13,6 +13,7 @@
 #include "connection_ids.hpp"
 #include "error.hpp"
 #include "iochannel.hpp"
+#include "stream_buffer.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
@@ -31,6 +32,8 @@ namespace oxen::quic
     // returns 0 on success
     using stream_open_callback = std::function<uint64_t(Stream&)>;
     using stream_unblocked_callback = std::function<bool(Stream&)>;
+    using stream_watermark_callback = std::function<void(Stream&, bool writable)>;
+    using stream_drained_callback = std::function<void(Stream&, bool drained)>;
 
     void _chunk_sender_trace(const char* file, int lineno, std::string_view message);
     void _chunk_sender_trace(const char* file, int lineno, std::string_view message, size_t val);
@@ -40,6 +43,7 @@ namespace oxen::quic
         friend class TestHelper;
         friend class Connection;
         friend class Network;
+        friend class Loop;
 
       protected:
         Stream(Connection& conn,
@@ -64,6 +68,62 @@ namespace oxen::quic
 
         void close(uint64_t app_err_code = 0);
 
+        // Enables coalescing of small sends: data sent in pieces of no more than `max_size` bytes
+        // gets copied into a contiguous stream-owned buffer (releasing the caller's keep-alive
+        // immediately) rather than being queued as its own piece.  This is worthwhile for streams
+        // sending many small messages.  A `max_size` of 0 disables coalescing (the default); the
+        // value is capped at 4kiB.
+        void set_coalescing(size_t max_size = 1024);
+
+        // Sets the send priority of this stream, in the style of RFC 9218 (HTTP extensible
+        // priorities).  When the connection has more data to send than it can send at once, data of
+        // more urgent streams (lower `urgency` values, from 0 to MAX_URGENCY) is always sent before
+        // that of less urgent ones.  Among streams of the same urgency, non-incremental streams are
+        // sent one at a time, in stream id order, ahead of incremental streams, which share the
+        // available bandwidth by taking turns.  The default is DEFAULT_URGENCY, incremental.
+        //
+        // Throws std::invalid_argument if `urgency` is larger than MAX_URGENCY.
+        void set_priority(uint8_t urgency, bool incremental = true);
+
+        // Returns the stream's current urgency and incremental flag
+        std::pair<uint8_t, bool> priority() const;
+
+        // Enables (or disables) manual receive flow control for this stream.  Normally received
+        // data counts as consumed as soon as it has been passed to the stream's data callback, at
+        // which point the remote is given flow control credit to send that much more.  In manual
+        // mode the credit is only given when the application calls consume(), so a consumer that
+        // can't keep up can hold back the remote simply by not consuming (bounding the buffered
+        // data to the stream's receive window; see opt::receive_window).  Disabling manual mode
+        // consumes all of the outstanding data.
+        void set_manual_consume(bool enabled = true);
+
+        // Marks `bytes` of received data as consumed in manual consumption mode, giving the remote
+        // credit to send that much more stream data.  Values larger than the amount of unconsumed
+        // data just consume all of it.
+        void consume(size_t bytes);
+
+        // Returns the number of bytes received in manual consumption mode but not yet consumed
+        size_t unconsumed() const;
+
+        // Sets high and low watermarks on the stream's buffered send data (data queued on the
+        // stream that the remote has not yet acknowledged).  When the buffered data reaches `high`
+        // bytes `cb` is called with `writable` false, and once it has then drained to `low` bytes
+        // or less, with `writable` true; a producer can use this to pace itself rather than polling
+        // or queueing without bound.  The callback is invoked in the event loop thread, straight
+        // away if the stream is already at or above `high`.  A `high` of 0 removes the watermarks.
+        //
+        // Throws std::invalid_argument if `low` is not less than `high`.
+        void set_watermarks(size_t high, size_t low, stream_watermark_callback cb);
+
+        // Returns false if the stream's buffered send data has reached its high watermark and not
+        // yet drained to its low watermark.
+        bool is_writable() const;
+
+        // Calls `cb` in the event loop thread once the stream's send buffer is empty, i.e. once all
+        // data queued on it has been acknowledged by the remote (straight away if nothing is
+        // queued), with `drained` true; or with `drained` false if the stream closes first.
+        void when_drained(stream_drained_callback cb);
+
         void set_stream_data_cb(stream_data_callback cb) { data_callback = std::move(cb); }
         void set_stream_close_cb(stream_close_callback cb) { close_callback = std::move(cb); }
 
@@ -84,6 +144,12 @@ namespace oxen::quic
             _conn = nullptr;
         }
 
+        // Called (from the event loop) when the stream's connection is torn down without the
+        // stream being closed, such as when the connection is dropped or closed quietly, so that a
+        // subclass can release anything it has scheduled.  No callbacks should be invoked from here.
+        // The default does nothing.
+        virtual void dropped() {}
+
         // Called immediately after set_ready so that a subclass can do thing as soon as the stream
         // becomes ready. The default does nothing.
         virtual void on_ready() {}
@@ -91,11 +157,24 @@ namespace oxen::quic
         /// Called periodically to check if anything needs to be timed out.  The default does
         /// nothing, but subclasses can override to not do nothing if it's not the case that nothing
         /// ain't not good enough isn't false.
-        virtual void check_timeouts() {}
+        virtual void check_timeouts() { _default_check_timeouts = true; }
+
+        /// Called after each check_timeouts() call to find out whether the stream still needs
+        /// them: the connection only calls check_timeouts() on streams added to it since the last
+        /// check, and on streams for which this returned true.  A stream that stops being checked
+        /// can call watch_timeouts() once it has something to time out again.
+        ///
+        /// The default returns false for streams that don't override check_timeouts(), and true
+        /// (that is, always keep checking) for those that do.
+        virtual bool has_timeouts() const { return !_default_check_timeouts; }
+
+        // Asks for this stream's check_timeouts() to be called again; must be called from the
+        // event loop.
+        void watch_timeouts();
 
         void send_impl(bstring_view data, std::shared_ptr<void> keep_alive = nullptr) override;
 
-        stream_buffer user_buffers;
+        stream_buffer user_buffers{_memory.get()};
 
         bool sent_fin() const override { return _sent_fin; }
         void set_fin(bool v) override { _sent_fin = v; }
@@ -103,35 +182,53 @@ namespace oxen::quic
         bool has_unsent_impl() const override { return not is_empty_impl(); }
         bool is_closing_impl() const override { return _is_closing; }
         bool is_empty_impl() const override { return user_buffers.empty(); }
-        size_t unsent_impl() const override;
+        size_t unsent_impl() const override { return user_buffers.unsent(); }
+
+        // Also publishes the number of queued buffers (for BTRequestStream::num_pending)
+        void publish_state() override;
+        std::atomic<size_t> _published_buffers{0};
 
       private:
-        std::vector<ngtcp2_vec> pending() override;
+        size_t pending(ngtcp2_vec* bufs, size_t max) override;
 
-        size_t _unacked_size{0};
         bool _is_closing{false};
         bool _is_shutdown{false};
         bool _sent_fin{false};
         bool _ready{false};
         int64_t _stream_id;
 
+        // Links in the connection's list of streams to check for timeouts
+        Stream* _timeouts_prev{nullptr};
+        Stream* _timeouts_next{nullptr};
+        bool _timeouts_watched{false};
+        bool _default_check_timeouts{false};
+
+        // Manual receive flow control (see set_manual_consume)
+        bool _manual_consume{false};
+        uint64_t _unconsumed{0};
+
+        // Send buffer watermarks (see set_watermarks), and the amount of buffered data currently
+        // counted towards the connection's buffered total
+        watermarks _watermarks;
+        stream_watermark_callback watermark_callback;
+        size_t _conn_buffered{0};
+
+        // Callbacks waiting for the send buffer to empty (see when_drained)
+        std::vector<stream_drained_callback> drain_callbacks;
+        void fire_drained(bool drained);
+
+        // Updates the stream and connection watermarks after the buffered data size changes
+        void buffered_changed();
+
         void wrote(size_t bytes) override;
 
         void append_buffer(bstring_view buffer, std::shared_ptr<void> keep_alive);
 
         void acknowledge(size_t bytes);
 
-        size_t size() const
-        {
-            size_t sum{0};
-            if (user_buffers.empty())
-                return sum;
-            for (const auto& [data, store] : user_buffers)
-                sum += data.size();
-            return sum;
-        }
+        size_t size() const { return user_buffers.size(); }
 
-        size_t unacked() const { return _unacked_size; }
+        size_t unacked() const { return user_buffers.unacked(); }
 
         // Implementations classes for send_chunks()
 
@@ -160,6 +257,15 @@ namespace oxen::quic
                     cs->queue_next_chunk();
             }
 
+            // Adaptive mode (see send_chunks): must be called from the event loop thread
+            template <typename... Args>
+            static void make_adaptive(int max_queue, Args&&... args)
+            {
+                std::shared_ptr<chunk_sender<Container>> cs{new chunk_sender<Container>(std::forward<Args>(args)...)};
+                cs->max_inflight = max_queue;
+                cs->fill();
+            }
+
           private:
             // This is instantiated for each chunk, contains the chunk data itself, and is what we
             // put into the keep_alive; during destruction, we queue the next chunk.
@@ -171,7 +277,11 @@ namespace oxen::quic
 
               public:
                 single_chunk(chunk_sender& cs, Container&& d) : _chunks{cs.shared_from_this()}, _data{std::move(d)} {}
-                ~single_chunk() { _chunks->queue_next_chunk(); }
+                ~single_chunk()
+                {
+                    _chunks->inflight--;
+                    _chunks->fill();
+                }
 
                 bstring_view view() const
                 {
@@ -198,12 +308,30 @@ namespace oxen::quic
             chunk_callback_t next_chunk;
             done_callback_t done;
 
+            // Chunks currently queued on the stream, and the adaptive mode limit on them (0 if not
+            // in adaptive mode).
+            int inflight = 0;
+            int max_inflight = 0;
+
+            // Queues up the next chunk(s) after a chunk completes: in fixed mode exactly one (to
+            // replace it), in adaptive mode as many as the stream wants to keep the connection's
+            // congestion window full, but always at least one.
+            void fill()
+            {
+                if (!max_inflight)
+                    return (void)queue_next_chunk();
+                while (inflight < max_inflight && (inflight == 0 || str.wants_more_chunks()))
+                    if (!queue_next_chunk())
+                        return;
+            }
+
           public:
-            void queue_next_chunk()
+            // Returns false if there was no next chunk to queue
+            bool queue_next_chunk()
             {
                 if (!next_chunk)
                     // We already finished (i.e. via a previous chunk destructor)
-                    return;
+                    return false;
 
                 auto data = next_chunk(const_cast<const Stream&>(str));
                 bool no_data = false;
@@ -221,7 +349,7 @@ namespace oxen::quic
                     next_chunk = nullptr;
                     if (done)
                         done(str);
-                    return;
+                    return false;
                 }
 
                 auto next = std::make_shared<single_chunk>(*this, std::move(data));
@@ -229,10 +357,17 @@ namespace oxen::quic
 #ifndef NDEBUG
                 _chunk_sender_trace(__FILE__, __LINE__, "got chunk to send of size ", bsv.size());
 #endif
+                inflight++;
                 str.send(bsv, std::move(next));
+                return true;
             }
         };
 
+        // Used by adaptive chunk sending: true if the stream has less unsent data queued than the
+        // connection's congestion window (ngtcp2's estimate of the bandwidth-delay product), so
+        // that queueing another chunk helps keep the path full.
+        bool wants_more_chunks() const;
+
         prepared_datagram pending_datagram(bool) override;
 
       public:
@@ -269,6 +404,55 @@ namespace oxen::quic
             chunk_sender<T>::make(simultaneous, *this, std::move(next_chunk), std::move(done));
         }
 
+        /// Argument for send_chunks to have the number of chunks in flight adapt to the connection:
+        /// rather than a fixed number, chunks are queued for as long as the stream has less unsent
+        /// data than the connection's current congestion window, so that high bandwidth-delay paths
+        /// stay full without slow paths getting overbuffered.  At least one and no more than
+        /// `max_simultaneous` chunks are in flight at a time.
+        struct adaptive_chunks
+        {
+            int max_simultaneous = 32;
+        };
+
+        /// Same as above, but with an adaptive number of chunks in flight.  In this mode next_chunk
+        /// is always called from the event loop thread.
+        template <typename NextChunk, typename EP = Endpoint>
+        void send_chunks(NextChunk next_chunk, std::function<void(Stream&)> done, adaptive_chunks adaptive)
+        {
+            if (adaptive.max_simultaneous < 1)
+                throw std::logic_error{"Stream::send_chunks max_simultaneous must be >= 1"};
+
+            using T = decltype(next_chunk(const_cast<const Stream&>(*this)));
+            // The cast defers instantiation until Endpoint is a complete type (see IOChannel)
+            static_cast<EP&>(endpoint).call(
+                    [this, next = std::move(next_chunk), done = std::move(done), max = adaptive.max_simultaneous]() mutable {
+                        chunk_sender<T>::make_adaptive(max, *this, std::move(next), std::move(done));
+                    });
+        }
+
+        // Default size of the file windows that send_file maps at a time
+        static constexpr size_t DEFAULT_FILE_WINDOW = 4_Mi;
+
+        /// Sends `len` bytes of the file open as `fd`, starting at byte `offset`, without reading it
+        /// into user buffers: the file is mapped into memory a window of `window` bytes at a time,
+        /// and each window is sent directly from the mapping and unmapped once all of its data has
+        /// been acknowledged.  No more than `max_windows` windows are mapped at once (fewer when the
+        /// connection's congestion window doesn't need them; see adaptive_chunks), so arbitrarily
+        /// large files can be sent with bounded memory use.
+        ///
+        /// The descriptor is duplicated, so the caller may close `fd` as soon as this returns.  The
+        /// requested range must lie within the file, and the file must not be truncated while being
+        /// sent.  `done` is called as with send_chunks, once the last window has been queued.
+        ///
+        /// On Windows the windows are read into buffers rather than mapped.
+        void send_file(
+                int fd,
+                uint64_t offset,
+                uint64_t len,
+                std::function<void(Stream&)> done = nullptr,
+                size_t window = DEFAULT_FILE_WINDOW,
+                int max_windows = 4);
+
         void set_ready();
     };
 }  // namespace oxen::quic
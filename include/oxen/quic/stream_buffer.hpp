@@ -0,0 +1,102 @@
+#pragma once
+
+extern "C"
+{
+#include <ngtcp2/ngtcp2.h>
+}
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // The send queue of a stream: the data buffers given to the stream to send (along with
+    // whatever keeps each one alive), from which data is dropped from the front as it gets
+    // acknowledged by the remote.  The queue is made up of three parts:
+    //
+    //     [ acknowledged (dropped) | sent but unacknowledged | unsent ]
+    //                                                        ^ cursor
+    //
+    // The position of the first unsent byte and the byte counts of each part are maintained
+    // incrementally, so that getting the data to send next (`fill`), recording data as sent
+    // (`wrote`) and acknowledging it (`acknowledge`) never have to walk over already sent buffers,
+    // no matter how many small buffers are queued.
+    //
+    // With coalescing enabled (see `set_coalescing`), small buffers are copied into shared arena
+    // chunks instead of being queued (and kept alive) individually: consecutive small writes then
+    // end up as a single contiguous buffer, and so as a single iovec when sending.
+    //
+    // The queue itself and the arena chunks are allocated from the given memory resource (see
+    // opt::memory_resource), which must outlive the stream_buffer.
+    class stream_buffer
+    {
+      public:
+        // Size of each arena chunk that small writes get copied into when coalescing
+        static constexpr size_t ARENA_CHUNK_SIZE = 16 * 1024;
+
+        explicit stream_buffer(std::pmr::memory_resource* mem = std::pmr::new_delete_resource()) : bufs{mem} {}
+
+        // Appends a buffer to the end of the queue; `keep_alive` is released once all of the
+        // buffer's data has been acknowledged.  If coalescing is enabled and the buffer is small
+        // enough it is copied instead, and `keep_alive` is released immediately.
+        void append(bstring_view data, std::shared_ptr<void> keep_alive);
+
+        // Enables coalescing of appended buffers of up to `max_size` bytes, or disables it if 0.
+        // `max_size` is capped at a quarter of ARENA_CHUNK_SIZE.
+        void set_coalescing(size_t max_size) { coalesce_max = std::min(max_size, ARENA_CHUNK_SIZE / 4); }
+
+        // Returns the current coalescing threshold (0 if disabled)
+        size_t coalescing() const { return coalesce_max; }
+
+        // Moves `bytes` of data from unsent to sent-but-unacknowledged.  `bytes` must not exceed
+        // unsent().
+        void wrote(size_t bytes);
+
+        // Drops `bytes` of sent data from the front of the queue.  `bytes` must not exceed
+        // unacked().
+        void acknowledge(size_t bytes);
+
+        // Fills up to `max` iovecs, starting from the first unsent byte, and returns the number
+        // filled.
+        size_t fill(ngtcp2_vec* vecs, size_t max) const;
+
+        // Total bytes sent but not yet acknowledged
+        size_t unacked() const { return _unacked; }
+
+        // Total bytes not yet sent
+        size_t unsent() const { return _size - _unacked; }
+
+        // Total bytes in the queue: unacked() + unsent()
+        size_t size() const { return _size; }
+
+        // True if there is nothing in the queue at all (i.e. everything has been acknowledged)
+        bool empty() const { return bufs.empty(); }
+
+        // Number of (not fully acknowledged) buffers in the queue
+        size_t num_buffers() const { return bufs.size(); }
+
+      private:
+        std::pmr::deque<std::pair<bstring_view, std::shared_ptr<void>>> bufs;
+        size_t _size{0};
+        size_t _unacked{0};
+
+        // Cursor of the first unsent byte: index into `bufs` and offset into that buffer.  When
+        // everything has been sent this is {bufs.size(), 0}.
+        size_t cursor_idx{0};
+        size_t cursor_off{0};
+
+        // Arena chunk that coalesced writes are currently being copied into.  It is reserved up
+        // front and never grows beyond that, so data already copied into it never moves.
+        std::shared_ptr<std::pmr::vector<std::byte>> arena;
+        size_t coalesce_max{0};
+
+        void append_coalesced(bstring_view data);
+    };
+}  // namespace oxen::quic
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace oxen::quic
+{
+    // Table of a connection's streams, keyed by stream ID, used by Connection in place of a tree
+    // so that the per-frame lookups done for ngtcp2 callbacks are O(1).
+    //
+    // QUIC stream IDs are allocated densely within each of the four stream types (the low two bits
+    // of the ID), so each type gets a deque of slots indexed by stream ordinal (ID >> 2), relative
+    // to the ordinal of the first slot.  Slots of closed streams are released from either end of
+    // the deque as they empty out.  A long-lived stream would otherwise pin the front of the deque
+    // (leaving it to grow with every later stream), so once the deque becomes mostly empty slots
+    // any live streams at its front are moved into a small ordered overflow map and the front is
+    // released.  Each stream moves at most once, so this stays amortized O(1).
+    //
+    // Pointers returned by find/insert are invalidated by any subsequent insertion or removal.
+    // Not thread-safe.
+    template <typename T>
+    class stream_table
+    {
+      public:
+        // The deque of a stream type is compacted once it has more than this many slots, and no
+        // more than one in COMPACT_RATIO of them are in use.
+        static constexpr size_t COMPACT_MIN = 64;
+        static constexpr size_t COMPACT_RATIO = 4;
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        // Returns a pointer to the stream stored for `id`, or nullptr if there isn't one.
+        const std::shared_ptr<T>* find(int64_t id) const
+        {
+            auto& t = types[id & 3];
+            auto ord = ordinal(id);
+            if (ord >= t.base && ord - t.base < t.slots.size())
+            {
+                auto& s = t.slots[ord - t.base];
+                return s ? &s : nullptr;
+            }
+            if (auto it = t.overflow.find(ord); it != t.overflow.end())
+                return &it->second;
+            return nullptr;
+        }
+
+        // Adds a stream for `id`, which must not already be present.  Returns the stored pointer.
+        const std::shared_ptr<T>& insert(int64_t id, std::shared_ptr<T> stream)
+        {
+            assert(stream);
+            assert(!find(id));
+            auto& t = types[id & 3];
+            auto ord = ordinal(id);
+            count++;
+
+            if (t.slots.empty())
+            {
+                // A new window, which (like any other) has to be entirely above the overflow map
+                if (!t.overflow.empty() && ord < t.overflow.rbegin()->first)
+                    return t.overflow.emplace(ord, std::move(stream)).first->second;
+                t.base = ord;
+            }
+            else if (ord < t.base)
+            {
+                // An ID below the current window: add slots at the front if that is cheap enough
+                // (and keeps the overflow map entirely below the window), otherwise it goes in the
+                // overflow map.
+                if (t.base - ord > COMPACT_MIN + t.slots.size() ||
+                    (!t.overflow.empty() && ord < t.overflow.rbegin()->first))
+                    return t.overflow.emplace(ord, std::move(stream)).first->second;
+                t.slots.insert(t.slots.begin(), t.base - ord, nullptr);
+                t.base = ord;
+            }
+
+            if (ord - t.base >= t.slots.size())
+                t.slots.resize(ord - t.base + 1);
+            auto& slot = t.slots[ord - t.base];
+            slot = std::move(stream);
+            t.used++;
+            return slot;
+        }
+
+        // Removes and returns the stream stored for `id`, or returns nullptr if there isn't one.
+        std::shared_ptr<T> extract(int64_t id)
+        {
+            auto& t = types[id & 3];
+            auto ord = ordinal(id);
+            std::shared_ptr<T> out;
+
+            if (ord >= t.base && ord - t.base < t.slots.size())
+            {
+                out = std::move(t.slots[ord - t.base]);
+                if (!out)
+                    return out;
+                t.used--;
+                trim(t);
+            }
+            else if (auto it = t.overflow.find(ord); it != t.overflow.end())
+            {
+                out = std::move(it->second);
+                t.overflow.erase(it);
+            }
+            else
+                return out;
+
+            count--;
+            return out;
+        }
+
+        void clear()
+        {
+            for (auto& t : types)
+                t = type_slots{};
+            count = 0;
+        }
+
+        // Frees spare slot storage left over from earlier streams
+        void shrink_to_fit()
+        {
+            for (auto& t : types)
+                t.slots.shrink_to_fit();
+        }
+
+        // Calls `f(const std::shared_ptr<T>&)` for each stream: grouped by stream type, and in
+        // order of ID within each type.  `f` must not add or remove streams.
+        template <typename F>
+        void for_each(F&& f) const
+        {
+            for (auto& t : types)
+            {
+                for (auto& [ord, s] : t.overflow)
+                    f(s);
+                for (auto& s : t.slots)
+                    if (s)
+                        f(s);
+            }
+        }
+
+        // Returns the stream that for_each would visit first; the table must not be empty.
+        const std::shared_ptr<T>& front() const
+        {
+            assert(count > 0);
+            for (auto& t : types)
+            {
+                if (!t.overflow.empty())
+                    return t.overflow.begin()->second;
+                // After trimming, the first slot (if any) is always in use
+                if (!t.slots.empty())
+                    return t.slots.front();
+            }
+            assert(false);
+            return types[0].slots.front();
+        }
+
+        // Total number of slots held, in use or not (for memory accounting)
+        size_t slot_count() const
+        {
+            size_t n = 0;
+            for (auto& t : types)
+                n += t.slots.size() + t.overflow.size();
+            return n;
+        }
+
+      private:
+        struct type_slots
+        {
+            uint64_t base{0};  // ordinal of slots.front()
+            size_t used{0};    // non-empty entries in `slots`
+            std::deque<std::shared_ptr<T>> slots;
+            std::map<uint64_t, std::shared_ptr<T>> overflow;  // live streams below `base`
+        };
+
+        std::array<type_slots, 4> types;
+        size_t count{0};
+
+        static uint64_t ordinal(int64_t id)
+        {
+            assert(id >= 0);
+            return static_cast<uint64_t>(id) >> 2;
+        }
+
+        // Releases empty slots from both ends, compacting into the overflow map first if the
+        // deque has become mostly empty.
+        void trim(type_slots& t)
+        {
+            if (t.slots.size() > COMPACT_MIN && t.slots.size() > COMPACT_RATIO * t.used)
+            {
+                // Keep the longest tail of the deque that is at least half full, and move the live
+                // streams in front of it into the overflow map.
+                size_t keep = 0, live = 0;
+                for (size_t len = 1; len <= t.slots.size(); len++)
+                {
+                    if (t.slots[t.slots.size() - len])
+                        live++;
+                    if (2 * live >= len)
+                        keep = len;
+                }
+                for (size_t n = t.slots.size() - keep; n > 0; n--)
+                {
+                    if (auto& s = t.slots.front())
+                    {
+                        t.overflow.emplace_hint(t.overflow.end(), t.base, std::move(s));
+                        t.used--;
+                    }
+                    t.slots.pop_front();
+                    t.base++;
+                }
+            }
+
+            while (!t.slots.empty() && !t.slots.front())
+            {
+                t.slots.pop_front();
+                t.base++;
+            }
+            while (!t.slots.empty() && !t.slots.back())
+                t.slots.pop_back();
+        }
+    };
+}  // namespace oxen::quic
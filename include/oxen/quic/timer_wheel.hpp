@@ -0,0 +1,140 @@
+#pragma once
+
+#include <event2/event.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    class timer_wheel;
+
+    namespace detail
+    {
+        // Intrusive, circular doubly-linked list node linking the timers of a wheel slot
+        struct timer_node
+        {
+            timer_node* next = nullptr;
+            timer_node* prev = nullptr;
+        };
+    }  // namespace detail
+
+    // A one-shot timer driven by a Loop's timer_wheel.  Scheduling, rescheduling and cancelling are
+    // O(1) and never allocate, so this is suitable for timers that are rearmed on nearly every
+    // packet (such as a connection's retransmit timer).  Timers fire up to one wheel tick after
+    // their deadline, and never before it.
+    //
+    // Like a libevent event, the callback is a plain function pointer plus argument; the timer is
+    // unlinked from the wheel before the callback is invoked, so the callback is free to reschedule
+    // or destroy the timer (or the object that owns it).  Must only be used from the loop thread.
+    class wheel_timer : detail::timer_node
+    {
+      public:
+        using callback_t = void (*)(void* arg);
+
+        wheel_timer(timer_wheel& wheel, callback_t cb, void* arg) : wheel{&wheel}, cb{cb}, arg{arg} {}
+
+        ~wheel_timer() { cancel(); }
+
+        wheel_timer(const wheel_timer&) = delete;
+        wheel_timer& operator=(const wheel_timer&) = delete;
+        wheel_timer(wheel_timer&&) = delete;
+        wheel_timer& operator=(wheel_timer&&) = delete;
+
+        // Schedules the timer to fire at (or shortly after) `when`, replacing any previous schedule.
+        // A time in the past fires the timer on the next loop iteration.
+        void schedule(std::chrono::steady_clock::time_point when);
+
+        void schedule_after(std::chrono::nanoseconds delay) { schedule(get_time() + delay); }
+
+        // Unschedules the timer, if scheduled.
+        void cancel();
+
+        bool scheduled() const { return next != nullptr; }
+
+      private:
+        friend class timer_wheel;
+
+        timer_wheel* wheel;
+        callback_t cb;
+        void* arg;
+
+        // The tick at which we are due; only meaningful while scheduled (i.e. while the link
+        // pointers of our timer_node base are non-null).
+        uint64_t tick = 0;
+        // The wheel level and slot this timer was last filed under, or level == NO_SLOT if it is in
+        // the immediate list.
+        uint8_t level = 0;
+        uint8_t slot = 0;
+    };
+
+    // Hierarchical timer wheel (in the style of the Linux kernel and Tokio timer wheels) that
+    // multiplexes any number of wheel_timers onto a single libevent timer.  Time is divided into
+    // ticks of TICK; level 0 of the wheel has one slot per tick for the next 64 ticks, level 1 one
+    // slot per 64 ticks for the next 64² ticks, and so on.  A timer is filed in the lowest level
+    // whose slot range covers its deadline and is moved down a level ("cascaded") when that slot
+    // comes due, so the cost of a timer is O(1) to schedule plus at most LEVELS moves before it
+    // fires, regardless of how many timers there are.
+    //
+    // Only one libevent timer is ever armed: for the start of the earliest occupied slot.  It is
+    // moved earlier when a timer with an earlier deadline is scheduled, but left alone when timers
+    // are cancelled (it then just fires early, finds nothing to do, and re-arms), so that the
+    // common schedule/cancel churn doesn't touch libevent's timer heap at all.
+    class timer_wheel
+    {
+      public:
+        // Timer resolution.  This is finer than ngtcp2's 1ms loss detection granularity because
+        // connection expiry also covers pacing, where firing a whole millisecond late would cost
+        // throughput.
+        static constexpr std::chrono::microseconds TICK{250};
+        static constexpr size_t LEVELS = 6;
+        static constexpr size_t SLOTS = 64;
+
+        explicit timer_wheel(event_base* loop);
+        ~timer_wheel();
+
+        timer_wheel(const timer_wheel&) = delete;
+        timer_wheel& operator=(const timer_wheel&) = delete;
+        timer_wheel(timer_wheel&&) = delete;
+        timer_wheel& operator=(timer_wheel&&) = delete;
+
+        // Number of timers currently scheduled
+        size_t size() const { return count; }
+
+      private:
+        friend class wheel_timer;
+
+        static constexpr uint8_t NO_SLOT = 0xff;
+        static constexpr uint64_t NOT_ARMED = ~uint64_t{0};
+
+        const std::chrono::steady_clock::time_point start;
+        event_ptr ev;
+
+        // All timers with a tick <= elapsed have been fired
+        uint64_t elapsed = 0;
+        uint64_t armed = NOT_ARMED;
+        size_t count = 0;
+
+        // List heads of each slot of each level
+        std::array<std::array<detail::timer_node, SLOTS>, LEVELS> slots;
+        std::array<uint64_t, LEVELS> occupied{};
+        // Timers scheduled for a tick that has already been processed
+        detail::timer_node immediate;
+
+        uint64_t tick_at(std::chrono::steady_clock::time_point t, bool round_up) const;
+
+        void schedule(wheel_timer& t, std::chrono::steady_clock::time_point when);
+        void cancel(wheel_timer& t);
+
+        void file(wheel_timer& t);
+        std::optional<uint64_t> next_expiration() const;
+        void process();
+        void arm(uint64_t tick);
+        void rearm();
+    };
+}  // namespace oxen::quic
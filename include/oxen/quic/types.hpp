@@ -6,7 +6,59 @@ namespace oxen::quic
 {
     enum class Direction { OUTBOUND = 0, INBOUND = 1 };
 
-    enum class Splitting { NONE = 0, ACTIVE = 1 };
+    enum class Splitting { NONE = 0, ACTIVE = 1, FRAGMENT = 2 };
+
+    // UDP packet send method used by a socket; see UDPSocket::send_backend().
+    enum class SendBackend { SENDMSG = 0, SENDMMSG = 1, GSO = 2 };
+
+    std::string_view to_string(SendBackend b);
+
+    // ngtcp2 congestion controller used for a connection's sending; see opt::congestion_control.
+    enum class CongestionControl { CUBIC = 0, RENO = 1, BBR = 2 };
+
+    std::string_view to_string(CongestionControl cc);
+
+    // How a connection shares its packets between datagrams and stream data; see opt::send_share.
+    enum class DatagramShare { ROUND_ROBIN = 0, STRICT = 1, WEIGHTED = 2 };
+
+    std::string_view to_string(DatagramShare s);
+
+    // Kernel receive timestamps requested for a UDP socket; see opt::socket_options.
+    enum class RxTimestamps { NONE = 0, SOFTWARE = 1, HARDWARE = 2 };
+
+    std::string_view to_string(RxTimestamps t);
+
+    // High/low watermark state of a byte count (such as the amount of buffered send data): the count
+    // goes "unwritable" when it reaches `high`, and stays that way until it has dropped back down
+    // to `low` or less.  A `high` of 0 disables the watermarks.
+    struct watermarks
+    {
+        size_t high{0};
+        size_t low{0};
+        bool blocked{false};
+
+        // Updates the state for a new count, returning the new writability if it changed
+        std::optional<bool> update(size_t count)
+        {
+            if (!high)
+                return std::nullopt;
+            if (!blocked && count >= high)
+                return !(blocked = true);
+            if (blocked && count <= low)
+                return !(blocked = false);
+            return std::nullopt;
+        }
+
+        // Replaces the watermarks, starting out unblocked; throws if low isn't below high.
+        void set(size_t h, size_t l)
+        {
+            if (h && l >= h)
+                throw std::invalid_argument{"Invalid watermarks: low watermark must be below the high watermark"};
+            high = h;
+            low = l;
+            blocked = false;
+        }
+    };
 
     // Struct returned as a result of send_packet that either is implicitly
     // convertible to bool, but also is able to carry an error code
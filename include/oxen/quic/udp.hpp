@@ -13,9 +13,16 @@ extern "C"
 
 #include <event2/event.h>
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <optional>
 
 #include "address.hpp"
+#include "buffer_pool.hpp"
+#include "opt.hpp"
+#include "stats.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
@@ -29,6 +36,8 @@ namespace oxen::quic
     using msghdr = ::msghdr;
 #endif
 
+    class UringIO;
+
     // Simple struct wrapping a raw packet and its corresponding information
     struct Packet
     {
@@ -36,17 +45,82 @@ namespace oxen::quic
         bstring_view data;
         ngtcp2_pkt_info pkt_info{};
 
+        /// When the packet arrived, according to the kernel (or NIC), if the socket has receive
+        /// timestamps enabled: converted to the steady clock of get_timestamp(), so that it can be
+        /// handed straight to ngtcp2.  Zero if unknown.
+        std::chrono::nanoseconds received{0};
+
+        /// The pooled receive buffer that `data` points into, if any.  A consumer that needs the
+        /// packet data to outlive the receive callback can hold a copy of this (which just bumps a
+        /// reference count) instead of copying the data; the socket then won't reuse that buffer
+        /// for later reads until it is released.  May be empty (e.g. for packets received via
+        /// io_uring, which uses its own kernel-provided buffers).
+        pooled_buffer buffer;
+
         /// Constructs a packet from a path and data:
         Packet(Path p, bstring_view d) : path{std::move(p)}, data{std::move(d)} {}
 
-        /// Constructs a packet from a local address, data, and the IP header; remote addr and ECN
-        /// data are extracted from the header.
+        /// Constructs a packet from a local address, data, and the IP header; remote addr, ECN
+        /// data, and the kernel receive timestamp (if any) are extracted from the header.
         Packet(const Address& local, bstring_view data, msghdr& hdr);
     };
 
+    /// Interface for receiving packets from a UDPSocket in batches: rather than a callback per
+    /// packet, the socket collects everything it reads in one go (e.g. one recvmmsg call) and hands
+    /// the whole batch over with a single call, which lets the receiver amortize per-packet work
+    /// (such as connection lookups) across consecutive packets.
+    class PacketSink
+    {
+      public:
+        virtual ~PacketSink() = default;
+
+        /// Called with `n` (>= 1) packets, in the order they were received.  The packets may be
+        /// modified or moved from; they, and the data they point at, are only valid until this
+        /// returns (unless the data's `Packet::buffer` is retained).
+        virtual void handle_packets(Packet* pkts, size_t n) = 0;
+    };
+
+    /// Interface of the packet transport underneath an Endpoint: something bound to a local
+    /// address that sends UDP payloads and delivers the ones it receives to a PacketSink.
+    /// UDPSocket is the real one; an endpoint can be given another (such as a SimulatedNetwork
+    /// link, see simulated.hpp) with opt::packet_transport.  All methods are only called from the
+    /// endpoint's event loop thread (except for `stats()`, which can be called from anywhere).
+    class PacketTransport
+    {
+      public:
+        virtual ~PacketTransport() = default;
+
+        /// A run of consecutive packets in a multi-path `send()`, all going out on the same path
+        /// with the same ECN value.  `path` must remain valid for the duration of the send call.
+        struct send_run
+        {
+            const Path* path;
+            uint8_t ecn;
+            size_t n_pkts;
+        };
+
+        /// Returns the bound local address.
+        virtual const Address& address() const = 0;
+
+        /// Sends packets on one path, or on several paths, given as runs; see UDPSocket.
+        virtual std::pair<io_result, size_t> send(
+                const Path& path, const std::byte* bufs, const size_t* bufsize, uint8_t ecn, size_t n_pkts) = 0;
+        virtual std::pair<io_result, size_t> send(
+                const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize) = 0;
+
+        /// Queues a callback to invoke once a blocked transport becomes writeable again.
+        virtual void when_writeable(std::function<void()> cb) = 0;
+
+        /// Returns the send method in use by the transport.
+        virtual SendBackend send_backend() const = 0;
+
+        /// Returns the transport's traffic counters.
+        virtual socket_stats stats() const = 0;
+    };
+
     /// RAII class wrapping a UDP socket; the socket is bound at construction and closed during
     /// destruction.
-    class UDPSocket
+    class UDPSocket final : public PacketTransport
     {
       public:
         using socket_t =
@@ -67,8 +141,33 @@ namespace oxen::quic
         ///
         /// When packets are received they will be fed into the given callback.
         ///
+        /// If `reuseport` is true then SO_REUSEPORT is enabled on the socket before binding so that
+        /// multiple sockets (typically one per event loop) can be bound to the same address; see
+        /// `attach_reuseport_steering`.
+        ///
+        /// `sockopts` sets the socket's buffer sizes and busy polling; see opt::socket_options.
+        /// `max_payload` is the largest UDP payload that will be sent on the socket (see
+        /// opt::max_udp_payload); incoming packets larger than it (or than MAX_PMTUD_UDP_PAYLOAD, if
+        /// that is larger) are dropped.
+        ///
         /// ev_loop must outlive this object.
-        UDPSocket(event_base* ev_loop, const Address& addr, receive_callback_t cb);
+        UDPSocket(
+                event_base* ev_loop,
+                const Address& addr,
+                receive_callback_t cb,
+                bool reuseport = false,
+                const opt::socket_options& sockopts = {},
+                size_t max_payload = MAX_PMTUD_UDP_PAYLOAD);
+
+        /// Same as above, but delivers received packets in batches to the given sink, which must
+        /// outlive this object.
+        UDPSocket(
+                event_base* ev_loop,
+                const Address& addr,
+                PacketSink& sink,
+                bool reuseport = false,
+                const opt::socket_options& sockopts = {},
+                size_t max_payload = MAX_PMTUD_UDP_PAYLOAD);
 
         /// Non-copyable and non-moveable
         UDPSocket(const UDPSocket& s) = delete;
@@ -80,7 +179,7 @@ namespace oxen::quic
         /// the same as the Path's local address for incoming packets (this could be, for instance,
         /// bound to an "any" address, while incoming packets will have the actual IP address the
         /// packet arrived on).
-        const Address& address() const { return bound_; }
+        const Address& address() const override { return bound_; }
 
         /// Attempts to send one or more UDP payloads on a single path.  Returns a pair: an
         /// io_result of either success (all packets were sent), `blocked()` if some or all of the
@@ -99,7 +198,15 @@ namespace oxen::quic
         /// retry however much of the send is remaining (via resend()) and, once the send is fully
         /// completed, resuming creation of new packets.
         std::pair<io_result, size_t> send(
-                const Path& path, const std::byte* bufs, const size_t* bufsize, uint8_t ecn, size_t n_pkts);
+                const Path& path, const std::byte* bufs, const size_t* bufsize, uint8_t ecn, size_t n_pkts) override;
+
+        /// Same as above, but sends one batch of packets going to several different paths (e.g.
+        /// packets of many different connections), as given by a list of `n_runs` runs.  The
+        /// payloads of all the runs are packed sequentially at `bufs`, run after run, with lengths
+        /// in `bufsize`.  The total number of packets must not exceed DATAGRAM_BATCH_SIZE.  The returned
+        /// count of sent packets counts across the runs, in order.
+        std::pair<io_result, size_t> send(
+                const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize) override;
 
         /// Queues a callback to invoke when the UDP socket becomes writeable again.
         ///
@@ -107,22 +214,98 @@ namespace oxen::quic
         /// trigger a resend as soon as the socket blockage clears, and secondly to stop producing
         /// new packets until the blockage clears.  (Note that it is possible for this subsequent
         /// send to block again, in which case the caller should rinse and repeat).
-        void when_writeable(std::function<void()> cb);
+        void when_writeable(std::function<void()> cb) override;
+
+        /// Attaches a kernel steering program to the SO_REUSEPORT group this socket belongs to
+        /// (which must have been constructed with `reuseport` enabled) that delivers each incoming
+        /// QUIC packet to socket `b % group_size` of the group, where `b` is the first byte of the
+        /// packet's destination connection ID and sockets are numbered in the order they were bound.
+        /// Only needs to be called on one socket of the group.
+        ///
+        /// Throws if the platform does not support reuseport steering (currently Linux only).
+        void attach_reuseport_steering(size_t group_size);
+
+        /// Returns true if UDP generic receive offload was successfully enabled on this socket (in
+        /// which case the kernel may coalesce multiple incoming datagrams into a single read, which
+        /// we split back up before passing to the receive callback).
+        bool gro_enabled() const { return gro_; }
+
+        /// Returns the send method currently in use by this socket.  This is chosen at construction
+        /// (the best method compiled in and supported by the kernel) and can later degrade (e.g.
+        /// from GSO to sendmmsg if the NIC turns out not to support GSO).
+        SendBackend send_backend() const override { return send_backend_; }
+
+        /// Returns true if this socket's I/O is being driven by io_uring rather than libevent
+        /// readiness events.  This is only possible when built with -DLIBQUIC_IO_URING=ON, and
+        /// falls back to readiness-based I/O if the running kernel doesn't support io_uring (or
+        /// the multishot receive features we need from it).
+        bool io_uring_enabled() const { return uring_ != nullptr; }
+
+        /// Returns this socket's traffic counters.  These are published by the event loop thread
+        /// after every send and receive batch, and can be read from any thread.
+        socket_stats stats() const override { return stats_.load(); }
 
         /// Closed on destruction
-        ~UDPSocket();
+        ~UDPSocket() override;
 
       private:
-        void process_packet(bstring_view payload, msghdr& hdr);
+        friend class TestHelper;
+
+        UDPSocket(
+                event_base* ev_loop,
+                const Address& addr,
+                PacketSink* sink,
+                std::unique_ptr<PacketSink> owned_sink,
+                bool reuseport,
+                const opt::socket_options& sockopts,
+                size_t max_payload);
+
+        void apply_socket_options(const opt::socket_options& sockopts);
+
+        // Adds a received payload to the pending receive batch (splitting it first if it is a GRO
+        // super-buffer); returns the number of packets added.
+        size_t process_packet(bstring_view payload, msghdr& hdr, const pooled_buffer& owner);
+        // Hands everything collected by process_packet to the sink.
+        void deliver_batch();
         io_result receive();
 
         socket_t sock_;
         Address bound_;
+        size_t max_payload_;
+        bool gro_ = false;
+        // Set if the kernel attaches its receive drop counter (SO_RXQ_OVFL) to received packets,
+        // and the last value of that (32-bit, wrapping) counter we saw
+        bool rxq_ovfl_ = false;
+        uint32_t last_rxq_drops_ = 0;
+        // Set if the kernel timestamps received packets (SO_TIMESTAMPING)
+        bool rx_timestamps_ = false;
+        std::atomic<SendBackend> send_backend_{SendBackend::SENDMSG};
+
+        void select_send_backend();
+
+        // The body of the multi-run send(), which wraps it to update the counters
+        std::pair<io_result, size_t> send_impl(
+                const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize);
+
+        // Traffic counters (only touched from the event loop thread), and their published copy
+        socket_stats counters_;
+        atomic_snapshot<socket_stats> stats_;
+
+        // Pool of receive buffers (each big enough for one packet, or for one GRO super-buffer when
+        // GRO is enabled), and the buffers for the next read.  A buffer is only replaced with a
+        // fresh one from the pool when something downstream kept a reference to it.
+        std::optional<buffer_pool> recv_pool_;
+        std::array<pooled_buffer, DATAGRAM_BATCH_SIZE> recv_bufs_;
+
+        // Set if we are using io_uring for this socket (in which case rev_ is unused)
+        std::unique_ptr<UringIO> uring_;
 
         event_base* ev_ = nullptr;
 
         event_ptr rev_ = nullptr;
-        receive_callback_t receive_callback_;
+        PacketSink* sink_;
+        std::unique_ptr<PacketSink> owned_sink_;  // Set when constructed with a callback
+        std::vector<Packet> recv_batch_;
         event_ptr wev_ = nullptr;
         std::vector<std::function<void()>> writeable_callbacks_;
     };
@@ -45,16 +45,20 @@ namespace oxen::quic
     // the server will call this when it sends the final handshake packet
     // the client will call this when it receives that final handshake packet
     using connection_established_callback = std::function<void(connection_interface& conn)>;
+    using connect_callback = std::function<void(std::shared_ptr<connection_interface> conn)>;
 
     // called when a connection closes or times out before the handshake completes
     using connection_closed_callback = std::function<void(connection_interface& conn, uint64_t ec)>;
 
+    // called when a connection's buffered send data crosses its high or low watermark (see
+    // connection_interface::set_watermarks)
+    using connection_watermark_callback = std::function<void(connection_interface& conn, bool writable)>;
+
     using namespace std::literals;
     using bstring = std::basic_string<std::byte>;
     using ustring = std::basic_string<unsigned char>;
     using bstring_view = std::basic_string_view<std::byte>;
     using ustring_view = std::basic_string_view<unsigned char>;
-    using stream_buffer = std::deque<std::pair<bstring_view, std::shared_ptr<void>>>;
 
     constexpr bool IN_HELL =
 #ifdef _WIN32
@@ -110,6 +114,15 @@ namespace oxen::quic
     inline constexpr std::chrono::seconds DEFAULT_HANDSHAKE_TIMEOUT = 10s;
     inline constexpr std::chrono::seconds DEFAULT_IDLE_TIMEOUT = 30s;
 
+    // Default receive flow control windows (see opt::receive_window)
+    inline constexpr uint64_t DEFAULT_STREAM_RECV_WINDOW = 6_Mi;
+    inline constexpr uint64_t DEFAULT_CONN_RECV_WINDOW = 15_Mi;
+
+    // Stream send urgency levels, following RFC 9218: 0 is the most urgent and 7 the least; streams
+    // (and datagrams) default to 3.
+    inline constexpr uint8_t MAX_URGENCY = 7;
+    inline constexpr uint8_t DEFAULT_URGENCY = 3;
+
     // NGTCP2 sets the path_pmtud_payload to 1200 on connection creation, then discovers upwards
     // to a theoretical max of 1452. In 'lazy' mode, we take in split packets under the current max
     // pmtud size. In 'greedy' mode, we take in up to double the current pmtud size to split amongst
@@ -122,6 +135,20 @@ namespace oxen::quic
     inline constexpr size_t MAX_PMTUD_UDP_PAYLOAD = NGTCP2_MAX_PMTUD_UDP_PAYLOAD_SIZE;    // 1452
     inline constexpr size_t MAX_GREEDY_PMTUD_UDP_PAYLOAD = (MAX_PMTUD_UDP_PAYLOAD << 1);  // 2904
 
+    // The largest UDP payload an endpoint can be configured to send with opt::max_udp_payload: a
+    // 9000-byte jumbo frame, less the same overhead allowance as above.  MAX_PMTUD_UDP_PAYLOAD is
+    // only the default.
+    inline constexpr size_t MAX_JUMBO_UDP_PAYLOAD = 9000 - 48;  // 8952
+
+    // Datagram fragmentation (see opt::fragment_datagrams): as many data fragments as a datagram
+    // can be split into, the header of each fragment (fragment count, fragment index, and 16-bit
+    // message ID), and the defaults for the fragment limit and for the number of partially received
+    // datagrams held at once.
+    inline constexpr int MAX_DATAGRAM_FRAGMENTS = 64;
+    inline constexpr size_t FRAGMENT_HEADER_SIZE = 4;
+    inline constexpr int DEFAULT_DATAGRAM_FRAGMENTS = 16;
+    inline constexpr int DEFAULT_FRAGMENTS_PENDING = 64;
+
     // Maximum number of packets we can send in one batch when using sendmmsg/GSO, and maximum we
     // receive in one batch when using recvmmsg.
     inline constexpr size_t DATAGRAM_BATCH_SIZE = 24;
@@ -132,6 +159,20 @@ namespace oxen::quic
     // we can overrun up to the next integer multiple of DATAGRAM_BATCH_SIZE.
     inline constexpr size_t MAX_RECEIVE_PER_LOOP = 64;
 
+    // Maximum size of a single coalesced receive buffer when UDP GRO (generic receive offload) is
+    // active: the kernel can hand us up to a full 64kiB UDP payload of back-to-back same-sized
+    // datagrams in one read.
+    inline constexpr size_t MAX_GRO_PAYLOAD = 65535;
+
+    // Maximum total size of the segments of a single GSO send, which still has to fit within the
+    // IP length limit as one (IPv4) UDP datagram.  Only a full batch of jumbo payloads gets near it.
+    inline constexpr size_t MAX_GSO_PAYLOAD = 65507;
+
+    // Number of (MAX_GRO_PAYLOAD-sized) buffers we receive into per recvmmsg call when GRO is
+    // active.  (Each of these can contain dozens of packets, so we need far fewer than
+    // DATAGRAM_BATCH_SIZE).
+    inline constexpr size_t GRO_BATCH_SIZE = 8;
+
     // Check if T is an instantiation of templated class `Class`; for example,
     // `is_instantiation<std::basic_string, std::string>` is true.
     template <template <typename...> class Class, typename T>
@@ -184,6 +225,12 @@ namespace oxen::quic
     std::chrono::steady_clock::time_point get_time();
     std::chrono::nanoseconds get_timestamp();
 
+    // Fills `dest` with `len` bytes from GnuTLS's CSPRNG.  Small requests (such as connection IDs
+    // and tokens) are served from a per-thread (and so, per event loop) buffer that is refilled
+    // from gnutls_rnd a block at a time, rather than going into GnuTLS for each one; bytes are
+    // wiped from the buffer as they are handed out.  Returns false if the RNG failed.
+    bool random_bytes(void* dest, size_t len) noexcept;
+
     std::string str_tolower(std::string s);
 
     // Shortcut for a const-preserving `reinterpret_cast`ing c.data() from a std::byte to a uint8_t
@@ -0,0 +1,100 @@
+#include "admission.hpp"
+
+#include <algorithm>
+
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    // How many prefixes we keep rate state for; beyond this the oldest are forgotten early (which
+    // only gives them a fresh burst).
+    static constexpr size_t MAX_TRACKED_PREFIXES = 100'000;
+
+    static admission_control::clock::duration prefix_state_lifetime(const opt::handshake_admission& l)
+    {
+        // Long enough for a bucket to refill completely, so that forgetting it changes nothing
+        auto refill = l.prefix_rate > 0 ? std::chrono::duration<double>{l.prefix_burst / l.prefix_rate}
+                                        : std::chrono::duration<double>{0};
+        return std::max<admission_control::clock::duration>(
+                std::chrono::duration_cast<admission_control::clock::duration>(refill), std::chrono::seconds{10});
+    }
+
+    admission_control::admission_control(opt::handshake_admission limits) :
+            limits{limits},
+            global{limits.retry_rate, clock::now()},
+            prefixes{prefix_state_lifetime(limits), MAX_TRACKED_PREFIXES}
+    {}
+
+    bool admission_control::token_bucket::take(double rate, double burst, clock::time_point now)
+    {
+        if (now > last)
+        {
+            tokens = std::min(burst, tokens + rate * std::chrono::duration<double>{now - last}.count());
+            last = now;
+        }
+        if (tokens < 1)
+            return false;
+        tokens -= 1;
+        return true;
+    }
+
+    ustring admission_control::prefix(const Address& a)
+    {
+        if (a.is_ipv4())
+        {
+            auto* ip = reinterpret_cast<const unsigned char*>(&a.in4().sin_addr.s_addr);
+            return ustring{ip, 3};
+        }
+        auto* ip = a.in6().sin6_addr.s6_addr;
+        if (a.is_ipv4_mapped_ipv6())
+            return ustring{ip + 12, 3};
+        return ustring{ip, 6};
+    }
+
+    admission_control::decision admission_control::admit(const Address& remote, bool validated, clock::time_point now)
+    {
+        if (_stats.pending >= limits.max_pending)
+        {
+            _stats.dropped_pending++;
+            log::debug(log_cat, "Dropping Initial from {}: {} handshakes already pending", remote, _stats.pending);
+            return decision::drop;
+        }
+
+        if (limits.prefix_rate > 0)
+        {
+            auto key = prefix(remote);
+            auto* bucket = prefixes.find(key, now);
+            if (!bucket)
+            {
+                prefixes.insert_or_assign(key, token_bucket{limits.prefix_burst, now}, now);
+                bucket = prefixes.find(key, now);
+            }
+            if (!bucket->take(limits.prefix_rate, limits.prefix_burst, now))
+            {
+                bucket->dropped++;
+                _stats.dropped_prefix++;
+                log::debug(log_cat, "Dropping Initial from {}: source prefix is over its rate limit", remote);
+                return decision::drop;
+            }
+        }
+
+        // Every attempt counts towards the rate, but address-validated clients are let through:
+        // they have already done the Retry round trip, and asking again would just loop.
+        bool over_rate = !global.take(limits.retry_rate, limits.retry_rate, now);
+        if (!validated && (over_rate || _stats.pending >= limits.retry_pending))
+        {
+            _stats.retried++;
+            log::debug(log_cat, "Handshake load high; requiring address validation from {}", remote);
+            return decision::retry;
+        }
+
+        _stats.accepted++;
+        return decision::accept;
+    }
+
+    uint64_t admission_control::prefix_dropped(const Address& remote)
+    {
+        auto* bucket = prefixes.find(prefix(remote));
+        return bucket ? bucket->dropped : 0;
+    }
+}  // namespace oxen::quic
@@ -2,6 +2,7 @@
 
 #include <stdexcept>
 
+#include "instrumentation.hpp"
 #include "internal.hpp"
 
 namespace oxen::quic
@@ -9,7 +10,7 @@ namespace oxen::quic
 
     inline auto bp_cat = oxen::log::Cat("bparser");
 
-    static std::pair<std::ptrdiff_t, std::size_t> get_location(bstring& data, std::string_view substr)
+    static std::pair<std::ptrdiff_t, std::size_t> get_location(bstring_view data, std::string_view substr)
     {
         auto* bsubstr = reinterpret_cast<const std::byte*>(substr.data());
         // Make sure the given substr actually is a substr of data:
@@ -18,30 +19,73 @@ namespace oxen::quic
     }
 
     message::message(BTRequestStream& bp, bstring req, bool is_timeout) :
-            data{std::move(req)}, return_sender{bp.weak_from_this()}, _rid{bp.reference_id}, timed_out{is_timeout}
+            owned{std::move(req)},
+            data{owned},
+            return_sender{bp.weak_from_this()},
+            _rid{bp.reference_id},
+            timed_out{is_timeout}
     {
         if (!is_timeout)
-        {
-            oxenc::bt_list_consumer btlc(data);
+            parse();
+    }
 
-            req_type = get_location(data, btlc.consume_string_view());
-            req_id = btlc.consume_integer<int64_t>();
+    message::message(BTRequestStream& bp, bstring_view req, std::shared_ptr<const std::atomic<uint64_t>> borrow_gen) :
+            data{req},
+            borrow_gen{std::move(borrow_gen)},
+            gen{this->borrow_gen->load(std::memory_order_relaxed)},
+            return_sender{bp.weak_from_this()},
+            _rid{bp.reference_id}
+    {
+        parse();
+    }
 
-            if (type() == TYPE_COMMAND)
-                ep = get_location(data, btlc.consume_string_view());
+    message::message(const message& m) :
+            req_id{m.req_id},
+            owned{bstring_view{m.bytes(), m.data.size()}},
+            data{owned},
+            req_type{m.req_type},
+            ep{m.ep},
+            req_body{m.req_body},
+            return_sender{m.return_sender},
+            _rid{m._rid},
+            timed_out{m.timed_out}
+    {}
+
+    message::message(message&& m) :
+            req_id{m.req_id},
+            owned{std::move(m.owned)},
+            data{m.borrow_gen ? m.data : bstring_view{owned}},
+            borrow_gen{std::move(m.borrow_gen)},
+            gen{m.gen},
+            req_type{m.req_type},
+            ep{m.ep},
+            req_body{m.req_body},
+            return_sender{std::move(m.return_sender)},
+            _rid{m._rid},
+            timed_out{m.timed_out}
+    {}
+
+    void message::parse()
+    {
+        oxenc::bt_list_consumer btlc(data);
 
-            req_body = get_location(data, btlc.consume_string_view());
+        req_type = get_location(data, btlc.consume_string_view());
+        req_id = btlc.consume_integer<int64_t>();
 
-            btlc.finish();
-        }
+        if (type() == TYPE_COMMAND)
+            ep = get_location(data, btlc.consume_string_view());
+
+        req_body = get_location(data, btlc.consume_string_view());
+
+        btlc.finish();
     }
 
-    void message::respond(bstring_view body, bool error) const
+    void message::respond(bstring_view body, std::shared_ptr<void> keep_alive, bool error) const
     {
-        log::trace(bp_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(bp_cat, "{} called", __PRETTY_FUNCTION__);
 
         if (auto ptr = return_sender.lock())
-            ptr->respond(req_id, body, error);
+            ptr->respond(req_id, body, std::move(keep_alive), error);
         else
             log::warning(bp_cat, "BTRequestStream unable to send response: stream has gone away");
     }
@@ -56,44 +100,152 @@ namespace oxen::quic
         log::debug(bp_cat, "Bparser set generic request handler");
         generic_handler = std::move(request_handler);
     }
-    void BTRequestStream::respond(int64_t rid, bstring_view body, bool error)
+    void BTRequestStream::handle_bp_opt(opt::borrowed_messages)
+    {
+        log::debug(bp_cat, "Bparser set to lend out its receive buffer to messages");
+        borrow_messages = true;
+    }
+    void sent_request::queue() &&
+    {
+        auto& s = return_sender;
+        if (!body_keep_alive)
+            return s.send(std::move(data));
+
+        // The header, body and terminator have to be queued back-to-back, so queue them all from
+        // within a single event loop call (where the sends then happen immediately).
+        s.endpoint.call([&s, header = std::move(data), b = body, ka = std::move(body_keep_alive)]() mutable {
+            s.send(std::move(header));
+            s.send(b, std::move(ka));
+            s.send("e"sv);
+        });
+    }
+
+    void command_batch::send()
     {
-        log::trace(bp_cat, "{} called", __PRETTY_FUNCTION__);
+        if (empty())
+            return;
 
-        send(sent_request{*this, encode_response(rid, body, error), rid}.payload());
+        stream.endpoint.call([&s = stream, data = std::move(data), reqs = std::move(reqs)]() mutable {
+            for (auto& r : reqs)
+                s.track_request(r.rid, std::move(r.cb), r.expiry);
+            s.send(std::move(data));
+        });
+
+        data.clear();
+        reqs.clear();
+        count = 0;
     }
 
-    void BTRequestStream::check_timeouts()
+    void BTRequestStream::respond(int64_t rid, bstring_view body, std::shared_ptr<void> keep_alive, bool error)
     {
-        log::trace(bp_cat, "{} called", __PRETTY_FUNCTION__);
-        return check_timeouts(get_time());
+        QUIC_HOT_TRACE(bp_cat, "{} called", __PRETTY_FUNCTION__);
+
+        sent_request{*this, encode_response(rid, body.size(), error), body, rid, std::move(keep_alive)}.queue();
     }
-    void BTRequestStream::check_timeouts(std::optional<std::chrono::steady_clock::time_point> now)
+
+    BTRequestStream::pending_request::pending_request(BTRequestStream& s, timer_wheel& wheel) :
+            stream{s}, timer{wheel, on_timeout, this}
+    {}
+
+    void BTRequestStream::pending_request::on_timeout(void* self)
+    {
+        auto& stream = static_cast<pending_request*>(self)->stream;
+        auto rid = static_cast<pending_request*>(self)->req_id;
+        log::debug(bp_cat, "Request with req_id={} timed out", rid);
+
+        if (auto req = stream.take_request(rid))
+            stream.finish_request(std::move(req), message{stream, ""_bs, true});
+    }
+
+    void BTRequestStream::track_request(int64_t rid, std::function<void(message)> cb, time_point expiry)
     {
-        log::trace(bp_cat, "{} called", __PRETTY_FUNCTION__);
+        std::unique_ptr<pending_request> req;
+        if (req_pool.empty())
+            req = std::make_unique<pending_request>(*this, endpoint.timers());
+        else
+        {
+            req = std::move(req_pool.back());
+            req_pool.pop_back();
+        }
+        req->req_id = rid;
+        req->cb = std::move(cb);
+        req->timer.schedule(expiry);
 
-        while (!sent_reqs.empty())
+        if (pending_reqs.empty())
+            req_base = rid;
+        else if (rid < req_base)
         {
-            auto& f = *sent_reqs.front();
-            if (now && !f.is_expired(*now))
-                return;
-            auto ptr = std::move(sent_reqs.front());
-            sent_reqs.pop_front();
+            // Issued concurrently with a later request that got here first
+            for (; req_base > rid; req_base--)
+                pending_reqs.emplace_front();
+        }
 
-            try
-            {
-                f.cb(std::move(f).to_timeout());
-            }
-            catch (const std::exception& e)
-            {
-                log::error(bp_cat, "Uncaught exception from timeout response handler: {}", e.what());
-            }
+        auto idx = static_cast<size_t>(rid - req_base);
+        if (idx >= pending_reqs.size())
+            pending_reqs.resize(idx + 1);
+        assert(!pending_reqs[idx]);
+        pending_reqs[idx] = std::move(req);
+        num_reqs++;
+    }
+
+    std::unique_ptr<BTRequestStream::pending_request> BTRequestStream::take_request(int64_t rid)
+    {
+        if (rid < req_base || static_cast<uint64_t>(rid - req_base) >= pending_reqs.size())
+            return nullptr;
+
+        auto req = std::move(pending_reqs[rid - req_base]);
+        if (!req)
+            return req;
+        num_reqs--;
+
+        while (!pending_reqs.empty() && !pending_reqs.front())
+        {
+            pending_reqs.pop_front();
+            req_base++;
         }
+        while (!pending_reqs.empty() && !pending_reqs.back())
+            pending_reqs.pop_back();
+
+        return req;
+    }
+
+    void BTRequestStream::finish_request(std::unique_ptr<pending_request> req, message msg)
+    {
+        // Recycle the request before invoking the callback, which might well send another request
+        req->timer.cancel();
+        auto cb = std::move(req->cb);
+        req->cb = nullptr;
+        if (req_pool.size() < REQ_POOL_MAX)
+            req_pool.push_back(std::move(req));
+
+        bool timed_out = msg.timed_out;
+        try
+        {
+            cb(std::move(msg));
+        }
+        catch (const std::exception& e)
+        {
+            log::error(
+                    bp_cat, "Uncaught exception from {} handler: {}", timed_out ? "timeout response" : "response", e.what());
+        }
+    }
+
+    void BTRequestStream::timeout_requests()
+    {
+        QUIC_HOT_TRACE(bp_cat, "{} called", __PRETTY_FUNCTION__);
+
+        auto reqs = std::move(pending_reqs);
+        pending_reqs.clear();
+        num_reqs = 0;
+
+        for (auto& req : reqs)
+            if (req)
+                finish_request(std::move(req), message{*this, ""_bs, true});
     }
 
     void BTRequestStream::receive(bstring_view data)
     {
-        log::trace(bp_cat, "bparser recv data callback called!");
+        QUIC_HOT_TRACE(bp_cat, "bparser recv data callback called!");
 
         if (is_closing())
             return;
@@ -107,6 +259,43 @@ namespace oxen::quic
             log::error(bp_cat, "Exception caught: {}", e.what());
             close(BPARSER_ERROR_EXCEPTION);
         }
+
+        // Any messages that borrowed `data` are no longer valid
+        if (lent)
+        {
+            recv_gen->fetch_add(1, std::memory_order_release);
+            lent = false;
+        }
+    }
+
+    BTRequestStream::~BTRequestStream()
+    {
+        // Streams are normally destroyed on the loop (see Endpoint::make_shared), which is the only
+        // place the request timers may be touched; one released anywhere else goes through it.
+        if (pending_reqs.empty())
+            return;
+        if (endpoint.in_event_loop())
+            cancel_requests();
+        else
+            endpoint.call_get([this] { cancel_requests(); });
+    }
+
+    void BTRequestStream::cancel_requests()
+    {
+        for (auto& req : pending_reqs)
+            if (req)
+                req->timer.cancel();
+        pending_reqs.clear();
+        num_reqs = 0;
+    }
+
+    void BTRequestStream::dropped()
+    {
+        // The connection is going away without closing us (so no callbacks), but the request
+        // timers would still fire into us later
+        if (num_reqs)
+            log::debug(bp_cat, "Stream dropped with {} request(s) pending; discarding them", num_reqs);
+        cancel_requests();
     }
 
     void BTRequestStream::closed(uint64_t app_code)
@@ -115,7 +304,7 @@ namespace oxen::quic
 
         // First time out any pending requests, even if they haven't hit the timer, because we're
         // being closed and so they can never be answered.
-        check_timeouts(std::nullopt);
+        timeout_requests();
 
         if (close_callback)
         {
@@ -132,8 +321,12 @@ namespace oxen::quic
 
     void BTRequestStream::register_handler(std::string ep, std::function<void(message)> func)
     {
-        endpoint.call(
-                [this, ep = std::move(ep), func = std::move(func)]() mutable { func_map[std::move(ep)] = std::move(func); });
+        endpoint.call([this, ep = std::move(ep), func = std::move(func)]() mutable {
+            if (auto it = handler_index.find(ep); it != handler_index.end())
+                return void(handlers[it->second].func = std::move(func));
+            auto& h = handlers.emplace_back(command_handler{std::move(ep), std::move(func)});
+            handler_index.emplace(h.endpoint, handlers.size() - 1);
+        });
     }
 
     void BTRequestStream::register_generic_handler(std::function<void(message)> request_handler)
@@ -144,53 +337,43 @@ namespace oxen::quic
 
     void BTRequestStream::handle_input(message msg)
     {
-        log::trace(bp_cat, "{} called to handle {} input", __PRETTY_FUNCTION__, msg.type());
+        QUIC_HOT_TRACE(bp_cat, "{} called to handle {} input", __PRETTY_FUNCTION__, msg.type());
 
         if (auto type = msg.type(); type == message::TYPE_REPLY || type == message::TYPE_ERROR)
         {
-            log::trace(log_cat, "Looking for request with req_id={}", msg.req_id);
-            // Iterate using forward iterators, s.t. we go highest (newest) rids to lowest (oldest) rids.
-            // As a result, our comparator checks if the sent request ID is greater thanthan the target rid
-            auto itr = std::lower_bound(
-                    sent_reqs.begin(),
-                    sent_reqs.end(),
-                    msg.req_id,
-                    [](const std::shared_ptr<sent_request>& sr, int64_t rid) { return sr->req_id < rid; });
-
-            if (itr != sent_reqs.end())
+            QUIC_HOT_TRACE(log_cat, "Looking for request with req_id={}", msg.req_id);
+
+            if (auto req = take_request(msg.req_id))
             {
-                log::debug(bp_cat, "Successfully matched response to sent request!");
-                auto req = std::move(*itr);
-                sent_reqs.erase(itr);
-                try
-                {
-                    req->cb(std::move(msg));
-                }
-                catch (const std::exception& e)
-                {
-                    log::error(bp_cat, "Uncaught exception from response handler: {}", e.what());
-                }
+                QUIC_HOT_DEBUG(bp_cat, "Successfully matched response to sent request!");
+                finish_request(std::move(req), std::move(msg));
             }
+            else
+                log::debug(bp_cat, "Dropping response to unknown (or timed out) req_id={}", msg.req_id);
             return;
         }
 
         // `msg` likely isn't valid in the exception handlers below, so extract what we need to
-        // send a response anyway:
+        // send a response anyway.  For registered endpoints the name is that of the handler, so we
+        // only need to copy it out of the message when we don't have one.
         const auto req_id = msg.req_id;
-        const auto ep = msg.endpoint_str();
+        std::string_view ep;
+        std::string ep_buf;
         try
         {
-            if (!func_map.empty())
+            if (auto itr = handler_index.find(msg.endpoint()); itr != handler_index.end())
             {
-                if (auto itr = func_map.find(ep); itr != func_map.end())
-                {
-                    log::debug(bp_cat, "Executing request endpoint {}", msg.endpoint());
-                    return itr->second(std::move(msg));
-                }
+                auto& h = handlers[itr->second];
+                ep = h.endpoint;
+                QUIC_HOT_DEBUG(bp_cat, "Executing request endpoint {}", ep);
+                scoped_callback timing{loop_callback::bt_request};
+                return h.func(std::move(msg));
             }
+            ep = ep_buf = msg.endpoint_str();
             if (generic_handler)
             {
-                log::debug(bp_cat, "Executing generic request handler for endpoint {}", msg.endpoint());
+                QUIC_HOT_DEBUG(bp_cat, "Executing generic request handler for endpoint {}", ep);
+                scoped_callback timing{loop_callback::bt_request};
                 return generic_handler(std::move(msg));
             }
             throw no_such_endpoint{};
@@ -213,7 +396,7 @@ namespace oxen::quic
 
     void BTRequestStream::process_incoming(std::string_view req)
     {
-        log::trace(bp_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(bp_cat, "{} called", __PRETTY_FUNCTION__);
 
         while (not req.empty())
         {
@@ -249,6 +432,18 @@ namespace oxen::quic
 
             assert(current_len > 0);  // We shouldn't get out of the above without knowing this
 
+            if (borrow_messages && buf.empty() && req.size() >= current_len)
+            {
+                // The whole request is right here, so hand it off without copying it
+                if (!recv_gen)
+                    recv_gen = std::make_shared<std::atomic<uint64_t>>(0);
+                lent = true;
+                handle_input(message{*this, convert_sv<std::byte>(req.substr(0, current_len)), recv_gen});
+                req.remove_prefix(current_len);
+                current_len = 0;
+                continue;
+            }
+
             if (auto r_size = req.size() + buf.size(); r_size >= current_len)
             {
                 // We have enough data for a complete request, so copy whatever we need to
@@ -278,27 +473,16 @@ namespace oxen::quic
         }
     }
 
-    std::string BTRequestStream::encode_command(std::string_view endpoint, int64_t rid, bstring_view body)
+    std::string BTRequestStream::encode_command(std::string_view endpoint, int64_t rid, size_t body_len)
     {
-        oxenc::bt_list_producer btlp;
-
-        btlp.append(message::TYPE_COMMAND);
-        btlp.append(rid);
-        btlp.append(endpoint);
-        btlp.append(body);
-
-        return std::move(btlp).str();
+        constexpr auto type = message::TYPE_COMMAND;
+        return "l{}:{}i{}e{}:{}{}:"_format(type.size(), type, rid, endpoint.size(), endpoint, body_len);
     }
 
-    std::string BTRequestStream::encode_response(int64_t rid, bstring_view body, bool error)
+    std::string BTRequestStream::encode_response(int64_t rid, size_t body_len, bool error)
     {
-        oxenc::bt_list_producer btlp;
-
-        btlp.append(error ? message::TYPE_ERROR : message::TYPE_REPLY);
-        btlp.append(rid);
-        btlp.append(body);
-
-        return std::move(btlp).str();
+        auto type = error ? message::TYPE_ERROR : message::TYPE_REPLY;
+        return "l{}:{}i{}e{}:"_format(type.size(), type, rid, body_len);
     }
 
     /** Returns:
@@ -310,7 +494,8 @@ namespace oxen::quic
     */
     size_t BTRequestStream::parse_length(std::string_view req)
     {
-        auto pos = req.find_first_of(':');
+        // Only look as far as a valid length prefix could extend
+        auto pos = req.substr(0, MAX_REQ_LEN_ENCODED).find(':');
 
         // request is incomplete with no readable request length
         if (pos == std::string_view::npos)
@@ -344,7 +529,12 @@ namespace oxen::quic
 
     size_t BTRequestStream::num_pending() const
     {
-        return call_get_accessor(&BTRequestStream::num_pending_impl);
+        return _published_buffers.load(std::memory_order_relaxed);
+    }
+
+    size_t BTRequestStream::num_requests() const
+    {
+        return call_get_accessor(&BTRequestStream::num_requests_impl);
     }
 
 }  // namespace oxen::quic
@@ -0,0 +1,131 @@
+#include "buffer_pool.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace oxen::quic
+{
+    namespace detail
+    {
+        struct buffer_pool_core
+        {
+            const size_t buffer_size;
+            const size_t slab_count;
+            // Bytes from one slot header to the next: the header plus the buffer, rounded up so
+            // that every slot starts on a cache line.
+            const size_t stride;
+
+            std::vector<std::unique_ptr<std::byte[]>> slabs;
+            pooled_slot* free_list = nullptr;
+            size_t n_free = 0;
+
+            // Number of outstanding buffers, plus one for the owning buffer_pool; the core (and all
+            // of its slabs) is freed when this drops to zero.
+            size_t refs = 1;
+
+            buffer_pool_core(size_t bufsize, size_t slabsize) :
+                    buffer_size{bufsize},
+                    slab_count{slabsize},
+                    stride{(sizeof(pooled_slot) + bufsize + 63) & ~size_t{63}}
+            {}
+
+            void add_slab()
+            {
+                // The slab itself is over-allocated so that we can align the first slot
+                auto& slab = slabs.emplace_back(new std::byte[stride * slab_count + 64]);
+                auto base = reinterpret_cast<uintptr_t>(slab.get());
+                auto* start = slab.get() + (((base + 63) & ~uintptr_t{63}) - base);
+
+                for (size_t i = slab_count; i-- > 0;)
+                {
+                    auto* s = new (start + i * stride) pooled_slot{this, free_list, 0, 0};
+                    free_list = s;
+                }
+                n_free += slab_count;
+            }
+
+            void unref()
+            {
+                if (--refs == 0)
+                    delete this;
+            }
+        };
+
+        void release_slot(pooled_slot* slot)
+        {
+            auto* core = slot->core;
+            slot->next_free = core->free_list;
+            core->free_list = slot;
+            core->n_free++;
+            core->unref();
+        }
+    }  // namespace detail
+
+    size_t pooled_buffer::capacity() const
+    {
+        return slot ? slot->core->buffer_size : 0;
+    }
+
+    buffer_pool::buffer_pool(size_t buffer_size, size_t slab_count) :
+            core{new detail::buffer_pool_core{buffer_size, slab_count}}
+    {
+        assert(buffer_size > 0 && buffer_size <= UINT32_MAX);
+        assert(slab_count > 0);
+    }
+
+    buffer_pool::~buffer_pool()
+    {
+        core->unref();
+    }
+
+    pooled_buffer buffer_pool::acquire()
+    {
+        if (!core->free_list)
+            core->add_slab();
+
+        auto* slot = core->free_list;
+        core->free_list = slot->next_free;
+        core->n_free--;
+        slot->next_free = nullptr;
+        slot->refs = 1;
+        slot->size = 0;
+        core->refs++;
+        return pooled_buffer{slot};
+    }
+
+    pooled_buffer buffer_pool::copy(bstring_view data)
+    {
+        if (data.size() > core->buffer_size)
+            throw std::length_error{"buffer_pool::copy: data is larger than the pool's buffers"};
+        auto buf = acquire();
+        std::memcpy(buf.data(), data.data(), data.size());
+        buf.resize(data.size());
+        return buf;
+    }
+
+    pooled_buffer buffer_pool::copy_any(bstring_view data)
+    {
+        if (data.size() <= core->buffer_size)
+            return copy(data);
+        // The buffer keeps its (single buffer) pool's memory alive after the pool itself is gone
+        return buffer_pool{data.size(), 1}.copy(data);
+    }
+
+    size_t buffer_pool::buffer_size() const
+    {
+        return core->buffer_size;
+    }
+
+    size_t buffer_pool::allocated() const
+    {
+        return core->slabs.size() * core->slab_count;
+    }
+
+    size_t buffer_pool::available() const
+    {
+        return core->n_free;
+    }
+
+}  // namespace oxen::quic
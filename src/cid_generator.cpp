@@ -0,0 +1,88 @@
+#include "cid_generator.hpp"
+
+#include <array>
+#include <cstring>
+
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    static constexpr size_t AES_BLOCK = 16;
+
+    quic_lb_cid_generator::quic_lb_cid_generator(
+            uint8_t config_id, ustring_view server_id, size_t nonce_len, ustring_view key, bool self_encode_length) :
+            config_id{config_id}, server_id{server_id}, nonce_len{nonce_len}, self_encode_length{self_encode_length}
+    {
+        if (config_id > 6)
+            throw std::invalid_argument{"QUIC-LB config ID must be in [0, 6]"};
+        if (server_id.empty() || server_id.size() > 15)
+            throw std::invalid_argument{"QUIC-LB server ID must be 1 to 15 bytes"};
+        if (nonce_len < 4 || nonce_len > 18 || server_id.size() + nonce_len > 19)
+            throw std::invalid_argument{"QUIC-LB nonce must be 4 to 18 bytes, and at most 19 bytes with the server ID"};
+
+        if (key.empty())
+            return;
+
+        if (key.size() != AES_BLOCK)
+            throw std::invalid_argument{"QUIC-LB encryption key must be 16 bytes"};
+        // The other lengths need the four-pass construction, which we don't implement
+        if (server_id.size() + nonce_len != AES_BLOCK)
+            throw std::invalid_argument{"Encrypted QUIC-LB CIDs require server ID and nonce to total 16 bytes"};
+
+        // A single block of CBC with a zero IV (reset before every block) is ECB
+        std::array<uint8_t, AES_BLOCK> iv{};
+        gnutls_datum_t k{const_cast<uint8_t*>(key.data()), static_cast<unsigned int>(key.size())};
+        gnutls_datum_t i{iv.data(), static_cast<unsigned int>(iv.size())};
+        if (auto rv = gnutls_cipher_init(&cipher, GNUTLS_CIPHER_AES_128_CBC, &k, &i); rv < 0)
+            throw std::runtime_error{"Failed to initialize QUIC-LB cipher: {}"_format(gnutls_strerror(rv))};
+    }
+
+    quic_lb_cid_generator::~quic_lb_cid_generator()
+    {
+        if (cipher)
+            gnutls_cipher_deinit(cipher);
+    }
+
+    bool quic_lb_cid_generator::crypt_block(uint8_t* block, bool encrypt) const
+    {
+        std::array<uint8_t, AES_BLOCK> iv{};
+        std::lock_guard lock{cipher_mutex};
+        gnutls_cipher_set_iv(cipher, iv.data(), iv.size());
+        if (encrypt)
+            return gnutls_cipher_encrypt(cipher, block, AES_BLOCK) == 0;
+        return gnutls_cipher_decrypt(cipher, block, AES_BLOCK) == 0;
+    }
+
+    bool quic_lb_cid_generator::generate(uint8_t* cid)
+    {
+        auto len = length();
+        if (!random_bytes(cid, 1) || !random_bytes(cid + 1 + server_id.size(), nonce_len))
+            return false;
+
+        auto low_bits = self_encode_length ? static_cast<uint8_t>(len - 1) : static_cast<uint8_t>(cid[0] & 0x1f);
+        cid[0] = static_cast<uint8_t>(config_id << 5 | low_bits);
+        std::memcpy(cid + 1, server_id.data(), server_id.size());
+
+        if (cipher && !crypt_block(cid + 1, true))
+        {
+            log::warning(log_cat, "Failed to encrypt QUIC-LB connection ID");
+            return false;
+        }
+        return true;
+    }
+
+    std::optional<ustring> quic_lb_cid_generator::decode_server_id(ustring_view cid) const
+    {
+        if (cid.size() != length() || cid[0] >> 5 != config_id)
+            return std::nullopt;
+
+        if (!cipher)
+            return ustring{cid.substr(1, server_id.size())};
+
+        std::array<uint8_t, AES_BLOCK> block;
+        std::memcpy(block.data(), cid.data() + 1, AES_BLOCK);
+        if (!crypt_block(block.data(), false))
+            return std::nullopt;
+        return ustring{block.data(), server_id.size()};
+    }
+}  // namespace oxen::quic
@@ -14,6 +14,7 @@
 #include "error.hpp"
 #include "format.hpp"
 #include "gnutls_crypto.hpp"
+#include "instrumentation.hpp"
 #include "internal.hpp"
 #include "stream.hpp"
 #include "utils.hpp"
@@ -26,7 +27,7 @@ namespace oxen::quic
     {
         ngtcp2_conn* get_conn(ngtcp2_crypto_conn_ref* conn_ref)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return *static_cast<Connection*>(conn_ref->user_data);
         }
 
@@ -50,21 +51,21 @@ namespace oxen::quic
 
         static int on_ack_datagram(ngtcp2_conn* /* conn */, uint64_t dgram_id, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return static_cast<Connection*>(user_data)->ack_datagram(dgram_id);
         }
 
         static int on_recv_datagram(
                 ngtcp2_conn* /* conn */, uint32_t flags, const uint8_t* data, size_t datalen, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return static_cast<Connection*>(user_data)->recv_datagram(
                     {reinterpret_cast<const std::byte*>(data), datalen}, flags & NGTCP2_STREAM_DATA_FLAG_FIN);
         }
 
         static int on_recv_token(ngtcp2_conn* /* conn */, const uint8_t* token, size_t tokenlen, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return static_cast<Connection*>(user_data)->recv_token(token, tokenlen);
         }
 
@@ -78,7 +79,7 @@ namespace oxen::quic
                 void* user_data,
                 void* /*stream_user_data*/)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return static_cast<Connection*>(user_data)->stream_receive(
                     stream_id, {reinterpret_cast<const std::byte*>(data), datalen}, flags & NGTCP2_STREAM_DATA_FLAG_FIN);
         }
@@ -91,14 +92,14 @@ namespace oxen::quic
                 void* user_data,
                 void* /*stream_user_data*/)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-            log::trace(log_cat, "Ack [{},{}]", offset, offset + datalen);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "Ack [{},{}]", offset, offset + datalen);
             return static_cast<Connection*>(user_data)->stream_ack(stream_id, datalen);
         }
 
         static int on_stream_open(ngtcp2_conn* /*conn*/, int64_t stream_id, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             return static_cast<Connection*>(user_data)->stream_opened(stream_id);
         }
 
@@ -110,7 +111,7 @@ namespace oxen::quic
                 void* user_data,
                 void* /*stream_user_data*/)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             static_cast<Connection*>(user_data)->stream_closed(stream_id, app_error_code);
             return 0;
         }
@@ -123,7 +124,7 @@ namespace oxen::quic
                 void* user_data,
                 void* /*stream_user_data*/)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
             static_cast<Connection*>(user_data)->stream_closed(stream_id, app_error_code);
             return 0;
         }
@@ -133,14 +134,20 @@ namespace oxen::quic
             auto* conn = static_cast<Connection*>(user_data);
             auto dir_str = conn->is_inbound() ? "SERVER"s : "CLIENT"s;
 
-            log::trace(log_cat, "HANDSHAKE COMPLETED on {} connection", dir_str);
+            QUIC_HOT_TRACE(log_cat, "HANDSHAKE COMPLETED on {} connection", dir_str);
 
             int rv = 0;
 
             if (conn->is_inbound())
             {
+                conn->endpoint().inbound_handshake_finished(*conn);
                 rv = conn->server_handshake_completed();
 
+                // A duplicate of a pooled connection is closed without ever being reported
+                if (!conn->endpoint().pool_inbound(*conn))
+                    return rv;
+
+                scoped_callback timing{loop_callback::connection};
                 if (conn->conn_established_cb)
                     conn->conn_established_cb(*conn);
                 else
@@ -158,8 +165,9 @@ namespace oxen::quic
 
             // server should never call this, as it "confirms" on handshake completed
             assert(conn->is_outbound());
-            log::trace(log_cat, "HANDSHAKE CONFIRMED on CLIENT connection");
+            QUIC_HOT_TRACE(log_cat, "HANDSHAKE CONFIRMED on CLIENT connection");
 
+            scoped_callback timing{loop_callback::connection};
             if (conn->conn_established_cb)
                 conn->conn_established_cb(*conn);
             else
@@ -171,7 +179,7 @@ namespace oxen::quic
         static void rand_cb(uint8_t* dest, size_t destlen, const ngtcp2_rand_ctx* rand_ctx)
         {
             (void)rand_ctx;
-            (void)gnutls_rnd(GNUTLS_RND_RANDOM, dest, destlen);
+            (void)random_bytes(dest, destlen);
         }
 
         static int on_connection_id_status(
@@ -186,7 +194,7 @@ namespace oxen::quic
 
             auto dir_str = conn->is_inbound() ? "SERVER"s : "CLIENT"s;
             auto action = type == NGTCP2_CONNECTION_ID_STATUS_TYPE_ACTIVATE ? "ACTIVATING"s : "DEACTIVATING"s;
-            log::trace(log_cat, "{} {} DCID:{}", dir_str, action, oxenc::to_hex(cid->data, cid->data + cid->datalen));
+            QUIC_HOT_TRACE(log_cat, "{} {} DCID:{}", dir_str, action, oxenc::to_hex(cid->data, cid->data + cid->datalen));
 
             // auto& ep = conn->endpoint();
 
@@ -208,21 +216,21 @@ namespace oxen::quic
         static int get_new_connection_id(
                 ngtcp2_conn* /* _conn */, ngtcp2_cid* cid, uint8_t* token, size_t cidlen, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-
-            if (gnutls_rnd(GNUTLS_RND_RANDOM, cid->data, cidlen) != 0)
-                return NGTCP2_ERR_CALLBACK_FAILURE;
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
-            cid->datalen = cidlen;
             auto* conn = static_cast<Connection*>(user_data);
             auto& ep = conn->endpoint();
+            // ngtcp2 asks for CIDs of the same length as the connection's initial SCID
+            if (cidlen != ep.cid_length() || !ep.generate_cid(cid->data))
+                return NGTCP2_ERR_CALLBACK_FAILURE;
+            cid->datalen = cidlen;
 
             if (ngtcp2_crypto_generate_stateless_reset_token(
                         token, ep._static_secret.data(), ep._static_secret.size(), cid) != 0)
                 return NGTCP2_ERR_CALLBACK_FAILURE;
 
             auto dir_str = conn->is_outbound() ? "CLIENT"s : "SERVER"s;
-            log::trace(log_cat, "{} generated new CID for {}", dir_str, conn->reference_id());
+            QUIC_HOT_TRACE(log_cat, "{} generated new CID for {}", dir_str, conn->reference_id());
             ep.associate_cid(cid, *conn);
 
             // TODO: send new stateless reset token
@@ -235,11 +243,11 @@ namespace oxen::quic
 
         static int remove_connection_id(ngtcp2_conn* /* _conn */, const ngtcp2_cid* cid, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
             auto* conn = static_cast<Connection*>(user_data);
             auto dir_str = conn->is_outbound() ? "CLIENT"s : "SERVER"s;
-            log::trace(log_cat, "{} dissociating CID for {}", dir_str, conn->reference_id());
+            QUIC_HOT_TRACE(log_cat, "{} dissociating CID for {}", dir_str, conn->reference_id());
             conn->endpoint().dissociate_cid(cid, *conn);
 
             return 0;
@@ -248,7 +256,7 @@ namespace oxen::quic
         static int extend_max_local_streams_bidi(
                 [[maybe_unused]] ngtcp2_conn* _conn, uint64_t /*max_streams*/, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
             auto& conn = *static_cast<Connection*>(user_data);
             assert(_conn == conn);
@@ -267,14 +275,14 @@ namespace oxen::quic
                 ngtcp2_path_validation_result res,
                 void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
             auto& conn = *static_cast<Connection*>(user_data);
             assert(_conn == conn);
 
             if (conn.is_outbound())
             {
-                log::trace(log_cat, "Client updating remote addr...");
+                QUIC_HOT_TRACE(log_cat, "Client updating remote addr...");
                 conn.set_remote_addr(path->remote);
 
                 return 0;
@@ -295,7 +303,7 @@ namespace oxen::quic
 
         static int on_early_data_rejected(ngtcp2_conn* _conn, void* user_data)
         {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
             auto& conn = *static_cast<Connection*>(user_data);
             assert(_conn == conn);
@@ -305,11 +313,71 @@ namespace oxen::quic
 
             return 0;
         }
+
+        // The callbacks only depend on the connection's direction and whether datagrams are
+        // enabled, so rather than filling a table in for every connection we build the four
+        // possible tables once and hand ngtcp2 (which copies it) the right one.
+        static const ngtcp2_callbacks& table(bool outbound, bool datagrams)
+        {
+            static const std::array<ngtcp2_callbacks, 4> tables = [] {
+                std::array<ngtcp2_callbacks, 4> t{};
+                for (size_t i = 0; i < t.size(); i++)
+                    t[i] = make_table(i & 1, i & 2);
+                return t;
+            }();
+            return tables[(outbound ? 1 : 0) | (datagrams ? 2 : 0)];
+        }
+
+        static ngtcp2_callbacks make_table(bool outbound, bool datagrams)
+        {
+            ngtcp2_callbacks callbacks{};
+            callbacks.recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb;
+            callbacks.path_validation = on_path_validation;
+            callbacks.encrypt = ngtcp2_crypto_encrypt_cb;
+            callbacks.decrypt = ngtcp2_crypto_decrypt_cb;
+            callbacks.hp_mask = ngtcp2_crypto_hp_mask_cb;
+            callbacks.recv_stream_data = on_recv_stream_data;
+            callbacks.acked_stream_data_offset = on_acked_stream_data_offset;
+            callbacks.stream_close = on_stream_close;
+            callbacks.extend_max_local_streams_bidi = extend_max_local_streams_bidi;
+            callbacks.rand = rand_cb;
+            callbacks.get_new_connection_id = get_new_connection_id;
+            callbacks.remove_connection_id = remove_connection_id;
+            callbacks.dcid_status = on_connection_id_status;
+            callbacks.update_key = ngtcp2_crypto_update_key_cb;
+            callbacks.stream_reset = on_stream_reset;
+            callbacks.delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb;
+            callbacks.delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb;
+            callbacks.get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb;
+            callbacks.version_negotiation = ngtcp2_crypto_version_negotiation_cb;
+            callbacks.stream_open = on_stream_open;
+            callbacks.handshake_completed = on_handshake_completed;
+
+            if (datagrams)
+            {
+                callbacks.recv_datagram = on_recv_datagram;
+#ifndef NDEBUG
+                callbacks.ack_datagram = on_ack_datagram;
+#endif
+            }
+
+            if (outbound)
+            {
+                callbacks.client_initial = ngtcp2_crypto_client_initial_cb;
+                callbacks.handshake_confirmed = on_handshake_confirmed;
+                callbacks.recv_retry = ngtcp2_crypto_recv_retry_cb;
+                callbacks.recv_new_token = on_recv_token;
+            }
+            else
+                callbacks.recv_client_initial = ngtcp2_crypto_recv_client_initial_cb;
+
+            return callbacks;
+        }
     };
 
     void Connection::set_close_quietly()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         _close_quietly = true;
     }
@@ -358,46 +426,33 @@ namespace oxen::quic
 
     int Connection::client_handshake_completed()
     {
-        /** TODO:
-            This section will be uncommented and finished upon completion of 0RTT and session resumption capabilities.
-                - If early data is NOT ACCEPTED, then the call to ngtcp2_conn_tls_early_data_rejected must be invoked
-                to reset aspects of connection state prior to early data rejection.
-                - If early data is ACCEPTED, then we can open streams and start doing things immediately. At that point,
-                we should encode and store 0RTT transport parameters.
-            Moreover, decoding and setting 0RTT transport parameters must be handled in connection creation. Both that
-            location and the required callbacks are comment-blocked in the relevant location.
-        */
-        // if (not tls_session->get_early_data_accepted())
-        //{
-        // log::info(log_cat, "Early data was rejected by server!");
-
-        // if (auto rv = ngtcp2_conn_tls_early_data_rejected(conn.get()); rv != 0)
-        // {
-        //     log::error(log_cat, "ngtcp2_conn_tls_early_data_rejected: {}", ngtcp2_strerror(rv));
-        //     return -1;
-        // }
-        //}
-
-        // ustring data;
-        // data.resize(256);
-
-        // if (auto len = ngtcp2_conn_encode_0rtt_transport_params(conn.get(), data.data(), data.size()); len > 0)
-        // {
-        //     _endpoint.store_0rtt_transport_params(remote_pubkey, data);
-        //     log::info(log_cat, "Client encoded and stored 0rtt transport params");
-        // }
-        // else
-        // {
-        //     log::warning(log_cat, "Client could not encode 0-RTT transport parameters: {}", ngtcp2_strerror(len));
-        // }
+        if (tls_session->is_resumed() && !_is_validated && !validate_resumed_session())
+            return -1;
+
+        if (_attempted_0rtt && !tls_session->get_early_data_accepted())
+        {
+            log::info(log_cat, "Early data was rejected by server!");
+            _endpoint._session_cache->remove(remote_pubkey);
+
+            if (!ngtcp2_conn_get_tls_early_data_rejected(conn.get()))
+            {
+                if (auto rv = ngtcp2_conn_tls_early_data_rejected(conn.get()); rv != 0)
+                {
+                    log::error(log_cat, "ngtcp2_conn_tls_early_data_rejected: {}", ngtcp2_strerror(rv));
+                    return -1;
+                }
+            }
+        }
 
         return 0;
     }
 
     int Connection::server_handshake_completed()
     {
-        // TODO: uncomment this when 0rtt is implemented
-        // tls_session->send_session_ticket();
+        if (tls_session->is_resumed() && !_is_validated && !validate_resumed_session())
+            return -1;
+
+        tls_session->send_session_ticket();
 
         auto path = ngtcp2_conn_get_path(conn.get());
         auto now = get_timestamp().count();
@@ -427,6 +482,64 @@ namespace oxen::quic
         return 0;
     }
 
+    void Connection::store_session_ticket(ustring tls_data)
+    {
+        auto& cache = _endpoint._session_cache;
+        if (!cache || remote_pubkey.empty())
+            return;
+
+        std::array<uint8_t, 256> params;
+        auto len = ngtcp2_conn_encode_0rtt_transport_params(conn.get(), params.data(), params.size());
+        if (len < 0)
+        {
+            log::warning(log_cat, "Client could not encode 0-RTT transport parameters: {}", ngtcp2_strerror(len));
+            return;
+        }
+
+        ustring transport_params{params.data(), static_cast<size_t>(len)};
+        cache->store(
+                remote_pubkey,
+                session_ticket{std::move(tls_data), std::move(transport_params), std::chrono::system_clock::now()});
+        log::debug(log_cat, "Client stored session ticket for 0-RTT resumption");
+    }
+
+    void Connection::try_resume_session()
+    {
+        assert(is_outbound());
+        auto ticket = _endpoint._session_cache->load(remote_pubkey);
+        if (!ticket)
+            return;
+
+        if (!tls_session->set_resumption_data(ticket->tls_data))
+        {
+            _endpoint._session_cache->remove(remote_pubkey);
+            return;
+        }
+
+        if (auto rv = ngtcp2_conn_decode_and_set_0rtt_transport_params(
+                    conn.get(), ticket->transport_params.data(), ticket->transport_params.size());
+            rv != 0)
+        {
+            // We can still resume the session, just without sending early data
+            log::warning(log_cat, "Client failed to decode and set 0-RTT transport params: {}", ngtcp2_strerror(rv));
+            return;
+        }
+
+        _attempted_0rtt = true;
+        log::debug(log_cat, "Client resuming session with 0-RTT");
+    }
+
+    bool Connection::validate_resumed_session()
+    {
+        auto* session = dynamic_cast<GNUTLSSession*>(get_session());
+        bool success = session && (!session->creds.using_raw_pk || session->validate_remote_key());
+        if (success)
+            set_validated();
+        else
+            log::error(log_cat, "Unable to validate peer key of resumed session; rejecting connection!");
+        return success;
+    }
+
     void Connection::set_validated()
     {
         _is_validated = true;
@@ -476,9 +589,11 @@ namespace oxen::quic
 
     void Connection::halt_events()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         packet_io_trigger.reset();
         packet_retransmit_timer.reset();
+        hibernate_timer.reset();
+        send_cap_timer.reset();
         log::debug(log_cat, "Connection ({}) io trigger/retransmit timer events halted", reference_id());
     }
 
@@ -486,9 +601,83 @@ namespace oxen::quic
     {
         if (packet_io_trigger)
             event_active(packet_io_trigger.get(), 0, 0);
+        else if (_hibernating && packet_retransmit_timer)
+            // Hibernating connections give up their trigger event, so just send whatever (typically
+            // an ACK for a keep-alive) needs sending right away
+            on_packet_io_ready();
         // else we've reset the trigger (via halt_events), which means the connection is closing/draining/etc.
     }
 
+    void Connection::app_data_ready()
+    {
+        note_activity();
+        if (_cork_depth > 0)
+            _cork_pending = true;
+        else
+            packet_io_ready();
+    }
+
+    void Connection::cork()
+    {
+        _endpoint.call([this] { _cork_depth++; });
+    }
+
+    void Connection::set_watermarks(size_t high, size_t low, connection_watermark_callback cb)
+    {
+        if (high && low >= high)
+            throw std::invalid_argument{"Invalid watermarks: low watermark must be below the high watermark"};
+        _endpoint.call([this, high, low, cb = std::move(cb)]() mutable {
+            _watermarks.set(high, low);
+            watermark_cb = std::move(cb);
+            update_watermarks();
+        });
+    }
+
+    uint64_t Connection::send_window_estimate() const
+    {
+        ngtcp2_conn_info info;
+        ngtcp2_conn_get_conn_info(conn.get(), &info);
+        return info.cwnd;
+    }
+
+    void Connection::stream_buffered_changed(Stream& s, size_t size)
+    {
+        _buffered += size - s._conn_buffered;
+        s._conn_buffered = size;
+        update_watermarks();
+    }
+
+    void Connection::update_watermarks()
+    {
+        if (auto writable = _watermarks.update(_buffered); writable && watermark_cb)
+        {
+            log::debug(log_cat, "Connection ({}) is now {}writable", reference_id(), *writable ? "" : "un");
+            try
+            {
+                watermark_cb(*this, *writable);
+            }
+            catch (const std::exception& e)
+            {
+                log::error(log_cat, "Uncaught exception from connection watermark callback: {}", e.what());
+            }
+        }
+    }
+
+    void Connection::uncork()
+    {
+        // Hold a reference until this runs: a scoped_cork might be dropping the last reference to
+        // us outside the event loop.
+        _endpoint.call([this, self = shared_from_this()] {
+            if (_cork_depth == 0)
+            {
+                log::warning(log_cat, "Connection ({}) uncork() called without a matching cork()", reference_id());
+                return;
+            }
+            if (--_cork_depth == 0 && std::exchange(_cork_pending, false))
+                packet_io_ready();
+        });
+    }
+
     void Connection::close_connection(uint64_t error_code)
     {
         _endpoint.close_connection(*this, io_error{error_code});
@@ -498,7 +687,7 @@ namespace oxen::quic
     {
         if (auto rv = ngtcp2_conn_in_closing_period(*this); rv != 0)
         {
-            log::trace(
+            QUIC_HOT_TRACE(
                     log_cat,
                     "Note: {} connection {} in closing period; dropping packet",
                     is_inbound() ? "server" : "client",
@@ -513,31 +702,44 @@ namespace oxen::quic
         }
 
         if (read_packet(pkt).success())
-            log::trace(log_cat, "done with incoming packet");
+            QUIC_HOT_TRACE(log_cat, "done with incoming packet");
         else
-            log::trace(log_cat, "read packet failed");  // error will be already logged
+            QUIC_HOT_TRACE(log_cat, "read packet failed");  // error will be already logged
     }
 
     io_result Connection::read_packet(const Packet& pkt)
     {
-        auto ts = get_timestamp().count();
-        log::trace(log_cat, "Calling ngtcp2_conn_read_pkt...");
+        _counters.packets_received++;
+        _counters.bytes_received += pkt.data.size();
+
+        // Use the kernel's receive time when we have it, so that time the packet spent waiting for
+        // us to read it doesn't count towards RTT samples and ack delays.
+        const uint64_t now = get_timestamp().count();
+        uint64_t ts = now;
+        if (pkt.received.count() > 0)
+            ts = std::min<uint64_t>(pkt.received.count(), now);
+        ts = ngtcp2_ts(ts);
+        QUIC_HOT_TRACE(log_cat, "Calling ngtcp2_conn_read_pkt...");
         auto rv = ngtcp2_conn_read_pkt(*this, pkt.path, &pkt.pkt_info, u8data(pkt.data), pkt.data.size(), ts);
 
+        // Incoming packets are what move the path MTU (through PMTUD probe acks, the remote's
+        // transport parameters, and migration), so this is where the max datagram size changes
+        get_max_datagram_size_impl();
+
         switch (rv)
         {
             case 0:
                 packet_io_ready();
                 break;
             case NGTCP2_ERR_DRAINING:
-                log::trace(log_cat, "Note: {} is draining; signaling endpoint to drain connection", reference_id());
+                QUIC_HOT_TRACE(log_cat, "Note: {} is draining; signaling endpoint to drain connection", reference_id());
                 _endpoint.call([this]() {
                     log::debug(log_cat, "Endpoint draining connection {}", reference_id());
                     _endpoint.drain_connection(*this);
                 });
                 break;
             case NGTCP2_ERR_PROTO:
-                log::trace(
+                QUIC_HOT_TRACE(
                         log_cat,
                         "Note: {} encountered error {}; signaling endpoint to close connection",
                         reference_id(),
@@ -547,7 +749,7 @@ namespace oxen::quic
                 break;
             case NGTCP2_ERR_DROP_CONN:
                 // drop connection without calling ngtcp2_conn_write_connection_close()
-                log::trace(
+                QUIC_HOT_TRACE(
                         log_cat,
                         "Note: {} encountered ngtcp2 error {}; signaling endpoint to delete connection",
                         reference_id(),
@@ -559,7 +761,7 @@ namespace oxen::quic
                 break;
             case NGTCP2_ERR_CRYPTO:
                 // drop conn without calling ngtcp2_conn_write_connection_close()
-                log::trace(
+                QUIC_HOT_TRACE(
                         log_cat,
                         "Note: {} {} encountered ngtcp2 crypto error {} (code: {}); signaling endpoint to delete "
                         "connection",
@@ -573,7 +775,7 @@ namespace oxen::quic
                 });
                 break;
             default:
-                log::trace(
+                QUIC_HOT_TRACE(
                         log_cat,
                         "Note: {} encountered error {}; signaling endpoint to close connection",
                         reference_id(),
@@ -593,7 +795,7 @@ namespace oxen::quic
     // if none of the pending streams are ready, the new stream really shouldn't be ready, but here we are
     void Connection::check_pending_streams(uint64_t available)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         uint64_t popped = 0;
 
         while (!pending_streams.empty() && popped < available)
@@ -605,8 +807,9 @@ namespace oxen::quic
                 log::debug(log_cat, "Stream [ID:{}] ready for broadcast, moving out of pending streams", str->_stream_id);
                 str->set_ready();
                 popped += 1;
-                _streams[str->_stream_id] = std::move(str);
+                _streams.insert(str->_stream_id, std::move(str));
                 pending_streams.pop_front();
+                streams_changed();
             }
             else
                 return;
@@ -632,6 +835,7 @@ namespace oxen::quic
             std::function<std::shared_ptr<Stream>(Connection& c, Endpoint& e)> make_stream)
     {
         return _endpoint.call_get([this, &make_stream]() {
+            note_activity();
             std::shared_ptr<Stream> stream;
             if (make_stream)
                 stream = make_stream(*this, _endpoint);
@@ -642,10 +846,9 @@ namespace oxen::quic
             stream->_stream_id = next_incoming_stream_id;
             next_incoming_stream_id += 4;
 
-            log::trace(log_cat, "{} queuing new incoming stream for id {}", direction_str(), stream->_stream_id);
-            auto& str = _stream_queue[stream->_stream_id];
-            str = std::move(stream);
-            return str;
+            QUIC_HOT_TRACE(log_cat, "{} queuing new incoming stream for id {}", direction_str(), stream->_stream_id);
+            watch_timeouts(*stream);
+            return _stream_queue.insert(stream->_stream_id, std::move(stream));
         });
     }
 
@@ -670,16 +873,19 @@ namespace oxen::quic
             {
                 log::debug(log_cat, "Stream not ready [Code: {}]; adding to pending streams list", ngtcp2_strerror(rv));
                 assert(!stream->_ready);
+                watch_timeouts(*stream);
                 pending_streams.push_back(std::move(stream));
+                streams_changed();
                 return pending_streams.back();
             }
             else
             {
                 log::debug(log_cat, "Stream {} successfully created; ready to broadcast", stream->_stream_id);
                 stream->set_ready();
-                auto& strm = _streams[stream->_stream_id];
-                strm = std::move(stream);
-                return strm;
+                watch_timeouts(*stream);
+                auto& inserted = _streams.insert(stream->_stream_id, std::move(stream));
+                streams_changed();
+                return inserted;
             }
         });
     }
@@ -692,11 +898,11 @@ namespace oxen::quic
     std::shared_ptr<Stream> Connection::get_stream_impl(int64_t id)
     {
         return _endpoint.call_get([this, id]() -> std::shared_ptr<Stream> {
-            if (auto it = _streams.find(id); it != _streams.end())
-                return it->second;
+            if (auto* s = _streams.find(id))
+                return *s;
 
-            if (auto it = _stream_queue.find(id); it != _stream_queue.end())
-                return it->second;
+            if (auto* s = _stream_queue.find(id))
+                return *s;
 
             return nullptr;
         });
@@ -712,6 +918,99 @@ namespace oxen::quic
         auto ts = get_time();
         flush_packets(ts);
         schedule_packet_retransmit(ts);
+        update_stats();
+    }
+
+    void Connection::update_stats()
+    {
+        ngtcp2_conn_info info;
+        ngtcp2_conn_get_conn_info(conn.get(), &info);
+
+        auto& c = _counters;
+        c.smoothed_rtt = std::chrono::nanoseconds{info.smoothed_rtt};
+        c.min_rtt = std::chrono::nanoseconds{info.min_rtt};
+        c.latest_rtt = std::chrono::nanoseconds{info.latest_rtt};
+        c.rtt_variance = std::chrono::nanoseconds{info.rttvar};
+        c.cwnd = info.cwnd;
+        c.ssthresh = info.ssthresh;
+        c.bytes_in_flight = info.bytes_in_flight;
+        c.max_udp_payload = ngtcp2_conn_get_path_max_tx_udp_payload_size(conn.get());
+#if NGTCP2_VERSION_NUM >= 0x010400
+        // Losses also count towards the endpoint's totals
+        _endpoint._packets_lost.fetch_add(info.pkt_lost - c.packets_lost, std::memory_order_relaxed);
+        _endpoint._bytes_lost.fetch_add(info.bytes_lost - c.bytes_lost, std::memory_order_relaxed);
+        c.packets_lost = info.pkt_lost;
+        c.bytes_lost = info.bytes_lost;
+#endif
+
+        _stats.store(c);
+    }
+
+    void Connection::make_packet_io_trigger()
+    {
+        packet_io_trigger.reset(event_new(
+                endpoint().get_loop().get(),
+                -1,
+                0,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<Connection*>(self)->on_packet_io_ready();
+                },
+                this));
+    }
+
+    void Connection::note_activity()
+    {
+        _activity++;
+        if (_hibernating)
+            wake();
+    }
+
+    void Connection::check_hibernation()
+    {
+        bool idle = _activity == _activity_checked && _streams.empty() && _stream_queue.empty() &&
+                    pending_streams.empty() && _buffered == 0 && !blocked && ngtcp2_conn_get_handshake_completed(*this);
+        if (!idle)
+        {
+            _activity_checked = _activity;
+            hibernate_timer->schedule_after(context->config.hibernate);
+            return;
+        }
+        hibernate();
+    }
+
+    void Connection::hibernate()
+    {
+        log::debug(log_cat, "Connection ({}) is idle; hibernating", reference_id());
+        _hibernating = true;
+
+        // Send anything the trigger was about to before giving it up
+        if (packet_io_trigger)
+        {
+            on_packet_io_ready();
+            packet_io_trigger.reset();
+        }
+
+        if (datagrams)
+        {
+            datagrams->recv_buffer.release();
+            datagrams->frag_buffer.release();
+        }
+        _streams.shrink_to_fit();
+        _stream_queue.shrink_to_fit();
+        pending_streams.shrink_to_fit();
+    }
+
+    void Connection::wake()
+    {
+        log::debug(log_cat, "Connection ({}) waking from hibernation", reference_id());
+        _hibernating = false;
+        _activity_checked = _activity;
+        if (packet_retransmit_timer)
+        {
+            make_packet_io_trigger();
+            hibernate_timer->schedule_after(context->config.hibernate);
+        }
     }
 
     // RAII class for calling ngtcp2_conn_update_pkt_tx_timer.  If you don't call cancel() on
@@ -738,37 +1037,52 @@ namespace oxen::quic
         }
     };
 
-    // Sends the current `n_packets` packets queued in `send_buffer` with individual lengths
-    // `send_buffer_size`.
+    // Sends the current `n_packets` packets packed at `buf` with individual lengths `bufsize`.
+    // (Typically these just get copied into the endpoint's egress batch, to go out along with
+    // other connections' packets at the end of the event loop iteration).
     //
     // Returns true if the caller can keep on sending, false if the caller should return
     // immediately (i.e. because either an error occured or the socket is blocked).
     //
-    // In the case where the socket is blocked, this sets up an event to wait for it to become
-    // unblocked, at which point we'll re-enter flush_streams (which will finish off the pending
-    // packets before continuing).
+    // In the case where the socket is blocked, this moves the unsent packets into `blocked` (if not
+    // already there) and sets up an event to wait for it to become unblocked, at which point we
+    // send those and then re-enter flush_streams.
     //
     // If pkt_updater is provided then we cancel it when an error (other than a block) occurs.
-    bool Connection::send(pkt_tx_timer_updater* pkt_updater)
+    bool Connection::send(std::byte* buf, size_t* bufsize, pkt_tx_timer_updater* pkt_updater)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         assert(n_packets > 0 && n_packets <= MAX_BATCH);
 
         if (debug_datagram_flip_flop_enabled)
         {
             debug_datagram_counter += n_packets;
-            log::debug(log_cat, "enable_datagram_flip_flop_test is true; sent packet count: {}", debug_datagram_counter);
+            QUIC_HOT_DEBUG(log_cat, "enable_datagram_flip_flop_test is true; sent packet count: {}", debug_datagram_counter);
         }
 
-        auto rv = endpoint().send_packets(_path, send_buffer.data(), send_buffer_size.data(), send_ecn, n_packets);
+        const auto sending = n_packets;
+        const auto sending_bytes = std::accumulate(bufsize, bufsize + n_packets, uint64_t{0});
+
+        auto rv = endpoint().queue_packets(_path, buf, bufsize, send_ecn, n_packets);
 
         if (rv.blocked())
         {
             assert(n_packets > 0);  // n_packets, buf, bufsize now contain the unsent packets
-            log::debug(log_cat, "Packet send blocked; queuing re-send");
+            _counters.packets_sent += sending - n_packets;
+            _counters.bytes_sent += sending_bytes - std::accumulate(bufsize, bufsize + n_packets, uint64_t{0});
+            _counters.send_blocked++;
+            QUIC_HOT_DEBUG(log_cat, "Packet send blocked; queuing re-send");
+
+            if (!blocked || buf != blocked->buf.data())
+            {
+                if (!blocked)
+                    blocked = std::make_unique<blocked_packets>();
+                blocked->buf.assign(buf, buf + std::accumulate(bufsize, bufsize + n_packets, size_t{0}));
+                std::copy(bufsize, bufsize + n_packets, blocked->sizes.begin());
+            }
 
             _endpoint.get_socket()->when_writeable([this] {
-                if (send(nullptr))
+                if (send(blocked->buf.data(), blocked->sizes.data()))
                 {  // Send finished so we can start our timers up again
                     packet_io_ready();
                 }
@@ -777,7 +1091,17 @@ namespace oxen::quic
 
             return false;
         }
-        else if (rv.failure())
+
+        if (blocked)
+            blocked.reset();
+
+        if (rv.success())
+        {
+            _counters.packets_sent += sending;
+            _counters.bytes_sent += sending_bytes;
+        }
+
+        if (rv.failure())
         {
             log::warning(log_cat, "Error while trying to send packet: {}", rv.str_error());
             if (pkt_updater)
@@ -791,10 +1115,26 @@ namespace oxen::quic
             return false;
         }
 
-        log::trace(log_cat, "Packets away!");
+        QUIC_HOT_TRACE(log_cat, "Packets away!");
         return true;
     }
 
+    void Connection::send_rate_cap::refill(std::chrono::steady_clock::time_point now)
+    {
+        if (!rate)
+            return;
+        const double burst = std::max(rate / 50.0, 4.0 * MAX_PMTUD_UDP_PAYLOAD);
+        tokens = std::min(burst, tokens + rate * std::chrono::duration<double>{now - last}.count());
+        last = now;
+    }
+
+    std::chrono::nanoseconds Connection::send_rate_cap::wait() const
+    {
+        if (allows())
+            return 0ns;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>{(1 - tokens) / rate});
+    }
+
     // Don't worry about seeding this because it doesn't matter at all if the stream selection below
     // is predictable, we just want to shuffle it.
     thread_local std::mt19937 stream_start_rng{};
@@ -805,50 +1145,67 @@ namespace oxen::quic
         // schedule another event loop call of ourselves (so that we don't starve the loop)
         const auto max_udp_payload_size = ngtcp2_conn_get_path_max_tx_udp_payload_size(conn.get());
         const auto max_stream_packets = ngtcp2_conn_get_send_quantum(conn.get()) / max_udp_payload_size;
-        auto ts = static_cast<uint64_t>(std::chrono::nanoseconds{tp.time_since_epoch()}.count());
+        auto ts = ngtcp2_ts(static_cast<uint64_t>(std::chrono::nanoseconds{tp.time_since_epoch()}.count()));
 
         if (n_packets > 0)
         {
             // We're blocked from a previous call, and haven't finished sending all our packets yet
             // so there's nothing to do for now (once the packets are fully sent we'll get called
             // again so that we can keep working on sending).
-            log::trace(log_cat, "Skipping this flush_streams call; we still have {} queued packets", n_packets);
+            QUIC_HOT_TRACE(log_cat, "Skipping this flush_streams call; we still have {} queued packets", n_packets);
             return;
         }
 
+        // See opt::send_share.  With STRICT or WEIGHTED sharing the datagram channel isn't queued
+        // along with the streams, but gets picked ahead of them whenever the policy has it send the
+        // next packet.  A class over its rate cap sits out until the cap allows more.
+        const auto& share = context->config.send_share;
+        const bool datagrams_separate = share.policy != DatagramShare::ROUND_ROBIN;
+        _datagram_cap.refill(tp);
+        _stream_cap.refill(tp);
+        // Set once datagrams can't send any more in this flush (congested, or over their cap)
+        bool datagrams_stalled = !_datagram_cap.allows();
+        bool streams_capped = !_stream_cap.allows();
+        const bool queue_datagrams = !datagrams_separate && !datagrams_stalled && !datagrams->is_empty();
+
         std::list<IOChannel*> channels;
-        if (!_streams.empty())
+        if (!_streams.empty() && !streams_capped)
         {
-            // Start from a random stream so that we aren't favouring early streams by potentially
-            // giving them more opportunities to send packets.
-            auto mid = std::next(
-                    _streams.begin(), std::uniform_int_distribution<size_t>{0, _streams.size() - 1}(stream_start_rng));
+            // Non-incremental streams get queued first, in stream id order, so that they end up
+            // ahead of incremental streams of the same urgency (once sorted by urgency, below).
+            _streams.for_each([&channels](const std::shared_ptr<Stream>& s) {
+                if (not s->_incremental and not s->_sent_fin)
+                    channels.push_back(s.get());
+            });
 
-            for (auto it = mid; it != _streams.end(); ++it)
-            {
-                auto& stream_ptr = it->second;
-                if (stream_ptr and not stream_ptr->_sent_fin)
-                    channels.push_back(stream_ptr.get());
-            }
+            // Start from a random stream so that we aren't favouring early streams by potentially
+            // giving them more opportunities to send packets: the streams before the starting one
+            // get moved to the end (after any datagrams).
+            const auto mid = std::uniform_int_distribution<size_t>{0, _streams.size() - 1}(stream_start_rng);
+            std::list<IOChannel*> wrapped;
+            size_t i = 0;
+            _streams.for_each([&](const std::shared_ptr<Stream>& s) {
+                if (s->_incremental and not s->_sent_fin)
+                    (i < mid ? wrapped : channels).push_back(s.get());
+                i++;
+            });
 
             // if we have datagrams to send, then mix them into the streams
-            if (not datagrams->is_empty())
+            if (queue_datagrams)
             {
-                log::trace(log_cat, "Datagram channel has things to send");
+                QUIC_HOT_TRACE(log_cat, "Datagram channel has things to send");
                 channels.push_back(datagrams.get());
             }
 
-            for (auto it = _streams.begin(); it != mid; ++it)
-            {
-                auto& stream_ptr = it->second;
-                if (stream_ptr and not stream_ptr->_sent_fin)
-                    channels.push_back(stream_ptr.get());
-            }
+            channels.splice(channels.end(), wrapped);
+
+            // Stable, so this keeps the above ordering within each urgency level
+            channels.sort([](const IOChannel* a, const IOChannel* b) { return a->_urgency < b->_urgency; });
         }
-        else if (not datagrams->is_empty())
+        else if (queue_datagrams)
         {
             // if we have only datagrams to send, then we should probably do that
-            log::trace(log_cat, "Datagram channel has things to send");
+            QUIC_HOT_TRACE(log_cat, "Datagram channel has things to send");
             channels.push_back(datagrams.get());
         }
 
@@ -860,8 +1217,48 @@ namespace oxen::quic
         channels.push_back(pseudo_stream.get());
         auto streams_end_it = std::prev(channels.end());
 
+        // Puts a channel with more to send back into the queue (before the -1 pseudo stream) for
+        // another turn.  An incremental channel goes after everything else of the same urgency, so
+        // that it takes turns with its peers; a non-incremental one goes back to the front of its
+        // urgency level so that it keeps going until it is done.
+        auto requeue = [&](IOChannel* ch) {
+            if (ch->is_stream() ? streams_capped : (datagrams_separate || datagrams_stalled))
+                return;
+            auto it = streams_end_it;
+            if (ch->_incremental)
+                while (it != channels.begin() && (*std::prev(it))->_urgency > ch->_urgency)
+                    --it;
+            else
+            {
+                it = channels.begin();
+                while (it != streams_end_it && (*it)->_urgency < ch->_urgency)
+                    ++it;
+            }
+            channels.insert(it, ch);
+        };
+
+        // Gives the datagram channel the next go, to finish filling the current packet or write the
+        // datagram that didn't fit into the packet just written
+        auto datagrams_next = [&] {
+            if (!datagrams_separate && !datagrams_stalled)
+                channels.push_front(datagrams.get());
+        };
+
+        // Drops the streams (but not the datagram channel or -1 pseudo stream) from the queue
+        auto stop_streams = [&] {
+            streams_capped = true;
+            for (auto it = channels.begin(); it != streams_end_it;)
+                it = (*it)->is_stream() ? channels.erase(it) : std::next(it);
+        };
+
+        // Everything we build here only needs to last until we hand it off in send() (which copies
+        // anything it can't get rid of right away), so we can use the loop's shared scratch space.
+        const auto max_payload = _endpoint._max_udp_payload;
+        auto& scratch = _endpoint._loop.scratch(max_payload);
+        auto& stream_iovecs = scratch.stream_iovecs;
+
         ngtcp2_pkt_info pkt_info{};
-        auto* buf_pos = reinterpret_cast<uint8_t*>(send_buffer.data());
+        auto* buf_pos = reinterpret_cast<uint8_t*>(scratch.buf.data());
         pkt_tx_timer_updater pkt_updater{*this, ts};
         size_t stream_packets = 0;
 
@@ -869,22 +1266,37 @@ namespace oxen::quic
 
         while (!channels.empty())
         {
-            log::trace(log_cat, "Creating packet {} of max {} batch stream packets", n_packets, MAX_BATCH);
+            QUIC_HOT_TRACE(log_cat, "Creating packet {} of max {} batch stream packets", n_packets, MAX_BATCH);
             int datagram_accepted = std::numeric_limits<int>::min();
             ngtcp2_ssize nwrite = 0;
             ngtcp2_ssize ndatalen;
             uint32_t flags = 0;
             int64_t stream_id = -10;
-
-            auto* source = channels.front();
-            channels.pop_front();  // Pop it off; if this stream should be checked again, append just
-                                   // before streams_end_it.
+            bool bufs_truncated = false;
+
+            // The weighting only applies while both classes have something to send: a class that runs
+            // out starts over on equal terms once it has more.
+            const bool streams_waiting = channels.front() != pseudo_stream.get();
+            if (datagrams->is_empty() || !streams_waiting)
+                _datagram_share_packets = _stream_share_packets = 0;
+
+            IOChannel* source;
+            if (datagrams_separate && !datagrams_stalled && !datagrams->is_empty() &&
+                (share.policy == DatagramShare::STRICT || !streams_waiting ||
+                 _datagram_share_packets < share.weight * (_datagram_share_packets + _stream_share_packets + 1)))
+                source = datagrams.get();
+            else
+            {
+                source = channels.front();
+                channels.pop_front();  // Pop it off; if this stream should be checked again, requeue it.
+            }
 
             // this block will execute all "real" streams plus the "pseudo stream" of ID -1 to finish
             // off any packets that need to be sent
             if (source->is_stream())
             {
-                std::vector<ngtcp2_vec> bufs = source->pending();
+                auto nbufs = source->pending(stream_iovecs.data(), stream_iovecs.size());
+                bufs_truncated = nbufs == stream_iovecs.size();
 
                 stream_id = source->stream_id();
 
@@ -892,13 +1304,13 @@ namespace oxen::quic
                 {
                     if (source->is_closing() && !source->sent_fin() && source->unsent() == 0)
                     {
-                        log::trace(log_cat, "Sending FIN");
+                        QUIC_HOT_TRACE(log_cat, "Sending FIN");
                         flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
                         source->set_fin(true);
                     }
-                    else if (bufs.empty())
+                    else if (nbufs == 0)
                     {
-                        log::debug(log_cat, "pending() returned empty buffer for stream ID {}, moving on", stream_id);
+                        QUIC_HOT_DEBUG(log_cat, "pending() returned empty buffer for stream ID {}, moving on", stream_id);
                         continue;
                     }
                 }
@@ -908,15 +1320,15 @@ namespace oxen::quic
                         _path,
                         &pkt_info,
                         buf_pos,
-                        MAX_PMTUD_UDP_PAYLOAD,
+                        max_payload,
                         &ndatalen,
                         flags |= NGTCP2_WRITE_STREAM_FLAG_MORE,
                         stream_id,
-                        bufs.data(),
-                        bufs.size(),
+                        stream_iovecs.data(),
+                        nbufs,
                         ts);
 
-                log::trace(log_cat, "add_stream_data for stream {} returned [{},{}]", stream_id, nwrite, ndatalen);
+                QUIC_HOT_TRACE(log_cat, "add_stream_data for stream {} returned [{},{}]", stream_id, nwrite, ndatalen);
             }
             else  // datagram block
             {
@@ -927,7 +1339,7 @@ namespace oxen::quic
                         _path,
                         &pkt_info,
                         buf_pos,
-                        MAX_PMTUD_UDP_PAYLOAD,
+                        max_payload,
                         &datagram_accepted,
                         flags |= NGTCP2_WRITE_DATAGRAM_FLAG_MORE,
                         dgram.id,
@@ -935,20 +1347,26 @@ namespace oxen::quic
                         dgram.size(),
                         ts);
 
-                log::debug(log_cat, "ngtcp2_conn_writev_datagram returned a value of {}", nwrite);
+                QUIC_HOT_DEBUG(log_cat, "ngtcp2_conn_writev_datagram returned a value of {}", nwrite);
 
                 if (datagram_accepted != 0)
                 {
-                    log::trace(log_cat, "ngtcp2 accepted datagram ID: {} for transmission", dgram.id);
+                    QUIC_HOT_TRACE(log_cat, "ngtcp2 accepted datagram ID: {} for transmission", dgram.id);
                     datagrams->send_buffer.drop_front(prefer_big_first);
+                    datagrams->publish_state();
+                    _datagram_cap.spend(dgram.size());
+                    if (!_datagram_cap.allows())
+                        datagrams_stalled = true;
                 }
             }
 
             // congested
             if (nwrite == 0)
             {
-                log::trace(log_cat, "Done writing: connection is congested");
-                if (source->is_stream() && stream_id != -1)
+                QUIC_HOT_TRACE(log_cat, "Done writing: connection is congested");
+                if (!source->is_stream())
+                    datagrams_stalled = true;
+                else if (stream_id != -1)
                     // we are congested, so clear all pending streams (aside from the -1
                     // pseudo-stream at the end) so that our next call hits the -1 to finish off.
                     channels.erase(channels.begin(), streams_end_it);
@@ -970,20 +1388,32 @@ namespace oxen::quic
 
                     if (source->is_stream())
                     {
-                        log::trace(log_cat, "Consumed {} bytes from stream {} and have space left", ndatalen, stream_id);
+                        QUIC_HOT_TRACE(log_cat, "Consumed {} bytes from stream {} and have space left", ndatalen, stream_id);
                         assert(ndatalen >= 0);
                         if (stream_id != -1)
+                        {
                             source->wrote(ndatalen);
+                            _stream_cap.spend(ndatalen);
+                            if (!_stream_cap.allows())
+                                stop_streams();
+                            // If we could only offer part of the stream's data then there is still
+                            // more of it that can go into this packet.
+                            if (bufs_truncated && source->has_unsent())
+                                requeue(source);
+                        }
                     }
                     else
                     {
                         if (source->has_unsent())
-                            channels.push_front(datagrams.get());
+                            datagrams_next();
                     }
                 }
                 else
                 {
-                    log::debug(log_cat, "Non-fatal ngtcp2 error (stream ID:{}): {}", stream_id, ngtcp2_strerror(nwrite));
+                    QUIC_HOT_DEBUG(log_cat, "Non-fatal ngtcp2 error (stream ID:{}): {}", stream_id, ngtcp2_strerror(nwrite));
+                    // Otherwise we'd just keep picking the same datagram again
+                    if (!source->is_stream())
+                        datagrams_stalled = true;
                 }
 
                 continue;
@@ -993,36 +1423,43 @@ namespace oxen::quic
 
             if (stream_id > -1 && ndatalen > 0)
             {
-                log::trace(log_cat, "consumed {} bytes from stream {}", ndatalen, stream_id);
+                QUIC_HOT_TRACE(log_cat, "consumed {} bytes from stream {}", ndatalen, stream_id);
                 source->wrote(ndatalen);
+                _stream_cap.spend(ndatalen);
+                if (!_stream_cap.allows())
+                    stop_streams();
             }
 
             // success
             buf_pos += nwrite;
-            send_buffer_size[n_packets++] = nwrite;
+            scratch.sizes[n_packets++] = nwrite;
             send_ecn = pkt_info.ecn;
             stream_packets++;
+            if (!source->is_stream())
+                _datagram_share_packets++;
+            else if (stream_id != -1)
+                _stream_share_packets++;
 
             if (n_packets == MAX_BATCH)
             {
-                log::trace(log_cat, "Sending stream data packet batch");
-                if (!send(&pkt_updater))
+                QUIC_HOT_TRACE(log_cat, "Sending stream data packet batch");
+                if (!send(scratch.buf.data(), scratch.sizes.data(), &pkt_updater))
                     return;
 
                 assert(n_packets == 0);
-                buf_pos = reinterpret_cast<uint8_t*>(send_buffer.data());
+                buf_pos = reinterpret_cast<uint8_t*>(scratch.buf.data());
             }
 
             if (stream_packets == max_stream_packets)
             {
-                log::trace(log_cat, "Max stream packets ({}) reached", max_stream_packets);
+                QUIC_HOT_TRACE(log_cat, "Max stream packets ({}) reached", max_stream_packets);
                 break;
             }
 
             // packet is full and the datagram was NOT included, so it must be written to the next packet
             if (datagram_accepted == 0 && nwrite > 0)
             {
-                channels.push_front(datagrams.get());
+                datagrams_next();
                 continue;
             }
 
@@ -1035,67 +1472,83 @@ namespace oxen::quic
             else if (source->has_unsent())
             {
                 // For an actual stream with more data we want to let it be checked again, so
-                // insert it just before the final -1 fake stream for potential reconsideration.
+                // requeue it (before the final -1 fake stream) for potential reconsideration.
                 assert(!channels.empty());
-                channels.insert(streams_end_it, source);
+                requeue(source);
             }
         }
 
         if (n_packets > 0)
         {
-            log::trace(log_cat, "Sending final packet batch of {} packets", n_packets);
-            send(&pkt_updater);
+            QUIC_HOT_TRACE(log_cat, "Sending final packet batch of {} packets", n_packets);
+            send(scratch.buf.data(), scratch.sizes.data(), &pkt_updater);
         }
-        log::debug(log_cat, "Exiting flush_streams()");
+
+        // Come back when whichever capped class has more to send is allowed to again
+        if (send_cap_timer)
+        {
+            auto wait = std::chrono::nanoseconds::max();
+            if (!_datagram_cap.allows() && !datagrams->is_empty())
+                wait = _datagram_cap.wait();
+            if (!_stream_cap.allows() && !_streams.empty())
+                wait = std::min(wait, _stream_cap.wait());
+            if (wait != std::chrono::nanoseconds::max())
+                send_cap_timer->schedule(tp + wait);
+        }
+        QUIC_HOT_DEBUG(log_cat, "Exiting flush_streams()");
     }
 
     void Connection::schedule_packet_retransmit(std::chrono::steady_clock::time_point ts)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        if (!packet_retransmit_timer)
+            return;  // halted
+
         ngtcp2_tstamp exp_ns = ngtcp2_conn_get_expiry(conn.get());
 
         if (exp_ns == std::numeric_limits<ngtcp2_tstamp>::max())
         {
             log::info(log_cat, "No retransmit needed right now");
-            event_del(packet_retransmit_timer.get());
+            packet_retransmit_timer->cancel();
             return;
         }
 
-        auto delta = static_cast<int64_t>(exp_ns) * 1ns - ts.time_since_epoch();
-        log::trace(log_cat, "Expiry delta: {}ns", delta.count());
+        auto expiry = std::chrono::steady_clock::time_point{
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(static_cast<int64_t>(exp_ns) * 1ns)};
+        QUIC_HOT_TRACE(log_cat, "Expiry delta: {}ns", (expiry - ts).count());
 
-        // very rarely, something weird happens and the wakeup time ngtcp2 gives is
-        // in the past; if that happens, fire the timer with a 0µs timeout.
-        timeval tv;
-        if (delta > 0s)
-        {
-            delta += 999ns;  // Round up to the next µs (libevent timers have µs precision)
-            tv.tv_sec = delta / 1s;
-            tv.tv_usec = (delta % 1s) / 1us;
-        }
-        else
-        {
-            tv.tv_sec = 0;
-            tv.tv_usec = 0;
-        }
-        event_add(packet_retransmit_timer.get(), &tv);
+        // very rarely, something weird happens and the wakeup time ngtcp2 gives is in the past; the
+        // timer wheel deals with that by firing the timer on the next loop iteration.
+        packet_retransmit_timer->schedule(expiry);
+    }
+
+    void Connection::schedule_removal(std::chrono::steady_clock::time_point when)
+    {
+        removal_timer.emplace(
+                _endpoint.timers(),
+                [](void* self_) {
+                    auto& self = *static_cast<Connection*>(self_);
+                    log::debug(log_cat, "Deleting closing/draining connection ({})", self.reference_id());
+                    // This destroys the connection (and this timer along with it)
+                    self._endpoint.delete_connection(self);
+                },
+                this);
+        removal_timer->schedule(when);
     }
 
     int Connection::stream_opened(int64_t id)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         log::info(log_cat, "New stream ID:{}", id);
+        note_activity();
 
-        if (auto itr = _stream_queue.find(id); itr != _stream_queue.end())
+        if (auto s = _stream_queue.extract(id))
         {
             log::debug(log_cat, "Taking ready stream from on deck and assigning stream ID {}!", id);
 
-            auto& s = itr->second;
             s->set_ready();
-
-            [[maybe_unused]] auto [it, ins] = _streams.emplace(id, std::move(s));
-            _stream_queue.erase(itr);
-            assert(ins);
+            _streams.insert(id, std::move(s));
+            streams_changed();
             return 0;
         }
 
@@ -1114,8 +1567,9 @@ namespace oxen::quic
             return 0;
         }
 
-        [[maybe_unused]] auto [it, ins] = _streams.emplace(id, std::move(stream));
-        assert(ins);
+        watch_timeouts(*stream);
+        _streams.insert(id, std::move(stream));
+        streams_changed();
         log::info(log_cat, "Created new incoming stream {}", id);
         return 0;
     }
@@ -1124,29 +1578,53 @@ namespace oxen::quic
     {
         const bool was_closing = stream._is_closing;
         stream._is_closing = stream._is_shutdown = true;
+        stream.publish_state();
 
         if (!was_closing)
         {
-            log::trace(log_cat, "Invoking stream close callback");
+            QUIC_HOT_TRACE(log_cat, "Invoking stream close callback");
             stream.closed(app_code);
         }
+
+        // Whatever is left in a closed stream's buffer will never be sent (or acknowledged)
+        if (stream._conn_buffered)
+            stream_buffered_changed(stream, 0);
+        if (!stream.drain_callbacks.empty())
+            stream.fire_drained(false);
+    }
+
+    void Connection::streams_changed()
+    {
+        _published_streams_active.store(_streams.size(), std::memory_order_relaxed);
+        _published_streams_pending.store(pending_streams.size(), std::memory_order_relaxed);
     }
 
     void Connection::stream_closed(int64_t id, uint64_t app_code)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         assert(ngtcp2_is_bidi_stream(id));
         log::info(log_cat, "Stream {} closed with code {}", id, app_code);
-        auto it = _streams.find(id);
+        auto* it = _streams.find(id);
 
-        if (it == _streams.end())
+        if (!it)
             return;
 
-        auto& stream = *it->second;
+        auto& stream = **it;
         stream_execute_close(stream, app_code);
 
+        // Data never consumed from the stream still counts against the connection's window, so
+        // release it for the other streams
+        if (stream._unconsumed)
+        {
+            ngtcp2_conn_extend_max_offset(conn.get(), stream._unconsumed);
+            stream._unconsumed = 0;
+        }
+
         log::info(log_cat, "Erasing stream {}", id);
-        _streams.erase(it);
+        // The close callback could have opened streams, so we can't reuse `it`
+        if (auto removed = _streams.extract(id))
+            unwatch_timeouts(*removed);
+        streams_changed();
 
         if (!ngtcp2_conn_is_local_stream(conn.get(), id))
             ngtcp2_conn_extend_max_streams_bidi(conn.get(), 1);
@@ -1158,31 +1636,48 @@ namespace oxen::quic
     // stream close callbacks for all open streams.
     void Connection::close_all_streams()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
-        for (const auto& [id, stream] : _stream_queue)
-            stream_execute_close(*stream, STREAM_ERROR_CONNECTION_CLOSED);
+        _stream_queue.for_each([this](const std::shared_ptr<Stream>& s) {
+            unwatch_timeouts(*s);
+            stream_execute_close(*s, STREAM_ERROR_CONNECTION_CLOSED);
+        });
         _stream_queue.clear();
         for (const auto& s : pending_streams)
+        {
+            unwatch_timeouts(*s);
             stream_execute_close(*s, STREAM_ERROR_CONNECTION_CLOSED);
+        }
         pending_streams.clear();
+        streams_changed();
 
         while (!_streams.empty())
-            stream_closed(_streams.begin()->first, STREAM_ERROR_CONNECTION_CLOSED);
+            stream_closed(_streams.front()->_stream_id, STREAM_ERROR_CONNECTION_CLOSED);
+    }
+
+    void Connection::notify_streams_dropped()
+    {
+        for (auto* table : {&_streams, &_stream_queue})
+            table->for_each([](const std::shared_ptr<Stream>& s) { s->dropped(); });
+        for (auto& stream : pending_streams)
+            stream->dropped();
     }
 
     void Connection::drop_streams()
     {
         log::debug(log_cat, "Dropping all streams from Connection {}", reference_id());
-        for (auto* stream_map : {&_streams, &_stream_queue})
+        while (timeout_streams)
+            unwatch_timeouts(*timeout_streams);
+        notify_streams_dropped();
+        for (auto* table : {&_streams, &_stream_queue})
         {
-            for (auto& [id, stream] : *stream_map)
-                stream->_conn = nullptr;
-            stream_map->clear();
+            table->for_each([](const std::shared_ptr<Stream>& s) { s->_conn = nullptr; });
+            table->clear();
         }
         for (auto& stream : pending_streams)
             stream->_conn = nullptr;
         pending_streams.clear();
+        streams_changed();
         if (datagrams)
         {
             datagrams->_conn = nullptr;
@@ -1196,9 +1691,9 @@ namespace oxen::quic
 
     int Connection::stream_ack(int64_t id, size_t size)
     {
-        if (auto it = _streams.find(id); it != _streams.end())
+        if (auto* s = _streams.find(id))
         {
-            it->second->acknowledge(size);
+            (*s)->acknowledge(size);
             return 0;
         }
         return NGTCP2_ERR_CALLBACK_FAILURE;
@@ -1206,6 +1701,7 @@ namespace oxen::quic
 
     int Connection::stream_receive(int64_t id, bstring_view data, bool fin)
     {
+        note_activity();
         auto str = get_stream(id);
 
         if (data.size() == 0)
@@ -1217,11 +1713,18 @@ namespace oxen::quic
             return 0;
         }
 
-        log::trace(log_cat, "Stream (ID: {}) received data: {}", id, buffer_printer{data});
+        QUIC_HOT_TRACE(log_cat, "Stream (ID: {}) received data: {}", id, buffer_printer{data});
+
+        // In manual consumption mode the data only gets credited back to the remote once the
+        // application consumes it (which it might do from within the data callback)
+        bool manual = str->_manual_consume;
+        if (manual)
+            str->_unconsumed += data.size();
 
         std::optional<uint64_t> error;
         try
         {
+            scoped_callback timing{loop_callback::stream_data};
             str->receive(data);
         }
         catch (const application_stream_error& e)
@@ -1264,7 +1767,7 @@ namespace oxen::quic
             log::info(log_cat, "Stream {} closed by remote", str->_stream_id);
             // no clean up, close_cb called after this
         }
-        else
+        else if (!manual)
         {
             ngtcp2_conn_extend_max_stream_offset(conn.get(), id, data.size());
             ngtcp2_conn_extend_max_offset(conn.get(), data.size());
@@ -1273,16 +1776,29 @@ namespace oxen::quic
         return 0;
     }
 
+    void Connection::stream_consumed(Stream& s, uint64_t bytes)
+    {
+        bytes = std::min(bytes, s._unconsumed);
+        if (!bytes)
+            return;
+        s._unconsumed -= bytes;
+        ngtcp2_conn_extend_max_stream_offset(conn.get(), s._stream_id, bytes);
+        ngtcp2_conn_extend_max_offset(conn.get(), bytes);
+        // Get the new credit out to the remote, which may well be waiting on it
+        packet_io_ready();
+    }
+
     // this callback is defined for debugging datagrams
     int Connection::ack_datagram(uint64_t dgram_id)
     {
-        log::trace(log_cat, "Connection (CID: {}) acked datagram ID:{}", _source_cid, dgram_id);
+        QUIC_HOT_TRACE(log_cat, "Connection (CID: {}) acked datagram ID:{}", _source_cid, dgram_id);
         return 0;
     }
 
     int Connection::recv_datagram(bstring_view data, bool fin)
     {
-        log::trace(log_cat, "Connection (CID: {}) received datagram: {}", _source_cid, buffer_printer{data});
+        QUIC_HOT_TRACE(log_cat, "Connection (CID: {}) received datagram: {}", _source_cid, buffer_printer{data});
+        note_activity();
 
         std::optional<bstring> maybe_data;
 
@@ -1298,7 +1814,7 @@ namespace oxen::quic
             data.remove_prefix(2);
 
             if (dgid % 4 == 0)
-                log::trace(log_cat, "Datagram sent unsplit, bypassing rotating buffer");
+                QUIC_HOT_TRACE(log_cat, "Datagram sent unsplit, bypassing rotating buffer");
             else
             {
                 // send received datagram to rotating_buffer if packet_splitting is enabled
@@ -1307,13 +1823,20 @@ namespace oxen::quic
                 // split datagram did not have a match
                 if (not maybe_data)
                 {
-                    log::trace(log_cat, "Datagram (ID: {}) awaiting counterpart", dgid);
+                    QUIC_HOT_TRACE(log_cat, "Datagram (ID: {}) awaiting counterpart", dgid);
                     return 0;
                 }
             }
         }
+        else if (datagrams->_fragmentation)
+        {
+            auto payload = datagrams->from_fragment(data, maybe_data);
+            if (!payload)
+                return 0;
+            data = *payload;
+        }
 
-        if (!datagrams->dgram_data_cb)
+        if (!datagrams->has_data_cb())
             log::debug(log_cat, "Connection (CID: {}) has no endpoint-supplied datagram data callback", _source_cid);
         else
         {
@@ -1321,7 +1844,17 @@ namespace oxen::quic
 
             try
             {
-                datagrams->dgram_data_cb(*di, (maybe_data ? std::move(*maybe_data) : bstring{data.begin(), data.end()}));
+                scoped_callback timing{loop_callback::datagram};
+                if (maybe_data)
+                    data = *maybe_data;
+
+                if (datagrams->dgram_view_cb)
+                    datagrams->dgram_view_cb(*di, data);
+                else if (datagrams->dgram_pooled_cb)
+                    datagrams->dgram_pooled_cb(*di, _endpoint.datagram_recv_pool->copy_any(data));
+                else
+                    datagrams->dgram_data_cb(
+                            *di, (maybe_data ? std::move(*maybe_data) : bstring{data.begin(), data.end()}));
                 good = true;
             }
             catch (const std::exception& e)
@@ -1365,7 +1898,7 @@ namespace oxen::quic
 
     void Connection::send_datagram(bstring_view data, std::shared_ptr<void> keep_alive)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         if (!_datagrams_enabled)
             throw std::runtime_error{"Endpoint not configured for datagram IO"};
@@ -1373,9 +1906,20 @@ namespace oxen::quic
         datagrams->send(data, std::move(keep_alive));
     }
 
+    void Connection::send_datagrams(const bstring_view* data, size_t count, std::shared_ptr<void> keep_alive)
+    {
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+
+        if (!_datagrams_enabled)
+            throw std::runtime_error{"Endpoint not configured for datagram IO"};
+
+        if (count)
+            datagrams->send_batch({data, data + count}, std::move(keep_alive));
+    }
+
     uint64_t Connection::get_streams_available_impl() const
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         return ngtcp2_conn_get_streams_bidi_left(conn.get());
     }
 
@@ -1389,11 +1933,20 @@ namespace oxen::quic
         // Minus packet splitting overhead that adds 2 bytes of overhead per full or half datagram:
         size_t adjustment = DATAGRAM_OVERHEAD + (_packet_splitting ? 2 : 0);
 
+        // When fragmenting, as many fragments as allowed, each with a fragment header.  With
+        // parity, fragments also leave room for the parity fragment's 4-byte size prefix.
+        if (auto& frag = datagrams->_fragmentation)
+        {
+            multiple = frag->max_fragments;
+            adjustment = DATAGRAM_OVERHEAD + FRAGMENT_HEADER_SIZE + (frag->fec ? 4 : 0);
+        }
+
         size_t max_dgram_size = multiple * (ngtcp2_conn_get_path_max_tx_udp_payload_size(conn.get()) - adjustment);
         if (max_dgram_size != _last_max_dgram_size)
         {
             _max_dgram_size_changed = true;
             _last_max_dgram_size = max_dgram_size;
+            _published_max_datagram_size.store(max_dgram_size, std::memory_order_relaxed);
         }
 
         return max_dgram_size;
@@ -1412,76 +1965,78 @@ namespace oxen::quic
     }
 
     int Connection::init(
-            ngtcp2_settings& settings,
-            ngtcp2_transport_params& params,
-            ngtcp2_callbacks& callbacks,
-            std::chrono::nanoseconds handshake_timeout)
-    {
-        callbacks.recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb;
-        callbacks.path_validation = Callbacks::on_path_validation;
-        callbacks.encrypt = ngtcp2_crypto_encrypt_cb;
-        callbacks.decrypt = ngtcp2_crypto_decrypt_cb;
-        callbacks.hp_mask = ngtcp2_crypto_hp_mask_cb;
-        callbacks.recv_stream_data = Callbacks::on_recv_stream_data;
-        callbacks.acked_stream_data_offset = Callbacks::on_acked_stream_data_offset;
-        callbacks.stream_close = Callbacks::on_stream_close;
-        callbacks.extend_max_local_streams_bidi = Callbacks::extend_max_local_streams_bidi;
-        callbacks.rand = Callbacks::rand_cb;
-        callbacks.get_new_connection_id = Callbacks::get_new_connection_id;
-        callbacks.remove_connection_id = Callbacks::remove_connection_id;
-        callbacks.dcid_status = Callbacks::on_connection_id_status;
-        callbacks.update_key = ngtcp2_crypto_update_key_cb;
-        callbacks.stream_reset = Callbacks::on_stream_reset;
-        callbacks.delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb;
-        callbacks.delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb;
-        callbacks.get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb;
-        callbacks.version_negotiation = ngtcp2_crypto_version_negotiation_cb;
-        callbacks.stream_open = Callbacks::on_stream_open;
-        callbacks.handshake_completed = Callbacks::on_handshake_completed;
-
+            ngtcp2_settings& settings, ngtcp2_transport_params& params, std::chrono::nanoseconds handshake_timeout)
+    {
         ngtcp2_settings_default(&settings);
 
         settings.initial_ts = get_timestamp().count();
+        _last_ts = settings.initial_ts;
 #ifndef NDEBUG
         settings.log_printf = log_printer;
 #endif
-        settings.max_tx_udp_payload_size = MAX_PMTUD_UDP_PAYLOAD;
-        settings.cc_algo = NGTCP2_CC_ALGO_CUBIC;
-        settings.initial_rtt = NGTCP2_DEFAULT_INITIAL_RTT;
-        settings.max_window = 24_Mi;
-        settings.max_stream_window = 16_Mi;
+        settings.max_tx_udp_payload_size = _endpoint._max_udp_payload;
+#if NGTCP2_VERSION_NUM >= 0x010400
+        if (!_endpoint._pmtud_probes.empty())
+        {
+            settings.pmtud_probes = _endpoint._pmtud_probes.data();
+            settings.pmtud_probeslen = _endpoint._pmtud_probes.size();
+        }
+#endif
+        const auto& cfg = context->config;
+        switch (cfg.cc_algo)
+        {
+            case CongestionControl::CUBIC:
+                settings.cc_algo = NGTCP2_CC_ALGO_CUBIC;
+                break;
+            case CongestionControl::RENO:
+                settings.cc_algo = NGTCP2_CC_ALGO_RENO;
+                break;
+            case CongestionControl::BBR:
+                settings.cc_algo = NGTCP2_CC_ALGO_BBR;
+                break;
+        }
+        _counters.cc_algo = cfg.cc_algo;
+        settings.initial_rtt = cfg.initial_rtt.count() > 0
+                                     ? static_cast<uint64_t>(std::chrono::nanoseconds{cfg.initial_rtt}.count())
+                                     : NGTCP2_DEFAULT_INITIAL_RTT;
+        // An explicitly set receive window is also the most it grows to, unless a larger maximum was
+        // given as well; otherwise the windows grow up to the default maximums.
+        auto max_window = [&](uint64_t max, uint64_t window, uint64_t default_max) -> uint64_t {
+            if (max)
+                return std::max(max, window);
+            return cfg.recv_window_set ? window : std::max(default_max, window);
+        };
+        settings.max_window = max_window(cfg.max_conn_recv_window, cfg.conn_recv_window, 24_Mi);
+        settings.max_stream_window = max_window(cfg.max_stream_recv_window, cfg.stream_recv_window, 16_Mi);
         settings.handshake_timeout = handshake_timeout <= 0s ? UINT64_MAX : static_cast<uint64_t>(handshake_timeout.count());
 
         ngtcp2_transport_params_default(&params);
 
         // Connection flow level control window
-        params.initial_max_data = 15_Mi;
+        params.initial_max_data = context->config.conn_recv_window;
         // Max concurrent streams supported on one connection
         params.initial_max_streams_uni = 0;
         // Max send buffer for streams (local = streams we initiate, remote = streams initiated to us)
-        params.initial_max_stream_data_bidi_local = 6_Mi;
-        params.initial_max_stream_data_bidi_remote = 6_Mi;
-        params.initial_max_stream_data_uni = 6_Mi;
+        params.initial_max_stream_data_bidi_local = context->config.stream_recv_window;
+        params.initial_max_stream_data_bidi_remote = context->config.stream_recv_window;
+        params.initial_max_stream_data_uni = context->config.stream_recv_window;
         params.max_idle_timeout = std::chrono::nanoseconds{context->config.idle_timeout}.count();
         params.active_connection_id_limit = MAX_ACTIVE_CIDS;
 
         // config values
         params.initial_max_streams_bidi = _max_streams;
 
+        // Tells the peer not to send us packets larger than we send: our datagram buffers, and the
+        // split datagram halves and fragments they hold, are sized to our own max payload
+        params.max_udp_payload_size = _endpoint._max_udp_payload;
+
         if (_datagrams_enabled)
         {
-            log::trace(log_cat, "Enabling datagram support for connection");
+            QUIC_HOT_TRACE(log_cat, "Enabling datagram support for connection");
             // This is effectively an "unlimited" value, which lets us accept any size that fits into a QUIC packet
             // (see rfc 9221)
             params.max_datagram_frame_size = 65535;
-            // default ngtcp2 values set by ngtcp2_settings_default_versioned
-            params.max_udp_payload_size = NGTCP2_DEFAULT_MAX_RECV_UDP_PAYLOAD_SIZE;  // 65527
-            settings.max_tx_udp_payload_size = MAX_PMTUD_UDP_PAYLOAD;                // 1500 - 48 (approximate overhead)
             // settings.no_tx_udp_payload_size_shaping = 1;
-            callbacks.recv_datagram = Callbacks::on_recv_datagram;
-#ifndef NDEBUG
-            callbacks.ack_datagram = Callbacks::on_ack_datagram;
-#endif
 
             di = _endpoint.make_shared<dgram_interface>(*this);
         }
@@ -1489,7 +2044,6 @@ namespace oxen::quic
         {
             // setting this value to 0 disables datagram support
             params.max_datagram_frame_size = 0;
-            callbacks.recv_datagram = nullptr;
         }
 
         return 0;
@@ -1510,6 +2064,7 @@ namespace oxen::quic
             ngtcp2_cid* ocid) :
             _endpoint{ep},
             context{std::move(ctx)},
+            _memory{ep.connection_memory()},
             dir{context->dir},
             _is_outbound{dir == Direction::OUTBOUND},
             _ref_id{rid},
@@ -1534,54 +2089,53 @@ namespace oxen::quic
                                : nullptr;
 
         datagrams = _endpoint.make_shared<DatagramIO>(*this, _endpoint, ep.dgram_recv_cb);
+        datagrams->dgram_view_cb = ep.dgram_recv_view_cb;
+        datagrams->dgram_pooled_cb = ep.dgram_recv_pooled_cb;
         pseudo_stream = _endpoint.make_shared<Stream>(*this, _endpoint);
         pseudo_stream->_stream_id = -1;
 
         const auto d_str = is_outbound() ? "outbound"s : "inbound"s;
-        log::trace(log_cat, "Creating new {} connection object", d_str);
+        QUIC_HOT_TRACE(log_cat, "Creating new {} connection object", d_str);
 
         ngtcp2_settings settings;
         ngtcp2_transport_params params;
-        ngtcp2_callbacks callbacks{};
+        const auto& callbacks = Callbacks::table(is_outbound(), _datagrams_enabled);
         ngtcp2_conn* connptr;
         int rv = 0;
 
         auto handshake_timeout = context->config.handshake_timeout.value_or(default_handshake_timeout);
-        if (rv = init(settings, params, callbacks, handshake_timeout); rv != 0)
+        if (rv = init(settings, params, handshake_timeout); rv != 0)
             log::critical(log_cat, "Error: {} connection not created", d_str);
 
         tls_session = tls_creds->make_session(*this, alpns);
 
-        if (is_outbound())
+        if (auto& qlog = context->config.qlog)
         {
-            callbacks.client_initial = ngtcp2_crypto_client_initial_cb;
-            callbacks.handshake_confirmed = Callbacks::on_handshake_confirmed;
-            callbacks.recv_retry = ngtcp2_crypto_recv_retry_cb;
-            callbacks.recv_new_token = Callbacks::on_recv_token;
+            // Name the trace after the original DCID, which both sides of the connection know
+            const ngtcp2_cid& odcid = is_outbound() ? _dest_cid : ocid ? *ocid : hdr->dcid;
+            auto id = oxenc::to_hex(odcid.data, odcid.data + odcid.datalen);
+            _qlog = qlog->start_trace("{}_{}"_format(id, is_outbound() ? "client" : "server"));
+            settings.qlog_write = [](void* user_data, uint32_t flags, const void* data, size_t datalen) {
+                static_cast<Connection*>(user_data)->_qlog->write(data, datalen, flags & NGTCP2_QLOG_WRITE_FLAG_FIN);
+            };
+        }
 
+        if (is_outbound())
+        {
             // Clients should be the ones providing a remote pubkey here. This way we can emplace it into
             // the gnutlssession object to be verified. Servers should be verifying via callback
             assert(remote_pk.has_value());
             remote_pubkey = *remote_pk;
             tls_session->set_expected_remote_key(remote_pubkey);
 
-            if (auto maybe_token = _endpoint.get_path_validation_token(remote_pubkey))
+            // ngtcp2 only copies the token in ngtcp2_conn_client_new, so it has to live until then
+            auto maybe_token = _endpoint.get_path_validation_token(remote_pubkey);
+            if (maybe_token)
             {
                 settings.token = maybe_token->data();
                 settings.tokenlen = maybe_token->size();
             }
 
-            // TODO: uncomment this with 0RTT resumption
-            // if (auto maybe_params = _endpoint.get_0rtt_transport_params(remote_pubkey))
-            // {
-            //     if (auto rv = ngtcp2_conn_decode_and_set_0rtt_transport_params(
-            //                 conn.get(), maybe_params->data(), maybe_params->size());
-            //         rv != 0)
-            //         log::warning(log_cat, "Client failed to decode and set 0rtt transport params!");
-            //     else
-            //         log::info(log_cat, "Client decoded and set 0rtt transport params!");
-            // }
-
             rv = ngtcp2_conn_client_new(
                     &connptr,
                     &_dest_cid,
@@ -1596,8 +2150,6 @@ namespace oxen::quic
         }
         else
         {
-            callbacks.recv_client_initial = ngtcp2_crypto_recv_client_initial_cb;
-
             if (ocid)
             {
                 params.original_dcid = *ocid;
@@ -1645,22 +2197,17 @@ namespace oxen::quic
         ngtcp2_conn_set_tls_native_handle(connptr, tls_session->get_session());
 
         conn.reset(connptr);
+        get_max_datagram_size_impl();  // Publishes the initial value
 
-        auto* ev_base = endpoint().get_loop().get();
+        if (is_outbound() && _endpoint._session_cache)
+            try_resume_session();
 
-        packet_io_trigger.reset(event_new(
-                ev_base,
-                -1,
-                0,
-                [](evutil_socket_t, short, void* self) { static_cast<Connection*>(self)->on_packet_io_ready(); },
-                this));
-        packet_retransmit_timer.reset(event_new(
-                ev_base,
-                -1,
-                0,
-                [](evutil_socket_t, short, void* self_) {
+        make_packet_io_trigger();
+        packet_retransmit_timer.emplace(
+                _endpoint.timers(),
+                [](void* self_) {
                     auto& self = *static_cast<Connection*>(self_);
-                    if (auto rv = ngtcp2_conn_handle_expiry(self, get_timestamp().count()); rv != 0)
+                    if (auto rv = ngtcp2_conn_handle_expiry(self, self.ngtcp2_ts(get_timestamp().count())); rv != 0)
                     {
                         log::debug(log_cat, "Error: expiry handler invocation returned error code: {}", ngtcp2_strerror(rv));
                         self.endpoint().close_connection(self, io_error{rv});
@@ -1668,9 +2215,25 @@ namespace oxen::quic
                     }
                     self.on_packet_io_ready();
                 },
-                this));
+                this);
+
+        const auto& share = context->config.send_share;
+        _datagram_cap.rate = share.datagram_rate;
+        _stream_cap.rate = share.stream_rate;
+        if (share.datagram_rate || share.stream_rate)
+            send_cap_timer.emplace(
+                    _endpoint.timers(),
+                    [](void* self) { static_cast<Connection*>(self)->packet_io_ready(); },
+                    this);
 
-        event_add(packet_retransmit_timer.get(), nullptr);
+        if (context->config.hibernate > 0ms)
+        {
+            hibernate_timer.emplace(
+                    _endpoint.timers(),
+                    [](void* self) { static_cast<Connection*>(self)->check_hibernation(); },
+                    this);
+            hibernate_timer->schedule_after(context->config.hibernate);
+        }
 
         log::info(log_cat, "Successfully created new {} connection object {}", d_str, _ref_id);
     }
@@ -1689,7 +2252,7 @@ namespace oxen::quic
             std::optional<ngtcp2_token_type> token_type,
             ngtcp2_cid* ocid)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         std::shared_ptr<Connection> conn{new Connection{
                 ep,
                 rid,
@@ -1712,22 +2275,60 @@ namespace oxen::quic
         return conn;
     }
 
+    void Connection::watch_timeouts(Stream& s)
+    {
+        if (s._timeouts_watched)
+            return;
+        s._timeouts_watched = true;
+        s._timeouts_prev = nullptr;
+        s._timeouts_next = timeout_streams;
+        if (timeout_streams)
+            timeout_streams->_timeouts_prev = &s;
+        timeout_streams = &s;
+    }
+
+    void Connection::unwatch_timeouts(Stream& s)
+    {
+        if (!s._timeouts_watched)
+            return;
+        if (s._timeouts_prev)
+            s._timeouts_prev->_timeouts_next = s._timeouts_next;
+        else
+            timeout_streams = s._timeouts_next;
+        if (s._timeouts_next)
+            s._timeouts_next->_timeouts_prev = s._timeouts_prev;
+        s._timeouts_prev = s._timeouts_next = nullptr;
+        s._timeouts_watched = false;
+    }
+
     void Connection::check_stream_timeouts()
     {
-        for (const auto* s : {&_streams, &_stream_queue})
-            for (const auto& [id, stream] : *s)
-                stream->check_timeouts();
-        for (const auto& s : pending_streams)
+        if (!timeout_streams)
+            return;
+
+        // Timeout handlers can open or close streams (and so change the list), so we hold on to
+        // what we're about to check first.
+        std::vector<std::shared_ptr<Stream>> watched;
+        for (auto* s = timeout_streams; s; s = s->_timeouts_next)
+            watched.push_back(s->shared_from_this());
+
+        for (auto& s : watched)
+        {
+            if (!s->_timeouts_watched)
+                continue;
             s->check_timeouts();
+            if (s->_timeouts_watched && !s->has_timeouts())
+                unwatch_timeouts(*s);
+        }
     }
 
     size_t connection_interface::num_streams_active()
     {
-        return endpoint().call_get([this] { return num_streams_active_impl(); });
+        return _published_streams_active.load(std::memory_order_relaxed);
     }
     size_t connection_interface::num_streams_pending()
     {
-        return endpoint().call_get([this] { return num_streams_pending_impl(); });
+        return _published_streams_pending.load(std::memory_order_relaxed);
     }
     uint64_t connection_interface::get_max_streams()
     {
@@ -1751,17 +2352,52 @@ namespace oxen::quic
     }
     size_t connection_interface::get_max_datagram_size()
     {
-        return endpoint().call_get([this]() -> int { return get_max_datagram_size_impl(); });
+        return _published_max_datagram_size.load(std::memory_order_relaxed);
+    }
+    size_t connection_interface::resident_bytes()
+    {
+        return endpoint().call_get([this] { return resident_bytes_impl(); });
+    }
+    bool connection_interface::is_hibernating()
+    {
+        return endpoint().call_get([this] { return is_hibernating_impl(); });
+    }
+    size_t connection_interface::buffered_bytes()
+    {
+        return endpoint().call_get([this] { return buffered_bytes_impl(); });
+    }
+    bool connection_interface::is_writable()
+    {
+        return endpoint().call_get([this] { return is_writable_impl(); });
+    }
+
+    size_t Connection::resident_bytes_impl() const
+    {
+        size_t total = sizeof(Connection);
+        if (packet_io_trigger)
+            total += event_get_struct_event_size();
+        if (blocked)
+            total += sizeof(blocked_packets) + blocked->buf.capacity();
+        if (datagrams)
+        {
+            total += sizeof(DatagramIO) + datagrams->recv_buffer.resident_bytes() + datagrams->frag_buffer.resident_bytes();
+        }
+        // Streams may be subclasses that are larger than this, but Stream is a good lower bound
+        total += (_streams.size() + _stream_queue.size() + pending_streams.size()) * sizeof(Stream);
+        total += (_streams.slot_count() + _stream_queue.slot_count()) * sizeof(std::shared_ptr<Stream>);
+        return total;
     }
 
     connection_interface::~connection_interface()
     {
-        log::trace(log_cat, "connection_interface @{} destroyed", (void*)this);
+        QUIC_HOT_TRACE(log_cat, "connection_interface @{} destroyed", (void*)this);
     }
 
     Connection::~Connection()
     {
-        log::trace(log_cat, "Connection @{} destroyed", (void*)this);
+        QUIC_HOT_TRACE(log_cat, "Connection @{} destroyed", (void*)this);
+        if (_qlog)
+            _qlog->finish();
     }
 
 }  // namespace oxen::quic
@@ -22,8 +22,25 @@ namespace oxen::quic
     {
         quic_cid cid;
         cid.datalen = static_cast<size_t>(NGTCP2_MAX_CIDLEN);
-        gnutls_rnd(GNUTLS_RND_RANDOM, cid.data, cid.datalen);
+        if (!random_bytes(cid.data, cid.datalen))
+            throw std::runtime_error{"Failed to generate random connection ID"};
         return cid;
     }
 
+    quic_cid quic_cid::random(size_t route, size_t route_count)
+    {
+        auto cid = random();
+        set_route(cid.data, route, route_count);
+        return cid;
+    }
+
+    void quic_cid::set_route(uint8_t* cid_data, size_t route, size_t route_count)
+    {
+        assert(route_count >= 1 && route_count <= 256 && route < route_count);
+        // Keep the routing byte uniformly random over all values that map to `route` so that it
+        // doesn't needlessly weaken the rest of the (random) CID:
+        auto slots = 256 / route_count;
+        cid_data[0] = static_cast<uint8_t>(route + route_count * (cid_data[0] % slots));
+    }
+
 }  // namespace oxen::quic
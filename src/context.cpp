@@ -36,12 +36,66 @@ namespace oxen::quic
         log::trace(log_cat, "User passed connection idle_timeout config value: {}", config.idle_timeout.count());
     }
 
+    void IOContext::handle_ioctx_opt(opt::hibernate hib)
+    {
+        config.hibernate = hib.idle;
+        log::trace(log_cat, "User passed connection hibernate config value: {}", config.hibernate.count());
+    }
+
+    void IOContext::handle_ioctx_opt(opt::qlog ql)
+    {
+        config.qlog = std::move(ql.writer);
+        log::trace(log_cat, "User passed qlog writer");
+    }
+
     void IOContext::handle_ioctx_opt(opt::handshake_timeout hto)
     {
         config.handshake_timeout = hto.timeout;
         log::trace(log_cat, "User passed connection handshake_timeout config value: {}", config.handshake_timeout->count());
     }
 
+    void IOContext::handle_ioctx_opt(opt::receive_window rw)
+    {
+        config.stream_recv_window = rw.stream;
+        config.conn_recv_window = rw.connection;
+        config.recv_window_set = true;
+        log::trace(log_cat, "User passed receive windows: {}B per stream, {}B per connection", rw.stream, rw.connection);
+    }
+
+    void IOContext::handle_ioctx_opt(opt::max_receive_window mrw)
+    {
+        config.max_stream_recv_window = mrw.stream;
+        config.max_conn_recv_window = mrw.connection;
+        log::trace(
+                log_cat,
+                "User passed maximum receive windows: {}B per stream, {}B per connection",
+                mrw.stream,
+                mrw.connection);
+    }
+
+    void IOContext::handle_ioctx_opt(opt::congestion_control cc)
+    {
+        config.cc_algo = cc.algorithm;
+        config.initial_rtt = cc.initial_rtt;
+        log::trace(
+                log_cat,
+                "User passed congestion control {} with initial rtt {}us",
+                to_string(cc.algorithm),
+                cc.initial_rtt.count());
+    }
+
+    void IOContext::handle_ioctx_opt(opt::send_share ss)
+    {
+        config.send_share = ss;
+        log::trace(
+                log_cat,
+                "User passed {} datagram send sharing (weight {}) with rate caps of {}B/s datagrams, {}B/s streams",
+                to_string(ss.policy),
+                ss.weight,
+                ss.datagram_rate,
+                ss.stream_rate);
+    }
+
     void IOContext::handle_ioctx_opt(stream_data_callback func)
     {
         log::trace(log_cat, "IO context stored stream close callback");
@@ -12,46 +12,43 @@ namespace oxen::quic
             dgram_data_cb{std::move(data_cb)},
             rbufsize{endpoint.datagram_bufsize()},
             recv_buffer{*this},
+            _fragmentation{endpoint.datagram_fragmentation()},
+            frag_buffer{*this, _fragmentation ? static_cast<size_t>(_fragmentation->max_pending) : 0},
             _packet_splitting(_conn->packet_splitting_enabled())
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
     }
 
     int64_t DatagramIO::stream_id() const
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         return std::numeric_limits<int64_t>::min();
     }
 
     std::shared_ptr<Stream> DatagramIO::get_stream()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         return nullptr;
     }
 
     bool DatagramIO::is_closing_impl() const
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         return false;
     }
     bool DatagramIO::sent_fin() const
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         return false;
     }
     void DatagramIO::set_fin(bool)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
     };
     size_t DatagramIO::unsent_impl() const
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        size_t sum{0};
-        if (send_buffer.empty())
-            return sum;
-        for (const auto& entry : send_buffer.buf)
-            sum += entry.size();
-        return sum;
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        return send_buffer.bytes();
     }
     bool DatagramIO::has_unsent_impl() const
     {
@@ -59,12 +56,12 @@ namespace oxen::quic
     }
     void DatagramIO::wrote(size_t)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
     };
-    std::vector<ngtcp2_vec> DatagramIO::pending()
+    size_t DatagramIO::pending(ngtcp2_vec*, size_t)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        return {};
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        return 0;
     }
 
     dgram_interface::dgram_interface(Connection& c) : ci{c}, reference_id{ci.reference_id()} {}
@@ -82,62 +79,199 @@ namespace oxen::quic
     void DatagramIO::send_impl(bstring_view data, std::shared_ptr<void> keep_alive)
     {
         // if packet_splitting is lazy OR packet_splitting is off, send as "normal" datagram
-        endpoint.call([this, data, keep_alive = std::move(keep_alive)]() {
+        endpoint.call([this, data, keep_alive = std::move(keep_alive)]() mutable {
             if (!_conn)
             {
                 log::warning(log_cat, "Unable to send datagram: connection has gone away");
                 return;
             }
 
-            // check this first and once; already considers policy when returning
-            const auto max_size = _conn->get_max_datagram_size_impl();
+            if (enqueue(data, std::move(keep_alive), _conn->get_max_datagram_size_impl()))
+            {
+                publish_state();
+                _conn->app_data_ready();
+            }
+        });
+    }
 
-            // we use >= instead of > for that just-in-case 1-byte cushion
-            if (data.size() > max_size)
+    void DatagramIO::send_batch(std::vector<bstring_view> data, std::shared_ptr<void> keep_alive)
+    {
+        endpoint.call([this, data = std::move(data), keep_alive = std::move(keep_alive)]() {
+            if (!_conn)
             {
-                log::warning(
-                        log_cat,
-                        "Data of length {} cannot be sent with {} datagrams of max size {}",
-                        data.size(),
-                        _packet_splitting ? "unsplit" : "split",
-                        max_size);
-                // Ideally we would throw, but because we're inside a `call` and are probably
-                // running after the `send_impl` call returned, all we can really do is warn and
-                // drop.
+                log::warning(log_cat, "Unable to send {} datagrams: connection has gone away", data.size());
                 return;
             }
 
-            log::trace(
+            const auto max_size = _conn->get_max_datagram_size_impl();
+            bool queued = false;
+            for (auto& d : data)
+                queued |= enqueue(d, keep_alive, max_size);
+            if (queued)
+            {
+                publish_state();
+                _conn->app_data_ready();
+            }
+        });
+    }
+
+    bool DatagramIO::enqueue(bstring_view data, std::shared_ptr<void> keep_alive, size_t max_size)
+    {
+        // max_size already considers policy
+
+        // we use >= instead of > for that just-in-case 1-byte cushion
+        if (data.size() > max_size)
+        {
+            log::warning(
                     log_cat,
-                    "Connection ({}) sending {} datagram: {}",
-                    _conn->reference_id(),
-                    _packet_splitting ? "split" : "whole",
-                    buffer_printer{data});
+                    "Data of length {} cannot be sent with {} datagrams of max size {}",
+                    data.size(),
+                    _packet_splitting ? "unsplit" : "split",
+                    max_size);
+            // Ideally we would throw, but because we're inside a `call` and are probably running
+            // after the `send_impl` call returned, all we can really do is warn and drop.
+            return false;
+        }
 
-            bool split = _packet_splitting && data.size() > max_size / 2;
+        if (_fragmentation)
+        {
+            enqueue_fragments(data, std::move(keep_alive), max_size);
+            return true;
+        }
 
-            auto dgram_id = _next_dgram_counter << 2;
-            if (split)
-                dgram_id |= 0b10;
-            (++_next_dgram_counter) %= 1 << 14;
+        QUIC_HOT_TRACE(
+                log_cat,
+                "Connection ({}) sending {} datagram: {}",
+                _conn->reference_id(),
+                _packet_splitting ? "split" : "whole",
+                buffer_printer{data});
 
-            send_buffer.emplace(data, dgram_id, std::move(keep_alive), split ? dgram::OVERSIZED : dgram::STANDARD, max_size);
+        bool split = _packet_splitting && data.size() > max_size / 2;
 
-            _conn->packet_io_ready();
-        });
+        auto dgram_id = _next_dgram_counter << 2;
+        if (split)
+            dgram_id |= 0b10;
+        (++_next_dgram_counter) %= 1 << 14;
+
+        send_buffer.emplace(data, dgram_id, std::move(keep_alive), split ? dgram::OVERSIZED : dgram::STANDARD, max_size);
+        return true;
+    }
+
+    namespace
+    {
+        // Owns the parity fragment of a fragmented datagram, plus the keep-alive of the datagram's
+        // data (which the other fragments point into)
+        struct fragment_parity
+        {
+            bstring data;
+            std::shared_ptr<void> keep_alive;
+        };
+    }  // namespace
+
+    void DatagramIO::enqueue_fragments(bstring_view data, std::shared_ptr<void> keep_alive, size_t max_size)
+    {
+        // max_size is max_fragments times the largest fragment we can fit into a packet
+        const size_t frag_max = max_size / _fragmentation->max_fragments;
+        const size_t count = std::max<size_t>(1, (data.size() + frag_max - 1) / frag_max);
+
+        if (count == 1)
+        {
+            QUIC_HOT_TRACE(
+                    log_cat, "Connection ({}) sending whole datagram: {}", _conn->reference_id(), buffer_printer{data});
+            const uint8_t whole = 1;
+            send_buffer.emplace_fragment(data, 0, {&whole, 1}, std::move(keep_alive));
+            return;
+        }
+
+        // Spread the data evenly over the fragments, rather than sending a runt at the end
+        const size_t frag_size = (data.size() + count - 1) / count;
+        const auto msg_id = _next_msg_id++;
+
+        QUIC_HOT_TRACE(
+                log_cat,
+                "Connection ({}) sending datagram of size {} as msg ID {} in {} fragments{}",
+                _conn->reference_id(),
+                data.size(),
+                msg_id,
+                count,
+                _fragmentation->fec ? " plus parity" : "");
+
+        std::array<uint8_t, FRAGMENT_HEADER_SIZE> header{static_cast<uint8_t>(count), 0};
+        oxenc::write_host_as_big(msg_id, header.data() + 2);
+
+        std::shared_ptr<fragment_parity> parity;
+        if (_fragmentation->fec)
+        {
+            parity = std::make_shared<fragment_parity>();
+            parity->data.resize(4 + frag_size);
+            oxenc::write_host_as_big(static_cast<uint32_t>(data.size()), parity->data.data());
+            parity->keep_alive = std::move(keep_alive);
+            keep_alive = parity;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            auto frag = data.substr(i * frag_size, frag_size);
+            if (parity)
+            {
+                auto* p = parity->data.data() + 4;
+                for (size_t j = 0; j < frag.size(); j++)
+                    p[j] ^= frag[j];
+            }
+            header[1] = static_cast<uint8_t>(i);
+            send_buffer.emplace_fragment(frag, msg_id, {header.data(), header.size()}, keep_alive);
+        }
+
+        if (parity)
+        {
+            header[1] = static_cast<uint8_t>(count);
+            bstring_view pdata{parity->data};
+            send_buffer.emplace_fragment(pdata, msg_id, {header.data(), header.size()}, std::move(parity));
+        }
     }
 
     prepared_datagram DatagramIO::pending_datagram(bool r)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         return send_buffer.prepare(r, _packet_splitting);
     }
 
     std::optional<bstring> DatagramIO::to_buffer(bstring_view data, uint16_t dgid)
     {
-        log::trace(log_cat, "DatagramIO handed datagram with endian swapped ID: {}", dgid);
+        QUIC_HOT_TRACE(log_cat, "DatagramIO handed datagram with endian swapped ID: {}", dgid);
 
         return recv_buffer.receive(data, dgid);
     }
+
+    std::optional<bstring_view> DatagramIO::from_fragment(bstring_view data, std::optional<bstring>& reassembled)
+    {
+        if (data.empty())
+        {
+            log::warning(log_cat, "Ignoring invalid datagram: too short for fragmentation");
+            return std::nullopt;
+        }
+
+        auto count = static_cast<uint8_t>(data[0]);
+        if (count == 1)
+            return data.substr(1);
+
+        if (count == 0 || count > MAX_DATAGRAM_FRAGMENTS || data.size() < FRAGMENT_HEADER_SIZE)
+        {
+            log::warning(log_cat, "Ignoring invalid datagram fragment");
+            return std::nullopt;
+        }
+
+        auto index = static_cast<uint8_t>(data[1]);
+        auto msg_id = oxenc::load_big_to_host<uint16_t>(data.data() + 2);
+        data.remove_prefix(FRAGMENT_HEADER_SIZE);
+
+        reassembled = frag_buffer.receive(data, msg_id, index, count);
+        if (!reassembled)
+        {
+            QUIC_HOT_TRACE(log_cat, "Datagram (msg ID: {}) awaiting more fragments", msg_id);
+            return std::nullopt;
+        }
+        return *reassembled;
+    }
 }  // namespace oxen::quic
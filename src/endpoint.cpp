@@ -16,6 +16,8 @@ extern "C"
 #include <optional>
 
 #include "connection.hpp"
+#include "gnutls_crypto.hpp"
+#include "instrumentation.hpp"
 #include "internal.hpp"
 #include "types.hpp"
 #include "utils.hpp"
@@ -28,13 +30,28 @@ namespace oxen::quic
         _packet_splitting = dc.split_packets;
         _policy = dc.mode;
         _rbufsize = dc.bufsize;
+        _fragmentation.reset();
 
-        log::trace(
+        QUIC_HOT_TRACE(
                 log_cat,
                 "User has activated endpoint datagram support with {} split-packet support",
                 _packet_splitting ? "" : "no");
     }
 
+    void Endpoint::handle_ep_opt(opt::fragment_datagrams fd)
+    {
+        _datagrams = true;
+        _packet_splitting = false;
+        _policy = Splitting::FRAGMENT;
+        _fragmentation = fd;
+
+        QUIC_HOT_TRACE(
+                log_cat,
+                "User has activated endpoint datagram support with up to {} fragments per datagram{}",
+                fd.max_fragments,
+                fd.fec ? " (with parity)" : "");
+    }
+
     void Endpoint::handle_ep_opt(opt::outbound_alpns alpns)
     {
         outbound_alpns = std::move(alpns.alpns);
@@ -52,19 +69,37 @@ namespace oxen::quic
 
     void Endpoint::handle_ep_opt(dgram_data_callback func)
     {
-        log::trace(log_cat, "Endpoint given datagram recv callback");
+        QUIC_HOT_TRACE(log_cat, "Endpoint given datagram recv callback");
         dgram_recv_cb = std::move(func);
+        dgram_recv_view_cb = nullptr;
+        dgram_recv_pooled_cb = nullptr;
+    }
+
+    void Endpoint::handle_ep_opt(dgram_data_view_callback func)
+    {
+        QUIC_HOT_TRACE(log_cat, "Endpoint given datagram recv (view) callback");
+        dgram_recv_view_cb = std::move(func);
+        dgram_recv_cb = nullptr;
+        dgram_recv_pooled_cb = nullptr;
+    }
+
+    void Endpoint::handle_ep_opt(dgram_data_pooled_callback func)
+    {
+        QUIC_HOT_TRACE(log_cat, "Endpoint given datagram recv (pooled) callback");
+        dgram_recv_pooled_cb = std::move(func);
+        dgram_recv_cb = nullptr;
+        dgram_recv_view_cb = nullptr;
     }
 
     void Endpoint::handle_ep_opt(connection_established_callback conn_established_cb)
     {
-        log::trace(log_cat, "Endpoint given connection established callback");
+        QUIC_HOT_TRACE(log_cat, "Endpoint given connection established callback");
         connection_established_cb = std::move(conn_established_cb);
     }
 
     void Endpoint::handle_ep_opt(connection_closed_callback conn_closed_cb)
     {
-        log::trace(log_cat, "Endpoint given connection closed callback");
+        QUIC_HOT_TRACE(log_cat, "Endpoint given connection closed callback");
         connection_close_cb = std::move(conn_closed_cb);
     }
 
@@ -74,13 +109,81 @@ namespace oxen::quic
         assert(_static_secret.size() >= 16);  // opt::static_secret should have checked this
     }
 
+    void Endpoint::handle_ep_opt(opt::session_resumption resumption)
+    {
+        QUIC_HOT_TRACE(log_cat, "Endpoint given session cache for 0-RTT resumption");
+        _session_cache = std::move(resumption.cache);
+    }
+
+    void Endpoint::handle_ep_opt(opt::handshake_admission limits)
+    {
+        admission = admission_control{limits};
+    }
+
+    void Endpoint::handle_ep_opt(opt::connection_id_generator gen)
+    {
+        if (in_group())
+            throw std::invalid_argument{"opt::connection_id_generator cannot be used by endpoint group members"};
+        QUIC_HOT_TRACE(log_cat, "Endpoint given {}-byte connection ID generator", gen.generator->length());
+        _cid_generator = std::move(gen.generator);
+    }
+
+    void Endpoint::handle_ep_opt(opt::connection_pooling pooling)
+    {
+        QUIC_HOT_TRACE(
+                log_cat,
+                "Endpoint pooling outbound{} connections",
+                pooling.local_key ? " (and deduplicating inbound)" : "");
+        _pooling = std::move(pooling);
+    }
+
+    void Endpoint::handle_ep_opt(opt::memory_resource mem)
+    {
+        QUIC_HOT_TRACE(log_cat, "Endpoint allocating connection buffers from a custom memory resource");
+        _memory_factory = std::move(mem.per_connection);
+    }
+
+    std::shared_ptr<std::pmr::memory_resource> Endpoint::connection_memory()
+    {
+        assert(in_event_loop());
+        if (_memory_factory)
+            if (auto mem = _memory_factory())
+                return mem;
+        // Non-owning: the global heap outlives everything
+        return {std::shared_ptr<void>{}, std::pmr::new_delete_resource()};
+    }
+
     ConnectionID Endpoint::next_reference_id()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         assert(in_event_loop());
         return ConnectionID{++_next_rid};
     }
 
+    quic_cid Endpoint::make_cid() const
+    {
+        if (!_cid_generator)
+            return in_group() ? quic_cid::random(_group_index, _group_size) : quic_cid::random();
+
+        quic_cid cid;
+        cid.datalen = _cid_generator->length();
+        if (!_cid_generator->generate(cid.data))
+            throw std::runtime_error{"Failed to generate connection ID"};
+        return cid;
+    }
+
+    bool Endpoint::generate_cid(uint8_t* data) const
+    {
+        if (_cid_generator)
+            return _cid_generator->generate(data);
+
+        if (!random_bytes(data, NGTCP2_MAX_CIDLEN))
+            return false;
+        if (in_group())
+            quic_cid::set_route(data, _group_index, _group_size);
+        return true;
+    }
+
     ustring Endpoint::make_static_secret()
     {
         ustring secret;
@@ -89,34 +192,200 @@ namespace oxen::quic
         return secret;
     }
 
+    void Endpoint::set_max_udp_payload(size_t size)
+    {
+        if (size < MIN_UDP_PAYLOAD || size > MAX_JUMBO_UDP_PAYLOAD)
+            throw std::invalid_argument{"opt::max_udp_payload must be between {} and {} (got {})"_format(
+                    MIN_UDP_PAYLOAD, MAX_JUMBO_UDP_PAYLOAD, size)};
+        _max_udp_payload = size;
+
+        // ngtcp2 works through these in order, skipping any that aren't above what it has already
+        // confirmed, so we lead with the max itself and then fall back through the common MTUs
+        // below it (jumbo frames, ethernet, then ngtcp2's own defaults), less the same 48 bytes.
+        _pmtud_probes.clear();
+        if (size <= MAX_PMTUD_UDP_PAYLOAD)
+            return;
+        _pmtud_probes.push_back(static_cast<uint16_t>(size));
+        for (size_t mtu : {9000, 1500, 1454, 1390, 1280})
+            if (auto probe = mtu - 48; probe < size)
+                _pmtud_probes.push_back(static_cast<uint16_t>(probe));
+    }
+
     void Endpoint::_init_internals()
     {
-        log::debug(log_cat, "Starting new UDP socket on {}", _local);
-        socket = std::make_unique<UDPSocket>(
-                get_loop().get(), _local, [this](auto&& packet) { handle_packet(std::move(packet)); });
+        // Endpoints get constructed on the caller's thread, but the timer wheel (for the expiry
+        // timer below) may only be touched from the loop thread; a NUMA-local loop also wants our
+        // packet buffers and socket allocated from there.
+        if (!_loop.in_event_loop())
+            return _loop.call_get([this] { _init_internals(); });
+
+        datagram_pool.emplace(_max_udp_payload, 16);
+        datagram_recv_pool.emplace(2 * _max_udp_payload, 16);
+        egress_buf.resize(_max_udp_payload * DATAGRAM_BATCH_SIZE);
+
+        if (_transport_factory)
+        {
+            log::debug(log_cat, "Starting new packet transport on {}", _local);
+            socket = _transport_factory(
+                    get_loop().get(), _local, static_cast<PacketSink&>(*this), _socket_options, _max_udp_payload);
+            if (!socket)
+                throw std::runtime_error{"opt::packet_transport factory did not return a transport"};
+        }
+        else
+        {
+            log::debug(log_cat, "Starting new UDP socket on {}", _local);
+            auto udp = std::make_unique<UDPSocket>(
+                    get_loop().get(),
+                    _local,
+                    static_cast<PacketSink&>(*this),
+                    in_group(),
+                    _socket_options,
+                    _max_udp_payload);
+
+            // The first member of a group sets up steering for the whole reuseport group; since it
+            // is bound first it is socket 0 and subsequent members are numbered in order from there.
+            if (in_group() && _group_index == 0)
+                udp->attach_reuseport_steering(_group_size);
+
+            socket = std::move(udp);
+        }
 
         _local = socket->address();
 
-        expiry_timer.reset(event_new(
+        egress_flush.reset(event_new(
                 get_loop().get(),
-                -1,          // Not attached to an actual socket
-                EV_PERSIST,  // Stays active (i.e. repeats) once fired
-                [](evutil_socket_t, short, void* self) { static_cast<Endpoint*>(self)->check_timeouts(); },
+                -1,
+                0,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<Endpoint*>(self)->flush_egress();
+                },
                 this));
-        timeval exp_interval;
-        exp_interval.tv_sec = 0;
-        exp_interval.tv_usec = 250'000;
-        event_add(expiry_timer.get(), &exp_interval);
+
+        expiry_timer.emplace(
+                timers(),
+                [](void* self_) {
+                    auto& self = *static_cast<Endpoint*>(self_);
+                    self.check_timeouts();
+                    self.expiry_timer->schedule_after(STREAM_TIMEOUT_INTERVAL);
+                },
+                this);
+        expiry_timer->schedule_after(STREAM_TIMEOUT_INTERVAL);
     }
 
     void Endpoint::_listen()
     {
         _set_context_globals(inbound_ctx);
+        _init_session_resumption();
         _accepting_inbound = true;
 
         log::debug(log_cat, "Inbound context ready for incoming connections");
     }
 
+    void Endpoint::_init_session_resumption()
+    {
+        // GnuTLS wants a 64 byte ticket key, which is exactly a SHA-512 hash
+        static constexpr auto domain = "oxen-libquic session ticket key"sv;
+        ustring buf;
+        buf.reserve(domain.size() + _static_secret.size());
+        buf += to_usv(domain);
+        buf += _static_secret;
+        _ticket_key.resize(64);
+        if (auto rv = gnutls_hash_fast(GNUTLS_DIG_SHA512, buf.data(), buf.size(), _ticket_key.data()); rv != 0)
+            throw std::runtime_error{"Failed to derive session ticket key: {}"_format(gnutls_strerror(rv))};
+        _ticket_key_datum = {_ticket_key.data(), static_cast<unsigned int>(_ticket_key.size())};
+
+        gnutls_anti_replay_t ar;
+        if (auto rv = gnutls_anti_replay_init(&ar); rv != 0)
+            throw std::runtime_error{"gnutls_anti_replay_init failed: {}"_format(gnutls_strerror(rv))};
+        _anti_replay.reset(ar);
+        gnutls_anti_replay_set_window(
+                ar, std::chrono::duration_cast<std::chrono::milliseconds>(ANTI_REPLAY_WINDOW).count());
+        gnutls_anti_replay_set_add_function(ar, anti_replay_db_add_func);
+        gnutls_anti_replay_set_ptr(ar, this);
+    }
+
+    Path Endpoint::outbound_path(RemoteAddress& remote) const
+    {
+        if (!remote.is_addressable())
+            throw std::invalid_argument("Address must be addressible to connect");
+
+        if (_local.is_ipv6() && !remote.is_ipv6())
+            remote.map_ipv4_as_ipv6();
+
+        return Path{_local, remote};
+    }
+
+    std::shared_ptr<Connection> Endpoint::_connect(Path path, std::shared_ptr<IOContext> ctx, ustring remote_pk)
+    {
+        assert(in_event_loop());
+
+        if (_pooling && !remote_pk.empty())
+        {
+            if (auto existing = pooled_conn(remote_pk))
+            {
+                log::debug(log_cat, "Reusing pooled connection ({}) to remote", existing->reference_id());
+                return existing;
+            }
+        }
+
+        _set_context_globals(ctx);
+        outbound_ctx = ctx;
+
+        auto next_rid = next_reference_id();
+
+        for (;;)
+        {
+            // reserve a random CID in the lookup table; it is pointed at the connection once that
+            // has been constructed
+            if (auto scid = make_cid(); conn_lookup.emplace(scid, nullptr).second)
+            {
+                if (auto [it_b, res_b] = conns.emplace(next_rid, nullptr); res_b)
+                {
+                    try
+                    {
+                        it_b->second = Connection::make_conn(
+                                *this,
+                                next_rid,
+                                scid,
+                                quic_cid::random(),
+                                std::move(path),
+                                std::move(ctx),
+                                outbound_alpns,
+                                handshake_timeout,
+                                std::move(remote_pk));
+                    }
+                    catch (...)
+                    {
+                        conns.erase(it_b);
+                        conn_lookup.erase(scid);
+                        lookup_generation++;
+                        throw;
+                    }
+                    conn_lookup.insert_or_assign(scid, it_b->second.get());
+                    if (auto key = it_b->second->remote_key(); _pooling && !key.empty())
+                        pool.insert_or_assign(ustring{key}, next_rid);
+                    return it_b->second;
+                }
+                conn_lookup.erase(scid);
+            }
+        }
+    }
+
+    std::shared_ptr<connection_interface> Endpoint::_try_connect(
+            Path path, std::shared_ptr<IOContext> ctx, ustring remote_pk)
+    {
+        try
+        {
+            return _connect(std::move(path), std::move(ctx), std::move(remote_pk));
+        }
+        catch (const std::exception& e)
+        {
+            log::error(log_cat, "Failed to create outbound connection: {}", e.what());
+            return nullptr;
+        }
+    }
+
     void Endpoint::_set_context_globals(std::shared_ptr<IOContext>& ctx)
     {
         ctx->config.datagram_support = _datagrams;
@@ -142,23 +411,74 @@ namespace oxen::quic
         return ret;
     }
 
-    void Endpoint::close_conns(std::optional<Direction> d)
+    void Endpoint::close_conns(std::optional<Direction> d, std::chrono::milliseconds max_time)
     {
+        std::chrono::steady_clock::time_point deadline{};
+        if (max_time > 0ms)
+            deadline = get_time() + max_time;
+
         // We need to defer this because we aren't allowed to close connections during some other
         // callback, and can't guarantee we aren't in such a callback.
-        call_soon([this, d] { _close_conns(d); });
+        call_soon([this, d, deadline] { _close_conns(d, deadline); });
     }
 
-    void Endpoint::_close_conns(std::optional<Direction> d)
+    void Endpoint::_close_conns(
+            std::optional<Direction> d, std::chrono::steady_clock::time_point deadline, std::function<void()> done)
     {
         // We have to do this in two passes rather than just closing as we go because
-        // `_close_connection` can remove from `conns`, invalidating our implicit iterator.
-        std::vector<Connection*> close_me;
-        for (const auto& c : conns)
-            if (!d || *d == c.second->direction())
-                close_me.push_back(c.second.get());
-        for (auto* c : close_me)
-            _close_connection(*c, io_error{0}, "NO_ERROR");
+        // `_close_connection` can remove from `conns`, invalidating our implicit iterator.  We keep
+        // IDs rather than pointers because connections can go away between batches.
+        auto close_me = std::make_shared<std::vector<ConnectionID>>();
+        close_me->reserve(conns.size());
+        for (const auto& [rid, c] : conns)
+            if (c && (!d || *d == c->direction()))
+                close_me->push_back(rid);
+
+        log::debug(log_cat, "Closing {} connection(s)", close_me->size());
+        _close_conns_batch(std::move(close_me), 0, deadline, std::move(done));
+    }
+
+    void Endpoint::_close_conns_batch(
+            std::shared_ptr<std::vector<ConnectionID>> ids,
+            size_t pos,
+            std::chrono::steady_clock::time_point deadline,
+            std::function<void()> done)
+    {
+        const bool expired = deadline != std::chrono::steady_clock::time_point{} && get_time() >= deadline;
+        if (expired)
+            log::warning(
+                    log_cat, "Ran out of time closing connections; dropping the last {} of them", ids->size() - pos);
+
+        // Once out of time we drop all the rest at once: that's quick, since nothing gets sent
+        const size_t end = expired ? ids->size() : std::min(ids->size(), pos + CLOSE_BATCH_SIZE);
+        for (; pos < end; pos++)
+        {
+            auto it = conns.find((*ids)[pos]);
+            if (it == conns.end() || !it->second || it->second->is_closing() || it->second->is_draining())
+                continue;
+            if (expired)
+            {
+                it->second->set_closing();
+                it->second->halt_events();
+                drop_connection(*it->second, io_error{CONN_SHUTDOWN_TIMEOUT});
+            }
+            else
+                _close_connection(*it->second, io_error{0}, "NO_ERROR");
+        }
+
+        if (pos < ids->size())
+        {
+            call_soon([this, ids = std::move(ids), pos, deadline, done = std::move(done)]() mutable {
+                _close_conns_batch(std::move(ids), pos, deadline, std::move(done));
+            });
+            return;
+        }
+
+        // Send the last of the close packets now rather than leaving them for the flush event, in
+        // case we're shutting down and the loop is about to stop
+        flush_egress();
+        if (done)
+            done();
     }
 
     void Endpoint::drain_connection(Connection& conn)
@@ -179,25 +499,69 @@ namespace oxen::quic
 
         _execute_close_hooks(conn, io_error{err->error_code});
 
-        draining_closing.emplace(get_time() + ngtcp2_conn_get_pto(conn) * 3 * 1ns, conn.reference_id());
+        conn.schedule_removal(get_time() + ngtcp2_conn_get_pto(conn) * 3 * 1ns);
 
         log::debug(log_cat, "Connection ({}) marked as draining", conn.reference_id());
     }
 
     void Endpoint::handle_packet(Packet&& pkt)
     {
-        auto dcid_opt = handle_packet_connid(pkt);
+        handle_packets(&pkt, 1);
+    }
 
-        if (!dcid_opt)
+    void Endpoint::handle_packets(Packet* pkts, size_t n)
+    {
+        // Packets typically arrive in runs for the same connection (e.g. a burst of stream data from
+        // one peer), so we only look up the connection again when the DCID changes, or if handling
+        // the previous packet removed any connection or CID.
+        Connection* cptr = nullptr;
+        quic_cid last_dcid;
+        uint64_t generation = 0;
+
+        for (size_t i = 0; i < n; i++)
         {
-            log::warning(log_cat, "Error: initial packet handling failed");
-            return;
-        }
+            auto& pkt = pkts[i];
 
-        auto& dcid = *dcid_opt;
+            auto dcid_opt = handle_packet_connid(pkt);
 
+            if (!dcid_opt)
+            {
+                log::warning(log_cat, "Error: initial packet handling failed");
+                continue;
+            }
+
+            auto& dcid = *dcid_opt;
+
+            if (!cptr || dcid != last_dcid || generation != lookup_generation)
+            {
+                cptr = connection_for_packet(pkt, dcid);
+                if (!cptr)
+                    continue;
+                last_dcid = dcid;
+                generation = lookup_generation;
+            }
+
+            if (cptr->is_outbound())
+                // For a inbound packet on an outbound connection the packet handling code will have
+                // set the actual ip address in the packet, but that might not match the path that
+                // we created the connection with (because, often, we create using the any address),
+                // so forcibly reset the local address to the endpoint bind address so that we don't
+                // see it on an unknown path because of the anyaddr != specific address mismatch.
+                //
+                // We *don't* want to do this for inbound connections because we absolutely have to
+                // return those from the same address they arrived on (otherwise, on a multi-IP
+                // machine, you could have something arrive on IP2 but reply on IP1, which the
+                // remote side will not accept).
+                pkt.path.local = _local;
+
+            cptr->handle_conn_packet(pkt);
+        }
+    }
+
+    Connection* Endpoint::connection_for_packet(const Packet& pkt, quic_cid& dcid)
+    {
         // check existing conns
-        log::trace(log_cat, "Incoming connection ID: {}", dcid);
+        QUIC_HOT_TRACE(log_cat, "Incoming connection ID: {}", dcid);
 
         auto cptr = fetch_associated_conn(&dcid);
 
@@ -210,7 +574,7 @@ namespace oxen::quic
                 if (!cptr)
                 {
                     log::warning(log_cat, "Error: connection could not be created");
-                    return;
+                    return nullptr;
                 }
 
                 initial_association(*cptr);
@@ -218,26 +582,13 @@ namespace oxen::quic
             else
             {
                 log::info(log_cat, "Dropping packet; unknown connection ID to endpoint not accepting inbound conns");
-                return;
+                return nullptr;
             }
         }
         else
-            log::debug(log_cat, "Found associated connection to incoming DCID!");
+            QUIC_HOT_DEBUG(log_cat, "Found associated connection to incoming DCID!");
 
-        if (cptr->is_outbound())
-            // For a inbound packet on an outbound connection the packet handling code will have set
-            // the actual ip address in the packet, but that might not match the path that we
-            // created the connection with (because, often, we create using the any address), so
-            // forcibly reset the local address to the endpoint bind address so that we don't see it
-            // on an unknown path because of the anyaddr != specific address mismatch.
-            //
-            // We *don't* want to do this for inbound connections because we absolutely have to
-            // return those from the same address they arrived on (otherwise, on a multi-IP machine,
-            // you could have something arrive on IP2 but reply on IP1, which the remote side will
-            // not accept).
-            pkt.path.local = _local;
-
-        cptr->handle_conn_packet(std::move(pkt));
+        return cptr;
     }
 
     void Endpoint::drop_connection(Connection& conn, io_error err)
@@ -266,17 +617,21 @@ namespace oxen::quic
             conn.close_all_streams();
 
             // prioritize connection level callback over endpoint level
+            scoped_callback timing{loop_callback::connection};
             if (conn.conn_closed_cb)
             {
-                log::trace(log_cat, "{} Calling Connection-level close callback", conn.is_inbound() ? "server" : "client");
+                QUIC_HOT_TRACE(
+                        log_cat, "{} Calling Connection-level close callback", conn.is_inbound() ? "server" : "client");
                 conn.conn_closed_cb(conn, ec.code());
             }
             else if (connection_close_cb)
             {
-                log::trace(log_cat, "{} Calling Endpoint-level close callback", conn.is_inbound() ? "server" : "client");
+                QUIC_HOT_TRACE(log_cat, "{} Calling Endpoint-level close callback", conn.is_inbound() ? "server" : "client");
                 connection_close_cb(conn, ec.code());
             }
         }
+        else
+            conn.notify_streams_dropped();
     }
 
     void Endpoint::_close_connection(Connection& conn, io_error ec, std::string msg)
@@ -322,12 +677,11 @@ namespace oxen::quic
         else
             ngtcp2_ccerr_set_application_error(&err, ec.code(), reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
 
-        std::vector<std::byte> buf;
-        buf.resize(MAX_PMTUD_UDP_PAYLOAD);
+        std::array<std::byte, MAX_PMTUD_UDP_PAYLOAD> buf;
         ngtcp2_pkt_info pkt_info{};
 
         auto written = ngtcp2_conn_write_connection_close(
-                conn, nullptr, &pkt_info, u8data(buf), buf.size(), &err, get_timestamp().count());
+                conn, nullptr, &pkt_info, u8data(buf), buf.size(), &err, conn.ngtcp2_ts(get_timestamp().count()));
 
         if (written <= 0)
         {
@@ -341,13 +695,32 @@ namespace oxen::quic
         }
         // ensure we had enough write space
         assert(static_cast<size_t>(written) <= buf.size());
-        buf.resize(written);
+        size_t size = static_cast<size_t>(written);
 
         log::debug(log_cat, "Marked connection ({}) as closing; sending close packet", conn.reference_id());
 
-        draining_closing.emplace(get_time() + ngtcp2_conn_get_pto(conn) * 3 * 1ns, conn.reference_id());
+        conn.schedule_removal(get_time() + ngtcp2_conn_get_pto(conn) * 3 * 1ns);
 
-        send_or_queue_packet(conn.path_impl(), std::move(buf), /*ecn=*/0, [this, &conn](io_result rv) {
+        // The close packet normally just joins the egress batch, so that closing many connections
+        // at once (such as with close_conns) sends their close packets in batches.  Only if the
+        // socket is blocked do we copy it out to wait for the socket.
+        size_t n_pkts = 1;
+        if (auto rv = queue_packets(conn.path_impl(), buf.data(), &size, /*ecn=*/0, n_pkts); !rv.blocked())
+        {
+            if (rv.failure())
+            {
+                log::warning(
+                        log_cat,
+                        "Error: failed to send close packet [{}]; removing connection ({})",
+                        rv.str_error(),
+                        conn.reference_id());
+                delete_connection(conn);
+            }
+            return;
+        }
+
+        std::vector<std::byte> pkt{buf.begin(), buf.begin() + size};
+        send_or_queue_packet(conn.path_impl(), std::move(pkt), /*ecn=*/0, [this, &conn](io_result rv) {
             if (rv.failure())
             {
                 log::warning(
@@ -385,40 +758,30 @@ namespace oxen::quic
 
         conn.drop_streams();
 
+        inbound_handshake_finished(conn);
+        unpool(conn);
+
         conns.erase(rid);
+        lookup_generation++;
         log::debug(log_cat, "Deleted connection ({})", rid);
     }
 
-    int Endpoint::validate_anti_replay(ustring key, ustring data, time_t /* exp */)
+    int Endpoint::validate_anti_replay(ustring_view key)
     {
-        if (auto itr = anti_replay_db.find(key); itr != anti_replay_db.end())
+        // GnuTLS itself rejects ClientHellos older than the window, so we only need to remember
+        // keys for that long; a full store refuses the key, which just makes the client fall back
+        // to a full handshake.
+        if (!anti_replay_db.insert(key))
         {
-            auto& entry = itr->second;
-
-            if (entry == data)
-                return GNUTLS_E_DB_ENTRY_EXISTS;
+            log::debug(log_cat, "Rejecting 0-RTT early data: replayed (or anti-replay store is full)");
+            return GNUTLS_E_DB_ENTRY_EXISTS;
         }
-
-        anti_replay_db[std::move(key)] = std::move(data);
         return 0;
     }
 
-    void Endpoint::store_0rtt_transport_params(ustring remote_pk, ustring encoded_params)
-    {
-        encoded_transport_params.insert_or_assign(remote_pk, std::move(encoded_params));
-    }
-
-    std::optional<ustring> Endpoint::get_0rtt_transport_params(ustring remote_pk)
-    {
-        if (auto itr = encoded_transport_params.find(remote_pk); itr != encoded_transport_params.end())
-            return itr->second;
-
-        return std::nullopt;
-    }
-
     void Endpoint::initial_association(Connection& conn)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
         assert(in_event_loop());
 
         std::array<ngtcp2_cid, MAX_ACTIVE_CIDS> scids;
@@ -426,7 +789,7 @@ namespace oxen::quic
         auto dir_str = conn.is_outbound() ? "CLIENT"s : "SERVER"s;
         auto n = ngtcp2_conn_get_scid(conn, nullptr);
 
-        log::trace(log_cat, "{} associating {} active initial CID's", dir_str, n);
+        QUIC_HOT_TRACE(log_cat, "{} associating {} active initial CID's", dir_str, n);
 
         ngtcp2_conn_get_scid(conn, scids.data());
 
@@ -439,7 +802,7 @@ namespace oxen::quic
     void Endpoint::associate_cid(const ngtcp2_cid* cid, Connection& conn)
     {
         auto dir_str = conn.is_inbound() ? "SERVER"s : "CLIENT"s;
-        log::trace(
+        QUIC_HOT_TRACE(
                 log_cat,
                 "{} associating CID:{} to {}",
                 dir_str,
@@ -448,7 +811,7 @@ namespace oxen::quic
 
         assert(in_event_loop());
         auto ccid = quic_cid{*cid};
-        conn_lookup.emplace(ccid, conn.reference_id());
+        conn_lookup.insert_or_assign(ccid, &conn);
         conn.store_associated_cid(ccid);
     }
 
@@ -458,7 +821,7 @@ namespace oxen::quic
             return;
 
         auto dir_str = conn.is_inbound() ? "SERVER"s : "CLIENT"s;
-        log::trace(
+        QUIC_HOT_TRACE(
                 log_cat,
                 "{} dissociating CID:{} to {}",
                 dir_str,
@@ -468,19 +831,15 @@ namespace oxen::quic
         assert(in_event_loop());
         auto ccid = quic_cid{*cid};
         conn_lookup.erase(ccid);
+        lookup_generation++;
     }
 
     Connection* Endpoint::fetch_associated_conn(ngtcp2_cid* cid)
     {
         auto ccid = quic_cid{*cid};
 
-        if (auto it_a = conn_lookup.find(ccid); it_a != conn_lookup.end())
-        {
-            if (auto it_b = conns.find(it_a->second); it_b != conns.end())
-            {
-                return it_b->second.get();
-            }
-        }
+        if (auto* c = conn_lookup.find(ccid); c && *c)
+            return *c;
 
         log::debug(log_cat, "Could not find connection associated with {}", ccid);
 
@@ -498,7 +857,7 @@ namespace oxen::quic
                     _static_secret.size(),
                     pkt.path.remote,
                     pkt.path.remote.socklen(),
-                    3600 * NGTCP2_SECONDS,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(PATH_TOKEN_LIFETIME).count(),
                     now);
             rv != 0)
         {
@@ -539,9 +898,19 @@ namespace oxen::quic
     void Endpoint::send_retry(const Packet& pkt, ngtcp2_pkt_hd* hdr)
     {
         ngtcp2_cid scid;
-        scid.datalen = NGTCP2_RETRY_SCIDLEN;
+        bool ok;
+        if (_cid_generator)
+        {
+            scid.datalen = _cid_generator->length();
+            ok = _cid_generator->generate(scid.data);
+        }
+        else
+        {
+            scid.datalen = NGTCP2_RETRY_SCIDLEN;
+            ok = random_bytes(scid.data, scid.datalen);
+        }
 
-        if (auto rv = gnutls_rnd(GNUTLS_RND_RANDOM, scid.data, scid.datalen); rv != 0)
+        if (!ok)
         {
             log::warning(log_cat, "Server failed to generate retry SCID!");
             return;
@@ -606,22 +975,103 @@ namespace oxen::quic
         send_or_queue_packet(pkt.path, std::move(buf), /* ecn */ 0);
     }
 
-    void Endpoint::store_path_validation_token(ustring remote_pk, ustring token)
+    void Endpoint::store_path_validation_token(ustring_view remote_pk, ustring token)
     {
-        path_validation_tokens.insert_or_assign(std::move(remote_pk), std::move(token));
+        path_validation_tokens.insert_or_assign(remote_pk, std::move(token));
     }
 
-    std::optional<ustring> Endpoint::get_path_validation_token(ustring remote_pk)
+    std::optional<ustring> Endpoint::get_path_validation_token(ustring_view remote_pk)
     {
-        if (auto itr = path_validation_tokens.find(remote_pk); itr != path_validation_tokens.end())
-            return itr->second;
+        if (auto* token = path_validation_tokens.find(remote_pk))
+            return *token;
 
         return std::nullopt;
     }
 
+    void Endpoint::inbound_handshake_finished(Connection& conn)
+    {
+        if (pending_handshakes.erase(conn.reference_id()))
+            admission.handshake_finished();
+    }
+
+    std::shared_ptr<Connection> Endpoint::pooled_conn(ustring_view remote_key)
+    {
+        auto it = pool.find(remote_key);
+        if (it == pool.end())
+            return nullptr;
+        auto c = conns.find(it->second);
+        if (c == conns.end() || !c->second || c->second->is_closing() || c->second->is_draining())
+            return nullptr;
+        return c->second;
+    }
+
+    bool Endpoint::pool_inbound(Connection& conn)
+    {
+        if (!_pooling || !_pooling->local_key || conn.remote_key().empty())
+            return true;
+
+        auto remote = conn.remote_key();
+        auto existing = pooled_conn(remote);
+        if (existing && existing->is_outbound())
+        {
+            // Keep the connection initiated by the lower pubkey: ours if that is us
+            if (ustring_view{*_pooling->local_key} < remote)
+            {
+                log::debug(
+                        log_cat,
+                        "Closing inbound connection ({}) duplicating outbound connection ({})",
+                        conn.reference_id(),
+                        existing->reference_id());
+                // It was never reported as established, so it shouldn't be reported as closed either
+                conn.set_close_quietly();
+                close_connection(conn, io_error{CONN_DUPLICATE});
+                return false;
+            }
+            log::debug(
+                    log_cat,
+                    "Closing outbound connection ({}) duplicated by inbound connection ({})",
+                    existing->reference_id(),
+                    conn.reference_id());
+            close_connection(*existing, io_error{CONN_DUPLICATE});
+        }
+
+        // Otherwise the newest inbound connection replaces any older one (from which the remote has
+        // most likely moved on)
+        pool.insert_or_assign(ustring{remote}, conn.reference_id());
+        return true;
+    }
+
+    void Endpoint::unpool(Connection& conn)
+    {
+        if (!_pooling)
+            return;
+        if (auto it = pool.find(conn.remote_key()); it != pool.end() && it->second == conn.reference_id())
+            pool.erase(it);
+    }
+
+    admission_stats Endpoint::handshake_admission_stats()
+    {
+        return call_get([this] { return admission.stats(); });
+    }
+
+    uint64_t Endpoint::handshake_prefix_dropped(const Address& remote)
+    {
+        return call_get([&] { return admission.prefix_dropped(remote); });
+    }
+
+    endpoint_stats Endpoint::stats() const
+    {
+        endpoint_stats s;
+        if (socket)
+            s.socket = socket->stats();
+        s.packets_lost = _packets_lost.load(std::memory_order_relaxed);
+        s.bytes_lost = _bytes_lost.load(std::memory_order_relaxed);
+        return s;
+    }
+
     void Endpoint::connection_established(connection_interface& conn)
     {
-        log::trace(log_cat, "Connection established, calling user callback ({})", conn.reference_id());
+        QUIC_HOT_TRACE(log_cat, "Connection established, calling user callback ({})", conn.reference_id());
 
         if (connection_established_cb)
             connection_established_cb(conn);
@@ -630,7 +1080,7 @@ namespace oxen::quic
     std::optional<quic_cid> Endpoint::handle_packet_connid(const Packet& pkt)
     {
         ngtcp2_version_cid vid;
-        auto rv = ngtcp2_pkt_decode_version_cid(&vid, u8data(pkt.data), pkt.data.size(), NGTCP2_MAX_CIDLEN);
+        auto rv = ngtcp2_pkt_decode_version_cid(&vid, u8data(pkt.data), pkt.data.size(), cid_length());
 
         if (rv == NGTCP2_ERR_VERSION_NEGOTIATION)
         {  // version negotiation has not been sent yet, ignore packet
@@ -639,13 +1089,13 @@ namespace oxen::quic
         }
         if (rv != 0)
         {
-            log::debug(log_cat, "Error: failed to decode QUIC packet header [code: {}]", ngtcp2_strerror(rv));
+            QUIC_HOT_DEBUG(log_cat, "Error: failed to decode QUIC packet header [code: {}]", ngtcp2_strerror(rv));
             return std::nullopt;
         }
 
         if (vid.dcidlen > NGTCP2_MAX_CIDLEN)
         {
-            log::debug(
+            QUIC_HOT_DEBUG(
                     log_cat,
                     "Error: destination ID is longer than NGTCP2_MAX_CIDLEN ({} > {})",
                     vid.dcidlen,
@@ -658,7 +1108,7 @@ namespace oxen::quic
 
     Connection* Endpoint::accept_initial_connection(const Packet& pkt)
     {
-        log::trace(log_cat, "Accepting new connection...");
+        QUIC_HOT_TRACE(log_cat, "Accepting new connection...");
 
         ngtcp2_pkt_hd hdr;
 
@@ -720,23 +1170,35 @@ namespace oxen::quic
             }
         }
 
-        log::debug(log_cat, "Constructing path using packet path: {}", pkt.path);
-
         assert(in_event_loop());
 
+        switch (admission.admit(pkt.path.remote, token_type != NGTCP2_TOKEN_TYPE_UNKNOWN))
+        {
+            case admission_control::decision::accept:
+                break;
+            case admission_control::decision::retry:
+                send_retry(pkt, &hdr);
+                return nullptr;
+            case admission_control::decision::drop:
+                return nullptr;
+        }
+
+        QUIC_HOT_DEBUG(log_cat, "Constructing path using packet path: {}", pkt.path);
+
         auto next_rid = next_reference_id();
 
         for (;;)
         {
-            // emplace random CID into lookup keyed to unique reference ID
-            if (auto [it_a, res_a] = conn_lookup.emplace(quic_cid::random(), next_rid); res_a)
+            // reserve a random CID in the lookup table; it is pointed at the connection once that has
+            // been constructed
+            if (auto scid = make_cid(); conn_lookup.emplace(scid, nullptr).second)
             {
                 if (auto [it_b, res_b] = conns.emplace(next_rid, nullptr); res_b)
                 {
                     it_b->second = Connection::make_conn(
                             *this,
                             next_rid,
-                            it_a->first,
+                            scid,
                             hdr.scid,
                             pkt.path,
                             inbound_ctx,
@@ -746,6 +1208,10 @@ namespace oxen::quic
                             &hdr,
                             token_type,
                             pkt_original_cid);
+                    conn_lookup.insert_or_assign(scid, it_b->second.get());
+
+                    pending_handshakes.insert(next_rid);
+                    admission.handshake_started();
 
                     return it_b->second.get();
                 }
@@ -755,7 +1221,7 @@ namespace oxen::quic
 
     io_result Endpoint::send_packets(const Path& path, std::byte* buf, size_t* bufsize, uint8_t ecn, size_t& n_pkts)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         if (!socket)
         {
@@ -764,7 +1230,7 @@ namespace oxen::quic
         }
         assert(n_pkts >= 1 && n_pkts <= MAX_BATCH);
 
-        log::trace(log_cat, "Sending {} UDP packet(s) {}...", n_pkts, path);
+        QUIC_HOT_TRACE(log_cat, "Sending {} UDP packet(s) {}...", n_pkts, path);
 
         auto [ret, sent] = socket->send(path, buf, bufsize, ecn, n_pkts);
 
@@ -778,12 +1244,12 @@ namespace oxen::quic
         if (sent < n_pkts)
         {
             if (sent == 0)  // Didn't send *any* packets, i.e. we got entirely blocked
-                log::debug(log_cat, "UDP sent none of {}", n_pkts);
+                QUIC_HOT_DEBUG(log_cat, "UDP sent none of {}", n_pkts);
 
             else
             {
                 // We sent some but not all, so shift the unsent packets back to the beginning of buf/bufsize
-                log::debug(log_cat, "UDP undersent {}/{}", sent, n_pkts);
+                QUIC_HOT_DEBUG(log_cat, "UDP undersent {}/{}", sent, n_pkts);
                 size_t offset = std::accumulate(bufsize, bufsize + sent, size_t{0});
                 size_t len = std::accumulate(bufsize + sent, bufsize + n_pkts, size_t{0});
                 std::memmove(buf, buf + offset, len);
@@ -802,10 +1268,124 @@ namespace oxen::quic
         return ret;
     }
 
+    io_result Endpoint::queue_packets(const Path& path, std::byte* buf, size_t* bufsize, uint8_t ecn, size_t& n_pkts)
+    {
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+
+        if (!socket)
+        {
+            log::warning(log_cat, "Cannot send packets on closed socket ({})", path);
+            return io_result{EBADF};
+        }
+        assert(n_pkts >= 1 && n_pkts <= MAX_BATCH);
+
+        if (egress_blocked)
+            return io_result{EAGAIN};
+
+        if (egress_pkts + n_pkts > MAX_BATCH)
+        {
+            // No room for these: send what we have first
+            flush_egress();
+            if (egress_blocked)
+                return io_result{EAGAIN};
+        }
+
+        // A full batch with nothing queued ahead of it has nothing to be batched with, so skip the
+        // copy and send it right away.
+        if (egress_pkts == 0 && n_pkts == MAX_BATCH)
+            return send_packets(path, buf, bufsize, ecn, n_pkts);
+
+        auto len = std::accumulate(bufsize, bufsize + n_pkts, size_t{0});
+        assert(egress_bytes + len <= egress_buf.size());
+        std::memcpy(egress_buf.data() + egress_bytes, buf, len);
+        std::copy(bufsize, bufsize + n_pkts, egress_sizes.begin() + egress_pkts);
+
+        if (auto* last = egress_runs.empty() ? nullptr : &egress_runs.back();
+            last && last->ecn == ecn && last->path.local == path.local && last->path.remote == path.remote)
+            last->n_pkts += n_pkts;
+        else
+            egress_runs.push_back({path, ecn, n_pkts});
+
+        if (egress_pkts == 0)
+            event_active(egress_flush.get(), 0, 0);
+
+        egress_pkts += n_pkts;
+        egress_bytes += len;
+        n_pkts = 0;
+        return io_result{};
+    }
+
+    void Endpoint::flush_egress()
+    {
+        if (!socket || egress_blocked)
+            return;
+
+        std::array<PacketTransport::send_run, DATAGRAM_BATCH_SIZE> runs;
+
+        while (egress_pkts > 0)
+        {
+            QUIC_HOT_TRACE(log_cat, "Sending egress batch of {} packet(s) to {} path(s)", egress_pkts, egress_runs.size());
+
+            for (size_t i = 0; i < egress_runs.size(); i++)
+                runs[i] = {&egress_runs[i].path, egress_runs[i].ecn, egress_runs[i].n_pkts};
+
+            auto [ret, sent] = socket->send(runs.data(), egress_runs.size(), egress_buf.data(), egress_sizes.data());
+
+            if (sent > 0)
+            {
+                // Partial sends leave us not knowing whether the remainder hit a block or an error
+                // (sendmmsg only reports an error for the first message), so go around again.
+                egress_consume(sent);
+                continue;
+            }
+
+            if (ret.blocked())
+            {
+                QUIC_HOT_DEBUG(log_cat, "Egress batch send blocked with {} packets left; queuing re-send", egress_pkts);
+                egress_blocked = true;
+                socket->when_writeable([this] {
+                    egress_blocked = false;
+                    flush_egress();
+                });
+                return;
+            }
+
+            if (ret.failure())
+            {
+                // The first path's packets failed, so drop them and carry on with the others
+                auto& failed = egress_runs.front();
+                log::warning(
+                        log_cat,
+                        "Error sending {} packet(s) {}: {}; dropping them",
+                        failed.n_pkts,
+                        failed.path,
+                        ret.str_error());
+                egress_consume(failed.n_pkts);
+            }
+        }
+    }
+
+    void Endpoint::egress_consume(size_t n)
+    {
+        assert(n <= egress_pkts);
+        size_t len = std::accumulate(egress_sizes.begin(), egress_sizes.begin() + n, size_t{0});
+        std::memmove(egress_buf.data(), egress_buf.data() + len, egress_bytes - len);
+        std::copy(egress_sizes.begin() + n, egress_sizes.begin() + egress_pkts, egress_sizes.begin());
+        egress_pkts -= n;
+        egress_bytes -= len;
+
+        auto it = egress_runs.begin();
+        for (; it != egress_runs.end() && n >= it->n_pkts; ++it)
+            n -= it->n_pkts;
+        if (n > 0)
+            it->n_pkts -= n;
+        egress_runs.erase(egress_runs.begin(), it);
+    }
+
     void Endpoint::send_or_queue_packet(
             const Path& p, std::vector<std::byte> buf, uint8_t ecn, std::function<void(io_result)> callback)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         if (!socket)
         {
@@ -832,7 +1412,7 @@ namespace oxen::quic
     void Endpoint::send_version_negotiation(const ngtcp2_version_cid& vid, const Path& p)
     {
         uint8_t rint;
-        gnutls_rnd(GNUTLS_RND_RANDOM, &rint, 8);
+        (void)random_bytes(&rint, sizeof(rint));
         std::vector<std::byte> buf;
         buf.resize(MAX_PMTUD_UDP_PAYLOAD);
         std::array<uint32_t, NGTCP2_PROTO_VER_MAX - NGTCP2_PROTO_VER_MIN + 2> versions;
@@ -864,24 +1444,6 @@ namespace oxen::quic
 
     void Endpoint::check_timeouts()
     {
-        auto now = get_time();
-
-        for (auto it_a = draining_closing.begin(); it_a != draining_closing.end();)
-        {
-            if (it_a->first < now)
-            {
-                if (auto it_b = conns.find(it_a->second); it_b != conns.end())
-                {
-                    log::debug(log_cat, "Deleting closing/draining connection ({})", it_b->first);
-                    delete_connection(*it_b->second.get());
-                }
-
-                it_a = draining_closing.erase(it_a);
-            }
-            else
-                ++it_a;
-        }
-
         // Propagate the timeout check to connections, to be propagated to streams
         for (auto& [cid, conn] : conns)
             conn->check_stream_timeouts();
@@ -897,18 +1459,15 @@ namespace oxen::quic
 
     Connection* Endpoint::get_conn(const quic_cid& id)
     {
-        if (auto it_a = conn_lookup.find(id); it_a != conn_lookup.end())
-        {
-            if (auto it_b = conns.find(it_a->second); it_b != conns.end())
-                return it_b->second.get();
-        }
+        if (auto* c = conn_lookup.find(id))
+            return *c;
 
         return nullptr;
     }
 
     bool Endpoint::in_event_loop() const
     {
-        return net.in_event_loop();
+        return _loop.in_event_loop();
     }
 
 }  // namespace oxen::quic
@@ -113,6 +113,14 @@ namespace oxen::quic
             throw std::invalid_argument("gnutls didn't like a specified key file/memblock");
         }
 
+        // Parsing the default priority string is a noticeable part of setting up a session, so do it
+        // once here rather than in every session
+        if (auto rv = gnutls_priority_init(&priority_cache, nullptr, nullptr); rv < 0)
+        {
+            log::warning(log_cat, "gnutls_priority_init error: {}", gnutls_strerror(rv));
+            throw std::runtime_error("gnutls default priority setup failed");
+        }
+
         log::debug(log_cat, "Completed credential initialization");
     }
 
@@ -187,6 +195,8 @@ namespace oxen::quic
     GNUTLSCreds::~GNUTLSCreds()
     {
         log::trace(log_cat, "Entered {}", __PRETTY_FUNCTION__);
+        if (priority_cache)
+            gnutls_priority_deinit(priority_cache);
         gnutls_certificate_free_credentials(cred);
     }
 
@@ -217,6 +227,37 @@ namespace oxen::quic
         return p;
     }
 
+    void GNUTLSCreds::enable_key_verify_cache(std::chrono::seconds lifetime, size_t max_entries)
+    {
+        verified.reset(new verified_keys{{}, expiring_store<ustring>{lifetime, max_entries}});
+    }
+
+    bool GNUTLSCreds::verify_key(ustring_view key, ustring_view alpn) const
+    {
+        if (!key_verify)
+            return true;
+        if (!verified)
+            return key_verify(key, alpn);
+
+        // Keys are fixed size, so key + alpn is unambiguous
+        ustring cache_key;
+        cache_key.reserve(key.size() + alpn.size());
+        cache_key.append(key).append(alpn);
+        {
+            std::lock_guard lock{verified->mutex};
+            if (auto* v = verified->keys.find(cache_key); v && *v == cache_key)
+                return true;
+        }
+
+        // Not called under the lock, as it might take a while
+        if (!key_verify(key, alpn))
+            return false;
+
+        std::lock_guard lock{verified->mutex};
+        verified->keys.insert_or_assign(cache_key, cache_key);
+        return true;
+    }
+
     std::unique_ptr<TLSSession> GNUTLSCreds::make_session(Connection& c, const std::vector<ustring>& alpns)
     {
         return std::make_unique<GNUTLSSession>(*this, c, alpns);
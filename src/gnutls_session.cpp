@@ -6,27 +6,21 @@
 namespace oxen::quic
 {
     /*
-        Client session resumption requires:
-            gnutls_session_set_data to be called in TLSsession creation
-            gnutls_session_get_data2 to be called in hook function after handshake completion
+        Client session resumption (see opt::session_resumption):
+            gnutls_session_set_data is called (via set_resumption_data) when creating the Connection
+            gnutls_session_get_data2 is called in the hook function below whenever the server sends
+            us a new session ticket
     */
 
     extern "C"
     {
-        int anti_replay_db_add_func(void* dbf, time_t exp_time, const gnutls_datum_t* key, const gnutls_datum_t* data)
+        int anti_replay_db_add_func(
+                void* dbf, time_t /* exp_time */, const gnutls_datum_t* key, const gnutls_datum_t* /* data */)
         {
             auto* ep = static_cast<Endpoint*>(dbf);
             assert(ep);
 
-            log::warning(log_cat, "0RTT session resumption is not available; callback is no-op");
-            return 0;
-
-            (void)exp_time;
-            (void)key;
-            (void)data;
-            (void)ep;
-
-            // return ep->validate_anti_replay({key->data, key->size}, {data->data, data->size}, exp_time);
+            return ep->validate_anti_replay({key->data, key->size});
         }
 
         int client_hook_func(
@@ -38,9 +32,16 @@ namespace oxen::quic
         {
             if (htype == GNUTLS_HANDSHAKE_NEW_SESSION_TICKET)
             {
-                auto* conn = get_connection_from_gnutls(session);
-                auto& ep = conn->endpoint();
-                (void)ep;
+                gnutls_datum_t data{nullptr, 0};
+                if (auto rv = gnutls_session_get_data2(session, &data); rv != 0)
+                {
+                    log::warning(log_cat, "gnutls_session_get_data2 failed: {}", gnutls_strerror(rv));
+                    return 0;
+                }
+                ustring tls_data{data.data, data.size};
+                gnutls_free(data.data);
+
+                get_connection_from_gnutls(session)->store_session_ticket(std::move(tls_data));
             }
 
             return 0;
@@ -68,31 +69,21 @@ namespace oxen::quic
     {
         log::trace(log_cat, "Entered {}", __PRETTY_FUNCTION__);
 
-        if (not is_client)
-            gnutls_anti_replay_deinit(anti_replay);
-
         gnutls_deinit(session);
-        gnutls_free(session_ticket_key.data);
     }
 
     GNUTLSSession::GNUTLSSession(
             GNUTLSCreds& creds, Connection& c, const std::vector<ustring>& alpns, std::optional<gnutls_key> expected_key) :
-            creds{creds}, session_ticket_key{}, is_client{c.is_outbound()}
+            creds{creds}, is_client{c.is_outbound()}
     {
         log::trace(log_cat, "Entered {}", __PRETTY_FUNCTION__);
 
         if (not is_client)
         {
-            gnutls_anti_replay_init(&anti_replay);
-            gnutls_anti_replay_set_add_function(anti_replay, anti_replay_db_add_func);
-            gnutls_anti_replay_set_ptr(anti_replay, &c.endpoint());
-
-            if (auto rv = gnutls_session_ticket_key_generate(&session_ticket_key); rv != 0)
-            {
-                auto err = "Server failed to generate session ticket key: {}"_format(gnutls_strerror(rv));
-                log::error(log_cat, err);
-                throw std::runtime_error{err};
-            }
+            // These are per-endpoint, so that a ticket issued on one connection can resume another
+            auto& ep = c.endpoint();
+            session_ticket_key = &ep.session_ticket_key();
+            anti_replay = ep.anti_replay();
         }
 
         if (expected_key)
@@ -119,18 +110,10 @@ namespace oxen::quic
             throw std::runtime_error("{} gnutls_init failed"_format(direction_string));
         }
 
-        if (creds.using_raw_pk)
+        if (auto rv = gnutls_priority_set(session, creds.priority_cache); rv < 0)
         {
-            if (auto rv = gnutls_priority_set(session, creds.priority_cache); rv < 0)
-            {
-                log::error(log_cat, "gnutls_priority_set failed: {}", gnutls_strerror(rv));
-                throw std::runtime_error("gnutls_priority_set failed");
-            }
-        }
-        else if (auto rv = gnutls_set_default_priority(session); rv < 0)
-        {
-            log::error(log_cat, "gnutls_set_default_priority failed: {}", gnutls_strerror(rv));
-            throw std::runtime_error("gnutls_set_default_priority failed");
+            log::error(log_cat, "gnutls_priority_set failed: {}", gnutls_strerror(rv));
+            throw std::runtime_error("gnutls_priority_set failed");
         }
 
         log::debug(
@@ -144,7 +127,7 @@ namespace oxen::quic
         {
             log::trace(log_cat, "gnutls configuring server session...");
 
-            if (auto rv = gnutls_session_ticket_enable_server(session, &session_ticket_key); rv != 0)
+            if (auto rv = gnutls_session_ticket_enable_server(session, session_ticket_key); rv != 0)
             {
                 auto err = "gnutls_session_ticket_enable_server failed: {}"_format(gnutls_strerror(rv));
                 log::error(log_cat, err);
@@ -171,6 +154,9 @@ namespace oxen::quic
                 log::warning(log_cat, "ngtcp2_crypto_gnutls_configure_client_session failed: {}", ngtcp2_strerror(rv));
                 throw std::runtime_error("ngtcp2_crypto_gnutls_configure_client_session failed");
             }
+
+            gnutls_handshake_set_hook_function(
+                    session, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET, GNUTLS_HOOK_POST, client_hook_func);
         }
 
         gnutls_session_set_ptr(session, &conn_ref);
@@ -236,6 +222,17 @@ namespace oxen::quic
         return 0;
     }
 
+    bool GNUTLSSession::set_resumption_data(ustring_view data)
+    {
+        assert(is_client);
+        if (auto rv = gnutls_session_set_data(session, data.data(), data.size()); rv != 0)
+        {
+            log::warning(log_cat, "gnutls_session_set_data failed: {}", gnutls_strerror(rv));
+            return false;
+        }
+        return true;
+    }
+
     ustring_view GNUTLSSession::selected_alpn()
     {
         gnutls_datum_t proto;
@@ -315,18 +312,27 @@ namespace oxen::quic
                     local_name);
         }
 
-        const auto* cert_data = cert_list[0].data + CERT_HEADER_SIZE;
-        auto cert_size = cert_list[0].size - CERT_HEADER_SIZE;
+        // The only key type we use is Ed25519, whose raw public key "certificate" is just a fixed
+        // 12 byte ASN.1 header followed by the 32 byte key, so we check for exactly that and compare
+        // the key bytes directly rather than parsing it.
+        const auto& cert = cert_list[0];
+        if (cert.size != CERT_HEADER_SIZE + GNUTLS_KEY_SIZE ||
+            std::memcmp(cert.data, ASN_ED25519_PUBKEY_PREFIX.data(), CERT_HEADER_SIZE) != 0)
+        {
+            log::warning(log_cat, "Quic {} received a peer raw public key that is not an Ed25519 key", local_name);
+            return success;
+        }
+
+        const auto* cert_data = cert.data + CERT_HEADER_SIZE;
 
         log::trace(
                 log_cat,
                 "Quic {} validating pubkey \"cert\" of len {}B:\n{}\n",
                 local_name,
-                cert_size,
-                buffer_printer{cert_data, cert_size});
+                GNUTLS_KEY_SIZE,
+                buffer_printer{cert_data, GNUTLS_KEY_SIZE});
 
-        // pubkey comes as 12 bytes header + 32 bytes key
-        _remote_key.write(cert_data, cert_size);
+        _remote_key.write(cert_data, GNUTLS_KEY_SIZE);
 
         if (is_client)
         {  // Client does validation through a remote pubkey provided when calling endpoint::connect
@@ -356,7 +362,7 @@ namespace oxen::quic
             // provided a certificate and is only called by the server, we can assume the following returns:
             //      true: the certificate was verified, and the connection is marked as validated
             //      false: the certificate was not verified, and the connection is rejected
-            success = (creds.key_verify) ? creds.key_verify(_remote_key.view(), alpn) : true;
+            success = creds.verify_key(_remote_key.view(), alpn);
 
             return success;
         }
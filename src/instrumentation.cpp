@@ -0,0 +1,103 @@
+#include "instrumentation.hpp"
+
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    thread_local loop_instrumentation* loop_instrumentation::_current = nullptr;
+
+    loop_instrumentation::loop_instrumentation(
+            Loop& loop, loop_stats_callback cb, std::chrono::milliseconds period, std::chrono::microseconds slow) :
+            loop{loop},
+            callback{std::move(cb)},
+            period{period},
+            slow{slow},
+            period_start{std::chrono::steady_clock::now()},
+            report_timer{
+                    loop.timers(), [](void* self) { static_cast<loop_instrumentation*>(self)->report(); }, this}
+    {
+        assert(loop.in_event_loop());
+        stats.loop_index = loop.index();
+        report_timer.schedule_after(period);
+        _current = this;
+    }
+
+    loop_instrumentation::~loop_instrumentation()
+    {
+        detach();
+    }
+
+    void loop_instrumentation::detach()
+    {
+        if (_current == this)
+            _current = nullptr;
+        report_timer.cancel();
+    }
+
+    void loop_instrumentation::record_job_wait(std::chrono::nanoseconds wait)
+    {
+        stats.job_wait_us.add(std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+    }
+
+    void loop_instrumentation::end_dispatch(std::chrono::nanoseconds elapsed)
+    {
+        stats.busy += elapsed;
+        stats.dispatch_us.add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+        // A dispatch is only slow in its own right if none of the callbacks within it were
+        if (slow.count() > 0 && elapsed >= slow && !slow_reported)
+        {
+            stats.slow++;
+            log::warning(
+                    log_cat,
+                    "Slow event loop {} dispatch: {}us (threshold {}us)",
+                    loop.index(),
+                    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+                    std::chrono::duration_cast<std::chrono::microseconds>(slow).count());
+        }
+        slow_reported = false;
+    }
+
+    void loop_instrumentation::end_callback(loop_callback type, std::chrono::nanoseconds elapsed)
+    {
+        auto& t = stats[type];
+        t.calls++;
+        t.total += elapsed;
+        if (elapsed > t.max)
+            t.max = elapsed;
+
+        if (slow.count() > 0 && elapsed >= slow)
+        {
+            stats.slow++;
+            slow_reported = true;
+            log::warning(
+                    log_cat,
+                    "Slow {} callback on event loop {}: {}us (threshold {}us)",
+                    to_string(type),
+                    loop.index(),
+                    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+                    std::chrono::duration_cast<std::chrono::microseconds>(slow).count());
+        }
+    }
+
+    void loop_instrumentation::report()
+    {
+        auto now = std::chrono::steady_clock::now();
+        stats.period = now - period_start;
+        period_start = now;
+
+        auto reported = std::move(stats);
+        stats = loop_stats{};
+        stats.loop_index = reported.loop_index;
+        report_timer.schedule_after(period);
+
+        try
+        {
+            callback(reported);
+        }
+        catch (const std::exception& e)
+        {
+            log::warning(log_cat, "Loop stats callback raised an exception: {}", e.what());
+        }
+    }
+}  // namespace oxen::quic
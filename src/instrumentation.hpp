@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include "loop.hpp"
+#include "stats.hpp"
+#include "timer_wheel.hpp"
+
+namespace oxen::quic
+{
+    // Collects the loop_stats of one Loop while loop stats are enabled (see
+    // Network::enable_loop_stats), and reports them every period.  Lives on, and is only ever
+    // touched from, the loop's thread: code running on the loop reaches it through `current()`,
+    // which is null (making all of the timing below free apart from that check) when disabled.
+    class loop_instrumentation
+    {
+      public:
+        loop_instrumentation(
+                Loop& loop, loop_stats_callback cb, std::chrono::milliseconds period, std::chrono::microseconds slow);
+        ~loop_instrumentation();
+
+        loop_instrumentation(const loop_instrumentation&) = delete;
+        loop_instrumentation& operator=(const loop_instrumentation&) = delete;
+
+        // The instrumentation of the loop running on this thread, if enabled
+        static loop_instrumentation* current() { return _current; }
+
+        // Stops reporting and stops being `current()`, ahead of being destroyed.  Scoped timers
+        // that already picked this up still report into it as they unwind, so it has to stay alive
+        // until they have (see Loop::set_stats).
+        void detach();
+
+        void record_job_wait(std::chrono::nanoseconds wait);
+        void record_job_queue_depth(size_t depth) { stats.job_queue_depth.add(depth); }
+
+      private:
+        friend class scoped_dispatch;
+        friend class scoped_callback;
+
+        static thread_local loop_instrumentation* _current;
+
+        Loop& loop;
+        loop_stats_callback callback;
+        const std::chrono::milliseconds period;
+        const std::chrono::nanoseconds slow;
+
+        loop_stats stats;
+        std::chrono::steady_clock::time_point period_start;
+        wheel_timer report_timer;
+
+        // Nesting depth of dispatches, and whether a slow callback was already reported during the
+        // current one
+        int dispatch_depth{0};
+        bool slow_reported{false};
+
+        void end_dispatch(std::chrono::nanoseconds elapsed);
+        void end_callback(loop_callback type, std::chrono::nanoseconds elapsed);
+        void report();
+    };
+
+    // Times the enclosing scope as a dispatch: a call into libquic from the event loop, i.e. the
+    // body of a libevent callback.  Nested dispatches (such as a connection sending its packets
+    // right away from within a socket read) are part of the outermost one.
+    class scoped_dispatch
+    {
+      public:
+        scoped_dispatch() : instr{loop_instrumentation::current()}
+        {
+            if (instr && instr->dispatch_depth++ == 0)
+                start = std::chrono::steady_clock::now();
+        }
+        ~scoped_dispatch()
+        {
+            if (instr && --instr->dispatch_depth == 0)
+                instr->end_dispatch(std::chrono::steady_clock::now() - start);
+        }
+
+        scoped_dispatch(const scoped_dispatch&) = delete;
+        scoped_dispatch& operator=(const scoped_dispatch&) = delete;
+
+      private:
+        loop_instrumentation* instr;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Times the enclosing scope as a user callback of the given type.
+    class scoped_callback
+    {
+      public:
+        explicit scoped_callback(loop_callback type) : instr{loop_instrumentation::current()}, type{type}
+        {
+            if (instr)
+                start = std::chrono::steady_clock::now();
+        }
+        ~scoped_callback()
+        {
+            if (instr)
+                instr->end_callback(type, std::chrono::steady_clock::now() - start);
+        }
+
+        scoped_callback(const scoped_callback&) = delete;
+        scoped_callback& operator=(const scoped_callback&) = delete;
+
+      private:
+        loop_instrumentation* instr;
+        loop_callback type;
+        std::chrono::steady_clock::time_point start;
+    };
+}  // namespace oxen::quic
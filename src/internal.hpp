@@ -7,6 +7,30 @@
 #include "format.hpp"
 #include "utils.hpp"
 
+// Trace and debug logging on hot paths (anything done per packet, per datagram, per stream write,
+// or per job) goes through these rather than calling log::trace/log::debug directly.  Normally
+// they are the same as those calls; building with -DLIBQUIC_HOT_PATH_LOGGING=OFF compiles them
+// out to nothing, including the evaluation of their arguments, so that the per-packet cost does
+// not depend on the logger configuration.  (A disabled log::trace still costs a level check plus
+// whatever it takes to construct its arguments, such as a buffer_printer.)
+#ifdef OXEN_LIBQUIC_NO_HOT_PATH_LOGGING
+#define QUIC_HOT_TRACE(...)                   \
+    do                                        \
+    {                                         \
+        if constexpr (false)                  \
+            ::oxen::log::trace(__VA_ARGS__);  \
+    } while (0)
+#define QUIC_HOT_DEBUG(...)                   \
+    do                                        \
+    {                                         \
+        if constexpr (false)                  \
+            ::oxen::log::debug(__VA_ARGS__);  \
+    } while (0)
+#else
+#define QUIC_HOT_TRACE(...) ::oxen::log::trace(__VA_ARGS__)
+#define QUIC_HOT_DEBUG(...) ::oxen::log::debug(__VA_ARGS__)
+#endif
+
 namespace oxen::quic
 {
 
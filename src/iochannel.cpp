@@ -6,29 +6,18 @@
 namespace oxen::quic
 {
 
-    IOChannel::IOChannel(Connection& c, Endpoint& e) : endpoint{e}, reference_id{c.reference_id()}, _conn{&c}
+    IOChannel::IOChannel(Connection& c, Endpoint& e) :
+            endpoint{e}, reference_id{c.reference_id()}, _conn{&c}, _memory{c._memory}
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
     }
 
-    bool IOChannel::is_empty() const
+    void IOChannel::publish_state()
     {
-        return call_get_accessor(&IOChannel::is_empty_impl);
-    }
-
-    size_t IOChannel::unsent() const
-    {
-        return call_get_accessor(&IOChannel::unsent_impl);
-    }
-
-    bool IOChannel::has_unsent() const
-    {
-        return call_get_accessor(&IOChannel::has_unsent_impl);
-    }
-
-    bool IOChannel::is_closing() const
-    {
-        return call_get_accessor(&IOChannel::is_closing_impl);
+        _published_empty.store(is_empty_impl(), std::memory_order_relaxed);
+        _published_unsent.store(unsent_impl(), std::memory_order_relaxed);
+        _published_has_unsent.store(has_unsent_impl(), std::memory_order_relaxed);
+        _published_closing.store(is_closing_impl(), std::memory_order_relaxed);
     }
 
     Path IOChannel::path() const
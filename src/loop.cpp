@@ -0,0 +1,302 @@
+#include "loop.hpp"
+
+#include <event2/event.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "instrumentation.hpp"
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    Loop::Loop(std::shared_ptr<event_base> loop_ptr, std::thread::id thread_id) :
+            ev_loop{std::move(loop_ptr)}, loop_thread_id{thread_id}
+    {
+        assert(ev_loop);
+        QUIC_HOT_TRACE(log_cat, "Wrapping pre-existing ev loop thread");
+
+        wheel = std::make_unique<timer_wheel>(ev_loop.get());
+        _scratch = std::make_unique<send_scratch>();
+        setup_job_waker();
+    }
+
+    namespace
+    {
+        // Applies the CPU pinning, memory policy, and scheduling of `opts` to the calling loop
+        // thread.  Returns true if the thread ended up pinned with local memory allocation.
+        bool apply_thread_options(size_t index, const loop_thread_options& opts)
+        {
+#ifdef __linux__
+            bool numa_local = false;
+            if (!opts.cpus.empty())
+            {
+                if (auto& cpus = opts.cpus[index % opts.cpus.size()]; !cpus.empty())
+                {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    for (auto cpu : cpus)
+                        CPU_SET(cpu, &set);
+
+                    if (int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); rv != 0)
+                        log::warning(
+                                log_cat,
+                                "Failed to pin event loop {} to CPU(s) {}: {}",
+                                index,
+                                "{}"_format(fmt::join(cpus, ",")),
+                                strerror(rv));
+                    else
+                    {
+                        log::info(log_cat, "Pinned event loop {} to CPU(s) {}", index, "{}"_format(fmt::join(cpus, ",")));
+                        if (opts.numa_local)
+                        {
+                            if (syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0)
+                                log::warning(
+                                        log_cat,
+                                        "Failed to set local memory policy for event loop {}: {}",
+                                        index,
+                                        strerror(errno));
+                            else
+                                numa_local = true;
+                        }
+                    }
+                }
+            }
+
+            if (opts.realtime_priority != 0)
+            {
+                sched_param param{};
+                param.sched_priority = opts.realtime_priority;
+                if (int rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); rv != 0)
+                    log::warning(
+                            log_cat,
+                            "Failed to set SCHED_FIFO priority {} for event loop {}: {}",
+                            opts.realtime_priority,
+                            index,
+                            strerror(rv));
+                else
+                    log::info(log_cat, "Event loop {} running SCHED_FIFO at priority {}", index, opts.realtime_priority);
+            }
+
+            return numa_local;
+#else
+            if (!opts.cpus.empty() || opts.realtime_priority != 0)
+                log::warning(log_cat, "Event loop CPU pinning and priority are only supported on Linux; ignoring them");
+            return false;
+#endif
+        }
+    }  // namespace
+
+    Loop::Loop(size_t index, const loop_thread_options& opts) : _index{index}
+    {
+        if (opts.realtime_priority < 0 || opts.realtime_priority > 99)
+            throw std::invalid_argument{"Event loop real-time priority must be between 1 and 99 (or 0 for none)"};
+#ifdef __linux__
+        for (auto& cpus : opts.cpus)
+            for (auto cpu : cpus)
+                if (cpu >= CPU_SETSIZE)
+                    throw std::invalid_argument{"Event loop CPU {} is out of range"_format(cpu)};
+#endif
+
+        std::unique_ptr<event_config, decltype(&event_config_free)> ev_conf{event_config_new(), event_config_free};
+        event_config_set_flag(ev_conf.get(), EVENT_BASE_FLAG_PRECISE_TIMER);
+        event_config_set_flag(ev_conf.get(), EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
+
+        ev_loop = std::shared_ptr<event_base>{event_base_new_with_config(ev_conf.get()), event_base_free};
+        if (!ev_loop)
+            throw std::runtime_error{"Failed to create libevent event base"};
+
+        log::info(log_cat, "Started libevent loop {} with backend {}", _index, event_base_get_method(ev_loop.get()));
+
+        setup_job_waker();
+
+        std::promise<void> p;
+
+        loop_thread.emplace([this, &p, &opts]() mutable {
+            _numa_local = apply_thread_options(_index, opts);
+            // Allocated here rather than up front so that, on a pinned loop, these land on (and are
+            // first touched from) the loop's own NUMA node.
+            wheel = std::make_unique<timer_wheel>(ev_loop.get());
+            _scratch = std::make_unique<send_scratch>();
+
+            log::debug(log_cat, "Starting event loop {} run", _index);
+            p.set_value();
+            event_base_loop(ev_loop.get(), EVLOOP_NO_EXIT_ON_EMPTY);
+            log::debug(log_cat, "Event loop {} run returned, thread finished", _index);
+        });
+
+        loop_thread_id = loop_thread->get_id();
+        p.get_future().get();
+    }
+
+    Loop::~Loop()
+    {
+        join();
+    }
+
+    void Loop::setup_job_waker()
+    {
+        job_waker.reset(event_new(
+                ev_loop.get(),
+                -1,
+                0,
+                [](evutil_socket_t, short, void* self) {
+                    QUIC_HOT_TRACE(log_cat, "processing job queue");
+                    scoped_dispatch timing;
+                    static_cast<Loop*>(self)->process_job_queue();
+                },
+                this));
+        assert(job_waker);
+    }
+
+    void Loop::stop(bool immediate)
+    {
+        if (!loop_thread)
+            return;
+
+        if (immediate)
+            event_base_loopbreak(ev_loop.get());
+        else
+            event_base_loopexit(ev_loop.get(), nullptr);
+    }
+
+    void Loop::join()
+    {
+        if (loop_thread && loop_thread->joinable())
+            loop_thread->join();
+    }
+
+    bool Loop::in_event_loop() const
+    {
+        return std::this_thread::get_id() == loop_thread_id;
+    }
+
+    void Loop::set_stats(loop_stats_callback cb, std::chrono::milliseconds period, std::chrono::microseconds slow)
+    {
+        assert(in_event_loop());
+        if (_instr)
+        {
+            // We're running inside scoped timers (at least those around the job that called us)
+            // that captured the current collector and will report into it as they unwind, so it
+            // can't be freed yet: detach it now, and free it at the start of the next job queue
+            // pass, by which point everything that captured it is gone.
+            _instr->detach();
+            _retired_instr.push_back(std::move(_instr));
+            wake();
+        }
+        if (cb)
+        {
+            if (period <= 0ms)
+                throw std::invalid_argument{"Loop stats period must be positive"};
+            _instr = std::make_unique<loop_instrumentation>(*this, std::move(cb), period, slow);
+        }
+        _timing_jobs.store(_instr != nullptr, std::memory_order_relaxed);
+    }
+
+    void Loop::call_soon(Job f)
+    {
+        QUIC_HOT_TRACE(log_cat, "Event loop queueing job");
+
+        if (_timing_jobs.load(std::memory_order_relaxed))
+            f = [f = std::move(f), queued = std::chrono::steady_clock::now()]() mutable {
+                if (auto* instr = loop_instrumentation::current())
+                    instr->record_job_wait(std::chrono::steady_clock::now() - queued);
+                f();
+            };
+
+        if (overflowing.load(std::memory_order_acquire) || !job_queue.try_push(f))
+        {
+            std::lock_guard lock{overflow_mutex};
+            overflow_queue.push(std::move(f));
+            overflowing.store(true, std::memory_order_release);
+            QUIC_HOT_TRACE(log_cat, "Event loop job ring full; {} jobs in overflow queue", overflow_queue.size());
+        }
+
+        wake();
+    }
+
+    void Loop::wake()
+    {
+        // Only the first job posted since the loop last started processing needs to activate the
+        // libevent waker; everything else gets picked up by that same wakeup.
+        if (!wake_pending.exchange(true, std::memory_order_acq_rel))
+            event_active(job_waker.get(), 0, 0);
+    }
+
+    void Loop::process_job_queue()
+    {
+        QUIC_HOT_TRACE(log_cat, "Event loop processing job queue");
+        assert(in_event_loop());
+
+        // Clear before draining: anything posted after this point will trigger a fresh wakeup.
+        wake_pending.exchange(false, std::memory_order_acq_rel);
+
+        // Only the scoped_dispatch around this pass is live, and it predates any of these
+        if (!_retired_instr.empty())
+            _retired_instr.clear();
+
+        Job job;
+
+        if (auto* instr = loop_instrumentation::current())
+            instr->record_job_queue_depth(job_queue.size());
+
+        // Process at most one ring's worth of jobs per wakeup so that a steady stream of jobs from
+        // other threads can't starve the loop's other events.
+        size_t processed = 0;
+        for (; processed < job_queue.capacity() && job_queue.try_pop(job); processed++)
+        {
+            QUIC_HOT_TRACE(log_cat, "Event loop invoking queued job");
+            scoped_callback timing{loop_callback::job};
+            job();
+            job.reset();
+        }
+
+        if (overflowing.load(std::memory_order_acquire))
+        {
+            std::queue<Job> overflowed;
+            {
+                std::lock_guard lock{overflow_mutex};
+                overflow_queue.swap(overflowed);
+            }
+
+            // No new jobs go into the ring while `overflowing` is set, so everything still in it
+            // predates the overflowed jobs and has to run first.
+            while (job_queue.try_pop(job))
+            {
+                scoped_callback timing{loop_callback::job};
+                job();
+                job.reset();
+            }
+
+            while (!overflowed.empty())
+            {
+                QUIC_HOT_TRACE(log_cat, "Event loop invoking overflowed job");
+                scoped_callback timing{loop_callback::job};
+                overflowed.front()();
+                overflowed.pop();
+            }
+
+            std::lock_guard lock{overflow_mutex};
+            if (overflow_queue.empty())
+                overflowing.store(false, std::memory_order_release);
+            else
+                processed = job_queue.capacity();  // Force a re-wake for the rest
+        }
+
+        if (processed == job_queue.capacity())
+            wake();
+    }
+
+}  // namespace oxen::quic
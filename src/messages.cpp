@@ -1,5 +1,7 @@
 #include "messages.hpp"
 
+#include <cstring>
+
 #include "connection.hpp"
 #include "datagram.hpp"
 #include "endpoint.hpp"
@@ -7,21 +9,38 @@
 
 namespace oxen::quic
 {
-    rotating_buffer::rotating_buffer(DatagramIO& d) : datagram{d}, bufsize{d.rbufsize}, rowsize{d.rbufsize / 4}
-    {
-        for (auto& v : buf)
-            v.resize(rowsize);
-    }
+    rotating_buffer::rotating_buffer(DatagramIO& d) :
+            datagram{d},
+            bufsize{d.rbufsize},
+            rowsize{d.rbufsize / 4},
+            held{d._memory.get()},
+            row_keys{
+                    std::pmr::vector<uint16_t>{d._memory.get()},
+                    std::pmr::vector<uint16_t>{d._memory.get()},
+                    std::pmr::vector<uint16_t>{d._memory.get()},
+                    std::pmr::vector<uint16_t>{d._memory.get()}}
+    {}
 
     std::optional<bstring> rotating_buffer::receive(bstring_view data, uint16_t dgid)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         assert(datagram.endpoint.in_event_loop());
         assert(datagram._conn);
 
+        // Halves are sized by the sender's packets, which can be larger than ours
+        if (data.size() > datagram.endpoint.datagram_pool->buffer_size())
+        {
+            log::warning(
+                    log_cat,
+                    "Ignoring oversized split datagram half ({}B > {}B)",
+                    data.size(),
+                    datagram.endpoint.datagram_pool->buffer_size());
+            return std::nullopt;
+        }
+
         auto idx = dgid >> 2;
-        log::trace(
+        QUIC_HOT_TRACE(
                 log_cat,
                 "dgid: {}, row: {}, col: {}, idx: {}, rowsize: {}, bufsize {}",
                 dgid,
@@ -31,46 +50,50 @@ namespace oxen::quic
                 rowsize,
                 bufsize);
 
-        row = (idx % bufsize) / rowsize;
-        col = idx % rowsize;
+        auto key = static_cast<uint16_t>(idx % bufsize);
+        row = key / rowsize;
+        col = key % rowsize;
 
-        auto& b = buf[row][col];
+        auto it = held.find(key);
 
-        if (b)
+        // We only pair with the other half of the same datagram; anything else in the slot is a
+        // stale half (of a datagram whose other half never arrived) that we replace.
+        if (it != held.end() && (it->second.id ^ dgid) == 1)
         {
+            auto& b = it->second;
             if (datagram._conn->debug_datagram_drop_enabled)
             {
-                log::debug(log_cat, "enable_datagram_drop_test is true, inducing packet loss");
+                QUIC_HOT_DEBUG(log_cat, "enable_datagram_drop_test is true, inducing packet loss");
                 datagram._conn->debug_datagram_counter++;
-                log::debug(log_cat, "test counter: {}", datagram._conn->debug_datagram_counter);
+                QUIC_HOT_DEBUG(log_cat, "test counter: {}", datagram._conn->debug_datagram_counter);
                 return std::nullopt;
             }
             else
             {
-                log::debug(log_cat, "enable_datagram_drop_test is false, skipping optional logic");
+                QUIC_HOT_DEBUG(log_cat, "enable_datagram_drop_test is false, skipping optional logic");
             }
 
-            log::trace(
+            QUIC_HOT_TRACE(
                     log_cat,
                     "Pairing datagram (ID: {}) with {} half at buffer pos [{},{}]",
                     dgid,
-                    (b->part < 0 ? "first"s : "second"s),
+                    (b.part < 0 ? "first"s : "second"s),
                     row,
                     col);
 
             bstring out;
-            out.reserve(b->data_size + data.size());
-            if (b->part < 0)
+            out.reserve(b.data.size() + data.size());
+            if (b.part < 0)
             {  // We have the first part already
-                out.append(b->data.data(), b->data_size);
+                out.append(b.data.data(), b.data.size());
                 out.append(data);
             }
             else
             {
                 out.append(data);
-                out.append(b->data.data(), b->data_size);
+                out.append(b.data.data(), b.data.size());
             }
-            b.reset();
+            held.erase(it);
 
             currently_held[row] -= 1;
 
@@ -78,10 +101,17 @@ namespace oxen::quic
         }
 
         // Otherwise: new piece
-        log::trace(log_cat, "Storing datagram (ID: {}) at buffer pos [{},{}]", dgid, row, col);
+        QUIC_HOT_TRACE(log_cat, "Storing datagram (ID: {}) at buffer pos [{},{}]", dgid, row, col);
 
-        b = std::make_unique<received_datagram>(dgid, data);
-        currently_held[row] += 1;
+        auto piece = datagram.endpoint.datagram_pool->copy(data);
+        if (it != held.end())
+            it->second = received_datagram{dgid, std::move(piece)};
+        else
+        {
+            held.emplace(key, received_datagram{dgid, std::move(piece)});
+            row_keys[row].push_back(key);
+            currently_held[row] += 1;
+        }
 
         int to_clear = (row + 2) % 4;
 
@@ -95,24 +125,213 @@ namespace oxen::quic
         return std::nullopt;
     }
 
+    fragment_buffer::fragment_buffer(DatagramIO& d, size_t max_pending) :
+            datagram{d}, max_pending{max_pending}, pending{d._memory.get()}, order{d._memory.get()}
+    {}
+
+    std::optional<bstring> fragment_buffer::receive(bstring_view data, uint16_t msg_id, uint8_t index, uint8_t count)
+    {
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+
+        assert(datagram.endpoint.in_event_loop());
+        assert(datagram._conn);
+        assert(count > 1 && count <= MAX_DATAGRAM_FRAGMENTS);
+
+        if (index > count)
+        {
+            log::warning(log_cat, "Ignoring invalid datagram fragment {} of {}", index, count);
+            return std::nullopt;
+        }
+
+        // Fragments are sized by the sender's packets, which can be larger than ours
+        if (data.size() > datagram.endpoint.datagram_pool->buffer_size())
+        {
+            log::warning(
+                    log_cat,
+                    "Ignoring oversized datagram fragment ({}B > {}B)",
+                    data.size(),
+                    datagram.endpoint.datagram_pool->buffer_size());
+            return std::nullopt;
+        }
+
+        if (index == 0 && datagram._conn->debug_datagram_drop_enabled)
+        {
+            QUIC_HOT_DEBUG(log_cat, "enable_datagram_drop_test is true, dropping first fragment");
+            datagram._conn->debug_datagram_counter++;
+            return std::nullopt;
+        }
+
+        auto [it, inserted] = pending.try_emplace(msg_id);
+        auto& p = it->second;
+        if (inserted)
+        {
+            p.count = count;
+            p.frags.resize(count);
+            order.push_back(msg_id);
+            if (order.size() > max_pending)
+            {
+                log::debug(log_cat, "Dropping oldest fragmented datagram (msg ID: {})", order.front());
+                pending.erase(order.front());
+                order.pop_front();
+            }
+        }
+        else if (p.done)
+        {
+            QUIC_HOT_TRACE(log_cat, "Ignoring late fragment {} of completed datagram (msg ID: {})", index, msg_id);
+            return std::nullopt;
+        }
+        else if (p.count != count)
+        {
+            log::warning(
+                    log_cat,
+                    "Ignoring datagram fragment with mismatched count ({} != {}) for msg ID {}",
+                    count,
+                    p.count,
+                    msg_id);
+            return std::nullopt;
+        }
+
+        if (index == count)
+        {
+            if (!p.parity)
+                p.parity = datagram.endpoint.datagram_pool->copy(data);
+        }
+        else if (!(p.received & (uint64_t{1} << index)))
+        {
+            p.frags[index] = datagram.endpoint.datagram_pool->copy(data);
+            p.received |= uint64_t{1} << index;
+            p.have++;
+        }
+
+        QUIC_HOT_TRACE(
+                log_cat,
+                "Stored fragment {} of {} for msg ID {} ({} data fragments{})",
+                index,
+                count,
+                msg_id,
+                p.have,
+                p.parity ? " + parity" : "");
+
+        if (p.have == p.count || (p.have + 1 == p.count && p.parity))
+            return assemble(p);
+        return std::nullopt;
+    }
+
+    std::optional<bstring> fragment_buffer::assemble(partial& p)
+    {
+        std::optional<bstring> out;
+
+        if (p.have == p.count)
+        {
+            size_t total = 0;
+            for (auto& f : p.frags)
+                total += f.size();
+            out.emplace();
+            out->reserve(total);
+            for (auto& f : p.frags)
+                out->append(f.data(), f.size());
+        }
+        else if (p.parity.size() > 4)
+        {
+            // The parity fragment is the total datagram size followed by the XOR of all of the data
+            // fragments, each zero-padded to the size of the first one.
+            const size_t total = oxenc::load_big_to_host<uint32_t>(p.parity.data());
+            const size_t frag_size = p.parity.size() - 4;
+            const size_t last_size = total - std::min(total, (p.count - 1) * frag_size);
+            auto size_of = [&](size_t i) { return i + 1 == p.count ? last_size : frag_size; };
+
+            size_t missing = 0;
+            while (p.received & (uint64_t{1} << missing))
+                missing++;
+
+            bool valid = total > (p.count - 1) * frag_size && total <= p.count * frag_size;
+            for (size_t i = 0; valid && i < p.count; i++)
+                if (i != missing && p.frags[i].size() != size_of(i))
+                    valid = false;
+
+            if (valid)
+            {
+                out.emplace(total, std::byte{0});
+                auto* rebuilt = out->data() + missing * frag_size;
+                std::memcpy(rebuilt, p.parity.data() + 4, size_of(missing));
+                for (size_t i = 0; i < p.count; i++)
+                {
+                    if (i == missing)
+                        continue;
+                    auto& f = p.frags[i];
+                    std::memcpy(out->data() + i * frag_size, f.data(), f.size());
+                    for (size_t j = 0, n = std::min(f.size(), size_of(missing)); j < n; j++)
+                        rebuilt[j] ^= f.data()[j];
+                }
+                recovered++;
+                log::debug(log_cat, "Rebuilt lost fragment {} of {} from parity", missing, p.count);
+            }
+            else
+                log::warning(log_cat, "Invalid parity fragment for fragmented datagram; dropping it");
+        }
+
+        p.done = true;
+        p.frags.clear();
+        p.frags.shrink_to_fit();
+        p.parity.reset();
+        return out;
+    }
+
+    int fragment_buffer::datagrams_stored() const
+    {
+        int n = 0;
+        for (const auto& [id, p] : pending)
+            if (!p.done)
+                n++;
+        return n;
+    }
+
+    size_t fragment_buffer::resident_bytes() const
+    {
+        size_t total = pending.bucket_count() * sizeof(void*) + order.size() * sizeof(uint16_t);
+        for (const auto& [id, p] : pending)
+        {
+            total += sizeof(partial) + 2 * sizeof(void*) + p.frags.capacity() * sizeof(pooled_buffer);
+            total += (p.have + (p.parity ? 1 : 0)) * datagram.endpoint.datagram_pool->buffer_size();
+        }
+        return total;
+    }
+
+    void fragment_buffer::release()
+    {
+        // (Assigning a fresh container with the same allocator, rather than `{}`, so that the memory
+        // goes back to the resource it came from)
+        pending = decltype(pending){pending.get_allocator()};
+        order.clear();
+        order.shrink_to_fit();
+    }
+
     void buffer_que::emplace(bstring_view pload, uint16_t p_id, std::shared_ptr<void> data, dgram type, size_t max_size)
     {
         auto d_storage = datagram_storage::make(pload, p_id, std::move(data), type, max_size);
 
+        _bytes += d_storage.size();
         buf.push_back(std::move(d_storage));
     }
 
+    void buffer_que::emplace_fragment(bstring_view frag, uint16_t msg_id, ustring_view header, std::shared_ptr<void> data)
+    {
+        _bytes += buf.emplace_back(datagram_storage::make_fragment(frag, msg_id, header, std::move(data))).size();
+    }
+
     void buffer_que::drop_front(bool b)
     {
         auto& f = buf.front();
 
-        if (f.type == dgram::STANDARD)
+        if (f.type != dgram::OVERSIZED)
         {
+            _bytes -= f.size();
             f.payload.reset();
             buf.pop_front();
             return;
         }
 
+        _bytes -= f.size();
         if (f.payload && not f.addendum)
             f.payload.reset();
         else if (f.addendum && not f.payload)
@@ -120,6 +339,7 @@ namespace oxen::quic
         else
         {
             (b ? f.payload : f.addendum).reset();
+            _bytes += f.size();
             return;
         }
 
@@ -129,11 +349,36 @@ namespace oxen::quic
 
     void rotating_buffer::clear_row(int index)
     {
-        log::trace(log_cat, "Clearing buffer row {} (i = {}, j = {})", index, row, col);
+        QUIC_HOT_TRACE(log_cat, "Clearing buffer row {} (i = {}, j = {})", index, row, col);
 
-        for (auto& b : buf[index])
-            if (b)
-                b.reset();
+        auto& keys = row_keys[index];
+        for (auto key : keys)
+            held.erase(key);
+
+        // Release the row's memory too if it grew large, rather than holding onto a high-water mark
+        if (keys.capacity() > 64)
+            std::pmr::vector<uint16_t>{keys.get_allocator()}.swap(keys);
+        else
+            keys.clear();
+    }
+
+    size_t rotating_buffer::resident_bytes() const
+    {
+        size_t total = held.bucket_count() * sizeof(void*);
+        // Each map node holds the value plus (typically) a next pointer and the cached hash
+        total += held.size() *
+                 (sizeof(decltype(held)::value_type) + 2 * sizeof(void*) + datagram.endpoint.datagram_pool->buffer_size());
+        for (const auto& keys : row_keys)
+            total += keys.capacity() * sizeof(uint16_t);
+        return total;
+    }
+
+    void rotating_buffer::release()
+    {
+        held = decltype(held){held.get_allocator()};
+        for (auto& keys : row_keys)
+            keys = std::pmr::vector<uint16_t>{keys.get_allocator()};
+        currently_held.fill(0);
     }
 
     int rotating_buffer::datagrams_stored() const
@@ -143,7 +388,7 @@ namespace oxen::quic
 
     outbound_dgram datagram_storage::fetch(bool b)
     {
-        if (type == dgram::STANDARD)
+        if (type != dgram::OVERSIZED)
             return {*payload, pload_id, -1, true};
 
         if (payload && not addendum)
@@ -158,19 +403,26 @@ namespace oxen::quic
 
     prepared_datagram buffer_que::prepare(bool b, int is_splitting)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
         prepared_datagram d{};
 
-        outbound_dgram out = buf.front().fetch(b);
+        auto& front = buf.front();
+        outbound_dgram out = front.fetch(b);
         d.id = out.id;
         d.bufs_len = 1;
         d.is_empty = out.is_empty;
 
-        oxenc::write_host_as_big(out.id, d.dgid.data());
-
-        if (is_splitting)
+        if (front.type == dgram::FRAGMENT)
+        {
+            std::memcpy(d.dgid.data(), front.header.data(), front.header_len);
+            d.bufs[0].base = d.dgid.data();
+            d.bufs[0].len = front.header_len;
+            d.bufs_len++;
+        }
+        else if (is_splitting)
         {
+            oxenc::write_host_as_big(out.id, d.dgid.data());
             d.bufs[0].base = d.dgid.data();
             d.bufs[0].len = 2;
             d.bufs_len++;
@@ -179,7 +431,7 @@ namespace oxen::quic
         d.bufs[d.bufs_len - 1].base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(out.data.data()));
         d.bufs[d.bufs_len - 1].len = out.data.size();
 
-        log::trace(
+        QUIC_HOT_TRACE(
                 log_cat,
                 "Preparing datagram (id: {}) payload (size: {}): {}",
                 out.id,
@@ -205,4 +457,16 @@ namespace oxen::quic
         return datagram_storage(first_half, second_half, d_id, d_id + 1, std::move(data));
     }
 
+    datagram_storage datagram_storage::make_fragment(
+            bstring_view frag, uint16_t msg_id, ustring_view header, std::shared_ptr<void> data)
+    {
+        assert(!header.empty() && header.size() <= FRAGMENT_HEADER_SIZE);
+
+        datagram_storage d{frag, msg_id, std::move(data)};
+        d.type = dgram::FRAGMENT;
+        std::memcpy(d.header.data(), header.data(), header.size());
+        d.header_len = static_cast<uint8_t>(header.size());
+        return d;
+    }
+
 }  // namespace oxen::quic
@@ -3,7 +3,9 @@
 #include <event2/event.h>
 #include <event2/thread.h>
 
+#include <algorithm>
 #include <exception>
+#include <list>
 #include <memory>
 #include <oxen/log.hpp>
 #include <stdexcept>
@@ -41,20 +43,25 @@ namespace oxen::quic
         });
     }
 
-    Network::Network(std::shared_ptr<event_base> loop_ptr, std::thread::id thread_id) :
-            ev_loop{std::move(loop_ptr)}, loop_thread_id{thread_id}
+    Network::Network(std::shared_ptr<event_base> loop_ptr, std::thread::id thread_id)
     {
-        assert(ev_loop);
         log::trace(log_cat, "Beginning network context creation with pre-existing ev loop thread");
 
-        setup_job_waker();
+        loops.push_back(std::make_unique<Loop>(std::move(loop_ptr), thread_id));
 
         running.store(true);
     }
 
-    Network::Network()
+    Network::Network() : Network{size_t{1}} {}
+
+    Network::Network(size_t loop_threads) : Network{loop_threads, loop_thread_options{}} {}
+
+    Network::Network(size_t loop_threads, loop_thread_options opts)
     {
-        log::trace(log_cat, "Beginning network context creation with new ev loop thread");
+        if (loop_threads == 0)
+            loop_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        log::trace(log_cat, "Beginning network context creation with {} new ev loop thread(s)", loop_threads);
 
 #ifdef _WIN32
         {
@@ -89,27 +96,9 @@ namespace oxen::quic
                 event_get_version(),
                 "{}"_format(fmt::join(ev_methods_avail, ", ")));
 
-        std::unique_ptr<event_config, decltype(&event_config_free)> ev_conf{event_config_new(), event_config_free};
-        event_config_set_flag(ev_conf.get(), EVENT_BASE_FLAG_PRECISE_TIMER);
-        event_config_set_flag(ev_conf.get(), EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
-
-        ev_loop = std::shared_ptr<event_base>{event_base_new_with_config(ev_conf.get()), event_base_free};
-
-        log::info(log_cat, "Started libevent loop with backend {}", event_base_get_method(ev_loop.get()));
-
-        setup_job_waker();
-
-        std::promise<void> p;
-
-        loop_thread.emplace([this, &p]() mutable {
-            log::debug(log_cat, "Starting event loop run");
-            p.set_value();
-            event_base_loop(ev_loop.get(), EVLOOP_NO_EXIT_ON_EMPTY);
-            log::debug(log_cat, "Event loop run returned, thread finished");
-        });
-
-        loop_thread_id = loop_thread->get_id();
-        p.get_future().get();
+        loops.reserve(loop_threads);
+        for (size_t i = 0; i < loop_threads; i++)
+            loops.push_back(std::make_unique<Loop>(i, opts));
 
         running.store(true);
         log::info(log_cat, "Network is started");
@@ -119,101 +108,89 @@ namespace oxen::quic
     {
         log::info(log_cat, "Shutting down network...");
 
+        // Instrumentation has to be torn down on the loops while they are still running
+        disable_loop_stats();
+
         if (shutdown_immediate)
             close_immediate();
         else
             close_gracefully();
 
-        if (loop_thread)
-            loop_thread->join();
+        for (auto& l : loops)
+            l->join();
 
         endpoint_map.clear();
 
         log::info(log_cat, "Network shutdown complete");
 
 #ifdef _WIN32
-        if (loop_thread)
+        if (primary_loop().owns_thread())
             WSACleanup();
 #endif
     }
 
-    void Network::setup_job_waker()
+    void Network::enable_loop_stats(
+            loop_stats_callback cb, std::chrono::milliseconds period, std::chrono::microseconds slow)
     {
-        job_waker.reset(event_new(
-                ev_loop.get(),
-                -1,
-                0,
-                [](evutil_socket_t, short, void* self) {
-                    log::trace(log_cat, "processing job queue");
-                    static_cast<Network*>(self)->process_job_queue();
-                },
-                this));
-        assert(job_waker);
+        if (!cb)
+            throw std::invalid_argument{"enable_loop_stats requires a callback"};
+        if (period <= 0ms)
+            throw std::invalid_argument{"Loop stats period must be positive"};
+
+        for (auto& l : loops)
+            l->call_get([&] { l->set_stats(cb, period, slow); });
     }
 
-    void Network::close_immediate()
+    void Network::disable_loop_stats()
     {
-        log::info(log_cat, "{} called", __PRETTY_FUNCTION__);
-
-        if (loop_thread)
-            event_base_loopbreak(ev_loop.get());
+        for (auto& l : loops)
+            l->call_get([&] { l->set_stats(nullptr, 0ms, std::chrono::microseconds{0}); });
     }
 
-    void Network::close_gracefully()
+    Loop& Network::assign_loop()
     {
-        log::info(log_cat, "{} called", __PRETTY_FUNCTION__);
-
-        std::promise<void> pr;
-        auto ft = pr.get_future();
-
-        call([&]() mutable {
-            for (const auto& ep : endpoint_map)
-                ep->_close_conns(std::nullopt);
-
-            pr.set_value();
-        });
-
-        ft.get();
-
-        if (loop_thread)
-            event_base_loopexit(ev_loop.get(), nullptr);
+        return *loops[next_loop++ % loops.size()];
     }
 
-    bool Network::in_event_loop() const
+    ustring Network::make_group_secret()
     {
-        return std::this_thread::get_id() == loop_thread_id;
+        return Endpoint::make_static_secret();
     }
 
-    void Network::call_soon(std::function<void(void)> f)
+    void Network::close_immediate()
     {
-        log::trace(log_cat, "Event loop queueing job");
-        {
-            std::lock_guard lock{job_queue_mutex};
-            job_queue.emplace(std::move(f));
-            log::trace(log_cat, "Event loop now has {} jobs queued", job_queue.size());
-        }
-        event_active(job_waker.get(), 0, 0);
+        log::info(log_cat, "{} called", __PRETTY_FUNCTION__);
+
+        for (auto& l : loops)
+            l->stop(true);
     }
 
-    void Network::process_job_queue()
+    void Network::close_gracefully()
     {
-        log::trace(log_cat, "Event loop processing job queue");
-        assert(in_event_loop());
+        log::info(log_cat, "{} called", __PRETTY_FUNCTION__);
 
-        decltype(job_queue) swapped_queue;
+        // Each endpoint's connections have to be closed from the endpoint's own loop; we dispatch
+        // them all first, then wait, so that the loops close their endpoints concurrently.
+        std::list<std::future<void>> closing;
 
-        {
-            std::lock_guard<std::mutex> lock{job_queue_mutex};
-            job_queue.swap(swapped_queue);
-        }
+        std::chrono::steady_clock::time_point deadline{};
+        if (shutdown_timeout > 0ms)
+            deadline = get_time() + shutdown_timeout;
 
-        while (not swapped_queue.empty())
+        for (const auto& ep : endpoint_map)
         {
-            auto job = std::move(swapped_queue.front());
-            swapped_queue.pop();
-            log::trace(log_cat, "Event loop invoking queued job");
-            job();
+            auto pr = std::make_shared<std::promise<void>>();
+            closing.push_back(pr->get_future());
+            ep->call([ep = ep.get(), pr, deadline]() mutable {
+                ep->_close_conns(std::nullopt, deadline, [pr] { pr->set_value(); });
+            });
         }
+
+        for (auto& f : closing)
+            f.get();
+
+        for (auto& l : loops)
+            l->stop();
     }
 
 }  // namespace oxen::quic
@@ -0,0 +1,123 @@
+#include "qlog.hpp"
+
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    qlog_trace::~qlog_trace()
+    {
+        if (file)
+            std::fclose(file);
+    }
+
+    void qlog_trace::write(const void* data, size_t len, bool fin)
+    {
+        if (finished)
+            return;
+        if (len)
+            pending.append(static_cast<const char*>(data), len);
+        if (fin || pending.size() >= qlog_writer::CHUNK_SIZE)
+            submit(fin);
+    }
+
+    void qlog_trace::submit(bool fin)
+    {
+        if (fin)
+            finished = true;
+
+        Job job{[self = shared_from_this(), data = std::move(pending), fin] { self->output->write(*self, data, fin); }};
+        pending.clear();
+
+        if (!output->ring.try_push(job))
+            output->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    qlog_writer::qlog_writer(std::filesystem::path dir, size_t ring_size) :
+            output{std::make_shared<detail::qlog_output>(std::move(dir), nullptr, ring_size)}
+    {
+        thread = std::thread{[out = output] { out->run(); }};
+    }
+
+    qlog_writer::qlog_writer(qlog_callback cb, size_t ring_size)
+    {
+        if (!cb)
+            throw std::invalid_argument{"qlog_writer requires a callback"};
+        output = std::make_shared<detail::qlog_output>(std::filesystem::path{}, std::move(cb), ring_size);
+        thread = std::thread{[out = output] { out->run(); }};
+    }
+
+    qlog_writer::~qlog_writer()
+    {
+        {
+            std::lock_guard lock{output->sleep_mutex};
+            output->stopping = true;
+        }
+        output->sleep_cv.notify_one();
+
+        // The last owner is often a Connection being destroyed on its event loop thread, which
+        // mustn't wait on file output: the thread has its own reference to the output state, and
+        // finishes off whatever is still queued by itself.
+        thread.detach();
+    }
+
+    void detail::qlog_output::run()
+    {
+        Job job;
+        for (;;)
+        {
+            // Read this before draining, so that we always drain once more after being stopped
+            bool stop = stopping.load();
+
+            while (ring.try_pop(job))
+            {
+                job();
+                job.reset();
+            }
+
+            if (stop)
+                break;
+
+            std::unique_lock lock{sleep_mutex};
+            sleep_cv.wait_for(lock, qlog_writer::POLL_INTERVAL, [this] { return stopping.load(); });
+        }
+
+        if (auto n = dropped.load(std::memory_order_relaxed))
+            log::warning(log_cat, "qlog writer dropped {} chunks of qlog output because it could not keep up", n);
+    }
+
+    void detail::qlog_output::write(qlog_trace& trace, std::string_view data, bool fin)
+    {
+        if (callback)
+        {
+            try
+            {
+                callback(trace.id, data, fin);
+            }
+            catch (const std::exception& e)
+            {
+                log::warning(log_cat, "qlog callback for {} raised an exception: {}", trace.id, e.what());
+            }
+            return;
+        }
+
+        if (!trace.file)
+        {
+            auto path = directory / (trace.id + ".sqlog");
+            trace.file = std::fopen(path.string().c_str(), "wb");
+            if (!trace.file)
+            {
+                log::warning(log_cat, "Unable to open qlog output file {}", path.string());
+                return;
+            }
+        }
+
+        if (std::fwrite(data.data(), 1, data.size(), trace.file) != data.size())
+            log::warning(log_cat, "Failed to write qlog output for {}", trace.id);
+
+        if (fin)
+        {
+            std::fclose(trace.file);
+            trace.file = nullptr;
+        }
+    }
+}  // namespace oxen::quic
@@ -0,0 +1,155 @@
+#include "session_cache.hpp"
+
+#include <oxenc/bt.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    memory_session_cache::memory_session_cache(size_t max_entries, std::chrono::seconds max_age) :
+            max_entries{max_entries}, max_age{max_age}
+    {
+        if (max_entries == 0)
+            throw std::invalid_argument{"memory_session_cache requires max_entries > 0"};
+    }
+
+    bool memory_session_cache::expired(const session_ticket& t, std::chrono::system_clock::time_point now) const
+    {
+        return t.received + max_age <= now;
+    }
+
+    void memory_session_cache::store_locked(ustring key, session_ticket ticket)
+    {
+        if (auto it = index.find(key); it != index.end())
+        {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        else if (entries.size() >= max_entries)
+        {
+            index.erase(entries.front().first);
+            entries.pop_front();
+        }
+
+        entries.emplace_back(key, std::move(ticket));
+        index.emplace(std::move(key), std::prev(entries.end()));
+    }
+
+    void memory_session_cache::store(ustring_view remote_key, session_ticket ticket)
+    {
+        std::lock_guard lock{mutex};
+        store_locked(ustring{remote_key}, std::move(ticket));
+    }
+
+    std::optional<session_ticket> memory_session_cache::load(ustring_view remote_key)
+    {
+        std::lock_guard lock{mutex};
+        auto it = index.find(remote_key);
+        if (it == index.end())
+            return std::nullopt;
+        if (expired(it->second->second, std::chrono::system_clock::now()))
+        {
+            entries.erase(it->second);
+            index.erase(it);
+            return std::nullopt;
+        }
+        return it->second->second;
+    }
+
+    void memory_session_cache::remove(ustring_view remote_key)
+    {
+        std::lock_guard lock{mutex};
+        if (auto it = index.find(remote_key); it != index.end())
+        {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    size_t memory_session_cache::size() const
+    {
+        std::lock_guard lock{mutex};
+        return entries.size();
+    }
+
+    // The file is a bt-encoded list of [remote key, TLS data, transport params, received] lists,
+    // with `received` in seconds since the epoch.
+    void memory_session_cache::save(const std::filesystem::path& path) const
+    {
+        oxenc::bt_list_producer out;
+        {
+            std::lock_guard lock{mutex};
+            auto now = std::chrono::system_clock::now();
+            for (const auto& [key, t] : entries)
+            {
+                if (expired(t, now))
+                    continue;
+                auto l = out.append_list();
+                l.append(to_sv(ustring_view{key}));
+                l.append(to_sv(ustring_view{t.tls_data}));
+                l.append(to_sv(ustring_view{t.transport_params}));
+                l.append(std::chrono::duration_cast<std::chrono::seconds>(t.received.time_since_epoch()).count());
+            }
+        }
+
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream f{tmp, std::ios::binary | std::ios::trunc};
+            auto data = out.view();
+            if (!f.write(data.data(), data.size()))
+                throw std::runtime_error{"Failed to write session cache file {}"_format(tmp.u8string())};
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+            throw std::runtime_error{"Failed to write session cache file {}: {}"_format(path.u8string(), ec.message())};
+    }
+
+    void memory_session_cache::load_file(const std::filesystem::path& path)
+    {
+        std::ifstream f{path, std::ios::binary};
+        if (!f)
+        {
+            if (!std::filesystem::exists(path))
+                return;
+            throw std::runtime_error{"Failed to open session cache file {}"_format(path.u8string())};
+        }
+        std::string data{std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+
+        std::vector<std::pair<ustring, session_ticket>> loaded;
+        try
+        {
+            oxenc::bt_list_consumer list{data};
+            while (!list.is_finished())
+            {
+                auto entry = list.consume_list_consumer();
+                auto key = entry.consume_string_view();
+                auto tls = entry.consume_string_view();
+                auto params = entry.consume_string_view();
+                auto received = entry.consume_integer<int64_t>();
+                loaded.emplace_back(
+                        ustring{to_usv(key)},
+                        session_ticket{
+                                ustring{to_usv(tls)},
+                                ustring{to_usv(params)},
+                                std::chrono::system_clock::time_point{std::chrono::seconds{received}}});
+            }
+        }
+        catch (const std::exception& e)
+        {
+            throw std::runtime_error{"Invalid session cache file {}: {}"_format(path.u8string(), e.what())};
+        }
+
+        std::lock_guard lock{mutex};
+        auto now = std::chrono::system_clock::now();
+        for (auto& [key, t] : loaded)
+            if (!expired(t, now))
+                store_locked(std::move(key), std::move(t));
+
+        log::debug(log_cat, "Loaded {} session tickets from {}", loaded.size(), path.u8string());
+    }
+}  // namespace oxen::quic
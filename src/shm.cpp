@@ -0,0 +1,959 @@
+#include "shm.hpp"
+
+#include "udp.hpp"
+
+#ifdef __linux__
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#endif
+
+#include "instrumentation.hpp"
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+#ifdef __linux__
+    namespace
+    {
+        constexpr uint32_t SHM_MAGIC = 0x51736d68;  // "Qsmh"
+        constexpr uint32_t SHM_VERSION = 1;
+
+        constexpr size_t MIN_RING_SIZE = 256_ki;
+        constexpr size_t MAX_RING_SIZE = 1_Gi;
+
+        // How long we wait before trying again to set up a channel with a loopback peer that
+        // didn't accept one (because it isn't using shm_transport, most likely).
+        constexpr auto RETRY_INTERVAL = 1s;
+
+        // Closes the file descriptor on destruction
+        struct unique_fd
+        {
+            int fd = -1;
+            unique_fd() = default;
+            explicit unique_fd(int fd) : fd{fd} {}
+            unique_fd(unique_fd&& o) noexcept : fd{std::exchange(o.fd, -1)} {}
+            unique_fd& operator=(unique_fd&& o) noexcept
+            {
+                std::swap(fd, o.fd);
+                return *this;
+            }
+            ~unique_fd()
+            {
+                if (fd != -1)
+                    ::close(fd);
+            }
+            explicit operator bool() const { return fd != -1; }
+        };
+
+        int check_rv(int rv, const char* what)
+        {
+            if (rv == -1)
+                throw std::system_error{errno, std::system_category(), what};
+            return rv;
+        }
+
+        // The abstract socket name (i.e. not in the filesystem, and scoped to the network namespace)
+        // that an endpoint on the given UDP port listens for channels on.
+        sockaddr_un listener_addr(uint16_t port, socklen_t& len)
+        {
+            sockaddr_un sa{};
+            sa.sun_family = AF_UNIX;
+            auto name = "oxen-libquic-shm-{}"_format(port);
+            // A leading nul puts the name in the abstract namespace; it isn't nul-terminated
+            std::memcpy(sa.sun_path + 1, name.data(), name.size());
+            len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+            return sa;
+        }
+
+        // The control block of one direction's ring, in the shared memory.  Positions are byte
+        // offsets that only ever increase (the index into the ring is the position modulo its
+        // size).  The producer and consumer fields are a cache line apart so that the two sides
+        // aren't fighting over one line.
+        struct ring_control
+        {
+            alignas(64) std::atomic<uint64_t> head;  // Written by the producer
+            // Set by a consumer going idle, which needs a wakeup when the next packet arrives
+            std::atomic<uint32_t> consumer_waiting;
+            alignas(64) std::atomic<uint64_t> tail;  // Written by the consumer
+            // Set by a blocked producer, which needs a wakeup once the consumer frees up space
+            std::atomic<uint32_t> producer_waiting;
+        };
+        static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+        // The start of the shared memory of a channel, followed by the data of the two rings.
+        // Ring 0 carries packets from the side that set up the channel to the side that accepted
+        // it, ring 1 the other way.
+        struct shm_header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t ring_size;
+            ring_control rings[2];
+        };
+        constexpr size_t DATA_OFFSET = sizeof(shm_header);
+
+        // Each packet in a ring is one of these, then the payload padded to a multiple of 8 bytes.
+        // A size of WRAP_MARKER means the rest of the ring up to its end is unused, and the next
+        // record is at the start.
+        struct record_header
+        {
+            uint32_t size;
+            uint8_t ecn;
+            uint8_t _reserved[3];
+        };
+        static_assert(sizeof(record_header) == 8);
+        constexpr uint32_t WRAP_MARKER = UINT32_MAX;
+
+        constexpr uint64_t record_size(size_t payload)
+        {
+            return sizeof(record_header) + ((payload + 7) & ~uint64_t{7});
+        }
+
+        // Sent by the side setting up a channel, along with (as SCM_RIGHTS) the memfd of the
+        // shared memory, the eventfd that wakes the accepting side, and the one that wakes us.
+        struct hello_msg
+        {
+            uint32_t magic;
+            uint32_t version;
+            // The address we send from (i.e. the one that our UDP packets to the peer would come
+            // from), and the peer address we are sending to; these are sockaddr_in or
+            // sockaddr_in6.
+            sockaddr_in6 from;
+            sockaddr_in6 to;
+        };
+
+        // One side's view of one of the rings.  Only one side ever produces into a ring and only
+        // the other consumes from it; each side only touches its own end's fields.
+        class ring
+        {
+            ring_control* ctl = nullptr;
+            std::byte* data = nullptr;
+            uint64_t size = 0;
+            // The producer's position of the next write (published to `ctl->head` by `publish()`),
+            // or the consumer's position of the next read (published to `ctl->tail` by
+            // `release()`).
+            uint64_t pos = 0;
+
+          public:
+            ring() = default;
+            ring(ring_control* ctl, std::byte* data, uint64_t size) : ctl{ctl}, data{data}, size{size} {}
+
+            void init_producer() { pos = ctl->head.load(std::memory_order_relaxed); }
+            void init_consumer() { pos = ctl->tail.load(std::memory_order_relaxed); }
+
+            // Producer: bytes that are free to write into
+            uint64_t free_space() const { return size - (pos - ctl->tail.load(std::memory_order_acquire)); }
+
+            // Producer: appends a packet, returning false (without writing anything) if there isn't
+            // room for it.  It only becomes visible to the consumer on `publish()`.
+            bool push(const std::byte* pkt, size_t len, uint8_t ecn)
+            {
+                const auto need = record_size(len);
+                const auto idx = pos & (size - 1);
+                const auto to_end = size - idx;
+                if ((need <= to_end ? need : to_end + need) > free_space())
+                    return false;
+
+                auto* at = data + idx;
+                if (need > to_end)
+                {
+                    // Doesn't fit before the end, so skip the rest of the ring (idx and the ring size
+                    // are multiples of 8, so there is always room for the marker)
+                    record_header skip{WRAP_MARKER, 0, {}};
+                    std::memcpy(at, &skip, sizeof(skip));
+                    pos += to_end;
+                    at = data;
+                }
+
+                record_header hdr{static_cast<uint32_t>(len), ecn, {}};
+                std::memcpy(at, &hdr, sizeof(hdr));
+                std::memcpy(at + sizeof(hdr), pkt, len);
+                pos += need;
+                return true;
+            }
+
+            // Producer: publishes everything pushed so far.  Returns true if the consumer is idle
+            // and needs to be woken up to see it.
+            bool publish()
+            {
+                ctl->head.store(pos, std::memory_order_seq_cst);
+                return ctl->consumer_waiting.load(std::memory_order_seq_cst) &&
+                       ctl->consumer_waiting.exchange(0, std::memory_order_seq_cst);
+            }
+
+            // Producer: asks the consumer for a wakeup once it frees up space.  Returns the free
+            // space, which may have changed since the caller last checked.
+            uint64_t want_space()
+            {
+                ctl->producer_waiting.store(1, std::memory_order_seq_cst);
+                return free_space();
+            }
+
+            // Consumer: returns the next packet (which remains valid until `release()`), nullopt if
+            // the ring is empty, or throws if the ring's contents are invalid.
+            std::optional<std::pair<bstring_view, uint8_t>> next()
+            {
+                const auto head = ctl->head.load(std::memory_order_acquire);
+                for (;;)
+                {
+                    if (pos == head)
+                        return std::nullopt;
+                    const auto idx = pos & (size - 1);
+                    const auto to_end = size - idx;
+                    record_header hdr;
+                    std::memcpy(&hdr, data + idx, sizeof(hdr));
+                    if (hdr.size == WRAP_MARKER)
+                    {
+                        pos += to_end;
+                        continue;
+                    }
+                    const auto need = record_size(hdr.size);
+                    if (hdr.size == 0 || need > to_end || need > head - pos)
+                        throw std::runtime_error{"invalid shared memory ring record"};
+                    pos += need;
+                    return std::make_pair(bstring_view{data + idx + sizeof(hdr), hdr.size}, hdr.ecn);
+                }
+            }
+
+            // Consumer: hands the space of everything read so far back to the producer.  Returns
+            // true if the producer is blocked and needs to be woken up.
+            bool release()
+            {
+                ctl->tail.store(pos, std::memory_order_seq_cst);
+                return ctl->producer_waiting.load(std::memory_order_seq_cst) &&
+                       ctl->producer_waiting.exchange(0, std::memory_order_seq_cst);
+            }
+
+            // Consumer: marks us as wanting a wakeup for the next packet.  Returns false (and
+            // clears the mark again) if there is already another packet available, in which case
+            // we should keep reading instead of going idle.
+            bool idle()
+            {
+                ctl->consumer_waiting.store(1, std::memory_order_seq_cst);
+                if (ctl->head.load(std::memory_order_seq_cst) == pos)
+                    return true;
+                ctl->consumer_waiting.store(0, std::memory_order_relaxed);
+                return false;
+            }
+        };
+
+        // Rounds the ring size up to a power of 2 within the supported range
+        shm_options normalized(shm_options opts)
+        {
+            auto& size = opts.ring_size;
+            size = std::clamp<size_t>(size, MIN_RING_SIZE, MAX_RING_SIZE);
+            if (size & (size - 1))
+                size = size_t{1} << (64 - __builtin_clzll(size));
+            return opts;
+        }
+
+        void wake(int fd)
+        {
+            // Can only fail if the counter is about to overflow, in which case it's awake anyway
+            (void)eventfd_write(fd, 1);
+        }
+    }  // namespace
+
+    class ShmTransport;
+
+    // A channel with one peer: the shared memory rings and the eventfds that go with them, and
+    // the control socket, which is only used to notice the peer going away.
+    struct shm_channel
+    {
+        ShmTransport& transport;
+        Address peer;
+        bool initiator;
+        // The path that packets received from the channel arrive on, i.e. the path that they would
+        // have arrived on over UDP.
+        Path rx_path;
+
+        unique_fd control;
+        unique_fd wake_fd;       // Ours: signalled when our rx ring has data, or our tx ring space
+        unique_fd peer_wake_fd;  // The peer's
+        void* mem = nullptr;
+        size_t mem_size = 0;
+        ring tx, rx;
+
+        event_ptr wake_ev;
+        event_ptr control_ev;
+        std::vector<std::function<void()>> writeable_callbacks;
+
+        shm_channel(
+                ShmTransport& transport,
+                Address peer,
+                bool initiator,
+                Path rx_path,
+                unique_fd control,
+                unique_fd wake,
+                unique_fd peer_wake,
+                void* mem,
+                size_t mem_size,
+                size_t ring_size);
+        ~shm_channel();
+
+        shm_channel(const shm_channel&) = delete;
+        shm_channel& operator=(const shm_channel&) = delete;
+
+        // Pushes a run of packets into the tx ring.  Returns the number pushed: fewer than
+        // `run.n_pkts` if the ring filled up.
+        size_t send(const PacketTransport::send_run& run, const std::byte* bufs, const size_t* bufsize);
+
+        void on_wake();
+        void on_control();
+    };
+
+    class ShmTransport final : public PacketTransport
+    {
+      public:
+        // `sockopts` and `max_payload` are for the UDP socket, as for a plain UDPSocket
+        ShmTransport(
+                event_base* loop,
+                const Address& addr,
+                PacketSink& sink,
+                const opt::socket_options& sockopts,
+                size_t max_payload,
+                shm_options opts);
+        ~ShmTransport() override;
+
+        const Address& address() const override { return udp.address(); }
+
+        std::pair<io_result, size_t> send(
+                const Path& path, const std::byte* bufs, const size_t* bufsize, uint8_t ecn, size_t n_pkts) override
+        {
+            const send_run run{&path, ecn, n_pkts};
+            return send(&run, 1, bufs, bufsize);
+        }
+
+        std::pair<io_result, size_t> send(
+                const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize) override;
+
+        void when_writeable(std::function<void()> cb) override;
+
+        SendBackend send_backend() const override { return udp.send_backend(); }
+
+        // The UDP socket's counters plus those of the packets that went through channels instead
+        socket_stats stats() const override;
+
+      private:
+        friend struct shm_channel;
+
+        event_base* const loop;
+        PacketSink& sink;
+        const shm_options opts;
+        UDPSocket udp;
+
+        unique_fd listener;
+        event_ptr listener_ev;
+        // Accepted control connections that haven't sent their hello yet
+        std::unordered_map<int, std::pair<unique_fd, event_ptr>> pending;
+
+        std::unordered_map<Address, std::unique_ptr<shm_channel>> channels;
+        // Loopback peers that didn't take a channel, and when we can next try them again
+        std::unordered_map<Address, std::chrono::steady_clock::time_point> unavailable;
+
+        // Set when a send blocked on a channel's ring, for `when_writeable`
+        std::optional<Address> blocked_on;
+
+        socket_stats counters;
+        atomic_snapshot<socket_stats> _stats;
+
+        // Returns the channel to send to `remote` through, if there is or can be one
+        shm_channel* channel_for(const Address& remote);
+        std::unique_ptr<shm_channel> open_channel(const Address& remote);
+
+        void accept_channels();
+        void receive_hello(int fd);
+
+        // Adds a channel, replacing or refusing in favour of any other one we have for its peer
+        void add_channel(std::unique_ptr<shm_channel> ch);
+        void close_channel(shm_channel& ch);
+    };
+
+    shm_channel::shm_channel(
+            ShmTransport& transport,
+            Address peer_,
+            bool initiator,
+            Path rx_path_,
+            unique_fd control_,
+            unique_fd wake,
+            unique_fd peer_wake,
+            void* mem_,
+            size_t mem_size_,
+            size_t ring_size) :
+            transport{transport},
+            peer{std::move(peer_)},
+            initiator{initiator},
+            rx_path{std::move(rx_path_)},
+            control{std::move(control_)},
+            wake_fd{std::move(wake)},
+            peer_wake_fd{std::move(peer_wake)},
+            mem{mem_},
+            mem_size{mem_size_}
+    {
+        auto* hdr = static_cast<shm_header*>(mem);
+        auto* data = static_cast<std::byte*>(mem) + DATA_OFFSET;
+        // `ring_size` is the one we validated (or set): the peer can rewrite the header's at any time
+        ring out{&hdr->rings[0], data, ring_size}, in{&hdr->rings[1], data + ring_size, ring_size};
+        if (!initiator)
+            std::swap(out, in);
+        tx = out;
+        rx = in;
+        tx.init_producer();
+        rx.init_consumer();
+
+        wake_ev.reset(event_new(
+                transport.loop,
+                wake_fd.fd,
+                EV_READ | EV_PERSIST,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<shm_channel*>(self)->on_wake();
+                },
+                this));
+        control_ev.reset(event_new(
+                transport.loop,
+                control.fd,
+                EV_READ | EV_PERSIST,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<shm_channel*>(self)->on_control();
+                },
+                this));
+        event_add(wake_ev.get(), nullptr);
+        event_add(control_ev.get(), nullptr);
+    }
+
+    shm_channel::~shm_channel()
+    {
+        wake_ev.reset();
+        control_ev.reset();
+        ::munmap(mem, mem_size);
+    }
+
+    size_t shm_channel::send(const PacketTransport::send_run& run, const std::byte* bufs, const size_t* bufsize)
+    {
+        size_t n = 0;
+        for (; n < run.n_pkts; bufs += bufsize[n++])
+        {
+            if (tx.push(bufs, bufsize[n], run.ecn))
+                continue;
+            // Ask for a wakeup when there's space, but the consumer might have caught up in the meantime
+            tx.want_space();
+            if (!tx.push(bufs, bufsize[n], run.ecn))
+                break;
+        }
+        if (n > 0 && tx.publish())
+            wake(peer_wake_fd.fd);
+        return n;
+    }
+
+    void shm_channel::on_wake()
+    {
+        eventfd_t val;
+        (void)eventfd_read(wake_fd.fd, &val);
+
+        auto& sink = transport.sink;
+        std::vector<Packet> batch;
+        batch.reserve(DATAGRAM_BATCH_SIZE);
+
+        size_t count = 0;
+        for (;;)
+        {
+            batch.clear();
+            try
+            {
+                while (batch.size() < DATAGRAM_BATCH_SIZE)
+                {
+                    auto rec = rx.next();
+                    if (!rec)
+                        break;
+                    auto& pkt = batch.emplace_back(rx_path, rec->first);
+                    pkt.pkt_info.ecn = rec->second;
+                    transport.counters.bytes_received += rec->first.size();
+                }
+            }
+            catch (const std::exception& e)
+            {
+                log::warning(log_cat, "Closing shared memory channel with {}: {}", peer, e.what());
+                return transport.close_channel(*this);
+            }
+
+            if (!batch.empty())
+            {
+                count += batch.size();
+                transport.counters.packets_received += batch.size();
+                transport._stats.store(transport.counters);
+                sink.handle_packets(batch.data(), batch.size());
+                if (rx.release())
+                    wake(peer_wake_fd.fd);
+            }
+
+            if (count >= MAX_RECEIVE_PER_LOOP)
+            {
+                // Let the loop get to other things before we come back for the rest
+                event_active(wake_ev.get(), EV_READ, 0);
+                break;
+            }
+            if (batch.size() < DATAGRAM_BATCH_SIZE && rx.idle())
+                break;
+        }
+
+        // We also get woken when the peer frees up space that we were waiting for; wait for a
+        // reasonable amount, though, rather than being woken for every packet it reads.
+        if (!writeable_callbacks.empty())
+        {
+            if (tx.free_space() < transport.opts.ring_size / 8 && tx.want_space() < transport.opts.ring_size / 8)
+                return;
+            auto callbacks = std::move(writeable_callbacks);
+            writeable_callbacks.clear();
+            for (const auto& f : callbacks)
+                f();
+        }
+    }
+
+    void shm_channel::on_control()
+    {
+        char buf[64];
+        auto n = ::recv(control.fd, buf, sizeof(buf), 0);
+        if (n > 0 || (n == -1 && (errno == EAGAIN || errno == EINTR)))
+            return;  // The peer doesn't send anything else, but ignore it if it does
+        log::debug(log_cat, "Shared memory channel with {} closed by peer", peer);
+        transport.close_channel(*this);
+    }
+
+    ShmTransport::ShmTransport(
+            event_base* loop,
+            const Address& addr,
+            PacketSink& sink,
+            const opt::socket_options& sockopts,
+            size_t max_payload,
+            shm_options opts_) :
+            loop{loop}, sink{sink}, opts{normalized(opts_)}, udp{loop, addr, sink, false, sockopts, max_payload}
+    {
+        socklen_t len;
+        auto sa = listener_addr(address().port(), len);
+        listener = unique_fd{::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+        if (!listener || ::bind(listener.fd, reinterpret_cast<sockaddr*>(&sa), len) == -1 ||
+            ::listen(listener.fd, 64) == -1)
+        {
+            // E.g. the port is also used by another endpoint with the other IP version.  We can still
+            // open channels to peers, just not accept them.
+            log::info(
+                    log_cat,
+                    "Unable to listen for shared memory channels on port {}: {}",
+                    address().port(),
+                    strerror(errno));
+            listener = unique_fd{};
+        }
+        else
+        {
+            listener_ev.reset(event_new(
+                    loop,
+                    listener.fd,
+                    EV_READ | EV_PERSIST,
+                    [](evutil_socket_t, short, void* self) {
+                        scoped_dispatch timing;
+                        static_cast<ShmTransport*>(self)->accept_channels();
+                    },
+                    this));
+            event_add(listener_ev.get(), nullptr);
+        }
+
+        log::debug(log_cat, "UDP socket on {} with shared memory transport for same-host peers", address());
+    }
+
+    ShmTransport::~ShmTransport()
+    {
+        channels.clear();
+        pending.clear();
+        listener_ev.reset();
+    }
+
+    socket_stats ShmTransport::stats() const
+    {
+        auto s = udp.stats();
+        auto c = _stats.load();
+        s.packets_sent += c.packets_sent;
+        s.bytes_sent += c.bytes_sent;
+        s.packets_received += c.packets_received;
+        s.bytes_received += c.bytes_received;
+        s.send_blocked += c.send_blocked;
+        s.shm_packets_sent = c.packets_sent;
+        s.shm_packets_received = c.packets_received;
+        return s;
+    }
+
+    std::pair<io_result, size_t> ShmTransport::send(
+            const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize)
+    {
+        blocked_on.reset();
+        size_t sent = 0;
+        for (size_t r = 0; r < n_runs;)
+        {
+            if (auto* ch = channel_for(runs[r].path->remote))
+            {
+                const auto& run = runs[r++];
+                auto n = ch->send(run, bufs, bufsize);
+                auto bytes = std::accumulate(bufsize, bufsize + n, uint64_t{0});
+                counters.packets_sent += n;
+                counters.bytes_sent += bytes;
+                sent += n;
+                if (n < run.n_pkts)
+                {
+                    QUIC_HOT_DEBUG(log_cat, "Shared memory ring to {} is full", ch->peer);
+                    counters.send_blocked++;
+                    _stats.store(counters);
+                    blocked_on = ch->peer;
+                    return {io_result{EAGAIN}, sent};
+                }
+                _stats.store(counters);
+                bufs += bytes;
+                bufsize += n;
+                continue;
+            }
+
+            // Send this run, along with any following ones that also have to go over UDP, with the
+            // UDP socket
+            size_t end = r + 1;
+            while (end < n_runs && !channel_for(runs[end].path->remote))
+                end++;
+            size_t n_pkts = 0;
+            for (size_t i = r; i < end; i++)
+                n_pkts += runs[i].n_pkts;
+
+            auto [res, n] = udp.send(runs + r, end - r, bufs, bufsize);
+            sent += n;
+            if (n < n_pkts)
+                return {res, sent};
+            bufs += std::accumulate(bufsize, bufsize + n_pkts, size_t{0});
+            bufsize += n_pkts;
+            r = end;
+        }
+        return {io_result{}, sent};
+    }
+
+    void ShmTransport::when_writeable(std::function<void()> cb)
+    {
+        if (blocked_on)
+            if (auto it = channels.find(*blocked_on); it != channels.end())
+                return it->second->writeable_callbacks.push_back(std::move(cb));
+        udp.when_writeable(std::move(cb));
+    }
+
+    shm_channel* ShmTransport::channel_for(const Address& remote)
+    {
+        if (auto it = channels.find(remote); it != channels.end())
+            return it->second.get();
+        if (!remote.is_loopback() || remote.port() == address().port())
+            return nullptr;
+
+        auto now = std::chrono::steady_clock::now();
+        if (auto it = unavailable.find(remote); it != unavailable.end())
+        {
+            if (now < it->second)
+                return nullptr;
+            unavailable.erase(it);
+        }
+
+        try
+        {
+            auto ch = open_channel(remote);
+            auto* ptr = ch.get();
+            add_channel(std::move(ch));
+            return ptr;
+        }
+        catch (const std::exception& e)
+        {
+            log::debug(log_cat, "No shared memory channel with {} ({}); using UDP", remote, e.what());
+            unavailable[remote] = now + RETRY_INTERVAL;
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<shm_channel> ShmTransport::open_channel(const Address& remote)
+    {
+        socklen_t len;
+        auto sa = listener_addr(remote.port(), len);
+        unique_fd control{check_rv(::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "socket")};
+        check_rv(::connect(control.fd, reinterpret_cast<sockaddr*>(&sa), len), "connect");
+
+        // Anyone can bind the abstract name first, and would then get the packets we send to the
+        // peer, so the listener has to pass the same check as the peers we accept
+        if (opts.same_user_only)
+        {
+            ucred cred{};
+            socklen_t cred_len = sizeof(cred);
+            check_rv(::getsockopt(control.fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len), "getsockopt");
+            if (cred.uid != ::geteuid())
+                throw std::runtime_error{"shared memory channel listener belongs to another user"};
+        }
+
+        const size_t mem_size = DATA_OFFSET + 2 * opts.ring_size;
+        unique_fd memfd{check_rv(::memfd_create("oxen-libquic-shm", MFD_CLOEXEC), "memfd_create")};
+        check_rv(::ftruncate(memfd.fd, static_cast<off_t>(mem_size)), "ftruncate");
+        void* mem = ::mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd.fd, 0);
+        if (mem == MAP_FAILED)
+            throw std::system_error{errno, std::system_category(), "mmap"};
+
+        // The fresh memory is all zeros, which is an empty ring at position 0; we just need to
+        // mark both sides as idle so that the first packets in each direction send wakeups.
+        auto* hdr = new (mem) shm_header{SHM_MAGIC, SHM_VERSION, opts.ring_size, {}};
+        for (auto& r : hdr->rings)
+            r.consumer_waiting.store(1);
+
+        unique_fd wake{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}, peer_wake{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+        if (!wake || !peer_wake)
+        {
+            ::munmap(mem, mem_size);
+            throw std::system_error{errno, std::system_category(), "eventfd"};
+        }
+
+        // The address our UDP packets to the peer would come from
+        auto from = address();
+        if (from.is_any_addr())
+        {
+            from = remote;
+            from.set_port(address().port());
+        }
+
+        hello_msg hello{SHM_MAGIC, SHM_VERSION, {}, {}};
+        std::memcpy(&hello.from, static_cast<const sockaddr*>(from), from.socklen());
+        std::memcpy(&hello.to, static_cast<const sockaddr*>(remote), remote.socklen());
+
+        iovec iov{&hello, sizeof(hello)};
+        alignas(cmsghdr) char control_buf[CMSG_SPACE(3 * sizeof(int))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control_buf;
+        msg.msg_controllen = sizeof(control_buf);
+        auto* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        const int fds[3] = {memfd.fd, peer_wake.fd, wake.fd};
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (::sendmsg(control.fd, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello)))
+        {
+            ::munmap(mem, mem_size);
+            throw std::system_error{errno, std::system_category(), "sendmsg"};
+        }
+
+        log::debug(log_cat, "Opened shared memory channel from {} to {}", from, remote);
+        return std::make_unique<shm_channel>(
+                *this,
+                remote,
+                true,
+                Path{from, remote},
+                std::move(control),
+                std::move(wake),
+                std::move(peer_wake),
+                mem,
+                mem_size,
+                opts.ring_size);
+    }
+
+    void ShmTransport::accept_channels()
+    {
+        for (;;)
+        {
+            unique_fd fd{::accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+            if (!fd)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    log::warning(log_cat, "Failed to accept shared memory channel: {}", strerror(errno));
+                return;
+            }
+
+            if (opts.same_user_only)
+            {
+                ucred cred{};
+                socklen_t len = sizeof(cred);
+                if (::getsockopt(fd.fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 || cred.uid != ::geteuid())
+                {
+                    log::info(log_cat, "Refusing shared memory channel from a process of another user");
+                    continue;
+                }
+            }
+
+            // The hello is sent along with connecting, but might not be here just yet
+            const int raw = fd.fd;
+            event_ptr ev{event_new(
+                    loop,
+                    raw,
+                    EV_READ | EV_PERSIST,
+                    [](evutil_socket_t fd, short, void* self) {
+                        scoped_dispatch timing;
+                        static_cast<ShmTransport*>(self)->receive_hello(fd);
+                    },
+                    this)};
+            event_add(ev.get(), nullptr);
+            pending.emplace(raw, std::make_pair(std::move(fd), std::move(ev)));
+        }
+    }
+
+    void ShmTransport::receive_hello(int fd)
+    {
+        auto it = pending.find(fd);
+        if (it == pending.end())
+            return;
+
+        hello_msg hello{};
+        iovec iov{&hello, sizeof(hello)};
+        alignas(cmsghdr) char control_buf[CMSG_SPACE(3 * sizeof(int))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control_buf;
+        msg.msg_controllen = sizeof(control_buf);
+
+        auto n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            return;
+
+        // Whatever happens now, it's no longer pending
+        auto control = std::move(it->second.first);
+        pending.erase(it);
+
+        // Take ownership of any descriptors first, so that nothing leaks if this is garbage
+        std::vector<unique_fd> fds;
+        for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+            {
+                int f;
+                std::memcpy(&f, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.emplace_back(f);
+            }
+        }
+
+        if (n != static_cast<ssize_t>(sizeof(hello)) || hello.magic != SHM_MAGIC || hello.version != SHM_VERSION ||
+            fds.size() != 3 || (msg.msg_flags & MSG_CTRUNC))
+        {
+            log::warning(log_cat, "Received invalid shared memory channel request; ignoring it");
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(fds[0].fd, &st) == -1 || st.st_size < static_cast<off_t>(DATA_OFFSET))
+        {
+            log::warning(log_cat, "Invalid shared memory channel memory; ignoring channel request");
+            return;
+        }
+        const auto mem_size = static_cast<size_t>(st.st_size);
+        void* mem = ::mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0].fd, 0);
+        if (mem == MAP_FAILED)
+        {
+            log::warning(log_cat, "Failed to map shared memory channel memory: {}", strerror(errno));
+            return;
+        }
+        auto* hdr = static_cast<shm_header*>(mem);
+        // Read exactly once: the peer can change it under us, so this validated copy is what the
+        // channel has to use
+        const auto ring_size = static_cast<size_t>(*static_cast<const volatile uint64_t*>(&hdr->ring_size));
+        if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || ring_size < MIN_RING_SIZE ||
+            ring_size > MAX_RING_SIZE || (ring_size & (ring_size - 1)) || mem_size != DATA_OFFSET + 2 * ring_size)
+        {
+            log::warning(log_cat, "Invalid shared memory channel header; ignoring channel request");
+            ::munmap(mem, mem_size);
+            return;
+        }
+
+        Address from{reinterpret_cast<const sockaddr*>(&hello.from)}, to{reinterpret_cast<const sockaddr*>(&hello.to)};
+        log::debug(log_cat, "Accepted shared memory channel from {} to {}", from, to);
+        add_channel(std::make_unique<shm_channel>(
+                *this,
+                from,
+                false,
+                Path{to, from},
+                std::move(control),
+                std::move(fds[1]),
+                std::move(fds[2]),
+                mem,
+                mem_size,
+                ring_size));
+    }
+
+    void ShmTransport::add_channel(std::unique_ptr<shm_channel> ch)
+    {
+        auto [it, inserted] = channels.try_emplace(ch->peer);
+        if (!inserted)
+        {
+            // If both sides opened a channel to each other at once then each side gets one of
+            // each; they both keep the one opened by the side with the lower port, and close the
+            // other.
+            auto& existing = *it->second;
+            bool keep_existing = existing.initiator == (address().port() < ch->peer.port());
+            log::debug(
+                    log_cat,
+                    "Duplicate shared memory channel with {}: keeping the {} one",
+                    ch->peer,
+                    keep_existing ? "old" : "new");
+            if (keep_existing)
+                return;
+            auto callbacks = std::move(existing.writeable_callbacks);
+            ch->writeable_callbacks.insert(ch->writeable_callbacks.end(), callbacks.begin(), callbacks.end());
+        }
+        unavailable.erase(ch->peer);
+        it->second = std::move(ch);
+    }
+
+    void ShmTransport::close_channel(shm_channel& ch)
+    {
+        auto it = channels.find(ch.peer);
+        if (it == channels.end() || it->second.get() != &ch)
+            return;
+
+        // Anything waiting for ring space can now just go over UDP instead
+        for (auto& f : ch.writeable_callbacks)
+            udp.when_writeable(std::move(f));
+        channels.erase(it);
+    }
+
+    opt::packet_transport shm_transport(shm_options opts)
+    {
+        return opt::packet_transport{
+                [opts](event_base* loop,
+                       const Address& addr,
+                       PacketSink& sink,
+                       const opt::socket_options& sockopts,
+                       size_t max_payload) -> std::unique_ptr<PacketTransport> {
+                    return std::make_unique<ShmTransport>(loop, addr, sink, sockopts, max_payload, opts);
+                }};
+    }
+#else
+    opt::packet_transport shm_transport(shm_options)
+    {
+        return opt::packet_transport{
+                [](event_base* loop,
+                   const Address& addr,
+                   PacketSink& sink,
+                   const opt::socket_options& sockopts,
+                   size_t max_payload) -> std::unique_ptr<PacketTransport> {
+                    log::info(log_cat, "Shared memory transport is only available on Linux; using plain UDP");
+                    return std::make_unique<UDPSocket>(loop, addr, sink, false, sockopts, max_payload);
+                }};
+    }
+#endif
+}  // namespace oxen::quic
@@ -0,0 +1,329 @@
+#include "simulated.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "instrumentation.hpp"
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    // An endpoint's attachment to a SimulatedNetwork.  Packets sent to it are queued here (by
+    // whichever thread sent them) until their arrival time, when a timer on the endpoint's loop
+    // hands them to the endpoint.
+    class SimulatedSocket final : public PacketTransport
+    {
+      public:
+        SimulatedSocket(
+                std::shared_ptr<SimulatedNetwork> network, event_base* ev_loop, const Address& addr, PacketSink& sink);
+        ~SimulatedSocket() override;
+
+        const Address& address() const override { return bound; }
+
+        std::pair<io_result, size_t> send(
+                const Path& path, const std::byte* bufs, const size_t* bufsize, uint8_t ecn, size_t n_pkts) override
+        {
+            const send_run run{&path, ecn, n_pkts};
+            return send(&run, 1, bufs, bufsize);
+        }
+
+        // Never blocks: a link that can't take a packet drops it, as a router would
+        std::pair<io_result, size_t> send(
+                const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize) override;
+
+        void when_writeable(std::function<void()> cb) override;
+
+        SendBackend send_backend() const override { return SendBackend::SENDMSG; }
+
+        socket_stats stats() const override { return _stats.load(); }
+
+        // Queues a packet to be received at `at`.  Called by the network (with its lock held) from
+        // the sender's thread.
+        void enqueue(
+                std::chrono::steady_clock::time_point at, Path path, uint8_t ecn, const std::byte* data, size_t size);
+
+      private:
+        struct queued_packet
+        {
+            std::chrono::steady_clock::time_point at;
+            uint64_t seq;
+            Path path;
+            uint8_t ecn;
+            std::vector<std::byte> data;
+
+            bool operator>(const queued_packet& other) const
+            {
+                return std::tie(at, seq) > std::tie(other.at, other.seq);
+            }
+        };
+
+        const std::shared_ptr<SimulatedNetwork> network;
+        PacketSink& sink;
+        Address bound;
+
+        socket_stats counters;
+        atomic_snapshot<socket_stats> _stats;
+
+        // Fires (on the endpoint's loop) when a packet is queued ahead of everything else, when the
+        // earliest queued packet is due, and to run writeable callbacks
+        event_ptr ev;
+        std::vector<std::function<void()>> writeable_callbacks;
+
+        // Min-heap of packets on their way to us, by arrival time (and then send order)
+        std::mutex inbound_mutex;
+        std::vector<queued_packet> inbound;
+        uint64_t next_seq{0};
+
+        void process();
+    };
+
+    SimulatedSocket::SimulatedSocket(
+            std::shared_ptr<SimulatedNetwork> net, event_base* ev_loop, const Address& addr, PacketSink& sink) :
+            network{std::move(net)}, sink{sink}
+    {
+        ev.reset(event_new(
+                ev_loop,
+                -1,
+                0,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<SimulatedSocket*>(self)->process();
+                },
+                this));
+
+        // Binding makes us reachable by other threads, so `ev` has to be ready first
+        bound = network->bind(*this, addr);
+        log::debug(log_cat, "Simulated socket bound to {}", bound);
+    }
+
+    SimulatedSocket::~SimulatedSocket()
+    {
+        network->unbind(*this);
+    }
+
+    std::pair<io_result, size_t> SimulatedSocket::send(
+            const send_run* runs, size_t n_runs, const std::byte* bufs, const size_t* bufsize)
+    {
+        network->send(*this, runs, n_runs, bufs, bufsize);
+
+        size_t n_pkts = 0;
+        for (size_t r = 0; r < n_runs; r++)
+            n_pkts += runs[r].n_pkts;
+        counters.packets_sent += n_pkts;
+        counters.bytes_sent += std::accumulate(bufsize, bufsize + n_pkts, uint64_t{0});
+        _stats.store(counters);
+
+        return {io_result{}, n_pkts};
+    }
+
+    void SimulatedSocket::when_writeable(std::function<void()> cb)
+    {
+        writeable_callbacks.push_back(std::move(cb));
+        event_active(ev.get(), 0, 0);
+    }
+
+    void SimulatedSocket::enqueue(
+            std::chrono::steady_clock::time_point at, Path path, uint8_t ecn, const std::byte* data, size_t size)
+    {
+        bool first;
+        {
+            std::lock_guard lock{inbound_mutex};
+            auto seq = next_seq++;
+            inbound.push_back(queued_packet{at, seq, std::move(path), ecn, {data, data + size}});
+            std::push_heap(inbound.begin(), inbound.end(), std::greater<>{});
+            first = inbound.front().seq == seq;
+        }
+
+        // Otherwise the timer for an earlier packet is already set (or it is about to be)
+        if (first)
+            event_active(ev.get(), 0, 0);
+    }
+
+    void SimulatedSocket::process()
+    {
+        auto callbacks = std::move(writeable_callbacks);
+        writeable_callbacks.clear();
+        for (const auto& f : callbacks)
+            f();
+
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<queued_packet> due;
+        std::optional<std::chrono::steady_clock::time_point> next;
+        {
+            std::lock_guard lock{inbound_mutex};
+            while (!inbound.empty() && inbound.front().at <= now)
+            {
+                std::pop_heap(inbound.begin(), inbound.end(), std::greater<>{});
+                due.push_back(std::move(inbound.back()));
+                inbound.pop_back();
+            }
+            if (!inbound.empty())
+                next = inbound.front().at;
+        }
+
+        std::vector<Packet> batch;
+        batch.reserve(std::min(due.size(), DATAGRAM_BATCH_SIZE));
+        for (size_t i = 0; i < due.size(); i += DATAGRAM_BATCH_SIZE)
+        {
+            batch.clear();
+            for (size_t j = i; j < std::min(due.size(), i + DATAGRAM_BATCH_SIZE); j++)
+            {
+                auto& q = due[j];
+                auto& pkt = batch.emplace_back(q.path, bstring_view{q.data.data(), q.data.size()});
+                pkt.pkt_info.ecn = q.ecn;
+                counters.bytes_received += q.data.size();
+            }
+            counters.packets_received += batch.size();
+            _stats.store(counters);
+
+            sink.handle_packets(batch.data(), batch.size());
+        }
+
+        if (next)
+        {
+            auto us = std::chrono::ceil<std::chrono::microseconds>(*next - now);
+            timeval tv{0, 0};
+            tv.tv_sec = us / 1s;
+            tv.tv_usec = (us % 1s).count();
+            event_add(ev.get(), &tv);
+        }
+    }
+
+    opt::packet_transport SimulatedNetwork::transport()
+    {
+        return opt::packet_transport{
+                [net = shared_from_this()](
+                        event_base* loop, const Address& addr, PacketSink& sink) -> std::unique_ptr<PacketTransport> {
+                    return std::make_unique<SimulatedSocket>(net, loop, addr, sink);
+                }};
+    }
+
+    void SimulatedNetwork::set_conditions(link_conditions c)
+    {
+        std::lock_guard lock{mutex};
+        defaults = c;
+    }
+
+    void SimulatedNetwork::set_link(const Address& from, const Address& to, link_conditions c)
+    {
+        std::lock_guard lock{mutex};
+        link(from.port(), to.port()).conditions = c;
+    }
+
+    simulated_network_stats SimulatedNetwork::stats() const
+    {
+        std::lock_guard lock{mutex};
+        return _stats;
+    }
+
+    SimulatedNetwork::link_state& SimulatedNetwork::link(uint16_t from, uint16_t to)
+    {
+        return links[{from, to}];
+    }
+
+    Address SimulatedNetwork::bind(SimulatedSocket& sock, Address addr)
+    {
+        std::lock_guard lock{mutex};
+
+        if (addr.port() == 0)
+        {
+            if (sockets.size() >= 65535)
+                throw std::runtime_error{"SimulatedNetwork has no free ports"};
+            while (next_port == 0 || sockets.count(next_port))
+                next_port++;
+            addr.set_port(next_port++);
+        }
+
+        if (!sockets.emplace(addr.port(), &sock).second)
+            throw std::runtime_error{"SimulatedNetwork port {} is already in use"_format(addr.port())};
+        return addr;
+    }
+
+    void SimulatedNetwork::unbind(const SimulatedSocket& sock)
+    {
+        std::lock_guard lock{mutex};
+        if (auto it = sockets.find(sock.address().port()); it != sockets.end() && it->second == &sock)
+            sockets.erase(it);
+    }
+
+    void SimulatedNetwork::send(
+            const SimulatedSocket& sock,
+            const PacketTransport::send_run* runs,
+            size_t n_runs,
+            const std::byte* bufs,
+            const size_t* bufsize)
+    {
+        using namespace std::chrono;
+        const auto now = steady_clock::now();
+        const auto& from = sock.address();
+        std::uniform_real_distribution<double> chance;
+
+        std::lock_guard lock{mutex};
+
+        for (size_t r = 0; r < n_runs; r++)
+        {
+            const auto& run = runs[r];
+            const auto& to = run.path->remote;
+            auto dest = sockets.find(to.port());
+            auto& l = link(from.port(), to.port());
+            const auto& c = l.conditions ? *l.conditions : defaults;
+
+            Address source = from;
+            if (source.is_any_addr())
+            {
+                source = to;
+                source.set_port(from.port());
+            }
+
+            for (size_t i = 0; i < run.n_pkts; i++, bufs += *bufsize++)
+            {
+                _stats.sent++;
+                if (dest == sockets.end())
+                {
+                    _stats.unroutable++;
+                    continue;
+                }
+
+                if (c.loss > 0 && chance(rng) < c.loss)
+                {
+                    _stats.lost++;
+                    continue;
+                }
+
+                auto at = now;
+                if (c.bandwidth)
+                {
+                    auto start = std::max(now, l.busy_until);
+                    if (duration<double>{start - now}.count() * c.bandwidth > c.queue_limit)
+                    {
+                        _stats.queue_dropped++;
+                        continue;
+                    }
+                    auto tx_time = duration<double>{static_cast<double>(*bufsize) / c.bandwidth};
+                    l.busy_until = start + duration_cast<nanoseconds>(tx_time);
+                    at = l.busy_until;
+                }
+
+                at += c.delay;
+                if (c.jitter.count() > 0)
+                    at += microseconds{std::uniform_int_distribution<int64_t>{0, c.jitter.count()}(rng)};
+                at = std::max(at, l.last_arrival);
+
+                if (c.reorder > 0 && chance(rng) < c.reorder)
+                {
+                    at += c.reorder_delay;
+                    _stats.reordered++;
+                }
+                else
+                    l.last_arrival = at;
+
+                _stats.delivered++;
+                dest->second->enqueue(at, Path{to, source}, run.ecn, bufs, *bufsize);
+            }
+        }
+    }
+}  // namespace oxen::quic
@@ -5,9 +5,20 @@ extern "C"
 #include <ngtcp2/ngtcp2.h>
 }
 
+#include <sys/stat.h>
+
+#include <cerrno>
 #include <cstddef>
 #include <cstdio>
 #include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "connection.hpp"
 #include "context.hpp"
@@ -24,7 +35,7 @@ namespace oxen::quic
             data_callback{data_cb},
             close_callback{std::move(close_cb)}
     {
-        log::trace(log_cat, "Creating Stream object...");
+        QUIC_HOT_TRACE(log_cat, "Creating Stream object...");
 
         if (!data_callback)
             data_callback = conn.get_default_data_callback();
@@ -34,12 +45,12 @@ namespace oxen::quic
                 log::info(log_cat, "Default stream close callback called ({})", quic_strerror(error_code));
             };
 
-        log::trace(log_cat, "Stream object created");
+        QUIC_HOT_TRACE(log_cat, "Stream object created");
     }
 
     Stream::~Stream()
     {
-        log::trace(log_cat, "Destroying stream {}", _stream_id);
+        QUIC_HOT_TRACE(log_cat, "Destroying stream {}", _stream_id);
     }
 
     bool Stream::available() const
@@ -65,7 +76,7 @@ namespace oxen::quic
         // NB: this *must* be a call (not a call_soon) because Connection calls on a short-lived
         // Stream that won't survive a return to the event loop.
         endpoint.call([this, app_err_code]() {
-            log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
+            QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
 
             if (_is_shutdown)
                 log::info(log_cat, "Stream is already shutting down");
@@ -74,6 +85,7 @@ namespace oxen::quic
             else
             {
                 _is_closing = _is_shutdown = true;
+                publish_state();
                 if (_conn)
                 {
                     log::info(log_cat, "Closing stream (ID: {}) with: {}", _stream_id, quic_strerror(app_err_code));
@@ -95,84 +107,52 @@ namespace oxen::quic
 
     void Stream::append_buffer(bstring_view buffer, std::shared_ptr<void> keep_alive)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        user_buffers.emplace_back(buffer, std::move(keep_alive));
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        user_buffers.append(buffer, std::move(keep_alive));
         assert(endpoint.in_event_loop());
         assert(_conn);
+        publish_state();
+        buffered_changed();
         if (_ready)
-            _conn->packet_io_ready();
+            _conn->app_data_ready();
         else
             log::info(log_cat, "Stream not ready for broadcast yet, data appended to buffer and on deck");
     }
 
     void Stream::acknowledge(size_t bytes)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        log::trace(log_cat, "Acking {} bytes of {}/{} unacked/size", bytes, _unacked_size, size());
-
-        assert(bytes <= _unacked_size);
-        _unacked_size -= bytes;
-
-        // drop all acked user_buffers, as they are unneeded
-        while (bytes >= user_buffers.front().first.size() && bytes)
-        {
-            bytes -= user_buffers.front().first.size();
-            user_buffers.pop_front();
-            log::trace(log_cat, "bytes: {}", bytes);
-        }
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "Acking {} bytes of {}/{} unacked/size", bytes, unacked(), size());
 
-        // advance bsv pointer to cover any remaining acked data
-        if (bytes)
-            user_buffers.front().first.remove_prefix(bytes);
+        user_buffers.acknowledge(bytes);
+        publish_state();
+        buffered_changed();
+        if (user_buffers.empty() && !drain_callbacks.empty())
+            fire_drained(true);
 
-        log::trace(log_cat, "{} bytes acked, {} unacked remaining", bytes, size());
+        QUIC_HOT_TRACE(log_cat, "{} bytes acked, {} unacked remaining", bytes, size());
     }
 
     void Stream::wrote(size_t bytes)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        log::trace(log_cat, "Increasing _unacked_size by {}B", bytes);
-        _unacked_size += bytes;
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "Increasing unacked size by {}B", bytes);
+        user_buffers.wrote(bytes);
+        publish_state();
     }
 
-    static auto get_buffer_it(std::deque<std::pair<bstring_view, std::shared_ptr<void>>>& bufs, size_t offset)
+    void Stream::publish_state()
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-        auto it = bufs.begin();
-
-        while (offset >= it->first.size() && it != bufs.end() && offset)
-        {
-            offset -= it->first.size();
-            it++;
-        }
-
-        return std::make_pair(std::move(it), offset);
+        IOChannel::publish_state();
+        _published_buffers.store(user_buffers.num_buffers(), std::memory_order_relaxed);
     }
 
-    std::vector<ngtcp2_vec> Stream::pending()
+    size_t Stream::pending(ngtcp2_vec* bufs, size_t max)
     {
-        log::trace(log_cat, "{} called", __PRETTY_FUNCTION__);
-
-        std::vector<ngtcp2_vec> nbufs{};
-
-        log::trace(log_cat, "unsent: {}", unsent());
+        QUIC_HOT_TRACE(log_cat, "{} called", __PRETTY_FUNCTION__);
+        QUIC_HOT_TRACE(log_cat, "unsent: {}", unsent_impl());
 
-        if (user_buffers.empty() || unsent() == 0)
-            return nbufs;
-
-        auto [it, offset] = get_buffer_it(user_buffers, _unacked_size);
-        nbufs.reserve(std::distance(it, user_buffers.end()));
-        auto& temp = nbufs.emplace_back();
-        temp.base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(it->first.data() + offset));
-        temp.len = it->first.size() - offset;
-        while (++it != user_buffers.end())
-        {
-            auto& temp = nbufs.emplace_back();
-            temp.base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(it->first.data()));
-            temp.len = it->first.size();
-        }
-
-        return nbufs;
+        return user_buffers.fill(bufs, max);
     }
 
     void Stream::send_impl(bstring_view data, std::shared_ptr<void> keep_alive)
@@ -191,32 +171,290 @@ namespace oxen::quic
                 log::warning(log_cat, "Stream {} unable to send: connection is closed", _stream_id);
                 return;
             }
-            log::trace(log_cat, "Stream (ID: {}) sending message: {}", _stream_id, buffer_printer{data});
+            QUIC_HOT_TRACE(log_cat, "Stream (ID: {}) sending message: {}", _stream_id, buffer_printer{data});
             append_buffer(data, std::move(ka));
         });
     }
 
-    size_t Stream::unsent_impl() const
+    void Stream::watch_timeouts()
+    {
+        assert(endpoint.in_event_loop());
+        if (_conn)
+            _conn->watch_timeouts(*this);
+    }
+
+    void Stream::set_coalescing(size_t max_size)
+    {
+        endpoint.call([this, max_size] { user_buffers.set_coalescing(max_size); });
+    }
+
+    void Stream::set_priority(uint8_t urgency, bool incremental)
+    {
+        if (urgency > MAX_URGENCY)
+            throw std::invalid_argument{"Invalid stream urgency {}: urgency must be <= {}"_format(urgency, MAX_URGENCY)};
+        endpoint.call([this, urgency, incremental] {
+            _urgency = urgency;
+            _incremental = incremental;
+        });
+    }
+
+    std::pair<uint8_t, bool> Stream::priority() const
+    {
+        return endpoint.call_get([this] { return std::make_pair(_urgency, _incremental); });
+    }
+
+    void Stream::set_manual_consume(bool enabled)
+    {
+        endpoint.call([this, enabled] {
+            _manual_consume = enabled;
+            if (!enabled && _conn && _unconsumed)
+                _conn->stream_consumed(*this, _unconsumed);
+        });
+    }
+
+    void Stream::consume(size_t bytes)
+    {
+        endpoint.call([this, bytes] {
+            if (_conn)
+                _conn->stream_consumed(*this, bytes);
+        });
+    }
+
+    size_t Stream::unconsumed() const
+    {
+        return endpoint.call_get([this] { return static_cast<size_t>(_unconsumed); });
+    }
+
+    void Stream::set_watermarks(size_t high, size_t low, stream_watermark_callback cb)
+    {
+        if (high && low >= high)
+            throw std::invalid_argument{"Invalid watermarks: low watermark must be below the high watermark"};
+        endpoint.call([this, high, low, cb = std::move(cb)]() mutable {
+            _watermarks.set(high, low);
+            watermark_callback = std::move(cb);
+            buffered_changed();
+        });
+    }
+
+    bool Stream::is_writable() const
+    {
+        return endpoint.call_get([this] { return !_watermarks.blocked; });
+    }
+
+    void Stream::when_drained(stream_drained_callback cb)
+    {
+        endpoint.call([this, cb = std::move(cb)]() mutable {
+            if (!_conn || _is_shutdown)
+                cb(*this, false);
+            else if (user_buffers.empty())
+                cb(*this, true);
+            else
+                drain_callbacks.push_back(std::move(cb));
+        });
+    }
+
+    void Stream::fire_drained(bool drained)
+    {
+        // Callbacks may queue more data or add new drain callbacks, so take the current ones first
+        auto callbacks = std::move(drain_callbacks);
+        drain_callbacks.clear();
+        for (auto& cb : callbacks)
+        {
+            try
+            {
+                cb(*this, drained);
+            }
+            catch (const std::exception& e)
+            {
+                log::error(log_cat, "Uncaught exception from stream drained callback: {}", e.what());
+            }
+        }
+    }
+
+    void Stream::buffered_changed()
+    {
+        auto size = user_buffers.size();
+        if (_conn && !_is_shutdown)
+            _conn->stream_buffered_changed(*this, size);
+
+        if (auto writable = _watermarks.update(size); writable && watermark_callback)
+        {
+            log::debug(log_cat, "Stream {} is now {}writable", _stream_id, *writable ? "" : "un");
+            try
+            {
+                watermark_callback(*this, *writable);
+            }
+            catch (const std::exception& e)
+            {
+                log::error(log_cat, "Uncaught exception from stream watermark callback: {}", e.what());
+            }
+        }
+    }
+
+    bool Stream::wants_more_chunks() const
+    {
+        return _conn && user_buffers.unsent() < _conn->send_window_estimate();
+    }
+
+    namespace
+    {
+        // One window of a file being sent by send_file: it is kept alive (as a chunk) until all of
+        // its data has been acknowledged, and then unmapped.
+        class file_window
+        {
+#ifdef _WIN32
+            std::vector<std::byte> buf;
+#else
+            void* map;
+            size_t map_len;
+            size_t skip;  // bytes between the (page aligned) start of the mapping and our data
+#endif
+            size_t len;
+
+          public:
+            file_window(int fd, uint64_t offset, size_t size) : len{size}
+            {
+#ifdef _WIN32
+                buf.resize(size);
+                if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+                    throw std::system_error{errno, std::system_category()};
+                for (size_t got = 0; got < size;)
+                {
+                    auto n = _read(fd, buf.data() + got, static_cast<unsigned>(std::min<size_t>(size - got, 1_Gi)));
+                    if (n <= 0)
+                        throw std::system_error{n < 0 ? errno : EIO, std::system_category()};
+                    got += n;
+                }
+#else
+                static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+                skip = offset % page_size;
+                map_len = skip + size;
+                map = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset - skip));
+                if (map == MAP_FAILED)
+                    throw std::system_error{errno, std::system_category()};
+                // Windows are sent front to back, and right away:
+                madvise(map, map_len, MADV_SEQUENTIAL);
+                madvise(map, map_len, MADV_WILLNEED);
+#endif
+            }
+
+            file_window(const file_window&) = delete;
+            file_window& operator=(const file_window&) = delete;
+
+            ~file_window()
+            {
+#ifndef _WIN32
+                munmap(map, map_len);
+#endif
+            }
+
+            const std::byte* data() const
+            {
+#ifdef _WIN32
+                return buf.data();
+#else
+                return static_cast<const std::byte*>(map) + skip;
+#endif
+            }
+            size_t size() const { return len; }
+        };
+
+        // The not yet sent part of a file being sent by send_file; owns a duplicate of the
+        // caller's descriptor.
+        struct file_source
+        {
+            int fd;
+            uint64_t pos;
+            uint64_t end;
+            size_t window;
+
+            file_source(int orig_fd, uint64_t offset, uint64_t len, size_t window) :
+                    pos{offset}, end{offset + len}, window{window}
+            {
+#ifdef _WIN32
+                struct _stat64 st;
+                if (_fstat64(orig_fd, &st) != 0)
+#else
+                struct stat st;
+                if (fstat(orig_fd, &st) != 0)
+#endif
+                    throw std::system_error{errno, std::system_category()};
+                if (end < offset || end > static_cast<uint64_t>(st.st_size))
+                    throw std::invalid_argument{
+                            "Stream::send_file range {}+{} is beyond the end of the file ({} bytes)"_format(
+                                    offset, len, st.st_size)};
+#ifdef _WIN32
+                fd = _dup(orig_fd);
+#else
+                fd = dup(orig_fd);
+#endif
+                if (fd < 0)
+                    throw std::system_error{errno, std::system_category()};
+            }
+
+            ~file_source()
+            {
+#ifdef _WIN32
+                _close(fd);
+#else
+                close(fd);
+#endif
+            }
+
+            // Returns the next window, or nullptr once the whole range has been returned
+            std::unique_ptr<file_window> next()
+            {
+                if (pos >= end)
+                    return nullptr;
+                auto size = static_cast<size_t>(std::min<uint64_t>(window, end - pos));
+                auto w = std::make_unique<file_window>(fd, pos, size);
+                pos += size;
+                return w;
+            }
+        };
+    }  // namespace
+
+    void Stream::send_file(
+            int fd, uint64_t offset, uint64_t len, std::function<void(Stream&)> done, size_t window, int max_windows)
     {
-        log::trace(log_cat, "size={}, unacked={}", size(), unacked());
-        return size() - unacked();
+        if (fd < 0)
+            throw std::invalid_argument{"Stream::send_file requires a valid file descriptor"};
+        if (window == 0)
+            throw std::invalid_argument{"Stream::send_file window size must be positive"};
+
+        auto src = std::make_shared<file_source>(fd, offset, len, window);
+        send_chunks(
+                [src = std::move(src)](const Stream& s) -> std::unique_ptr<file_window> {
+                    try
+                    {
+                        return src->next();
+                    }
+                    catch (const std::exception& e)
+                    {
+                        log::error(log_cat, "Stream::send_file failed to map file data: {}", e.what());
+                        const_cast<Stream&>(s).close(STREAM_ERROR_EXCEPTION);
+                        return nullptr;
+                    }
+                },
+                std::move(done),
+                adaptive_chunks{max_windows});
     }
 
     void Stream::set_ready()
     {
-        log::trace(log_cat, "Setting stream ready");
+        QUIC_HOT_TRACE(log_cat, "Setting stream ready");
         _ready = true;
         on_ready();
     }
 
     void _chunk_sender_trace(const char* file, int lineno, std::string_view message)
     {
-        log::trace(log_cat, "{}:{} -- {}", file, lineno, message);
+        QUIC_HOT_TRACE(log_cat, "{}:{} -- {}", file, lineno, message);
     }
 
     void _chunk_sender_trace(const char* file, int lineno, std::string_view message, size_t val)
     {
-        log::trace(log_cat, "{}:{} -- {}{}", file, lineno, message, val);
+        QUIC_HOT_TRACE(log_cat, "{}:{} -- {}{}", file, lineno, message, val);
     }
 
     prepared_datagram Stream::pending_datagram(bool)
@@ -0,0 +1,106 @@
+#include "stream_buffer.hpp"
+
+#include <cassert>
+
+namespace oxen::quic
+{
+    void stream_buffer::append(bstring_view data, std::shared_ptr<void> keep_alive)
+    {
+        if (data.empty())
+            return;
+        if (data.size() <= coalesce_max)
+            return append_coalesced(data);
+        bufs.emplace_back(data, std::move(keep_alive));
+        _size += data.size();
+    }
+
+    void stream_buffer::append_coalesced(bstring_view data)
+    {
+        if (!arena || arena->capacity() - arena->size() < data.size())
+        {
+            // The vector (like the control block) gets the allocator, and so the chunk itself too
+            arena = std::allocate_shared<std::pmr::vector<std::byte>>(bufs.get_allocator());
+            arena->reserve(ARENA_CHUNK_SIZE);
+        }
+
+        auto* dest = arena->data() + arena->size();
+        arena->insert(arena->end(), data.begin(), data.end());
+        _size += data.size();
+
+        // If the last queued buffer ends exactly where we just copied to then we can simply extend
+        // it, as long as it isn't already fully sent (which would put the cursor past it).
+        if (cursor_idx < bufs.size())
+        {
+            auto& [last, ka] = bufs.back();
+            if (ka == arena && last.data() + last.size() == dest)
+            {
+                last = bstring_view{last.data(), last.size() + data.size()};
+                return;
+            }
+        }
+        bufs.emplace_back(bstring_view{dest, data.size()}, arena);
+    }
+
+    void stream_buffer::wrote(size_t bytes)
+    {
+        assert(bytes <= unsent());
+        _unacked += bytes;
+
+        while (bytes)
+        {
+            assert(cursor_idx < bufs.size());
+            auto remaining = bufs[cursor_idx].first.size() - cursor_off;
+            if (bytes < remaining)
+            {
+                cursor_off += bytes;
+                break;
+            }
+            bytes -= remaining;
+            cursor_idx++;
+            cursor_off = 0;
+        }
+    }
+
+    void stream_buffer::acknowledge(size_t bytes)
+    {
+        assert(bytes <= _unacked);
+        _unacked -= bytes;
+        _size -= bytes;
+
+        // Drop all fully acked buffers.  Acked data is always sent data, so these are all before
+        // the unsent cursor.
+        while (bytes && bytes >= bufs.front().first.size())
+        {
+            bytes -= bufs.front().first.size();
+            bufs.pop_front();
+            assert(cursor_idx > 0);
+            cursor_idx--;
+        }
+
+        // Advance the front view past any remaining acked data
+        if (bytes)
+        {
+            bufs.front().first.remove_prefix(bytes);
+            if (cursor_idx == 0)
+            {
+                assert(cursor_off >= bytes);
+                cursor_off -= bytes;
+            }
+        }
+    }
+
+    size_t stream_buffer::fill(ngtcp2_vec* vecs, size_t max) const
+    {
+        size_t n = 0;
+        auto off = cursor_off;
+        for (auto i = cursor_idx; i < bufs.size() && n < max; i++, n++)
+        {
+            auto& data = bufs[i].first;
+            vecs[n].base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(data.data() + off));
+            vecs[n].len = data.size() - off;
+            off = 0;
+        }
+        return n;
+    }
+
+}  // namespace oxen::quic
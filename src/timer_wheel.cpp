@@ -0,0 +1,309 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include "instrumentation.hpp"
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    namespace
+    {
+        using detail::timer_node;
+
+        constexpr unsigned LEVEL_BITS = 6;
+        static_assert(timer_wheel::SLOTS == 1 << LEVEL_BITS);
+
+        // Number of ticks covered by the whole wheel; deadlines further out than this are filed at
+        // the far end of the top level and re-filed (possibly several times) until they come due.
+        constexpr uint64_t WHEEL_RANGE = uint64_t{1} << (LEVEL_BITS * timer_wheel::LEVELS);
+
+        void init_head(timer_node& head)
+        {
+            head.next = head.prev = &head;
+        }
+
+        bool list_empty(const timer_node& head)
+        {
+            return head.next == &head;
+        }
+
+        void link_tail(timer_node& head, timer_node& n)
+        {
+            n.prev = head.prev;
+            n.next = &head;
+            head.prev->next = &n;
+            head.prev = &n;
+        }
+
+        void unlink(timer_node& n)
+        {
+            n.prev->next = n.next;
+            n.next->prev = n.prev;
+            n.next = n.prev = nullptr;
+        }
+
+        // Moves the entire list at `from` onto the (empty) list `to`
+        void splice(timer_node& from, timer_node& to)
+        {
+            assert(list_empty(to));
+            if (list_empty(from))
+                return;
+            to.next = from.next;
+            to.prev = from.prev;
+            to.next->prev = &to;
+            to.prev->next = &to;
+            init_head(from);
+        }
+
+        unsigned highest_bit(uint64_t x)
+        {
+            assert(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+            return 63 - static_cast<unsigned>(__builtin_clzll(x));
+#else
+            unsigned i = 0;
+            while (x >>= 1)
+                i++;
+            return i;
+#endif
+        }
+
+        unsigned lowest_bit(uint64_t x)
+        {
+            assert(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+            unsigned i = 0;
+            while (!(x & 1))
+            {
+                x >>= 1;
+                i++;
+            }
+            return i;
+#endif
+        }
+
+        uint64_t rotr(uint64_t x, unsigned n)
+        {
+            n &= 63;
+            return n ? (x >> n) | (x << (64 - n)) : x;
+        }
+    }  // namespace
+
+    void wheel_timer::schedule(std::chrono::steady_clock::time_point when)
+    {
+        wheel->schedule(*this, when);
+    }
+
+    void wheel_timer::cancel()
+    {
+        if (scheduled())
+            wheel->cancel(*this);
+    }
+
+    timer_wheel::timer_wheel(event_base* loop) : start{get_time()}
+    {
+        for (auto& level : slots)
+            for (auto& head : level)
+                init_head(head);
+        init_head(immediate);
+
+        ev.reset(event_new(
+                loop,
+                -1,
+                0,
+                [](evutil_socket_t, short, void* self) {
+                    scoped_dispatch timing;
+                    static_cast<timer_wheel*>(self)->process();
+                },
+                this));
+        assert(ev);
+    }
+
+    timer_wheel::~timer_wheel()
+    {
+        // Anything still scheduled gets detached so that the timers' own destructors, if they run
+        // later, don't try to unlink themselves from us.
+        auto detach = [](timer_node& head) {
+            for (auto* n = head.next; n != &head;)
+            {
+                auto* next = n->next;
+                n->next = n->prev = nullptr;
+                n = next;
+            }
+            init_head(head);
+        };
+        for (auto& level : slots)
+            for (auto& head : level)
+                detach(head);
+        detach(immediate);
+    }
+
+    uint64_t timer_wheel::tick_at(std::chrono::steady_clock::time_point t, bool round_up) const
+    {
+        if (t <= start)
+            return 0;
+        auto since = t - start;
+        auto ticks = static_cast<uint64_t>(since / TICK);
+        if (round_up && since % TICK != decltype(since)::zero())
+            ticks++;
+        return ticks;
+    }
+
+    void timer_wheel::schedule(wheel_timer& t, std::chrono::steady_clock::time_point when)
+    {
+        if (t.scheduled())
+            cancel(t);
+
+        t.tick = tick_at(when, true);
+        count++;
+
+        if (t.tick <= elapsed)
+        {
+            t.level = NO_SLOT;
+            link_tail(immediate, t);
+            arm(elapsed);
+        }
+        else
+        {
+            file(t);
+            // We arm for the timer's actual deadline rather than the start of the slot it has been
+            // filed in; any cascading needed to reach it gets done when we process at that time.
+            arm(t.tick);
+        }
+    }
+
+    void timer_wheel::cancel(wheel_timer& t)
+    {
+        assert(t.scheduled());
+        unlink(t);
+        count--;
+
+        // This also does the right thing for a timer that was in a slot list we are currently
+        // processing (as the slot list will already be empty, or contain only newly filed timers).
+        if (t.level != NO_SLOT && list_empty(slots[t.level][t.slot]))
+            occupied[t.level] &= ~(uint64_t{1} << t.slot);
+    }
+
+    void timer_wheel::file(wheel_timer& t)
+    {
+        assert(t.tick > elapsed);
+        auto when = std::min(t.tick, elapsed + WHEEL_RANGE - 1);
+
+        // The level is determined by the highest bit group in which the deadline differs from the
+        // current time: that puts the timer into a slot strictly after the current slot of that
+        // level, within the current rotation of the level above.
+        auto level = highest_bit((elapsed ^ when) | (SLOTS - 1)) / LEVEL_BITS;
+        auto slot = (when >> (level * LEVEL_BITS)) & (SLOTS - 1);
+
+        t.level = static_cast<uint8_t>(level);
+        t.slot = static_cast<uint8_t>(slot);
+        link_tail(slots[level][slot], t);
+        occupied[level] |= uint64_t{1} << slot;
+    }
+
+    std::optional<uint64_t> timer_wheel::next_expiration() const
+    {
+        // Occupied slots of a lower level always come due before those of any higher level, so the
+        // first occupied slot we find (searching from the current slot of the lowest level) wins.
+        for (size_t level = 0; level < LEVELS; level++)
+        {
+            if (!occupied[level])
+                continue;
+
+            const unsigned shift = level * LEVEL_BITS;
+            const uint64_t slot_range = uint64_t{1} << shift;
+            const uint64_t level_range = slot_range << LEVEL_BITS;
+
+            auto now_slot = static_cast<unsigned>((elapsed >> shift) & (SLOTS - 1));
+            auto slot = (now_slot + lowest_bit(rotr(occupied[level], now_slot))) & (SLOTS - 1);
+
+            uint64_t deadline = (elapsed & ~(level_range - 1)) + slot * slot_range;
+            if (deadline <= elapsed)
+                deadline += level_range;
+            return deadline;
+        }
+        return std::nullopt;
+    }
+
+    void timer_wheel::process()
+    {
+        armed = NOT_ARMED;
+        const auto now = tick_at(get_time(), false);
+
+        timer_node due;
+        init_head(due);
+
+        auto fire_due = [&] {
+            while (!list_empty(due))
+            {
+                auto& t = static_cast<wheel_timer&>(*due.next);
+                unlink(t);
+                if (t.tick <= elapsed)
+                {
+                    count--;
+                    t.cb(t.arg);
+                }
+                else
+                    // Cascade into a lower level
+                    file(t);
+            }
+        };
+
+        // Timers that were already due when scheduled
+        splice(immediate, due);
+        fire_due();
+
+        while (auto next = next_expiration())
+        {
+            if (*next > now)
+                break;
+
+            elapsed = *next;
+            for (size_t level = 0; level < LEVELS; level++)
+            {
+                auto slot = (elapsed >> (level * LEVEL_BITS)) & (SLOTS - 1);
+                if (occupied[level] & (uint64_t{1} << slot))
+                {
+                    occupied[level] &= ~(uint64_t{1} << slot);
+                    splice(slots[level][slot], due);
+                    break;
+                }
+            }
+            fire_due();
+        }
+
+        elapsed = std::max(elapsed, now);
+
+        rearm();
+    }
+
+    void timer_wheel::arm(uint64_t tick)
+    {
+        if (tick >= armed)
+            return;
+        armed = tick;
+
+        auto delay = start + static_cast<int64_t>(tick) * TICK - get_time();
+        timeval tv{0, 0};
+        if (delay > 0s)
+        {
+            auto us = std::chrono::ceil<std::chrono::microseconds>(delay);
+            tv.tv_sec = us / 1s;
+            tv.tv_usec = (us % 1s).count();
+        }
+        event_add(ev.get(), &tv);
+    }
+
+    void timer_wheel::rearm()
+    {
+        if (!list_empty(immediate))
+            arm(elapsed);
+        else if (auto next = next_expiration())
+            arm(*next);
+    }
+
+}  // namespace oxen::quic
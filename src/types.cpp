@@ -0,0 +1,60 @@
+#include "types.hpp"
+
+namespace oxen::quic
+{
+    std::string_view to_string(SendBackend b)
+    {
+        switch (b)
+        {
+            case SendBackend::GSO:
+                return "gso"sv;
+            case SendBackend::SENDMMSG:
+                return "sendmmsg"sv;
+            case SendBackend::SENDMSG:
+                return "sendmsg"sv;
+        }
+        return "unknown"sv;
+    }
+
+    std::string_view to_string(CongestionControl cc)
+    {
+        switch (cc)
+        {
+            case CongestionControl::CUBIC:
+                return "cubic"sv;
+            case CongestionControl::RENO:
+                return "reno"sv;
+            case CongestionControl::BBR:
+                return "bbr"sv;
+        }
+        return "unknown"sv;
+    }
+
+    std::string_view to_string(DatagramShare s)
+    {
+        switch (s)
+        {
+            case DatagramShare::ROUND_ROBIN:
+                return "round-robin"sv;
+            case DatagramShare::STRICT:
+                return "strict"sv;
+            case DatagramShare::WEIGHTED:
+                return "weighted"sv;
+        }
+        return "unknown"sv;
+    }
+
+    std::string_view to_string(RxTimestamps t)
+    {
+        switch (t)
+        {
+            case RxTimestamps::NONE:
+                return "no"sv;
+            case RxTimestamps::SOFTWARE:
+                return "software"sv;
+            case RxTimestamps::HARDWARE:
+                return "hardware"sv;
+        }
+        return "unknown"sv;
+    }
+}  // namespace oxen::quic
@@ -3,6 +3,8 @@ extern "C"
 {
 
 #ifdef __linux__
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 #include <netinet/udp.h>
 #endif
 
@@ -18,10 +20,14 @@ extern "C"
 #endif
 }
 
+#include <limits>
+#include <numeric>
 #include <system_error>
 
+#include "instrumentation.hpp"
 #include "internal.hpp"
 #include "udp.hpp"
+#include "uring.hpp"
 
 #ifdef _WIN32
 
@@ -41,6 +47,10 @@ extern "C"
 
 #endif
 
+#if defined(OXEN_LIBQUIC_RECVMMSG) && defined(UDP_GRO)
+#define OXEN_LIBQUIC_UDP_GRO
+#endif
+
 namespace oxen::quic
 {
 
@@ -121,13 +131,80 @@ namespace oxen::quic
     }
 #endif
 
-    UDPSocket::UDPSocket(event_base* ev_loop, const Address& addr, receive_callback_t on_receive) :
-            ev_{ev_loop}, receive_callback_{std::move(on_receive)}
+    union alignas(cmsghdr) recv_cmsg_data
     {
-        assert(ev_);
+        char ecn[CMSG_SPACE(sizeof(int))];  // a char most places but an int on windows because yay
+        char pktinfo4[CMSG_SPACE(sizeof(in_pktinfo))];
+        char pktinfo6[CMSG_SPACE(sizeof(in6_pktinfo))];
+        // Room for all of them at once (ECN + pktinfo + GRO segment size + kernel drop counter +
+        // software/legacy/hardware receive timestamps):
+        char all[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(in6_pktinfo)) + CMSG_SPACE(sizeof(int)) +
+                 CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(3 * sizeof(timespec))];
+    };
 
-        if (!receive_callback_)
-            throw std::logic_error{"UDPSocket construction requires a non-empty receive callback"};
+    namespace
+    {
+        // Adapts a per-packet receive callback to the PacketSink interface
+        struct callback_sink final : PacketSink
+        {
+            UDPSocket::receive_callback_t cb;
+
+            explicit callback_sink(UDPSocket::receive_callback_t f) : cb{std::move(f)}
+            {
+                if (!cb)
+                    throw std::logic_error{"UDPSocket construction requires a non-empty receive callback"};
+            }
+
+            void handle_packets(Packet* pkts, size_t n) override
+            {
+                for (size_t i = 0; i < n; i++)
+                    cb(std::move(pkts[i]));
+            }
+        };
+    }  // namespace
+
+    UDPSocket::UDPSocket(
+            event_base* ev_loop,
+            const Address& addr,
+            receive_callback_t on_receive,
+            bool reuseport,
+            const opt::socket_options& sockopts,
+            size_t max_payload) :
+            UDPSocket{
+                    ev_loop,
+                    addr,
+                    nullptr,
+                    std::make_unique<callback_sink>(std::move(on_receive)),
+                    reuseport,
+                    sockopts,
+                    max_payload}
+    {}
+
+    UDPSocket::UDPSocket(
+            event_base* ev_loop,
+            const Address& addr,
+            PacketSink& sink,
+            bool reuseport,
+            const opt::socket_options& sockopts,
+            size_t max_payload) :
+            UDPSocket{ev_loop, addr, &sink, nullptr, reuseport, sockopts, max_payload}
+    {}
+
+    UDPSocket::UDPSocket(
+            event_base* ev_loop,
+            const Address& addr,
+            PacketSink* sink,
+            std::unique_ptr<PacketSink> owned_sink,
+            bool reuseport,
+            const opt::socket_options& sockopts,
+            size_t max_payload) :
+            max_payload_{max_payload},
+            ev_{ev_loop},
+            sink_{sink ? sink : owned_sink.get()},
+            owned_sink_{std::move(owned_sink)}
+    {
+        assert(ev_);
+        assert(sink_);
 
         const int sockopt_proto = addr.is_ipv6() ? IPPROTO_IPV6 : IPPROTO_IP;
         const unsigned int sockopt_on = 1;
@@ -174,31 +251,104 @@ namespace oxen::quic
                     &sockopt_on,
                     sizeof(sockopt_on)));
 
+        if (reuseport)
+        {
+#ifdef SO_REUSEPORT
+            check_rv(setsockopt(sock_, SOL_SOCKET, SO_REUSEPORT, &sockopt_on, sizeof(sockopt_on)));
+#else
+            throw std::runtime_error{"SO_REUSEPORT is not supported on this platform"};
+#endif
+        }
+
+        apply_socket_options(sockopts);
+
         // Bind!
         check_rv(bind(sock_, addr, addr.socklen()));
         check_rv(getsockname(sock_, bound_, bound_.socklen_ptr()));
 
-        // Make the socket non-blocking:
+        select_send_backend();
+
+#ifdef OXEN_LIBQUIC_UDP_GRO
+        // Enable UDP GRO, if the kernel supports it.  This is purely an optimization (and requires
+        // Linux 5.0+) so failure isn't fatal.
+        if (setsockopt(sock_, SOL_UDP, UDP_GRO, &sockopt_on, sizeof(sockopt_on)) == 0)
+            gro_ = true;
+        else
+            log::debug(log_cat, "UDP GRO not available: {}", strerror(errno));
+#endif
+
+        // Receive buffers never go below the default max payload, even when we send smaller
+        // packets, so that a peer that hasn't learned our (smaller) limit yet doesn't get its
+        // packets truncated
+        const size_t recv_payload = gro_ ? MAX_GRO_PAYLOAD : std::max(MAX_PMTUD_UDP_PAYLOAD, max_payload_);
+
+#ifdef OXEN_LIBQUIC_IO_URING
+        try
+        {
+            uring_ = std::make_unique<UringIO>(
+                    ev_,
+                    sock_,
+                    gro_ ? GRO_BATCH_SIZE * 4 : DATAGRAM_BATCH_SIZE * 8,
+                    recv_payload,
+                    sizeof(recv_cmsg_data),
+                    send_backend_ == SendBackend::GSO ? std::min(max_payload_ * MAX_BATCH, MAX_GSO_PAYLOAD) : max_payload_,
+                    [this](bstring_view payload, msghdr& hdr) { process_packet(payload, hdr, {}); },
+                    [this] { deliver_batch(); },
+                    [this] {
+                        if (!writeable_callbacks_.empty())
+                            event_active(wev_.get(), EV_WRITE, 0);
+                    });
+            log::debug(log_cat, "UDP socket on {} using io_uring", bound_);
+        }
+        catch (const std::exception& e)
+        {
+            log::info(log_cat, "io_uring unavailable ({}); using readiness-based socket I/O", e.what());
+        }
+#endif
+
+        if (!uring_)
+        {
+#ifdef OXEN_LIBQUIC_RECVMMSG
+            const size_t n_bufs = gro_ ? GRO_BATCH_SIZE : DATAGRAM_BATCH_SIZE;
+#else
+            const size_t n_bufs = 1;
+#endif
+            recv_pool_.emplace(recv_payload, n_bufs);
+            recv_batch_.reserve(gro_ ? MAX_RECEIVE_PER_LOOP : n_bufs);
+            for (size_t i = 0; i < n_bufs; i++)
+                recv_bufs_[i] = recv_pool_->acquire();
+        }
+
+        // Make the socket non-blocking (unless io_uring is driving it: io_uring does its own
+        // non-blocking attempts and internal polling, but with O_NONBLOCK set it would instead
+        // fail sends on a full socket buffer rather than queueing them):
+        if (!uring_)
+        {
 #ifdef _WIN32
-        u_long mode = 1;
-        ioctlsocket(sock_, FIONBIO, &mode);
+            u_long mode = 1;
+            ioctlsocket(sock_, FIONBIO, &mode);
 #else
-        check_rv(fcntl(sock_, F_SETFL, O_NONBLOCK));
+            check_rv(fcntl(sock_, F_SETFL, O_NONBLOCK));
 #endif
 
-        rev_.reset(event_new(
-                ev_,
-                sock_,
-                EV_READ | EV_PERSIST,
-                [](evutil_socket_t, short, void* self) { static_cast<UDPSocket*>(self)->receive(); },
-                this));
-        event_add(rev_.get(), nullptr);
+            rev_.reset(event_new(
+                    ev_,
+                    sock_,
+                    EV_READ | EV_PERSIST,
+                    [](evutil_socket_t, short, void* self) {
+                        scoped_dispatch timing;
+                        static_cast<UDPSocket*>(self)->receive();
+                    },
+                    this));
+            event_add(rev_.get(), nullptr);
+        }
 
         wev_.reset(event_new(
                 ev_,
                 sock_,
                 EV_WRITE,
                 [](evutil_socket_t, short, void* self_) {
+                    scoped_dispatch timing;
                     auto* self = static_cast<UDPSocket*>(self_);
                     auto callbacks = std::move(self->writeable_callbacks_);
                     for (const auto& f : callbacks)
@@ -208,8 +358,141 @@ namespace oxen::quic
         // Don't event_add wev_ now: we only activate wev_ when something asks to be tied to writeability
     }
 
+    namespace
+    {
+        // Sets the size of one of the socket buffers; `force_opt`, if non-zero, is the variant that
+        // ignores the system maximum, which we try first (it needs CAP_NET_ADMIN).
+        void set_socket_buffer(
+                UDPSocket::socket_t sock, int opt, [[maybe_unused]] int force_opt, size_t size, std::string_view which)
+        {
+            const int val = static_cast<int>(std::min<size_t>(size, std::numeric_limits<int>::max()));
+            bool forced = false;
+#ifndef _WIN32
+            if (force_opt)
+                forced = setsockopt(sock, SOL_SOCKET, force_opt, &val, sizeof(val)) == 0;
+#endif
+            if (!forced && setsockopt(sock, SOL_SOCKET, opt, reinterpret_cast<const char*>(&val), sizeof(val)) != 0)
+            {
+                log::warning(log_cat, "Failed to set UDP socket {} buffer size to {}B: {}", which, size, strerror(errno));
+                return;
+            }
+
+            int actual = 0;
+            socklen_t len = sizeof(actual);
+            getsockopt(sock, SOL_SOCKET, opt, reinterpret_cast<char*>(&actual), &len);
+#ifdef __linux__
+            // Linux doubles the value (to leave room for its bookkeeping overhead), and reports that
+            actual /= 2;
+#endif
+            if (static_cast<size_t>(actual) < size)
+                log::warning(
+                        log_cat,
+                        "UDP socket {} buffer is only {}B (requested {}B): the system maximum is lower, and we can't "
+                        "override it without CAP_NET_ADMIN",
+                        which,
+                        actual,
+                        size);
+            else
+                log::debug(log_cat, "UDP socket {} buffer set to {}B{}", which, actual, forced ? " (forced)" : "");
+        }
+    }  // namespace
+
+    void UDPSocket::apply_socket_options(const opt::socket_options& sockopts)
+    {
+        if (sockopts.receive_buffer)
+            set_socket_buffer(
+                    sock_,
+                    SO_RCVBUF,
+#ifdef SO_RCVBUFFORCE
+                    SO_RCVBUFFORCE,
+#else
+                    0,
+#endif
+                    sockopts.receive_buffer,
+                    "receive");
+        if (sockopts.send_buffer)
+            set_socket_buffer(
+                    sock_,
+                    SO_SNDBUF,
+#ifdef SO_SNDBUFFORCE
+                    SO_SNDBUFFORCE,
+#else
+                    0,
+#endif
+                    sockopts.send_buffer,
+                    "send");
+
+        if (sockopts.busy_poll.count() > 0)
+        {
+#ifdef SO_BUSY_POLL
+            const int us = static_cast<int>(std::min<int64_t>(sockopts.busy_poll.count(), std::numeric_limits<int>::max()));
+            if (setsockopt(sock_, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0)
+                log::warning(log_cat, "Failed to enable UDP socket busy polling ({}us): {}", us, strerror(errno));
+#else
+            log::warning(log_cat, "UDP socket busy polling is not supported on this platform");
+#endif
+        }
+
+#ifdef SO_RXQ_OVFL
+        // Have the kernel tell us how many packets it has dropped for want of receive buffer space
+        const int sockopt_on = 1;
+        rxq_ovfl_ = setsockopt(sock_, SOL_SOCKET, SO_RXQ_OVFL, &sockopt_on, sizeof(sockopt_on)) == 0;
+#endif
+
+        if (sockopts.rx_timestamps != RxTimestamps::NONE)
+        {
+#ifdef SO_TIMESTAMPING
+            // We always ask for software timestamps too, for packets the NIC doesn't timestamp
+            int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+            if (sockopts.rx_timestamps == RxTimestamps::HARDWARE)
+                flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+            if (setsockopt(sock_, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+                log::warning(
+                        log_cat,
+                        "Failed to enable {} UDP receive timestamps: {}",
+                        to_string(sockopts.rx_timestamps),
+                        strerror(errno));
+            else
+            {
+                rx_timestamps_ = true;
+                log::debug(log_cat, "Enabled {} receive timestamps on UDP socket", to_string(sockopts.rx_timestamps));
+            }
+#else
+            log::warning(log_cat, "UDP receive timestamps are not supported on this platform");
+#endif
+        }
+    }
+
+    void UDPSocket::attach_reuseport_steering([[maybe_unused]] size_t group_size)
+    {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+        assert(group_size >= 1 && group_size <= 256);
+
+        // The program sees the UDP payload (i.e. the QUIC packet) at offset 0.  Short header
+        // packets have the DCID immediately after the first byte; long header packets (first bit
+        // set) have 4 version bytes and a 1 byte DCID length before it.  The return value is the
+        // index of the socket in the reuseport group.
+        std::array<sock_filter, 7> code{{
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+                BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 2),
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+                BPF_STMT(BPF_JMP | BPF_JA, 1),
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),
+                BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(group_size)),
+                BPF_STMT(BPF_RET | BPF_A, 0),
+        }};
+        sock_fprog prog{static_cast<unsigned short>(code.size()), code.data()};
+
+        check_rv(setsockopt(sock_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)));
+        log::debug(log_cat, "Attached CID steering program for {}-socket reuseport group on {}", group_size, bound_);
+#else
+        throw std::runtime_error{"SO_REUSEPORT CID steering is not supported on this platform"};
+#endif
+    }
+
     UDPSocket::~UDPSocket()
     {
+        uring_.reset();
 #ifdef _WIN32
         ::closesocket(sock_);
 #else
@@ -217,14 +500,14 @@ namespace oxen::quic
 #endif
     }
 
-    void UDPSocket::process_packet(bstring_view payload, msghdr& hdr)
+    size_t UDPSocket::process_packet(bstring_view payload, msghdr& hdr, const pooled_buffer& owner)
     {
         if (payload.empty())
         {
             // This is unexpected, and not something a proper libquic client would ever send so
             // just drop it.
             log::warning(log_cat, "Dropping empty UDP packet");
-            return;
+            return 0;
         }
 
         // This flag means the packet payload couldn't fit in max_payload_size, but that should
@@ -238,18 +521,88 @@ namespace oxen::quic
         )
         {
             log::warning(log_cat, "Dropping truncated UDP packet");
-            return;
+            return 0;
+        }
+
+        size_t segment_size = payload.size();
+        if (gro_ || rxq_ovfl_)
+        {
+            for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+            {
+#ifdef OXEN_LIBQUIC_UDP_GRO
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                {
+                    int gso_size;
+                    std::memcpy(&gso_size, QUIC_CMSG_DATA(cmsg), sizeof(int));
+                    if (gso_size > 0)
+                        segment_size = static_cast<size_t>(gso_size);
+                }
+#endif
+#ifdef SO_RXQ_OVFL
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                {
+                    // The total dropped since the socket was opened, as of this packet's arrival
+                    uint32_t dropped;
+                    std::memcpy(&dropped, QUIC_CMSG_DATA(cmsg), sizeof(dropped));
+                    counters_.receive_dropped += static_cast<uint32_t>(dropped - last_rxq_drops_);
+                    last_rxq_drops_ = dropped;
+                }
+#endif
+            }
+        }
+
+        if (segment_size >= payload.size())
+        {
+            auto& pkt = recv_batch_.emplace_back(bound_, payload, hdr);
+            pkt.buffer = owner;
+            if (rx_timestamps_ && pkt.received.count())
+                counters_.receive_delay_us.add(static_cast<uint64_t>((get_timestamp() - pkt.received).count() / 1000));
+            return 1;
         }
 
-        receive_callback_(Packet{bound_, payload, hdr});
+        // GRO super-buffer: this is a sequence of datagrams from the same sender that were all
+        // exactly `segment_size` bytes long, except for the last which may be shorter.  They also
+        // share a path and ECN value, so we only need to parse the header once.
+        auto& first = recv_batch_.emplace_back(bound_, payload.substr(0, segment_size), hdr);
+        first.buffer = owner;
+        Path path = first.path;
+        auto pkt_info = first.pkt_info;
+        auto received = first.received;
+
+        size_t n = 1;
+        for (size_t pos = segment_size; pos < payload.size(); pos += segment_size, n++)
+        {
+            auto& pkt = recv_batch_.emplace_back(path, payload.substr(pos, segment_size));
+            pkt.pkt_info = pkt_info;
+            pkt.received = received;
+            pkt.buffer = owner;
+        }
+
+        // The kernel stamps the whole coalesced buffer with the arrival time of its first packet
+        if (rx_timestamps_ && received.count())
+        {
+            auto delay_us = static_cast<uint64_t>((get_timestamp() - received).count() / 1000);
+            for (size_t i = 0; i < n; i++)
+                counters_.receive_delay_us.add(delay_us);
+        }
+
+        QUIC_HOT_TRACE(log_cat, "Split {}B GRO buffer into {} packets", payload.size(), n);
+        return n;
     }
 
-    union alignas(cmsghdr) recv_cmsg_data
+    void UDPSocket::deliver_batch()
     {
-        char ecn[CMSG_SPACE(sizeof(int))];  // a char most places but an int on windows because yay
-        char pktinfo4[CMSG_SPACE(sizeof(in_pktinfo))];
-        char pktinfo6[CMSG_SPACE(sizeof(in6_pktinfo))];
-    };
+        if (recv_batch_.empty())
+            return;
+
+        counters_.packets_received += recv_batch_.size();
+        for (auto& pkt : recv_batch_)
+            counters_.bytes_received += pkt.data.size();
+        stats_.store(counters_);
+
+        sink_->handle_packets(recv_batch_.data(), recv_batch_.size());
+        recv_batch_.clear();
+    }
 
     io_result UDPSocket::receive()
     {
@@ -259,12 +612,13 @@ namespace oxen::quic
         std::array<mmsghdr, DATAGRAM_BATCH_SIZE> msgs = {};
         std::array<recv_cmsg_data, DATAGRAM_BATCH_SIZE> cmsgs = {};
 
-        std::array<std::array<std::byte, MAX_PMTUD_UDP_PAYLOAD>, DATAGRAM_BATCH_SIZE> data;
+        // With GRO we use fewer but much larger buffers, since each one can hold many packets
+        const size_t n_bufs = gro_ ? GRO_BATCH_SIZE : DATAGRAM_BATCH_SIZE;
+        const size_t buf_size = recv_pool_->buffer_size();
 
-        for (size_t i = 0; i < DATAGRAM_BATCH_SIZE; i++)
+        for (size_t i = 0; i < n_bufs; i++)
         {
-            iovs[i].iov_base = data[i].data();
-            iovs[i].iov_len = data[i].size();
+            iovs[i].iov_len = buf_size;
             auto& h = msgs[i].msg_hdr;
             h.msg_iov = &iovs[i];
             h.msg_iovlen = 1;
@@ -277,10 +631,19 @@ namespace oxen::quic
         size_t count = 0;
         do
         {
+            // recvmmsg overwrites these with the actual sizes, so reset them for each batch (in
+            // particular we need the full control buffer to get the GRO segment size).
+            for (size_t i = 0; i < n_bufs; i++)
+            {
+                iovs[i].iov_base = recv_bufs_[i].data();
+                msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+                msgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i]);
+            }
+
             int nread;
             do
             {
-                nread = recvmmsg(sock_, msgs.data(), msgs.size(), 0, nullptr);
+                nread = recvmmsg(sock_, msgs.data(), n_bufs, 0, nullptr);
             } while (nread == -1 && errno == EINTR);
 
             if (nread == 0)  // No packets available to read
@@ -294,11 +657,20 @@ namespace oxen::quic
             }
 
             for (int i = 0; i < nread; i++)
-                process_packet(bstring_view{data[i].data(), msgs[i].msg_len}, msgs[i].msg_hdr);
+            {
+                auto& buf = recv_bufs_[i];
+                buf.resize(msgs[i].msg_len);
+                count += process_packet(buf.view(), msgs[i].msg_hdr, buf);
+            }
 
-            count += nread;
+            deliver_batch();
 
-            if (nread < static_cast<int>(DATAGRAM_BATCH_SIZE))
+            // If something downstream held onto a buffer we can't read into it again
+            for (int i = 0; i < nread; i++)
+                if (recv_bufs_[i].use_count() > 1)
+                    recv_bufs_[i] = recv_pool_->acquire();
+
+            if (nread < static_cast<int>(n_bufs))
                 // We didn't fill the recvmmsg array so must be done
                 return io_result{};
 
@@ -309,15 +681,14 @@ namespace oxen::quic
 #else  // no recvmmsg
 
         sockaddr_storage peer{};
-        std::array<std::byte, MAX_PMTUD_UDP_PAYLOAD> data;
+        auto& buf = recv_bufs_[0];
 
         recv_cmsg_data cmsg{};
 
 #ifdef _WIN32
         // Microsoft renames everything but uses the same structure just to be obtuse:
         WSABUF iov;
-        iov.buf = reinterpret_cast<char*>(data.data());
-        iov.len = data.size();
+        iov.len = buf.capacity();
         WSAMSG hdr{};
         hdr.lpBuffers = &iov;
         hdr.dwBufferCount = 1;
@@ -327,8 +698,7 @@ namespace oxen::quic
         hdr.Control.len = sizeof(cmsg);
 #else
         iovec iov;
-        iov.iov_base = data.data();
-        iov.iov_len = data.size();
+        iov.iov_len = buf.capacity();
         msghdr hdr{};
         hdr.msg_iov = &iov;
         hdr.msg_iovlen = 1;
@@ -342,6 +712,7 @@ namespace oxen::quic
         do
         {
 #ifdef _WIN32
+            iov.buf = reinterpret_cast<char*>(buf.data());
             DWORD nbytes;
             auto rv = WSARecvMsg(sock_, &hdr, &nbytes, nullptr, nullptr);
             if (rv == SOCKET_ERROR)
@@ -352,6 +723,7 @@ namespace oxen::quic
                 return io_result::wsa(error);
             }
 #else
+            iov.iov_base = buf.data();
             int nbytes;
             do
             {
@@ -366,7 +738,12 @@ namespace oxen::quic
             }
 #endif
 
-            process_packet(bstring_view{data.data(), static_cast<size_t>(nbytes)}, hdr);
+            buf.resize(static_cast<size_t>(nbytes));
+            process_packet(buf.view(), hdr, buf);
+            deliver_batch();
+
+            if (buf.use_count() > 1)
+                buf = recv_pool_->acquire();
 
             count++;
 
@@ -404,7 +781,10 @@ namespace oxen::quic
 
     // We support different compilation modes for trying different methods of UDP sending by setting
     // these defines; these shouldn't be set directly but rather through the cmake -DLIBQUIC_SEND
-    // option.  At most one of these may be defined.
+    // option.  At most one of these may be defined.  The define selects the *best* method that
+    // gets compiled in; the actual method used by each socket is then selected at runtime (see
+    // UDPSocket::send_backend()), falling back to lesser methods if the better ones aren't
+    // supported by the running kernel.
     //
     // OXEN_LIBQUIC_UDP_GSO -- use sendmmsg and GSO to batch-send packets.  Only works on
     // Linux.  Will fall back to SENDMMSG if the required UDP_SEGMENT is not defined (i.e. on older
@@ -426,196 +806,355 @@ namespace oxen::quic
 #define OXEN_LIBQUIC_UDP_SENDMMSG
 #endif
 
-    std::pair<io_result, size_t> UDPSocket::send(
-            const Path& path, const std::byte* buf, const size_t* bufsize, uint8_t ecn, size_t n_pkts)
-    {
-        auto* next_buf = const_cast<char*>(reinterpret_cast<const char*>(buf));
-        int rv = 0;
-        size_t sent = 0;
-        sockaddr* dest_sa = const_cast<Address&>(path.remote);
-
-        const bool set_source_addr = bound_.is_any_addr() && !path.local.is_any_addr();
-        const bool source_ipv4 = path.local.is_ipv4();
-        union
-        {
-            in_pktinfo v4;
-            in6_pktinfo v6;
-        } source_addr;
-        const size_t source_addrlen = source_ipv4 ? sizeof(in_pktinfo) : sizeof(in6_pktinfo);
-        const int source_cmsg_level = source_ipv4 ? IPPROTO_IP : IPPROTO_IPV6;
-        const int source_cmsg_type = source_ipv4 ? IP_PKTINFO : IPV6_PKTINFO;
-        if (set_source_addr)
-        {
-            std::memset(&source_addr, 0, sizeof(source_addr));
-            if (source_ipv4)
-#ifdef _WIN32
-                source_addr.v4.ipi_addr
-#else
-                source_addr.v4.ipi_spec_dst
+#if defined(OXEN_LIBQUIC_UDP_GSO) || defined(OXEN_LIBQUIC_UDP_SENDMMSG)
+#define OXEN_LIBQUIC_HAVE_SENDMMSG
 #endif
-                        = path.local.in4().sin_addr;
-            else
-                source_addr.v6.ipi6_addr = path.local.in6().sin6_addr;
-        }
 
+    void UDPSocket::select_send_backend()
+    {
+        SendBackend b = SendBackend::SENDMSG;
+#ifdef OXEN_LIBQUIC_HAVE_SENDMMSG
+        b = SendBackend::SENDMMSG;
+#endif
 #ifdef OXEN_LIBQUIC_UDP_GSO
+        // UDP_SEGMENT was added in Linux 4.18; older kernels reject the getsockopt with
+        // ENOPROTOOPT.  (Whether the NIC can actually do it is another matter, which we only find
+        // out when a GSO send fails with EIO).
+        int segment = 0;
+        socklen_t seglen = sizeof(segment);
+        if (getsockopt(sock_, SOL_UDP, UDP_SEGMENT, &segment, &seglen) == 0)
+            b = SendBackend::GSO;
+        else
+            log::debug(log_cat, "UDP_SEGMENT not supported by kernel ({}): not using GSO", strerror(errno));
+#endif
+        send_backend_ = b;
+        log::debug(log_cat, "UDP socket on {} using {} send backend", bound_, to_string(b));
+    }
 
-        // With GSO, we use *one* sendmmsg call which can contain multiple batches of packets; each
-        // batch is of size n, where each of the n have the same size.
-        //
-        // We could have up to the full MAX_BATCH, with the worst case being every packet being a
-        // different size than the one before it.
-        alignas(cmsghdr) std::array<
-                std::array<char, CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(in6_pktinfo))>,
-                DATAGRAM_BATCH_SIZE>
-                controls{};
-        std::array<uint16_t, MAX_BATCH> gso_sizes{};   // Size of each of the packets
-        std::array<uint16_t, MAX_BATCH> gso_counts{};  // Number of packets
-
-        std::array<mmsghdr, MAX_BATCH> msgs{};
-        std::array<iovec, MAX_BATCH> iovs{};
-
-        unsigned int msg_count = 0;
-        for (size_t i = 0; i < n_pkts; i++)
+    namespace
+    {
+        // Space for the control messages we might attach to a sent message: ECN, the source
+        // address and the GSO segment size.
+        using send_control_buf = std::array<
+                char,
+                CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(in6_pktinfo))>;
+
+        // Sets the destination of `hdr` to the remote address of `path` and fills its control
+        // messages: the ECN value, the source address (if `set_source`, i.e. when the socket is
+        // bound to an any address) and, if non-zero, the GSO segment size.
+        template <typename Hdr>
+        void prepare_send_hdr(
+                Hdr& hdr,
+                send_control_buf& control,
+                const Path& path,
+                uint8_t ecn,
+                bool set_source,
+                [[maybe_unused]] uint16_t gso_size = 0)
         {
-            auto& gso_size = gso_sizes[msg_count];
-            auto& gso_count = gso_counts[msg_count];
-            gso_count++;
-            if (gso_size == 0)
-                gso_size = bufsize[i];  // new batch
-
-            if (i < n_pkts - 1 && bufsize[i + 1] == gso_size)
-                continue;  // The next one can be batched with us
-
-            auto& iov = iovs[msg_count];
-            auto& msg = msgs[msg_count];
-            auto& control = controls[msg_count];
-            iov.iov_base = next_buf;
-            iov.iov_len = gso_count * gso_size;
-            next_buf += iov.iov_len;
-            msg_count++;
-            auto& hdr = msg.msg_hdr;
-            hdr.msg_iov = &iov;
-            hdr.msg_iovlen = 1;
+            const bool ipv4 = path.local.is_ipv4();
+            auto* dest_sa = static_cast<sockaddr*>(const_cast<Address&>(path.remote));
+#ifdef _WIN32
+            hdr.name = dest_sa;
+            hdr.namelen = path.remote.socklen();
+            hdr.Control.buf = control.data();
+            auto& controllen = hdr.Control.len;
+#else
             hdr.msg_name = dest_sa;
             hdr.msg_namelen = path.remote.socklen();
             hdr.msg_control = control.data();
-            hdr.msg_controllen = control.size();
+            auto& controllen = hdr.msg_controllen;
+#endif
+            controllen = control.size();
 
             auto* cm = CMSG_FIRSTHDR(&hdr);
-            size_t actual_size = set_ecn_cmsg(cm, ecn, source_ipv4);
+            size_t actual_size = set_ecn_cmsg(cm, ecn, ipv4);
 
-            if (set_source_addr)
+            if (set_source)
             {
                 cm = CMSG_NXTHDR(&hdr, cm);
-                cm->cmsg_level = source_cmsg_level;
-                cm->cmsg_type = source_cmsg_type;
-                cm->cmsg_len = CMSG_LEN(source_addrlen);
-                std::memcpy(CMSG_DATA(cm), &source_addr, source_addrlen);
-                actual_size += CMSG_SPACE(source_addrlen);
+                if (ipv4)
+                {
+                    in_pktinfo info{};
+#ifdef _WIN32
+                    info.ipi_addr
+#else
+                    info.ipi_spec_dst
+#endif
+                            = path.local.in4().sin_addr;
+                    cm->cmsg_level = IPPROTO_IP;
+                    cm->cmsg_type = IP_PKTINFO;
+                    cm->cmsg_len = CMSG_LEN(sizeof(info));
+                    std::memcpy(QUIC_CMSG_DATA(cm), &info, sizeof(info));
+                    actual_size += CMSG_SPACE(sizeof(info));
+                }
+                else
+                {
+                    in6_pktinfo info{};
+                    info.ipi6_addr = path.local.in6().sin6_addr;
+                    cm->cmsg_level = IPPROTO_IPV6;
+                    cm->cmsg_type = IPV6_PKTINFO;
+                    cm->cmsg_len = CMSG_LEN(sizeof(info));
+                    std::memcpy(QUIC_CMSG_DATA(cm), &info, sizeof(info));
+                    actual_size += CMSG_SPACE(sizeof(info));
+                }
             }
 
-            if (gso_count > 1)
+#ifdef OXEN_LIBQUIC_UDP_GSO
+            if (gso_size)
             {
                 cm = CMSG_NXTHDR(&hdr, cm);
                 cm->cmsg_level = SOL_UDP;
                 cm->cmsg_type = UDP_SEGMENT;
                 cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
                 actual_size += CMSG_SPACE(sizeof(uint16_t));
-                *reinterpret_cast<uint16_t*>(QUIC_CMSG_DATA(cm)) = gso_size;
+                std::memcpy(QUIC_CMSG_DATA(cm), &gso_size, sizeof(gso_size));
             }
-            hdr.msg_controllen = actual_size;
+#endif
+            controllen = actual_size;
         }
+    }  // namespace
 
-        do
+    std::pair<io_result, size_t> UDPSocket::send(
+            const Path& path, const std::byte* buf, const size_t* bufsize, uint8_t ecn, size_t n_pkts)
+    {
+        const send_run run{&path, ecn, n_pkts};
+        return send(&run, 1, buf, bufsize);
+    }
+
+    std::pair<io_result, size_t> UDPSocket::send(
+            const send_run* runs, size_t n_runs, const std::byte* buf, const size_t* bufsize)
+    {
+        auto [rv, sent] = send_impl(runs, n_runs, buf, bufsize);
+
+        size_t n_pkts = 0;
+        for (size_t r = 0; r < n_runs; r++)
+            n_pkts += runs[r].n_pkts;
+        counters_.packets_sent += sent;
+        counters_.bytes_sent += std::accumulate(bufsize, bufsize + sent, uint64_t{0});
+        if (sent > 0 && sent < n_pkts)
+            counters_.short_writes++;
+        if (rv.blocked())
+            counters_.send_blocked++;
+        stats_.store(counters_);
+
+        return {rv, sent};
+    }
+
+    std::pair<io_result, size_t> UDPSocket::send_impl(
+            const send_run* runs, size_t n_runs, const std::byte* buf, const size_t* bufsize)
+    {
+        auto* next_buf = const_cast<char*>(reinterpret_cast<const char*>(buf));
+        int rv = 0;
+        size_t sent = 0;
+
+        // The run that each packet belongs to
+        std::array<const send_run*, DATAGRAM_BATCH_SIZE> pkt_run;
+        size_t n_pkts = 0;
+        for (size_t r = 0; r < n_runs; r++)
+            for (size_t i = 0; i < runs[r].n_pkts; i++)
+            {
+                assert(n_pkts < pkt_run.size());
+                pkt_run[n_pkts++] = &runs[r];
+            }
+        assert(n_pkts > 0);
+
+        const bool bound_any = bound_.is_any_addr();
+        auto set_source = [&](const send_run& run) { return bound_any && !run.path->local.is_any_addr(); };
+
+#ifdef OXEN_LIBQUIC_IO_URING
+        if (uring_)
         {
-            rv = sendmmsg(sock_, msgs.data(), msg_count, 0);
-            log::trace(log_cat, "sendmmsg returned {}", rv);
-        } while (rv == -1 && errno == EINTR);
-
-        // Figure out number of packets we actually sent:
-        // rv is the number of `msgs` elements that were updated; within each, the `.msg_len` field
-        // has been updated to the number of bytes that were sent (which we need to use to figure
-        // out how many actual batched packets went out from our batch-of-batches).
-#ifndef NDEBUG
-        bool found_unsent = false;
+#ifdef OXEN_LIBQUIC_UDP_GSO
+            if (uring_->take_gso_failure() && send_backend_ == SendBackend::GSO)
+            {
+                log::warning(log_cat, "GSO send on {} failed; falling back to sending without GSO", bound_);
+                send_backend_ = SendBackend::SENDMMSG;
+            }
+            const bool gso = send_backend_ == SendBackend::GSO;
+#else
+            constexpr bool gso = false;
+#endif
+
+            // The ring copies each message into its own send buffers, so we can build each one in
+            // the same space here.
+            alignas(cmsghdr) send_control_buf control{};
+            iovec iov;
+            msghdr hdr{};
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+
+            for (size_t i = 0; i < n_pkts;)
+            {
+                assert(bufsize[i] > 0);
+                auto& run = *pkt_run[i];
+
+                // With GSO we send each run of equal-sized packets to the same path as one message
+                size_t count = 1;
+                if (gso)
+                    while (i + count < n_pkts && pkt_run[i + count] == &run && bufsize[i + count] == bufsize[i] &&
+                           (count + 1) * bufsize[i] <= MAX_GSO_PAYLOAD)
+                        count++;
+
+                iov.iov_base = next_buf;
+                iov.iov_len = count * bufsize[i];
+                prepare_send_hdr(
+                        hdr, control, *run.path, run.ecn, set_source(run), count > 1 ? static_cast<uint16_t>(bufsize[i]) : 0);
+
+                if (!uring_->queue_send(hdr))
+                    break;
+
+                next_buf += iov.iov_len;
+                sent += count;
+                i += count;
+            }
+
+            uring_->flush();
+
+            // Sends complete asynchronously, and failures after this point are just packet loss;
+            // the only thing we can report here is running out of send slots.
+            return {io_result{sent < n_pkts ? EAGAIN : 0}, sent};
+        }
 #endif
-        if (rv >= 0)
+
+#ifdef OXEN_LIBQUIC_UDP_GSO
+        if (send_backend_ == SendBackend::GSO)
         {
-            for (unsigned int i = 0; i < msg_count; i++)
+            // With GSO, we use *one* sendmmsg call which can contain multiple batches of packets; each
+            // batch is of size n, where each of the n have the same size and path.
+            //
+            // We could have up to the full MAX_BATCH, with the worst case being every packet being a
+            // different size (or going somewhere different) than the one before it.
+            alignas(cmsghdr) std::array<send_control_buf, MAX_BATCH> controls{};
+            std::array<uint16_t, MAX_BATCH> gso_sizes{};   // Size of each of the packets
+            std::array<uint16_t, MAX_BATCH> gso_counts{};  // Number of packets
+
+            std::array<mmsghdr, MAX_BATCH> msgs{};
+            std::array<iovec, MAX_BATCH> iovs{};
+
+            unsigned int msg_count = 0;
+            bool used_segment = false;
+            for (size_t i = 0; i < n_pkts; i++)
+            {
+                auto& gso_size = gso_sizes[msg_count];
+                auto& gso_count = gso_counts[msg_count];
+                gso_count++;
+                if (gso_size == 0)
+                    gso_size = bufsize[i];  // new batch
+
+                if (i < n_pkts - 1 && bufsize[i + 1] == gso_size && pkt_run[i + 1] == pkt_run[i] &&
+                    (gso_count + 1u) * gso_size <= MAX_GSO_PAYLOAD)
+                    continue;  // The next one can be batched with us
+
+                auto& iov = iovs[msg_count];
+                auto& msg = msgs[msg_count];
+                auto& run = *pkt_run[i];
+                iov.iov_base = next_buf;
+                iov.iov_len = gso_count * gso_size;
+                next_buf += iov.iov_len;
+                auto& hdr = msg.msg_hdr;
+                hdr.msg_iov = &iov;
+                hdr.msg_iovlen = 1;
+                if (gso_count > 1)
+                    used_segment = true;
+                prepare_send_hdr(
+                        hdr, controls[msg_count], *run.path, run.ecn, set_source(run), gso_count > 1 ? gso_size : 0);
+                msg_count++;
+            }
+
+            do
+            {
+                rv = sendmmsg(sock_, msgs.data(), msg_count, 0);
+                QUIC_HOT_TRACE(log_cat, "sendmmsg returned {}", rv);
+            } while (rv == -1 && errno == EINTR);
+
+            // Figure out number of packets we actually sent:
+            // rv is the number of `msgs` elements that were updated; within each, the `.msg_len`
+            // field has been updated to the number of bytes that were sent (which we need to use to
+            // figure out how many actual batched packets went out from our batch-of-batches).
+#ifndef NDEBUG
+            bool found_unsent = false;
+#endif
+            if (rv >= 0)
             {
-                if (msgs[i].msg_len < iovs[i].iov_len)
+                for (unsigned int i = 0; i < msg_count; i++)
                 {
+                    if (msgs[i].msg_len < iovs[i].iov_len)
+                    {
 #ifndef NDEBUG
-                    // Once we encounter some unsent we expect to miss everything after that (i.e. we
-                    // are expecting that contiguous packets 0 through X are accepted and X+1 through
-                    // the end were not): so if this batch was partially sent then we shouldn't have
-                    // been any partial sends before it.
-                    assert(!found_unsent || msgs[i].msg_len == 0);
-                    found_unsent = true;
+                        // Once we encounter some unsent we expect to miss everything after that
+                        // (i.e. we are expecting that contiguous packets 0 through X are accepted
+                        // and X+1 through the end were not): so if this batch was partially sent
+                        // then we shouldn't have been any partial sends before it.
+                        assert(!found_unsent || msgs[i].msg_len == 0);
+                        found_unsent = true;
 #endif
 
-                    // Partial packets consumed should be impossible:
-                    assert(msgs[i].msg_len % gso_sizes[i] == 0);
-                    sent += msgs[i].msg_len / gso_sizes[i];
-                }
-                else
-                {
-                    assert(!found_unsent);
-                    sent += gso_counts[i];
+                        // Partial packets consumed should be impossible:
+                        assert(msgs[i].msg_len % gso_sizes[i] == 0);
+                        sent += msgs[i].msg_len / gso_sizes[i];
+                    }
+                    else
+                    {
+                        assert(!found_unsent);
+                        sent += gso_counts[i];
+                    }
                 }
             }
-        }
-
-#elif defined(OXEN_LIBQUIC_UDP_SENDMMSG)  // sendmmsg, but not GSO
 
-        std::array<mmsghdr, MAX_BATCH> msgs{};
-        std::array<iovec, MAX_BATCH> iovs{};
-
-        alignas(cmsghdr) std::array<std::array<char, CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(in6_pktinfo))>, MAX_BATCH>
-                controls{};
+            // A GSO send can fail with EIO (if the NIC doesn't support checksum offload) or EINVAL
+            // (if GSO is otherwise unusable on this path) even though the kernel accepted
+            // UDP_SEGMENT; when that happens we permanently drop back to plain sendmmsg for this
+            // socket and resend the batch that way.  (If rv is -1 then nothing was sent).
+            if (rv < 0 && used_segment && (errno == EIO || errno == EINVAL))
+            {
+                log::warning(
+                        log_cat,
+                        "GSO send on {} failed ({}); falling back to sendmmsg without GSO",
+                        bound_,
+                        strerror(errno));
+                send_backend_ = SendBackend::SENDMMSG;
+                next_buf = const_cast<char*>(reinterpret_cast<const char*>(buf));
+                sent = 0;
+            }
+            else
+                return {io_result{rv < 0 ? errno : 0}, sent};
+        }
+#endif
 
-        for (size_t i = 0; i < n_pkts; i++)
+#ifdef OXEN_LIBQUIC_HAVE_SENDMMSG
+        if (send_backend_ == SendBackend::SENDMMSG)
         {
-            assert(bufsize[i] > 0);
-
-            iovs[i].iov_base = next_buf;
-            iovs[i].iov_len = bufsize[i];
-            next_buf += bufsize[i];
+            std::array<mmsghdr, MAX_BATCH> msgs{};
+            std::array<iovec, MAX_BATCH> iovs{};
+            alignas(cmsghdr) std::array<send_control_buf, MAX_BATCH> controls{};
 
-            auto& hdr = msgs[i].msg_hdr;
-            hdr.msg_iov = &iovs[i];
-            hdr.msg_iovlen = 1;
-            hdr.msg_name = dest_sa;
-            hdr.msg_namelen = path.remote.socklen();
+            for (size_t i = 0; i < n_pkts; i++)
+            {
+                assert(bufsize[i] > 0);
 
-            auto& control = controls[i];
-            hdr.msg_control = control.data();
-            hdr.msg_controllen = control.size();
+                iovs[i].iov_base = next_buf;
+                iovs[i].iov_len = bufsize[i];
+                next_buf += bufsize[i];
 
-            auto* cm = CMSG_FIRSTHDR(&hdr);
-            size_t actual_size = set_ecn_cmsg(cm, ecn, source_ipv4);
+                auto& hdr = msgs[i].msg_hdr;
+                hdr.msg_iov = &iovs[i];
+                hdr.msg_iovlen = 1;
+                auto& run = *pkt_run[i];
+                prepare_send_hdr(hdr, controls[i], *run.path, run.ecn, set_source(run));
+            }
 
-            if (set_source_addr)
+            do
             {
-                cm = CMSG_NXTHDR(&hdr, cm);
-                cm->cmsg_level = source_cmsg_level;
-                cm->cmsg_type = source_cmsg_type;
-                cm->cmsg_len = CMSG_LEN(source_addrlen);
-                std::memcpy(CMSG_DATA(cm), &source_addr, source_addrlen);
-                actual_size += CMSG_SPACE(source_addrlen);
-            }
-            hdr.msg_controllen = actual_size;
-        }
+                rv = sendmmsg(sock_, msgs.data(), n_pkts, MSG_DONTWAIT);
+            } while (rv == -1 && errno == EINTR);
 
-        do
-        {
-            rv = sendmmsg(sock_, msgs.data(), n_pkts, MSG_DONTWAIT);
-        } while (rv == -1 && errno == EINTR);
+            sent = rv >= 0 ? rv : 0;
 
-        sent = rv >= 0 ? rv : 0;
+            return {io_result{rv < 0 ? errno : 0}, sent};
+        }
+#endif
 
-#else  // No sendmmsg at all, so we just use sendmsg in a loop
+        // Otherwise (no sendmmsg at all) we just use sendmsg in a loop
 
 #ifdef _WIN32
         // Microsoft renames everything but uses the same structure just to be obtuse:
@@ -623,45 +1162,24 @@ namespace oxen::quic
         WSAMSG hdr{};
         hdr.lpBuffers = &iov;
         hdr.dwBufferCount = 1;
-        hdr.name = dest_sa;
-        hdr.namelen = path.remote.socklen();
 #else
         msghdr hdr{};
         iovec iov;
         hdr.msg_iov = &iov;
         hdr.msg_iovlen = 1;
-        hdr.msg_name = dest_sa;
-        hdr.msg_namelen = path.remote.socklen();
-#endif
-
-        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(in6_pktinfo))> control{};
-#ifdef _WIN32
-        hdr.Control.buf = control.data();
-        auto& hdr_msg_controllen = hdr.Control.len;
-#else
-        hdr.msg_control = control.data();
-        auto& hdr_msg_controllen = hdr.msg_controllen;
 #endif
-        hdr_msg_controllen = control.size();
-
-        auto* cm = CMSG_FIRSTHDR(&hdr);
-        size_t actual_size = set_ecn_cmsg(cm, ecn, source_ipv4);
-
-        if (set_source_addr)
-        {
-            cm = CMSG_NXTHDR(&hdr, cm);
-            cm->cmsg_level = source_cmsg_level;
-            cm->cmsg_type = source_cmsg_type;
-            cm->cmsg_len = CMSG_LEN(source_addrlen);
-            std::memcpy(QUIC_CMSG_DATA(cm), &source_addr, source_addrlen);
-            actual_size += CMSG_SPACE(source_addrlen);
-        }
 
-        hdr_msg_controllen = actual_size;
+        alignas(cmsghdr) send_control_buf control{};
+        const send_run* hdr_run = nullptr;
 
         for (size_t i = 0; i < n_pkts; ++i)
         {
             assert(bufsize[i] > 0);
+            if (pkt_run[i] != hdr_run)
+            {
+                hdr_run = pkt_run[i];
+                prepare_send_hdr(hdr, control, *hdr_run->path, hdr_run->ecn, set_source(*hdr_run));
+            }
 #ifdef _WIN32
             iov.buf = next_buf;
             iov.len = bufsize[i];
@@ -686,14 +1204,23 @@ namespace oxen::quic
 
             sent++;
         }
-#endif
-
         return {io_result{rv < 0 ? errno : 0}, sent};
     }
 
     void UDPSocket::when_writeable(std::function<void()> cb)
     {
         writeable_callbacks_.push_back(std::move(cb));
+#ifdef OXEN_LIBQUIC_IO_URING
+        if (uring_)
+        {
+            // With io_uring "writeable" means having a free send slot, rather than the socket
+            // being writeable (which it nearly always is); if there is none right now then uring_
+            // activates wev_ when a slot gets freed.
+            if (uring_->free_send_slots() > 0)
+                event_active(wev_.get(), EV_WRITE, 0);
+            return;
+        }
+#endif
         event_add(wev_.get(), nullptr);
     }
 
@@ -714,6 +1241,28 @@ namespace oxen::quic
 
         for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
         {
+#ifdef SCM_TIMESTAMPING
+            // Kernel receive timestamp: software, (deprecated, always zero) legacy hardware, and raw
+            // hardware times, of which we prefer the hardware one when the NIC provides it
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING &&
+                cmsg->cmsg_len >= CMSG_LEN(3 * sizeof(timespec)))
+            {
+                std::array<timespec, 3> ts;
+                std::memcpy(ts.data(), QUIC_CMSG_DATA(cmsg), sizeof(ts));
+                auto& t = (ts[2].tv_sec || ts[2].tv_nsec) ? ts[2] : ts[0];
+                if (t.tv_sec || t.tv_nsec)
+                {
+                    // The timestamps are system (wall clock) times, so we need to translate to the
+                    // steady clock by how long ago that was.  A time in the future, or implausibly far
+                    // in the past, means an unsynchronized NIC clock: we then just don't use it.
+                    auto age = std::chrono::system_clock::now().time_since_epoch() -
+                               (std::chrono::seconds{t.tv_sec} + std::chrono::nanoseconds{t.tv_nsec});
+                    if (age >= -1ms && age < 10s)
+                        received = get_timestamp() - std::max<std::chrono::nanoseconds>(age, 0ns);
+                }
+                continue;
+            }
+#endif
             if (cmsg->cmsg_level != (path.remote.is_ipv4() ? IPPROTO_IP : IPPROTO_IPV6) || cmsg->cmsg_len == 0)
                 continue;
 
@@ -741,7 +1290,7 @@ namespace oxen::quic
             else if (cmsg->cmsg_type == IPV6_PKTINFO)
                 path.local.set_addr(&reinterpret_cast<const struct in6_pktinfo*>(QUIC_CMSG_DATA(cmsg))->ipi6_addr);
         }
-        log::trace(log_cat, "incoming packet path is {}", path);
+        QUIC_HOT_TRACE(log_cat, "incoming packet path is {}", path);
     }
 
 }  // namespace oxen::quic
@@ -0,0 +1,449 @@
+#include "uring.hpp"
+
+#ifdef OXEN_LIBQUIC_IO_URING
+
+extern "C"
+{
+#include <netinet/udp.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "instrumentation.hpp"
+#include "internal.hpp"
+
+namespace oxen::quic
+{
+    // user_data values identifying what a completion is for: the low byte is the type, and for
+    // sends the slot index is in the upper bits.
+    static constexpr uint64_t UD_RECV = 1;
+    static constexpr uint64_t UD_SEND = 2;
+
+    static constexpr uint16_t RECV_BGID = 0;
+
+    static int uring_setup(unsigned entries, io_uring_params* p)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+    }
+
+    static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+    }
+
+    template <typename T>
+    static T* ring_ptr(void* base, uint32_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    static void* map_ring(int fd, size_t size, off_t offset)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (p == MAP_FAILED)
+            throw std::runtime_error{"Failed to mmap io_uring ring: "s + strerror(errno)};
+        return p;
+    }
+
+    static size_t next_pow2(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+    UringIO::UringIO(
+            event_base* loop,
+            int sock,
+            size_t recv_buffers,
+            size_t max_payload,
+            size_t control_size,
+            size_t max_send_size,
+            receive_callback_t on_receive,
+            std::function<void()> on_receive_done,
+            std::function<void()> on_writeable) :
+            sock_{sock},
+            recv_buf_count{next_pow2(recv_buffers)},
+            recv_payload{max_payload},
+            recv_control{control_size},
+            send_size{max_send_size},
+            receive_cb{std::move(on_receive)},
+            receive_done_cb{std::move(on_receive_done)},
+            writeable_cb{std::move(on_writeable)}
+    {
+        assert(recv_buf_count <= 32768);
+
+        try
+        {
+            io_uring_params params{};
+            ring_fd = uring_setup(SQ_ENTRIES, &params);
+            if (ring_fd < 0)
+                throw std::runtime_error{"io_uring_setup failed: "s + strerror(errno)};
+
+            if (!(params.features & IORING_FEAT_NODROP))
+                throw std::runtime_error{"io_uring is missing required NODROP feature"};
+
+            // Check that the kernel knows the ops we need.  There is no way to probe for multishot
+            // recvmsg directly, but it landed in the same release (6.0) as IORING_OP_SEND_ZC.
+            constexpr unsigned n_probe_ops = 256;
+            std::vector<std::byte> probe_buf(sizeof(io_uring_probe) + n_probe_ops * sizeof(io_uring_probe_op));
+            auto* probe = reinterpret_cast<io_uring_probe*>(probe_buf.data());
+            if (uring_register(ring_fd, IORING_REGISTER_PROBE, probe, n_probe_ops) < 0)
+                throw std::runtime_error{"io_uring probe failed: "s + strerror(errno)};
+            auto supported = [probe](unsigned op) {
+                return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+            };
+            if (!supported(IORING_OP_RECVMSG) || !supported(IORING_OP_SENDMSG) || !supported(IORING_OP_SEND_ZC))
+                throw std::runtime_error{"io_uring does not support multishot recvmsg (Linux 6.0+ required)"};
+            zerocopy_ = supported(IORING_OP_SENDMSG_ZC);
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+            sq_ring = map_ring(ring_fd, sq_ring_size, IORING_OFF_SQ_RING);
+            cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring
+                                                                   : map_ring(ring_fd, cq_ring_size, IORING_OFF_CQ_RING);
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(map_ring(ring_fd, sqes_size, IORING_OFF_SQES));
+
+            sq_head = ring_ptr<unsigned>(sq_ring, params.sq_off.head);
+            sq_tail = ring_ptr<unsigned>(sq_ring, params.sq_off.tail);
+            sq_mask = *ring_ptr<unsigned>(sq_ring, params.sq_off.ring_mask);
+            sq_array = ring_ptr<unsigned>(sq_ring, params.sq_off.array);
+
+            cq_head = ring_ptr<unsigned>(cq_ring, params.cq_off.head);
+            cq_tail = ring_ptr<unsigned>(cq_ring, params.cq_off.tail);
+            cq_mask = *ring_ptr<unsigned>(cq_ring, params.cq_off.ring_mask);
+            cqes = ring_ptr<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+            // Provided buffer ring: this has to be page-aligned memory, so we mmap it.  The ring
+            // tail overlays the `resv` field of the first entry.
+            buf_ring_size = recv_buf_count * sizeof(io_uring_buf);
+            void* br = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (br == MAP_FAILED)
+                throw std::runtime_error{"Failed to allocate io_uring buffer ring: "s + strerror(errno)};
+            buf_ring = static_cast<io_uring_buf*>(br);
+            buf_ring_tail = &buf_ring[0].resv;
+            *buf_ring_tail = 0;
+
+            io_uring_buf_reg reg{};
+            reg.ring_addr = reinterpret_cast<uintptr_t>(buf_ring);
+            reg.ring_entries = static_cast<uint32_t>(recv_buf_count);
+            reg.bgid = RECV_BGID;
+            if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+                throw std::runtime_error{"io_uring provided buffer ring registration failed: "s + strerror(errno)};
+
+            // Each multishot recvmsg buffer starts with a io_uring_recvmsg_out header followed by
+            // the source address and the cmsgs (each in the space we reserve for it via recv_hdr)
+            // and then the payload.
+            recv_hdr.msg_namelen = sizeof(sockaddr_storage);
+            recv_hdr.msg_controllen = recv_control;
+            recv_buf_size = sizeof(io_uring_recvmsg_out) + recv_hdr.msg_namelen + recv_control + recv_payload;
+            recv_buf_size = (recv_buf_size + 63) & ~size_t{63};  // Keep every buffer (and its cmsgs) aligned
+            recv_bufs.resize(recv_buf_count * recv_buf_size);
+            for (size_t i = 0; i < recv_buf_count; i++)
+                recycle_buffer(static_cast<uint16_t>(i));
+            recv_done.reserve(recv_buf_count);
+
+            slots.resize(SEND_SLOTS);
+            send_bufs.resize(SEND_SLOTS * send_size);
+            free_slots.reserve(SEND_SLOTS);
+            for (size_t i = SEND_SLOTS; i-- > 0;)
+                free_slots.push_back(i);
+
+            event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (event_fd < 0)
+                throw std::runtime_error{"Failed to create io_uring eventfd: "s + strerror(errno)};
+            if (uring_register(ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0)
+                throw std::runtime_error{"io_uring eventfd registration failed: "s + strerror(errno)};
+        }
+        catch (...)
+        {
+            cleanup();
+            throw;
+        }
+
+        ev_.reset(event_new(
+                loop,
+                event_fd,
+                EV_READ | EV_PERSIST,
+                [](evutil_socket_t fd, short, void* self) {
+                    scoped_dispatch timing;
+                    uint64_t count;
+                    [[maybe_unused]] auto rv = ::read(fd, &count, sizeof(count));
+                    static_cast<UringIO*>(self)->process_completions();
+                },
+                this));
+        event_add(ev_.get(), nullptr);
+
+        arm_receive();
+        flush();
+
+        log::debug(
+                log_cat,
+                "io_uring engine started with {} {}B receive buffers, {} send slots{}",
+                recv_buf_count,
+                recv_buf_size,
+                SEND_SLOTS,
+                zerocopy_ ? " (zero-copy sends enabled)" : "");
+    }
+
+    UringIO::~UringIO()
+    {
+        ev_.reset();
+        cleanup();
+    }
+
+    void UringIO::cleanup()
+    {
+        // Closing the ring cancels anything still in flight; only after that is it safe to release
+        // the memory the kernel was using.
+        if (ring_fd >= 0)
+            ::close(ring_fd);
+        if (event_fd >= 0)
+            ::close(event_fd);
+        if (sqes)
+            munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        if (sq_ring)
+            munmap(sq_ring, sq_ring_size);
+        if (buf_ring)
+            munmap(buf_ring, buf_ring_size);
+        ring_fd = event_fd = -1;
+        sqes = nullptr;
+        sq_ring = cq_ring = nullptr;
+        buf_ring = nullptr;
+    }
+
+    io_uring_sqe* UringIO::next_sqe()
+    {
+        if (sq_next - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > sq_mask)
+        {
+            // SQ is full: push what we have to the kernel to make room
+            submit();
+            if (sq_next - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > sq_mask)
+                return nullptr;
+        }
+
+        unsigned idx = sq_next++ & sq_mask;
+        auto* sqe = &sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array[idx] = idx;
+        return sqe;
+    }
+
+    void UringIO::arm_receive()
+    {
+        auto* sqe = next_sqe();
+        if (!sqe)
+            return;  // We'll retry after the next batch of completions frees up the SQ
+
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sock_;
+        sqe->addr = reinterpret_cast<uintptr_t>(&recv_hdr);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_BGID;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = UD_RECV;
+        recv_armed = true;
+    }
+
+    void UringIO::recycle_buffer(uint16_t bid)
+    {
+        uint16_t tail = *buf_ring_tail;
+        auto& b = buf_ring[tail & (recv_buf_count - 1)];
+        b.addr = reinterpret_cast<uintptr_t>(recv_bufs.data() + bid * recv_buf_size);
+        b.len = static_cast<uint32_t>(recv_buf_size);
+        b.bid = bid;
+        // Careful: for the first entry `b.resv` *is* the tail, so the tail must be set last.
+        __atomic_store_n(buf_ring_tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+    }
+
+    bool UringIO::queue_send(const msghdr& hdr)
+    {
+        assert(hdr.msg_iovlen == 1);
+        assert(hdr.msg_iov[0].iov_len <= send_size);
+        assert(hdr.msg_namelen <= sizeof(sockaddr_storage));
+        assert(hdr.msg_controllen <= SEND_CONTROL_SIZE);
+
+        if (free_slots.empty())
+            return false;
+
+        auto* sqe = next_sqe();
+        if (!sqe)
+            return false;
+
+        size_t slot_idx = free_slots.back();
+        free_slots.pop_back();
+        auto& slot = slots[slot_idx];
+        auto* data = send_bufs.data() + slot_idx * send_size;
+        const size_t size = hdr.msg_iov[0].iov_len;
+
+        std::memcpy(data, hdr.msg_iov[0].iov_base, size);
+        std::memcpy(&slot.name, hdr.msg_name, hdr.msg_namelen);
+        if (hdr.msg_controllen)
+            std::memcpy(slot.control.data(), hdr.msg_control, hdr.msg_controllen);
+        slot.iov.iov_base = data;
+        slot.iov.iov_len = size;
+        slot.hdr = msghdr{};
+        slot.hdr.msg_name = &slot.name;
+        slot.hdr.msg_namelen = hdr.msg_namelen;
+        slot.hdr.msg_iov = &slot.iov;
+        slot.hdr.msg_iovlen = 1;
+        slot.hdr.msg_control = hdr.msg_controllen ? slot.control.data() : nullptr;
+        slot.hdr.msg_controllen = hdr.msg_controllen;
+
+        slot.segmented = false;
+#ifdef UDP_SEGMENT
+        for (auto* cm = CMSG_FIRSTHDR(&slot.hdr); cm; cm = CMSG_NXTHDR(&slot.hdr, cm))
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_SEGMENT)
+                slot.segmented = true;
+#endif
+
+        sqe->opcode = zerocopy_ && size >= ZEROCOPY_MIN_SIZE ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+        sqe->fd = sock_;
+        sqe->addr = reinterpret_cast<uintptr_t>(&slot.hdr);
+        sqe->len = 1;
+        sqe->user_data = UD_SEND | (static_cast<uint64_t>(slot_idx) << 8);
+        return true;
+    }
+
+    void UringIO::flush()
+    {
+        if (!processing)
+            submit();
+    }
+
+    void UringIO::submit()
+    {
+        unsigned to_submit = sq_next - *sq_tail;
+        if (!to_submit)
+            return;
+
+        // Publish the new entries; the kernel won't look at anything past the tail.
+        __atomic_store_n(sq_tail, sq_next, __ATOMIC_RELEASE);
+
+        int rv;
+        do
+        {
+            rv = uring_enter(ring_fd, to_submit, 0, 0);
+        } while (rv < 0 && errno == EINTR);
+
+        if (rv < 0)
+            log::warning(log_cat, "io_uring_enter failed: {}", strerror(errno));
+    }
+
+    void UringIO::process_completions()
+    {
+        processing = true;
+        bool slot_freed = false;
+
+        unsigned head = *cq_head;
+        for (;;)
+        {
+            if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+                break;
+
+            // Copy it out and release the CQE straight away so that the kernel can reuse the slot
+            // while we are invoking callbacks for it.
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (cqe.user_data == UD_RECV)
+            {
+                if (cqe.flags & IORING_CQE_F_BUFFER)
+                {
+                    auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    auto* buf = recv_bufs.data() + bid * recv_buf_size;
+
+                    if (cqe.res >= 0)
+                    {
+                        io_uring_recvmsg_out out;
+                        std::memcpy(&out, buf, sizeof(out));
+                        auto* name = buf + sizeof(out);
+                        auto* control = name + recv_hdr.msg_namelen;
+                        auto* payload = control + recv_control;
+
+                        msghdr hdr{};
+                        hdr.msg_name = name;
+                        hdr.msg_namelen = std::min<socklen_t>(out.namelen, recv_hdr.msg_namelen);
+                        hdr.msg_control = control;
+                        hdr.msg_controllen = std::min<size_t>(out.controllen, recv_control);
+                        hdr.msg_flags = static_cast<int>(out.flags);
+
+                        receive_cb(bstring_view{payload, std::min<size_t>(out.payloadlen, recv_payload)}, hdr);
+                    }
+
+                    recv_done.push_back(bid);
+                }
+
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    // Multishot terminated: either because we ran out of buffers (-ENOBUFS, which
+                    // is fine: we recycle them below, before re-arming), or because of an error.
+                    recv_armed = false;
+                    if (cqe.res < 0 && cqe.res != -ENOBUFS)
+                        log::warning(log_cat, "io_uring multishot recvmsg failed: {}", strerror(-cqe.res));
+                }
+            }
+            else if ((cqe.user_data & 0xff) == UD_SEND)
+            {
+                auto slot_idx = static_cast<size_t>(cqe.user_data >> 8);
+                assert(slot_idx < slots.size());
+                if (!(cqe.flags & IORING_CQE_F_NOTIF) && cqe.res < 0)
+                {
+                    // A failed send is equivalent to a dropped packet: the QUIC layer takes care of
+                    // retransmission, we just note it.
+                    log::debug(log_cat, "io_uring send failed: {}", strerror(-cqe.res));
+                    if (slots[slot_idx].segmented && (cqe.res == -EIO || cqe.res == -EINVAL))
+                        gso_failed = true;
+                }
+                // Zero-copy sends produce two completions: the send result (with F_MORE set) and a
+                // notification once the kernel is done with the buffer; the slot is only free after
+                // the final one.
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    free_slots.push_back(slot_idx);
+                    slot_freed = true;
+                }
+            }
+        }
+
+        if (!recv_done.empty())
+        {
+            if (receive_done_cb)
+                receive_done_cb();
+            for (auto bid : recv_done)
+                recycle_buffer(bid);
+            recv_done.clear();
+        }
+
+        if (!recv_armed)
+            arm_receive();
+
+        processing = false;
+        flush();
+
+        if (slot_freed && writeable_cb)
+            writeable_cb();
+    }
+
+}  // namespace oxen::quic
+
+#endif
@@ -0,0 +1,188 @@
+#pragma once
+
+// Internal io_uring driver used by UDPSocket when built with -DLIBQUIC_IO_URING=ON.  This talks to
+// the kernel directly (via the raw io_uring syscalls and the <linux/io_uring.h> ABI) rather than
+// through liburing so that we don't pick up another dependency for what is a fairly small subset
+// of io_uring.
+
+#ifdef OXEN_LIBQUIC_IO_URING
+
+extern "C"
+{
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+}
+
+#include <event2/event.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace oxen::quic
+{
+    // Drives all I/O of a single UDP socket through an io_uring instance:
+    //
+    // - receiving uses a single multishot IORING_OP_RECVMSG that pulls from a ring of provided
+    //   buffers, so that one submission keeps producing completions (one per datagram) for as long
+    //   as buffers are available;
+    // - sending copies each message into one of a fixed set of send slots and queues a
+    //   IORING_OP_SENDMSG (or, for large GSO messages when the kernel supports it,
+    //   IORING_OP_SENDMSG_ZC) for it.  Queued sends are submitted in one io_uring_enter call per
+    //   UDPSocket::send(), or once at the end of processing a batch of completions if the send was
+    //   triggered from within a receive callback.
+    //
+    // Completions are signalled through an eventfd registered with the ring, which is polled by the
+    // owning libevent loop, so the rest of the code is unaware that this is happening.  All methods
+    // must be called from the event loop thread.
+    class UringIO
+    {
+      public:
+        // Called for each received datagram (or GRO super-buffer) with the payload and a msghdr
+        // whose name and control fields point at the datagram's source address and cmsgs.
+        using receive_callback_t = std::function<void(bstring_view payload, msghdr& hdr)>;
+
+        static constexpr unsigned SQ_ENTRIES = 256;
+        static constexpr size_t SEND_SLOTS = 64;
+        // Messages at least this large are sent with zero-copy (if supported); for smaller ones
+        // the page pinning and extra completion cost more than the copy it avoids.
+        static constexpr size_t ZEROCOPY_MIN_SIZE = 8192;
+        // Space reserved in each send slot for cmsgs (ECN + source pktinfo + UDP_SEGMENT)
+        static constexpr size_t SEND_CONTROL_SIZE = 128;
+
+        // Sets up the ring and starts receiving on `sock`.  Each of the `recv_buffers` receive
+        // buffers holds one payload of up to `max_payload` bytes plus `control_size` bytes of
+        // cmsgs; each send slot holds a message of up to `max_send_size` bytes.  `on_writeable` is
+        // invoked whenever a send slot becomes free.
+        //
+        // `on_receive` is invoked for each received datagram while processing a batch of
+        // completions, and `on_receive_done` once at the end of that batch; received data remains
+        // valid until `on_receive_done` returns.
+        //
+        // Throws std::runtime_error if io_uring (or one of the features we need: provided buffer
+        // rings and multishot recvmsg, i.e. Linux 6.0+) is not available, in which case the caller
+        // should fall back to regular readiness-based I/O.
+        UringIO(event_base* loop,
+                int sock,
+                size_t recv_buffers,
+                size_t max_payload,
+                size_t control_size,
+                size_t max_send_size,
+                receive_callback_t on_receive,
+                std::function<void()> on_receive_done,
+                std::function<void()> on_writeable);
+
+        ~UringIO();
+
+        UringIO(const UringIO&) = delete;
+        UringIO& operator=(const UringIO&) = delete;
+        UringIO(UringIO&&) = delete;
+        UringIO& operator=(UringIO&&) = delete;
+
+        // Copies the given message (which must have a single iovec of at most `max_send_size`
+        // bytes) into a free send slot and queues it for sending.  Returns false if there are no
+        // free send slots, in which case nothing is queued and the caller should wait for the
+        // `on_writeable` callback.  Queued sends are not submitted until `flush()` is called.
+        bool queue_send(const msghdr& hdr);
+
+        // Submits all queued sends to the kernel.  If called while processing completions this is
+        // deferred until the end of the completion batch.
+        void flush();
+
+        // Number of send slots not currently in use.
+        size_t free_send_slots() const { return free_slots.size(); }
+
+        // True if zero-copy sends are supported and in use for large messages.
+        bool zerocopy() const { return zerocopy_; }
+
+        // Returns true (and resets the flag) if a GSO send has failed since the last call, which
+        // means the caller should stop using UDP_SEGMENT on this socket.
+        bool take_gso_failure() { return std::exchange(gso_failed, false); }
+
+      private:
+        struct send_slot
+        {
+            msghdr hdr;
+            iovec iov;
+            sockaddr_storage name;
+            alignas(cmsghdr) std::array<char, SEND_CONTROL_SIZE> control;
+            bool segmented;
+        };
+
+        int ring_fd = -1;
+        int sock_;
+
+        // Mapped rings
+        void* sq_ring = nullptr;
+        size_t sq_ring_size = 0;
+        void* cq_ring = nullptr;
+        size_t cq_ring_size = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqes_size = 0;
+
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned sq_mask;
+        unsigned* sq_array;
+        unsigned sq_next = 0;  // Our local SQ tail, published to the kernel in submit()
+
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned cq_mask;
+        io_uring_cqe* cqes;
+
+        // Provided receive buffers
+        io_uring_buf* buf_ring = nullptr;
+        size_t buf_ring_size = 0;
+        uint16_t* buf_ring_tail = nullptr;
+        size_t recv_buf_count;
+        size_t recv_payload;
+        size_t recv_control;
+        size_t recv_buf_size;
+        std::vector<std::byte> recv_bufs;
+        msghdr recv_hdr{};
+        bool recv_armed = false;
+        // Buffers received into during the current completion batch, which go back to the kernel
+        // once the batch has been handled.
+        std::vector<uint16_t> recv_done;
+
+        // Send slots, and the send data space for them
+        size_t send_size;
+        std::vector<send_slot> slots;
+        std::vector<std::byte> send_bufs;
+        std::vector<size_t> free_slots;
+        bool zerocopy_ = false;
+        bool gso_failed = false;
+
+        int event_fd = -1;
+        event_ptr ev_;
+        bool processing = false;
+
+        receive_callback_t receive_cb;
+        std::function<void()> receive_done_cb;
+        std::function<void()> writeable_cb;
+
+        io_uring_sqe* next_sqe();
+        void submit();
+        void arm_receive();
+        void recycle_buffer(uint16_t bid);
+        void process_completions();
+        void cleanup();
+    };
+}  // namespace oxen::quic
+
+#else
+
+namespace oxen::quic
+{
+    // Never instantiated; this just gives UDPSocket's `uring_` member a complete type.
+    class UringIO
+    {};
+}  // namespace oxen::quic
+
+#endif
@@ -2,8 +2,15 @@
 
 #include <oxenc/endian.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 
@@ -32,6 +39,55 @@ namespace oxen::quic
         return std::chrono::steady_clock::now().time_since_epoch();
     }
 
+    namespace
+    {
+        struct random_buffer
+        {
+            static constexpr size_t SIZE = 4096;
+            // Anything bigger than this goes straight to gnutls_rnd
+            static constexpr size_t MAX_BUFFERED = 256;
+
+            std::array<unsigned char, SIZE> buf;
+            size_t pos = SIZE;  // empty
+
+            ~random_buffer() { std::memset(buf.data(), 0, buf.size()); }
+        };
+
+        thread_local random_buffer rand_buf;
+
+        // A forked child must not hand out the same bytes as its parent.  Only the forking thread
+        // exists in the child, so resetting its buffer is enough.
+        void random_buffer_after_fork()
+        {
+            rand_buf.pos = random_buffer::SIZE;
+        }
+    }  // namespace
+
+    bool random_bytes(void* dest, size_t len) noexcept
+    {
+        if (len > random_buffer::MAX_BUFFERED)
+            return gnutls_rnd(GNUTLS_RND_RANDOM, dest, len) == 0;
+
+#ifndef _WIN32
+        static std::once_flag atfork_once;
+        std::call_once(atfork_once, [] { pthread_atfork(nullptr, nullptr, random_buffer_after_fork); });
+#endif
+
+        auto& b = rand_buf;
+        if (random_buffer::SIZE - b.pos < len)
+        {
+            if (gnutls_rnd(GNUTLS_RND_RANDOM, b.buf.data(), b.buf.size()) != 0)
+                return false;
+            b.pos = 0;
+        }
+
+        auto* p = b.buf.data() + b.pos;
+        std::memcpy(dest, p, len);
+        std::memset(p, 0, len);
+        b.pos += len;
+        return true;
+    }
+
     std::string str_tolower(std::string s)
     {
         std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
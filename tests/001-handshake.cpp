@@ -1,5 +1,6 @@
 #include <catch2/catch_test_macros.hpp>
 #include <oxen/quic.hpp>
+#include <filesystem>
 #include <oxen/quic/gnutls_crypto.hpp>
 #include <thread>
 
@@ -243,6 +244,49 @@ namespace oxen::quic::test
                                                  defaults::CLIENT_PUBKEY.length()});
     };
 
+    TEST_CASE("001 - Handshaking: Verified key cache", "[001][server][verifycache]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        std::atomic<int> verify_calls = 0;
+        server_tls->set_key_verify_callback([&](const ustring_view& key, const ustring_view&) {
+            verify_calls++;
+            return key == convert_sv<unsigned char>(std::string_view{defaults::CLIENT_PUBKEY});
+        });
+        server_tls->enable_key_verify_cache();
+
+        Address server_local{};
+        Address client_local{};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        for (int i = 0; i < 3; i++)
+        {
+            auto established = callback_waiter{[](connection_interface&) {}};
+            auto ci = client_endpoint->connect(client_remote, client_tls, established);
+            REQUIRE(established.wait());
+            CHECK(ci->is_validated());
+        }
+        CHECK(verify_calls == 1);
+
+        // Keys the callback rejected are not cached, and still get rejected
+        auto [other_seed, other_pubkey] = generate_ed25519();
+        auto other_tls = GNUTLSCreds::make_from_ed_keys(other_seed, other_pubkey);
+        for (int i = 0; i < 2; i++)
+        {
+            auto established = callback_waiter{[](connection_interface&) {}};
+            client_endpoint->connect(client_remote, other_tls, established);
+            CHECK_FALSE(established.wait(250ms));
+        }
+        CHECK(verify_calls == 3);
+    };
+
     TEST_CASE("001 - Handshaking: Types - IPv6", "[001][ipv6]")
     {
         if (disable_ipv6)
@@ -295,6 +339,256 @@ namespace oxen::quic::test
         CHECK(client_ci->is_validated());
     };
 
+    TEST_CASE("001 - Handshaking: Async and bulk connect", "[001][handshake][connect][bulk]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        constexpr int num_bulk = 20;
+        std::atomic<int> established = 0;
+        std::promise<void> all_established;
+        connection_established_callback client_established = [&](connection_interface&) {
+            if (++established == num_bulk + 1)
+                all_established.set_value();
+        };
+
+        Address server_local{};
+        Address client_local{};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local, client_established);
+
+        std::promise<std::shared_ptr<connection_interface>> async_p;
+        client_endpoint->connect_async(
+                client_remote,
+                [&](std::shared_ptr<connection_interface> ci) {
+                    CHECK(client_endpoint->in_event_loop());
+                    async_p.set_value(std::move(ci));
+                },
+                client_tls);
+        auto async_f = async_p.get_future();
+        require_future(async_f);
+        CHECK(async_f.get());
+
+        auto bulk = client_endpoint->connect_many(std::vector<RemoteAddress>(num_bulk, client_remote), client_tls);
+        REQUIRE(bulk.size() == num_bulk);
+        for (auto& ci : bulk)
+            CHECK(ci);
+
+        auto established_f = all_established.get_future();
+        require_future(established_f);
+        CHECK(client_endpoint->get_all_conns(Direction::OUTBOUND).size() == num_bulk + 1);
+
+        // Address validation happens up front, before connecting to any of them
+        RemoteAddress bad_remote{defaults::SERVER_PUBKEY, "0.0.0.0"s, uint16_t{0}};
+        CHECK_THROWS_AS(client_endpoint->connect_many({client_remote, bad_remote}, client_tls), std::invalid_argument);
+        CHECK_THROWS_AS(client_endpoint->connect_async(bad_remote, nullptr, client_tls), std::invalid_argument);
+        CHECK(client_endpoint->get_all_conns(Direction::OUTBOUND).size() == num_bulk + 1);
+    };
+
+    TEST_CASE("001 - Handshaking: 0-RTT session resumption", "[001][handshake][0rtt][resumption]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        std::promise<bstring> data_p;
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) { data_p.set_value(bstring{data}); };
+
+        Address server_local{};
+        Address client_local{};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto cache = std::make_shared<memory_session_cache>();
+        auto client_endpoint = test_net.endpoint(client_local, opt::session_resumption{cache});
+
+        auto is_resumed = [&](const std::shared_ptr<connection_interface>& ci) {
+            return client_endpoint->call_get(
+                    [&] { return std::dynamic_pointer_cast<Connection>(ci)->get_session()->is_resumed(); });
+        };
+
+        // The first connection does a full handshake, and gets a session ticket from the server
+        auto first_established = callback_waiter{[](connection_interface&) {}};
+        auto first = client_endpoint->connect(client_remote, client_tls, first_established);
+        REQUIRE(first_established.wait());
+        CHECK_FALSE(is_resumed(first));
+
+        for (int i = 0; i < 100 && cache->size() == 0; i++)
+            std::this_thread::sleep_for(10ms);
+        REQUIRE(cache->size() == 1);
+
+        first->close_connection();
+
+        // The second resumes the session, so the data sent on the stream opened immediately can go
+        // out as early data
+        auto second_established = callback_waiter{[](connection_interface&) {}};
+        auto second = client_endpoint->connect(client_remote, client_tls, second_established);
+        auto s = second->open_stream();
+        s->send("hello early"s);
+
+        REQUIRE(second_established.wait());
+        CHECK(is_resumed(second));
+        CHECK(second->is_validated());
+
+        auto data_f = data_p.get_future();
+        require_future(data_f);
+        CHECK(data_f.get() == "hello early"_bsv);
+        CHECK(cache->size() == 1);
+
+        SECTION("Persisting the cache")
+        {
+            auto path = std::filesystem::temp_directory_path() / "libquic-001-session-cache";
+            REQUIRE_NOTHROW(cache->save(path));
+
+            memory_session_cache loaded;
+            REQUIRE_NOTHROW(loaded.load_file(path));
+            CHECK(loaded.size() == 1);
+            auto ticket = loaded.load(to_usv(defaults::SERVER_PUBKEY));
+            auto orig = cache->load(to_usv(defaults::SERVER_PUBKEY));
+            REQUIRE(ticket);
+            REQUIRE(orig);
+            CHECK(ticket->tls_data == orig->tls_data);
+            CHECK(ticket->transport_params == orig->transport_params);
+
+            std::filesystem::remove(path);
+            memory_session_cache empty;
+            REQUIRE_NOTHROW(empty.load_file(path));
+            CHECK(empty.size() == 0);
+        }
+    };
+
+    TEST_CASE("001 - Handshaking: Admission control", "[001][handshake][admission]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        SECTION("Retry under load")
+        {
+            // With retry_pending of 0 the server is always "loaded", so every new client has to
+            // validate its address with a Retry first
+            auto server_endpoint = test_net.endpoint(server_local, opt::handshake_admission{0});
+            REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+            RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+            auto client_established = callback_waiter{[](connection_interface&) {}};
+            auto client_endpoint = test_net.endpoint(client_local, client_established);
+            auto conn = client_endpoint->connect(client_remote, client_tls);
+            REQUIRE(client_established.wait());
+
+            auto stats = server_endpoint->handshake_admission_stats();
+            CHECK(stats.retried == 1);
+            CHECK(stats.accepted == 1);
+            CHECK(stats.dropped_pending == 0);
+            CHECK(stats.pending == 0);
+        }
+
+        SECTION("Per-prefix rate limit")
+        {
+            // One connection attempt allowed, then (practically) never again
+            auto server_endpoint = test_net.endpoint(server_local, opt::handshake_admission{256, 1000, 4096, 0.001, 1});
+            REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+            RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+            auto client_established = callback_waiter{[](connection_interface&) {}};
+            auto client_endpoint = test_net.endpoint(client_local, client_established);
+            auto conn = client_endpoint->connect(client_remote, client_tls);
+            REQUIRE(client_established.wait());
+
+            auto second_established = callback_waiter{[](connection_interface&) {}};
+            auto conn2 = client_endpoint->connect(client_remote, client_tls, second_established);
+            CHECK_FALSE(second_established.wait(250ms));
+
+            auto stats = server_endpoint->handshake_admission_stats();
+            CHECK(stats.accepted == 1);
+            CHECK(stats.dropped_prefix > 0);
+            CHECK(server_endpoint->handshake_prefix_dropped(Address{"127.0.0.2", 1234}) == stats.dropped_prefix);
+            CHECK(server_endpoint->handshake_prefix_dropped(Address{"10.0.0.1", 1234}) == 0);
+        }
+    };
+
+    TEST_CASE("001 - Handshaking: Connection pooling", "[001][handshake][pooling]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // Polls (for up to ~2s) until `ep` has exactly `n` connections
+        auto wait_for_conns = [](std::shared_ptr<Endpoint>& ep, size_t n) {
+            for (int i = 0; i < 200 && ep->call_get([&] { return ep->get_all_conns().size(); }) != n; i++)
+                std::this_thread::sleep_for(10ms);
+            return ep->call_get([&] { return ep->get_all_conns(); });
+        };
+
+        SECTION("Concurrent connects share a connection")
+        {
+            auto server_endpoint = test_net.endpoint(Address{});
+            REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+            RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+            auto client_established = callback_waiter{[](connection_interface&) {}};
+            auto client_endpoint = test_net.endpoint(Address{}, opt::connection_pooling{}, client_established);
+
+            auto conn = client_endpoint->connect(client_remote, client_tls);
+            auto again = client_endpoint->connect(client_remote, client_tls);
+            CHECK(again == conn);
+            REQUIRE(client_established.wait());
+            CHECK(client_endpoint->connect(client_remote, client_tls) == conn);
+            CHECK(wait_for_conns(server_endpoint, 1).size() == 1);
+
+            // A closing connection isn't handed out again
+            conn->close_connection();
+            std::this_thread::sleep_for(50ms);
+            auto fresh = client_endpoint->connect(client_remote, client_tls);
+            CHECK(fresh != conn);
+        }
+
+        SECTION("Simultaneous connections are deduplicated")
+        {
+            std::atomic<int> a_closed{0}, b_closed{0};
+            connection_closed_callback a_closed_cb = [&](connection_interface&, uint64_t) { a_closed++; };
+            connection_closed_callback b_closed_cb = [&](connection_interface&, uint64_t) { b_closed++; };
+
+            // Each endpoint listens and connects with its own key
+            auto a = test_net.endpoint(Address{}, opt::connection_pooling{defaults::CLIENT_PUBKEY}, a_closed_cb);
+            auto b = test_net.endpoint(Address{}, opt::connection_pooling{defaults::SERVER_PUBKEY}, b_closed_cb);
+            REQUIRE_NOTHROW(a->listen(client_tls));
+            REQUIRE_NOTHROW(b->listen(server_tls));
+
+            a->connect(RemoteAddress{defaults::SERVER_PUBKEY, "127.0.0.1"s, b->local().port()}, client_tls);
+            b->connect(RemoteAddress{defaults::CLIENT_PUBKEY, "127.0.0.1"s, a->local().port()}, server_tls);
+
+            auto a_conns = wait_for_conns(a, 1);
+            auto b_conns = wait_for_conns(b, 1);
+            REQUIRE(a_conns.size() == 1);
+            REQUIRE(b_conns.size() == 1);
+
+            // The survivor is the connection initiated by the lower pubkey
+            bool a_lower = to_usv(defaults::CLIENT_PUBKEY) < to_usv(defaults::SERVER_PUBKEY);
+            CHECK(a_conns.front()->is_outbound() == a_lower);
+            CHECK(b_conns.front()->is_inbound() == a_lower);
+
+            // The lower pubkey's side drops its inbound duplicate before it was ever reported as
+            // established, so it doesn't get reported as closed either
+            CHECK((a_lower ? a_closed : b_closed) == 0);
+        }
+    };
+
     TEST_CASE("001 - multi-listen failure", "[001][dumb][listen][protection]")
     {
         Network net;
@@ -560,6 +854,56 @@ namespace oxen::quic::test
         CHECK(client_errcode == CONN_IDLE_CLOSED);
     }
 
+    TEST_CASE("001 - Hibernation", "[001][idle][hibernate]")
+    {
+        Network net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        std::atomic<int> received{0};
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view) { received++; };
+
+        auto server_endpoint = net.endpoint(Address{});
+        server_endpoint->listen(server_tls, server_data_cb, opt::hibernate{50ms});
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        // The client's keep-alives keep arriving at the hibernating server, and need answering
+        auto client_endpoint = net.endpoint(Address{});
+        auto client_ci = client_endpoint->connect(client_remote, client_tls, opt::keep_alive{20ms});
+
+        auto wait_for = [](auto&& pred) {
+            for (int i = 0; i < 100 && !pred(); i++)
+                std::this_thread::sleep_for(10ms);
+            return pred();
+        };
+
+        auto stream = client_ci->open_stream();
+        stream->send("hello"_bsv);
+        REQUIRE(wait_for([&] { return received == 1; }));
+
+        auto server_ci = server_endpoint->call_get([&] { return server_endpoint->get_all_conns().front(); });
+        CHECK_FALSE(server_ci->is_hibernating());
+        auto awake_bytes = server_ci->resident_bytes();
+
+        // An open stream keeps the connection awake
+        std::this_thread::sleep_for(200ms);
+        CHECK_FALSE(server_ci->is_hibernating());
+
+        stream->close();
+        REQUIRE(wait_for([&] { return server_ci->is_hibernating(); }));
+        CHECK(server_ci->resident_bytes() < awake_bytes);
+
+        // Keep-alives don't wake it
+        std::this_thread::sleep_for(200ms);
+        CHECK(server_ci->is_hibernating());
+
+        // New data does, transparently
+        client_ci->open_stream()->send("again"_bsv);
+        REQUIRE(wait_for([&] { return received == 2; }));
+        CHECK_FALSE(server_ci->is_hibernating());
+    }
+
     TEST_CASE("001 - Handshake timeout", "[001][handshake][timeout]")
     {
         auto net1 = std::make_unique<Network>();
@@ -1,5 +1,6 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers.hpp>
+#include <atomic>
 #include <future>
 #include <oxen/quic.hpp>
 #include <oxen/quic/gnutls_crypto.hpp>
@@ -44,6 +45,312 @@ namespace oxen::quic::test
         REQUIRE_NOTHROW(client_stream->send(good_msg));
 
         require_future(d_future);
+
+        // Packets are built in loop-level scratch space, so an idle connection only holds its own
+        // (small) state.
+        auto resident = conn_interface->resident_bytes();
+        REQUIRE(resident > 0);
+        REQUIRE(resident < MAX_PMTUD_UDP_PAYLOAD * DATAGRAM_BATCH_SIZE);
+    };
+
+    TEST_CASE("002 - Transport statistics", "[002][stats]")
+    {
+        Network test_net{};
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+
+        std::promise<void> d_promise;
+        auto d_future = d_promise.get_future();
+
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view) { d_promise.set_value(); };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(good_msg));
+        require_future(d_future);
+
+        // The snapshot is published after the connection's next send pass, which may not have
+        // happened quite yet
+        connection_stats stats;
+        for (int i = 0; i < 100; i++)
+        {
+            stats = conn_interface->stats();
+            if (stats.packets_received > 0 && stats.bytes_sent >= good_msg.size())
+                break;
+            std::this_thread::sleep_for(10ms);
+        }
+
+        CHECK(stats.packets_sent > 0);
+        CHECK(stats.bytes_sent >= good_msg.size());
+        CHECK(stats.bytes_sent >= stats.packets_sent);
+        CHECK(stats.packets_received > 0);
+        CHECK(stats.bytes_received >= stats.packets_received);
+        CHECK(stats.smoothed_rtt > 0ns);
+        CHECK(stats.min_rtt <= stats.smoothed_rtt);
+        CHECK(stats.cwnd > 0);
+        CHECK(stats.max_udp_payload >= 1200);
+        CHECK(stats.send_blocked == 0);
+
+        auto client_ep_stats = client_endpoint->stats();
+        CHECK(client_ep_stats.socket.packets_sent > 0);
+        CHECK(client_ep_stats.socket.bytes_sent >= client_ep_stats.socket.packets_sent);
+        CHECK(client_ep_stats.socket.packets_received > 0);
+
+        auto server_ep_stats = server_endpoint->stats();
+        CHECK(server_ep_stats.socket.packets_received > 0);
+        CHECK(server_ep_stats.socket.bytes_received >= good_msg.size());
+        CHECK(server_ep_stats.socket.packets_sent > 0);
+    };
+
+    TEST_CASE("002 - Congestion control selection", "[002][congestion]")
+    {
+        for (auto algo : {CongestionControl::CUBIC, CongestionControl::RENO, CongestionControl::BBR})
+        {
+            DYNAMIC_SECTION("Congestion control: " << to_string(algo))
+            {
+                Network test_net{};
+
+                constexpr size_t size = 1'000'000;
+                size_t received = 0;
+                std::promise<void> d_promise;
+                auto d_future = d_promise.get_future();
+
+                stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+                    received += data.size();
+                    if (received == size)
+                        d_promise.set_value();
+                };
+
+                auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+                // Only the client's settings matter to this transfer, but both sides get them, as
+                // they would in practice
+                opt::congestion_control cc{algo, 50ms};
+                opt::max_receive_window max_window{64_Mi};
+
+                auto server_endpoint = test_net.endpoint(Address{});
+                REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb, cc, max_window));
+
+                RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+                auto client_endpoint = test_net.endpoint(Address{});
+                auto conn_interface = client_endpoint->connect(client_remote, client_tls, cc, max_window);
+
+                auto client_stream = conn_interface->open_stream();
+                REQUIRE_NOTHROW(client_stream->send(bstring(size, std::byte{'c'})));
+                require_future(d_future, 5s);
+
+                CHECK(conn_interface->stats().cc_algo == algo);
+            }
+        }
+    };
+
+    TEST_CASE("002 - Jumbo UDP payloads", "[002][jumbo]")
+    {
+        Network test_net{};
+
+        REQUIRE_THROWS(test_net.endpoint(Address{}, opt::max_udp_payload{MIN_UDP_PAYLOAD - 1}));
+        REQUIRE_THROWS(test_net.endpoint(Address{}, opt::max_udp_payload{MAX_JUMBO_UDP_PAYLOAD + 1}));
+
+        constexpr size_t size = 2'000'000;
+        bstring received;
+        std::promise<void> d_promise;
+        auto d_future = d_promise.get_future();
+
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+            received.append(data);
+            if (received.size() == size)
+                d_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // Loopback has room for these (its MTU is 64kiB)
+        opt::max_udp_payload jumbo{MAX_JUMBO_UDP_PAYLOAD};
+
+        auto server_endpoint = test_net.endpoint(Address{}, jumbo);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+        CHECK(server_endpoint->max_udp_payload() == MAX_JUMBO_UDP_PAYLOAD);
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{}, jumbo);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        bstring msg(size, std::byte{0});
+        for (size_t i = 0; i < size; i++)
+            msg[i] = static_cast<std::byte>(i % 251);
+
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(bstring{msg}));
+        require_future(d_future, 5s);
+        CHECK(received == msg);
+
+#if NGTCP2_VERSION_NUM >= 0x010400
+        // Path MTU discovery should have found its way up to the jumbo size
+        auto deadline = std::chrono::steady_clock::now() + 1s;
+        while (conn_interface->stats().max_udp_payload <= MAX_PMTUD_UDP_PAYLOAD &&
+               std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(10ms);
+        CHECK(conn_interface->stats().max_udp_payload == MAX_JUMBO_UDP_PAYLOAD);
+#endif
+    };
+
+    TEST_CASE("002 - Jumbo UDP payloads on one side only", "[002][jumbo]")
+    {
+        Network test_net{};
+
+        constexpr size_t size = 2'000'000;
+        bstring received, echoed;
+        std::promise<void> d_promise, e_promise, dgram_promise;
+        auto d_future = d_promise.get_future();
+        auto e_future = e_promise.get_future();
+        auto dgram_future = dgram_promise.get_future();
+        bstring dgram_received;
+
+        // The server echoes everything back, so that jumbo and default sized packets both get to
+        // go both ways
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view data) {
+            received.append(data);
+            s.send(bstring{data});
+            if (received.size() == size)
+                d_promise.set_value();
+        };
+        stream_data_callback client_data_cb = [&](Stream&, bstring_view data) {
+            echoed.append(data);
+            if (echoed.size() == size)
+                e_promise.set_value();
+        };
+        dgram_data_callback server_dgram_cb = [&](dgram_interface&, bstring data) {
+            dgram_received = std::move(data);
+            dgram_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        opt::max_udp_payload jumbo{MAX_JUMBO_UDP_PAYLOAD};
+        opt::max_udp_payload standard{MAX_PMTUD_UDP_PAYLOAD};
+        opt::enable_datagrams split_dgram{Splitting::ACTIVE};
+
+        bool jumbo_client = true;
+        SECTION("Jumbo client") {}
+        SECTION("Jumbo server")
+        {
+            jumbo_client = false;
+        }
+
+        auto server_endpoint = test_net.endpoint(Address{}, jumbo_client ? standard : jumbo, split_dgram, server_dgram_cb);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{}, jumbo_client ? jumbo : standard, split_dgram);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls, client_data_cb);
+
+        bstring msg(size, std::byte{0});
+        for (size_t i = 0; i < size; i++)
+            msg[i] = static_cast<std::byte>(i % 251);
+
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(bstring{msg}));
+        require_future(d_future, 5s);
+        require_future(e_future, 5s);
+        CHECK(received == msg);
+        CHECK(echoed == msg);
+
+        // Neither side should be sending packets larger than the standard side takes, and so
+        // neither should offer datagrams that would need them
+        CHECK(conn_interface->stats().max_udp_payload <= MAX_PMTUD_UDP_PAYLOAD);
+        auto server_ci = server_endpoint->get_all_conns(Direction::INBOUND).front();
+        CHECK(server_ci->stats().max_udp_payload <= MAX_PMTUD_UDP_PAYLOAD);
+
+        auto max_dgram = conn_interface->get_max_datagram_size();
+        CHECK(max_dgram < 2 * MAX_PMTUD_UDP_PAYLOAD);
+        bstring dgram(max_dgram, std::byte{'d'});
+        conn_interface->send_datagram(bstring{dgram});
+        require_future(dgram_future);
+        CHECK(dgram_received == dgram);
+    };
+
+    TEST_CASE("002 - Send and receive over io_uring", "[002][io_uring]")
+    {
+        Network test_net{};
+
+        constexpr size_t size = 1'000'000;
+        constexpr int n_dgrams = 50;
+        bstring received, echoed;
+        std::promise<void> d_promise, e_promise, dgram_promise;
+        auto d_future = d_promise.get_future();
+        auto e_future = e_promise.get_future();
+        auto dgram_future = dgram_promise.get_future();
+        std::atomic<int> dgrams_received = 0;
+
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view data) {
+            received.append(data);
+            s.send(bstring{data});
+            if (received.size() == size)
+                d_promise.set_value();
+        };
+        stream_data_callback client_data_cb = [&](Stream&, bstring_view data) {
+            echoed.append(data);
+            if (echoed.size() == size)
+                e_promise.set_value();
+        };
+        dgram_data_callback server_dgram_cb = [&](dgram_interface&, bstring data) {
+            CHECK(data == bstring(100, std::byte{'d'}));
+            if (++dgrams_received == n_dgrams)
+                dgram_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        opt::enable_datagrams dgrams{};
+        auto server_endpoint = test_net.endpoint(Address{}, dgrams, server_dgram_cb);
+        auto client_endpoint = test_net.endpoint(Address{}, dgrams);
+
+        // Sockets fall back to readiness-based I/O when the library is built without io_uring or
+        // the running kernel doesn't support it, in which case there is nothing to test here.
+        if (!TestHelper::io_uring_enabled(*server_endpoint) || !TestHelper::io_uring_enabled(*client_endpoint))
+            SKIP("io_uring is not available in this build or on this kernel");
+
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls, client_data_cb);
+
+        bstring msg(size, std::byte{0});
+        for (size_t i = 0; i < size; i++)
+            msg[i] = static_cast<std::byte>(i % 251);
+
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(bstring{msg}));
+        require_future(d_future, 5s);
+        require_future(e_future, 5s);
+        CHECK(received == msg);
+        CHECK(echoed == msg);
+
+        for (int i = 0; i < n_dgrams; i++)
+            conn_interface->send_datagram(bstring(100, std::byte{'d'}));
+        require_future(dgram_future);
+
+        auto client_ep_stats = client_endpoint->stats();
+        CHECK(client_ep_stats.socket.packets_sent > 0);
+        CHECK(client_ep_stats.socket.bytes_sent >= size);
+        CHECK(client_ep_stats.socket.packets_received > 0);
+        CHECK(client_ep_stats.socket.bytes_received >= size);
+
+        auto server_ep_stats = server_endpoint->stats();
+        CHECK(server_ep_stats.socket.packets_received > 0);
+        CHECK(server_ep_stats.socket.bytes_received >= size);
+        CHECK(server_ep_stats.socket.packets_sent > 0);
     };
 
     TEST_CASE("002 - Simple client to server transmission", "[002][simple][bidirectional]")
@@ -495,6 +802,138 @@ namespace oxen::quic::test
         CHECK(responses == good_responses);
     }
 
+    TEST_CASE("002 - BParser batched commands", "[002][bparser][batch]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        static constexpr int num_requests = 50;
+
+        std::mutex mut;
+        std::promise<void> done_prom;
+        auto done = done_prom.get_future();
+        int responses = 0, good_responses = 0, timeouts = 0;
+        std::atomic<int> commands_seen = 0;
+
+        auto server_handler = [&](message msg) {
+            commands_seen++;
+            if (msg.body() != "ignore me")
+                msg.respond("re: {}"_format(msg.body()));
+        };
+
+        auto client_reply_handler = [&](message msg, int i) {
+            std::lock_guard lock{mut};
+            if (msg.timed_out)
+                timeouts++;
+            else if (msg.body() == "re: {}"_format(i))
+                good_responses++;
+            if (++responses == num_requests + 1)
+                done_prom.set_value();
+        };
+
+        stream_constructor_callback server_constructor = [&](Connection& c, Endpoint& e, std::optional<int64_t>) {
+            auto s = e.make_shared<BTRequestStream>(c, e);
+            s->register_handler("test_endpoint"s, server_handler);
+            return s;
+        };
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_constructor));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto client_bp = conn_interface->open_stream<BTRequestStream>();
+
+        command_batch batch{*client_bp};
+        for (int i = 0; i < num_requests; i++)
+            batch.command("test_endpoint"sv, "{}"_format(i), [&, i](message m) { client_reply_handler(std::move(m), i); });
+        batch.command("test_endpoint"sv, "ignore me"sv, [&](message m) { client_reply_handler(std::move(m), -1); }, 250ms);
+        batch.command("test_endpoint"sv, "no callback"sv);
+        CHECK(batch.size() == num_requests + 2);
+        batch.send();
+        CHECK(batch.empty());
+        CHECK(batch.bytes() == 0);
+
+        require_future(done);
+        std::lock_guard lock{mut};
+        CHECK(good_responses == num_requests);
+        CHECK(timeouts == 1);
+        CHECK(commands_seen == num_requests + 2);
+        CHECK(client_bp->num_requests() == 0);
+    }
+
+    TEST_CASE("002 - BParser borrowed messages", "[002][bparser][borrow]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // The server keeps (by moving) the first request it gets, and when the second one arrives
+        // reports whether the first one's data is still accessible.
+        std::optional<message> held;
+        std::promise<bool> still_valid;
+        std::function<void(message)> server_handler = [&](message m) {
+            if (!held)
+            {
+                m.respond("first");
+                held.emplace(std::move(m));
+                return;
+            }
+            try
+            {
+                still_valid.set_value(held->body() == "hello"sv);
+            }
+            catch (const std::logic_error&)
+            {
+                still_valid.set_value(false);
+            }
+            m.respond("second");
+        };
+
+        bool borrow = false;
+        SECTION("Owned messages (the default)") {}
+        SECTION("Borrowed messages")
+        {
+            borrow = true;
+        }
+
+        auto server_conn_est = [&](connection_interface& c) {
+            if (borrow)
+                c.queue_incoming_stream<BTRequestStream>(server_handler, opt::borrowed_messages{});
+            else
+                c.queue_incoming_stream<BTRequestStream>(server_handler);
+        };
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        server_endpoint->listen(server_tls, server_conn_est);
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+        auto client_bp = conn_interface->open_stream<BTRequestStream>();
+
+        // Only send the second request once the first has been dealt with, so that they can't
+        // arrive in the same chunk of stream data
+        std::promise<void> first_answered;
+        client_bp->command("test"s, "hello"s, [&](message) { first_answered.set_value(); });
+        require_future(first_answered.get_future());
+        client_bp->command("test"s, "again"s);
+
+        auto f = still_valid.get_future();
+        require_future(f);
+        // Moving a message out of the handler keeps it usable unless the stream opted in to lending
+        // out its receive buffer
+        CHECK(f.get() == !borrow);
+    }
+
     TEST_CASE("002 - BParser huge requests", "[002][bparser][huge]")
     {
         Network test_net{};
@@ -572,6 +1011,60 @@ namespace oxen::quic::test
             CHECK(responses == good_responses);
         }
 
+        SECTION("Huge, sent without copying")
+        {
+            std::promise<void> done_prom;
+            auto done = done_prom.get_future();
+
+            std::atomic<int> responses = 0, good_responses = 0;
+
+            auto req_msg = std::make_shared<std::string>(5'000'000, 'a');
+            for (size_t i = 0; i < req_msg->size(); i += 1000)
+                (*req_msg)[i] = 'b';
+
+            // Echo the request body back, keeping the request alive until the response is sent
+            auto server_handler = [&](message msg) mutable {
+                auto req = std::make_shared<message>(std::move(msg));
+                req->respond(req->body(), req);
+            };
+
+            auto client_reply_handler = [&](message msg) mutable {
+                if (msg)
+                {
+                    ++responses;
+                    if (msg.body() == *req_msg)
+                        ++good_responses;
+                    if (responses == num_requests)
+                        done_prom.set_value();
+                }
+            };
+
+            stream_constructor_callback server_constructor = [&](Connection& c, Endpoint& e, std::optional<int64_t>) {
+                auto s = e.make_shared<BTRequestStream>(c, e);
+                s->register_handler("test_endpoint"s, server_handler);
+                return s;
+            };
+
+            auto server_endpoint = test_net.endpoint(server_local);
+            REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_constructor));
+
+            RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+            auto client_endpoint = test_net.endpoint(client_local);
+            auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+            std::shared_ptr<BTRequestStream> client_bp = conn_interface->open_stream<BTRequestStream>();
+
+            for (int i = 0; i < num_requests; i++)
+                client_bp->command("test_endpoint"s, *req_msg, client_reply_handler, req_msg);
+            // Small bodies given with a keep-alive get copied, but must still arrive intact
+            client_bp->command("test_endpoint"s, "small"sv, [](message) {}, req_msg);
+
+            require_future(done, 3s);
+            CHECK(good_responses == num_requests);
+            CHECK(responses == good_responses);
+        }
+
         SECTION("Too huge")
         {
             std::string req_msg(10'000'000, 'a');
@@ -697,6 +1190,53 @@ namespace oxen::quic::test
         CHECK(errors == std::unordered_multiset{{"Invalid endpoint 'nuh uh'"s, "Invalid endpoint 'ep2'"s}});
     }
 
+    TEST_CASE("002 - BParser re-registered request handler", "[002][bparser][handlers]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        std::promise<void> prom;
+        auto done = prom.get_future();
+
+        auto handler1 = [&](message m) { m.respond("h1-{}"_format(m.endpoint())); };
+
+        auto handler2 = [&](message m) { m.respond("h2-{}"_format(m.endpoint())); };
+
+        auto server_conn_est = [&](connection_interface& c) {
+            auto s = c.queue_incoming_stream<BTRequestStream>();
+            s->register_handler("ep2"s, handler1);
+            s->register_handler("ep1"s, handler1);
+            // Replaces the first handler without disturbing the one registered after it
+            s->register_handler("ep2"s, handler2);
+        };
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        server_endpoint->listen(server_tls, server_conn_est);
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        std::unordered_multiset<std::string> responses;
+        auto resp_handler = [&](message m) {
+            responses.insert(m.body_str());
+            if (responses.size() >= 2)
+                prom.set_value();
+        };
+
+        std::shared_ptr<BTRequestStream> client_bp = conn_interface->open_stream<BTRequestStream>();
+        client_bp->command("ep1", "", resp_handler);
+        client_bp->command("ep2", "", resp_handler);
+
+        require_future(done);
+        CHECK(responses == std::unordered_multiset{{"h1-ep1"s, "h2-ep2"s}});
+    }
+
     TEST_CASE("002 - BParser connection close triggers timeout callback", "[002][bparser][close]")
     {
         Network test_net{};
@@ -738,4 +1278,121 @@ namespace oxen::quic::test
             slow_response.join();
     }
 
+    TEST_CASE("002 - BParser quietly closed connection discards pending requests", "[002][bparser][close]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // The server gets the request but never answers it
+        std::promise<void> got_request;
+        auto server_conn_est = [&](connection_interface& c) {
+            auto s = c.queue_incoming_stream<BTRequestStream>();
+            s->register_handler("ignore"s, [&](message) { got_request.set_value(); });
+        };
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        server_endpoint->listen(server_tls, server_conn_est);
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto client_bp = conn_interface->open_stream<BTRequestStream>();
+
+        std::atomic<bool> reply_called{false};
+        client_bp->command("ignore"s, ""s, [&](message) { reply_called = true; }, 100ms);
+        require_future(got_request.get_future());
+        REQUIRE(client_bp->num_requests() == 1);
+
+        // Dropping the connection this way bypasses the stream's close callback; the request's
+        // timer must not be left behind to fire into the (still referenced) stream.
+        conn_interface->set_close_quietly();
+        conn_interface->close_connection();
+
+        std::this_thread::sleep_for(250ms);
+        CHECK_FALSE(reply_called);
+        CHECK(client_bp->num_requests() == 0);
+    }
+
+    TEST_CASE("002 - BParser out of order responses and timeouts", "[002][bparser][ordering]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        static constexpr int num_requests = 8;
+
+        // The server holds on to every request until it has them all, then answers them in
+        // reverse order (except for the ones it ignores, which have to time out).
+        std::vector<message> held;
+        auto server_handler = [&](message m) {
+            held.push_back(std::move(m));
+            if (held.size() < num_requests)
+                return;
+            for (auto it = held.rbegin(); it != held.rend(); ++it)
+                if (it->body() != "ignore me")
+                    it->respond(it->body());
+            held.clear();
+        };
+
+        std::mutex mut;
+        std::promise<void> done_prom;
+        auto done = done_prom.get_future();
+        std::vector<std::string> replies;
+        int mismatched = 0;
+
+        auto make_handler = [&](std::string expected) {
+            return [&, expected = std::move(expected)](message msg) {
+                std::lock_guard lock{mut};
+                auto got = msg.timed_out ? "timeout:"s + expected : msg.body_str();
+                if (got != expected && !msg.timed_out)
+                    mismatched++;
+                replies.push_back(std::move(got));
+                if (replies.size() == num_requests - 1)
+                    done_prom.set_value();
+            };
+        };
+
+        stream_constructor_callback server_constructor = [&](Connection& c, Endpoint& e, std::optional<int64_t>) {
+            auto s = e.make_shared<BTRequestStream>(c, e);
+            s->register_handler("test"s, server_handler);
+            return s;
+        };
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_constructor));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto client_bp = conn_interface->open_stream<BTRequestStream>();
+
+        // Two ignored requests, where the later one has the shorter timeout and so has to time out
+        // first.  The first request is sent without a callback, and so isn't tracked at all.
+        client_bp->command("test"s, "no reply wanted"s);
+        client_bp->command("test"s, "ignore me"s, make_handler("ignore 1"), 600ms);
+        for (int i = 2; i < num_requests - 1; i++)
+            client_bp->command("test"s, "req{}"_format(i), make_handler("req{}"_format(i)));
+        client_bp->command("test"s, "ignore me"s, make_handler("ignore 2"), 300ms);
+
+        require_future(done);
+        CHECK(client_bp->num_requests() == 0);
+
+        std::lock_guard lock{mut};
+        CHECK(mismatched == 0);
+        std::vector<std::string> expected;
+        for (int i = num_requests - 2; i >= 2; i--)
+            expected.push_back("req{}"_format(i));
+        expected.push_back("timeout:ignore 2");
+        expected.push_back("timeout:ignore 1");
+        CHECK(replies == expected);
+    }
+
 }  // namespace oxen::quic::test
@@ -113,4 +113,102 @@ namespace oxen::quic::test
         async_thread_a.join();
         REQUIRE(data_check == 4);
     };
+
+    TEST_CASE("003 - Multi-client to server transmission: Closing many connections", "[003][multi-client][close]")
+    {
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // More than one close batch's worth, so that closing has to span several loop iterations
+        constexpr int N = Endpoint::CLOSE_BATCH_SIZE + 44;
+
+        std::atomic<int> n_established{0}, n_closed{0}, n_bad_code{0};
+        std::promise<void> all_established, all_closed;
+
+        connection_established_callback server_established = [&](connection_interface&) {
+            if (++n_established == N)
+                all_established.set_value();
+        };
+        connection_closed_callback client_closed = [&](connection_interface&, uint64_t ec) {
+            if (ec != 0)
+                n_bad_code++;
+            if (++n_closed == N)
+                all_closed.set_value();
+        };
+
+        auto server_endpoint = test_net.endpoint(Address{}, server_established);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        auto client_endpoint = test_net.endpoint(Address{}, client_closed);
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        std::vector<std::shared_ptr<connection_interface>> conns;
+        for (int i = 0; i < N; i++)
+            conns.push_back(client_endpoint->connect(client_remote, client_tls));
+
+        require_future(all_established.get_future(), 10s);
+
+        // Every client should hear the server's close, rather than timing out
+        server_endpoint->close_conns();
+        require_future(all_closed.get_future(), 5s);
+        CHECK(n_bad_code == 0);
+    };
+
+    TEST_CASE("003 - Multi-client to server transmission: Closing connections out of time", "[003][multi-client][close]")
+    {
+        Network client_net{};
+        auto server_net = std::make_unique<Network>();
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // One more close batch than gets through before the deadline
+        constexpr int N = Endpoint::CLOSE_BATCH_SIZE + 20;
+        constexpr auto max_time = 5ms;
+
+        std::atomic<int> n_established{0}, n_closed{0}, n_clean{0}, n_timed_out{0};
+        std::promise<void> all_established, all_closed;
+
+        connection_established_callback server_established = [&](connection_interface&) {
+            if (++n_established == N)
+                all_established.set_value();
+        };
+        connection_closed_callback server_closed = [&](connection_interface&, uint64_t ec) {
+            // Hold up the first batch of closes until the time limit has passed, so that the
+            // following batch has to be dropped
+            if (ec == 0 && ++n_clean == 1)
+                std::this_thread::sleep_for(max_time * 2);
+            if (ec == CONN_SHUTDOWN_TIMEOUT)
+                n_timed_out++;
+            if (++n_closed == N)
+                all_closed.set_value();
+        };
+
+        auto server_endpoint = server_net->endpoint(Address{}, server_established, server_closed);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        auto client_endpoint = client_net.endpoint(Address{});
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        std::vector<std::shared_ptr<connection_interface>> conns;
+        for (int i = 0; i < N; i++)
+            conns.push_back(client_endpoint->connect(client_remote, client_tls));
+
+        require_future(all_established.get_future(), 10s);
+
+        SECTION("Endpoint::close_conns")
+        {
+            server_endpoint->close_conns(std::nullopt, max_time);
+            require_future(all_closed.get_future(), 5s);
+        }
+        SECTION("Network::set_shutdown_timeout")
+        {
+            server_net->set_shutdown_timeout(max_time);
+            server_endpoint.reset();
+            server_net.reset();
+            CHECK(n_closed == N);
+        }
+
+        // (If the first batch only got going after the deadline then everything got dropped)
+        CHECK(n_timed_out >= N - static_cast<int>(Endpoint::CLOSE_BATCH_SIZE));
+        CHECK(n_clean + n_timed_out == N);
+    };
 }  // namespace oxen::quic::test
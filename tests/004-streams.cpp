@@ -1,5 +1,7 @@
 #include <catch2/catch_test_macros.hpp>
+#include <atomic>
 #include <memory>
+#include <memory_resource>
 #include <oxen/quic.hpp>
 #include <oxen/quic/gnutls_crypto.hpp>
 #include <stdexcept>
@@ -996,4 +998,340 @@ namespace oxen::quic::test
         REQUIRE("still alive"sv != "is success"sv);
     }
 
+
+    TEST_CASE("004 - Stream priorities", "[004][streams][priority]")
+    {
+        Network test_net{};
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        constexpr size_t bulk_size = 2'000'000;
+        const auto urgent_msg = "urgent!"_bsv;
+
+        // Sends a bulk stream and then a short message on a second stream, both non-incremental, and
+        // returns how much of the bulk data the server had received when the short message arrived.
+        auto bulk_received_before_urgent = [&](uint8_t control_urgency) {
+            std::atomic<size_t> bulk_received{0};
+            std::promise<size_t> urgent_promise;
+            auto urgent_future = urgent_promise.get_future();
+            std::promise<void> bulk_promise;
+            auto bulk_future = bulk_promise.get_future();
+
+            stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+                if (data == urgent_msg)
+                    urgent_promise.set_value(bulk_received);
+                else if ((bulk_received += data.size()) == bulk_size)
+                    bulk_promise.set_value();
+            };
+
+            auto client_established = callback_waiter{[](connection_interface&) {}};
+
+            auto server_endpoint = test_net.endpoint(server_local);
+            REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+            RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+            auto client_endpoint = test_net.endpoint(client_local, client_established);
+            auto client_ci = client_endpoint->connect(client_remote, client_tls);
+            REQUIRE(client_established.wait());
+
+            auto bulk = client_ci->open_stream();
+            auto control = client_ci->open_stream();
+
+            REQUIRE_THROWS_AS(control->set_priority(MAX_URGENCY + 1), std::invalid_argument);
+            REQUIRE(control->priority() == std::make_pair(DEFAULT_URGENCY, true));
+            bulk->set_priority(DEFAULT_URGENCY, false);
+            control->set_priority(control_urgency, false);
+            REQUIRE(control->priority() == std::make_pair(control_urgency, false));
+
+            {
+                // Queue up both while corked so that the scheduler sees them together
+                scoped_cork cork{*client_ci};
+                bulk->send(std::string(bulk_size, 'x'));
+                control->send(urgent_msg);
+            }
+
+            require_future(urgent_future, 5s);
+            require_future(bulk_future, 5s);
+            return urgent_future.get();
+        };
+
+        // With equal priorities the earlier (bulk) stream gets to send everything it has before the
+        // later one gets a turn; raising the urgency of the later stream has it go out first
+        // instead, ahead of (nearly) all of the bulk data.
+        const auto equal = bulk_received_before_urgent(DEFAULT_URGENCY);
+        const auto urgent = bulk_received_before_urgent(0);
+        CHECK(equal > bulk_size / 2);
+        CHECK(urgent < bulk_size / 10);
+    };
+
+    TEST_CASE("004 - Manual stream receive flow control", "[004][streams][flowcontrol]")
+    {
+        Network test_net{};
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        constexpr size_t window = 64_ki;
+        constexpr size_t total = 1_Mi;
+
+        std::atomic<size_t> received{0};
+        std::atomic<bool> consuming{false};
+        std::shared_ptr<Stream> server_stream;
+        std::promise<void> done_promise;
+        auto done = done_promise.get_future();
+
+        stream_open_callback server_open_cb = [&](Stream& s) -> uint64_t {
+            s.set_manual_consume();
+            server_stream = s.get_stream();
+            return 0;
+        };
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view data) {
+            if (consuming)
+                s.consume(data.size());
+            if ((received += data.size()) == total)
+                done_promise.set_value();
+        };
+
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_open_cb, server_data_cb, opt::receive_window{window}));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local, client_established);
+        auto client_ci = client_endpoint->connect(client_remote, client_tls);
+        REQUIRE(client_established.wait());
+
+        auto client_stream = client_ci->open_stream();
+        client_stream->send(std::string(total, 'x'));
+
+        // Without anything being consumed, the client can't send more than the stream window
+        std::this_thread::sleep_for(250ms);
+        REQUIRE(received > 0);
+        REQUIRE(received <= window);
+        REQUIRE(server_stream);
+        REQUIRE(server_stream->unconsumed() == received);
+
+        consuming = true;
+        server_stream->consume(received);
+        require_future(done, 5s);
+        CHECK(server_stream->unconsumed() == 0);
+    };
+
+    TEST_CASE("004 - Explicit receive window is not outgrown", "[004][streams][flowcontrol]")
+    {
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        constexpr size_t window = 64_ki;
+        constexpr size_t total = 8_Mi;
+
+        std::atomic<size_t> received{0};
+        std::atomic<bool> consuming{true};
+        std::shared_ptr<Stream> server_stream;
+
+        stream_open_callback server_open_cb = [&](Stream& s) -> uint64_t {
+            s.set_manual_consume();
+            server_stream = s.get_stream();
+            return 0;
+        };
+        // Consuming everything straight away at first is what has ngtcp2 grow windows; then, with
+        // the window as big as it gets, we stop.
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view data) {
+            if (consuming)
+                s.consume(data.size());
+            if ((received += data.size()) >= 1_Mi)
+                consuming = false;
+        };
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_open_cb, server_data_cb, opt::receive_window{window}));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto client_ci = client_endpoint->connect(client_remote, client_tls);
+        client_ci->open_stream()->send(std::string(total, 'x'));
+
+        for (int i = 0; i < 100 && consuming; i++)
+            std::this_thread::sleep_for(10ms);
+        REQUIRE_FALSE(consuming);
+
+        // Give the client time to fill whatever window it has been given
+        std::this_thread::sleep_for(250ms);
+        REQUIRE(server_stream);
+        CHECK(server_stream->unconsumed() > 0);
+        CHECK(server_stream->unconsumed() <= window);
+    };
+
+    TEST_CASE("004 - Stream send watermarks", "[004][streams][watermarks]")
+    {
+        Network test_net{};
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        constexpr size_t total = 2_Mi;
+
+        std::atomic<size_t> received{0};
+        std::promise<void> done_promise;
+        auto done = done_promise.get_future();
+
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+            if ((received += data.size()) == total)
+                done_promise.set_value();
+        };
+
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local, client_established);
+        auto client_ci = client_endpoint->connect(client_remote, client_tls);
+        REQUIRE(client_established.wait());
+
+        auto client_stream = client_ci->open_stream();
+
+        REQUIRE_THROWS_AS(client_stream->set_watermarks(1000, 1000, nullptr), std::invalid_argument);
+        REQUIRE_THROWS_AS(client_ci->set_watermarks(1000, 2000, nullptr), std::invalid_argument);
+
+        // Only touched from the event loop thread, until the final checks
+        std::vector<bool> stream_events, conn_events;
+        client_stream->set_watermarks(512_ki, 64_ki, [&](Stream&, bool writable) { stream_events.push_back(writable); });
+        client_ci->set_watermarks(
+                1_Mi, 128_ki, [&](connection_interface&, bool writable) { conn_events.push_back(writable); });
+
+        {
+            // Queue it all up before any of it goes out, so that the buffered data only crosses
+            // each watermark once
+            scoped_cork cork{*client_ci};
+            for (size_t sent = 0; sent < total; sent += 256_ki)
+                client_stream->send(std::string(256_ki, 'x'));
+        }
+
+        require_future(done, 5s);
+
+        // Everything has been received, but the final acks might still be on their way
+        for (int i = 0; i < 50 && !(client_stream->is_writable() && client_ci->is_writable()); i++)
+            std::this_thread::sleep_for(10ms);
+
+        CHECK(client_stream->is_writable());
+        CHECK(client_ci->is_writable());
+        auto [s_events, c_events] = client_endpoint->call_get([&] { return std::make_pair(stream_events, conn_events); });
+        CHECK(s_events == std::vector<bool>{false, true});
+        CHECK(c_events == std::vector<bool>{false, true});
+        CHECK(client_ci->buffered_bytes() == 0);
+    };
+
+    TEST_CASE("004 - Connection memory resource", "[004][streams][memory]")
+    {
+        // Counts what goes through it, and otherwise just uses the heap
+        struct counting_resource : std::pmr::memory_resource
+        {
+            std::atomic<size_t> allocations{0};
+
+            void* do_allocate(size_t bytes, size_t align) override
+            {
+                allocations++;
+                return std::pmr::new_delete_resource()->allocate(bytes, align);
+            }
+            void do_deallocate(void* p, size_t bytes, size_t align) override
+            {
+                std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+            }
+            bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+        };
+
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        size_t received = 0;
+        std::promise<void> all_received;
+        constexpr size_t chunks = 1000, chunk_size = 1000;
+        auto server_endpoint = test_net.endpoint(Address{});
+        server_endpoint->listen(server_tls, [&](Stream&, bstring_view data) {
+            received += data.size();
+            if (received == chunks * chunk_size)
+                all_received.set_value();
+        });
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        std::weak_ptr<counting_resource> conn_resource;
+        opt::memory_resource per_connection{[&]() -> std::shared_ptr<std::pmr::memory_resource> {
+            auto r = std::make_shared<counting_resource>();
+            conn_resource = r;
+            return r;
+        }};
+        auto client_endpoint = test_net.endpoint(Address{}, per_connection);
+
+        std::promise<void> closed;
+        auto conn = client_endpoint->connect(
+                client_remote, client_tls, [&](connection_interface&, uint64_t) { closed.set_value(); });
+        auto stream = conn->open_stream();
+        for (size_t i = 0; i < chunks; i++)
+            stream->send(std::string(chunk_size, 'm'));
+        require_future(all_received.get_future(), 5s);
+
+        // The stream's send queue came from the connection's resource
+        auto resource = conn_resource.lock();
+        REQUIRE(resource);
+        CHECK(resource->allocations > 0);
+        resource.reset();
+
+        // It goes away along with the connection and its stream
+        conn->close_connection();
+        require_future(closed.get_future());
+        conn.reset();
+        stream.reset();
+        for (int i = 0; i < 100 && !conn_resource.expired(); i++)
+            std::this_thread::sleep_for(10ms);
+        CHECK(conn_resource.expired());
+    };
+
+    TEST_CASE("004 - Lock-free stream accessors", "[004][streams][accessors]")
+    {
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        server_endpoint->listen(server_tls);
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+        auto client_endpoint = test_net.endpoint(Address{});
+
+        auto conn = client_endpoint->connect(client_remote, client_tls);
+        auto stream = conn->open_stream();
+        CHECK(stream->is_empty());
+        CHECK(stream->unsent() == 0);
+        CHECK_FALSE(stream->is_closing());
+        CHECK(conn->num_streams_active() + conn->num_streams_pending() == 1);
+
+        std::promise<bool> drained;
+        stream->send(std::string(100'000, 'a'));
+        stream->when_drained([&](Stream&, bool d) { drained.set_value(d); });
+
+        // The loop publishes the new state before getting to our next call, and none of the data
+        // can be sent (let alone acknowledged) before the handshake round trip
+        client_endpoint->call_get([] {});
+        CHECK_FALSE(stream->is_empty());
+        CHECK(stream->has_unsent());
+
+        auto f = drained.get_future();
+        require_future(f);
+        REQUIRE(f.get());
+        CHECK(stream->is_empty());
+        CHECK(stream->unsent() == 0);
+        CHECK(conn->num_streams_active() == 1);
+
+        stream->close();
+        client_endpoint->call_get([] {});
+        CHECK(stream->is_closing());
+    };
 }  // namespace oxen::quic::test
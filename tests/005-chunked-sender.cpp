@@ -1,4 +1,6 @@
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cstdio>
 #include <iterator>
 #include <thread>
 
@@ -110,4 +112,143 @@ namespace oxen::quic::test
                     "Goodbye.");
         }
     };
+
+    TEST_CASE("005 - Chunked stream sending: Adaptive", "[005][chunked][adaptive]")
+    {
+        Network test_net{};
+
+        constexpr size_t chunk_size = 32_ki;
+        constexpr int num_chunks = 200;
+        constexpr int max_simultaneous = 8;
+
+        std::atomic<size_t> received{0};
+        std::atomic<bool> corrupt{false};
+        std::promise<void> finished_p;
+        std::future<void> finished_f = finished_p.get_future();
+
+        // Chunk i consists entirely of the byte i % 256
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+            size_t pos = received;
+            for (auto b : data)
+                if (static_cast<uint8_t>(b) != static_cast<uint8_t>(pos++ / chunk_size))
+                    corrupt = true;
+            if ((received += data.size()) == chunk_size * num_chunks)
+                finished_p.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto stream = conn_interface->open_stream();
+
+        // A ring of exactly max_simultaneous buffers: reusing one while still in flight would
+        // corrupt the data the server sees.
+        std::array<std::vector<std::byte>, max_simultaneous> bufs;
+        int next = 0;
+        bool done = false;
+
+        // The chunks are handed out as non-owning shared_ptrs so that we can see when the stream is
+        // done with one, and so track how many are in flight.  Each time one is released (after the
+        // stream has queued whatever should replace it) we note how many are still in flight.
+        int released = 0;
+        std::vector<int> depths;
+
+        REQUIRE_THROWS_AS(stream->send_chunks([](const Stream&) { return ""s; }, nullptr, Stream::adaptive_chunks{0}),
+                          std::logic_error);
+
+        stream->send_chunks(
+                [&](const Stream&) -> std::shared_ptr<std::vector<std::byte>> {
+                    if (next == num_chunks)
+                        return nullptr;
+                    auto& buf = bufs[next % max_simultaneous];
+                    buf.assign(chunk_size, static_cast<std::byte>(next % 256));
+                    next++;
+                    return {&buf, [&](std::vector<std::byte>*) { depths.push_back(next - ++released); }};
+                },
+                [&](Stream&) { done = true; },
+                Stream::adaptive_chunks{max_simultaneous});
+
+        require_future(finished_f, 5s);
+        CHECK_FALSE(corrupt);
+        CHECK(client_endpoint->call_get([&] { return done; }));
+
+        // The congestion window starts out smaller than a chunk, so only a chunk or two are kept in
+        // flight at first; as the window opens up the stream should go deeper, up to the limit (but
+        // never running dry while there are chunks left).
+        auto [first_depth, max_depth] = client_endpoint->call_get(
+                [&] { return std::make_pair(depths.front(), *std::max_element(depths.begin(), depths.end())); });
+        CHECK(first_depth >= 1);
+        CHECK(max_depth > first_depth);
+        CHECK(max_depth <= max_simultaneous);
+    };
+
+    TEST_CASE("005 - Chunked stream sending: Files", "[005][chunked][file]")
+    {
+        Network test_net{};
+
+        // A file of a few windows, sent from an offset that isn't page aligned; the small window
+        // size means several windows get mapped and unmapped along the way.
+        constexpr size_t file_size = 3_Mi + 12345;
+        constexpr uint64_t offset = 777;
+        constexpr uint64_t len = file_size - offset - 100;
+        constexpr size_t window = 256_ki;
+
+        std::unique_ptr<FILE, int (*)(FILE*)> file{std::tmpfile(), &std::fclose};
+        REQUIRE(file);
+        std::vector<std::byte> contents(file_size);
+        for (size_t i = 0; i < file_size; i++)
+            contents[i] = static_cast<std::byte>((i * 131) % 251);
+        REQUIRE(std::fwrite(contents.data(), 1, file_size, file.get()) == file_size);
+        REQUIRE(std::fflush(file.get()) == 0);
+        int fd = fileno(file.get());
+
+        bstring received;
+        std::promise<void> finished_p;
+        std::future<void> finished_f = finished_p.get_future();
+
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+            received.append(data);
+            if (received.size() == len)
+                finished_p.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto stream = conn_interface->open_stream();
+
+        REQUIRE_THROWS_AS(stream->send_file(fd, offset, file_size), std::invalid_argument);
+        REQUIRE_THROWS_AS(stream->send_file(-1, 0, 1), std::invalid_argument);
+
+        std::atomic<bool> done = false;
+        stream->send_file(fd, offset, len, [&](Stream&) { done = true; }, window, 3);
+
+        // The stream holds its own descriptor
+        file.reset();
+
+        require_future(finished_f, 5s);
+        CHECK(done);
+        REQUIRE(received.size() == len);
+        CHECK(bstring_view{received} == bstring_view{contents.data() + offset, len});
+    };
 }  // namespace oxen::quic::test
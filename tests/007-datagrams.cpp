@@ -195,6 +195,101 @@ namespace oxen::quic::test
         };
     };
 
+    TEST_CASE("007 - Datagram support: Execute, Batch Send", "[007][datagrams][execute][batch]")
+    {
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        Network test_net{};
+
+        constexpr size_t n = 32;
+        std::vector<bstring> msgs;
+        for (size_t i = 0; i < n; i++)
+            msgs.push_back(bstring(10 + i, static_cast<std::byte>('a' + i % 26)));
+        std::vector<bstring_view> views{msgs.begin(), msgs.end()};
+
+        std::atomic<size_t> received{0};
+        std::promise<void> data_promise;
+        std::future<void> data_future = data_promise.get_future();
+
+        dgram_data_callback recv_dgram_cb = [&](dgram_interface&, bstring data) {
+            REQUIRE(data.size() >= 10);
+            if (++received == n)
+                data_promise.set_value();
+        };
+
+        opt::enable_datagrams default_gram{};
+
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(server_local, default_gram, recv_dgram_cb);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client = test_net.endpoint(client_local, default_gram, client_established);
+        auto conn_interface = client->connect(client_remote, client_tls);
+
+        REQUIRE(client_established.wait());
+
+        // A single keep-alive owns the data behind all of the views
+        conn_interface->send_datagrams(views, std::make_shared<std::vector<bstring>>(std::move(msgs)));
+
+        require_future(data_future);
+        REQUIRE(received == n);
+    };
+
+    TEST_CASE("007 - Datagram support: Execute, Zero-copy receive callbacks", "[007][datagrams][execute][zerocopy]")
+    {
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        Network test_net{};
+        auto msg = "hello from the other siiiii-iiiiide"_bsv;
+
+        std::promise<bstring> data_promise;
+        std::future<bstring> data_future = data_promise.get_future();
+
+        opt::enable_datagrams default_gram{};
+
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        std::shared_ptr<Endpoint> server_endpoint;
+
+        SECTION("View callback")
+        {
+            dgram_data_view_callback recv_dgram_cb = [&](dgram_interface&, bstring_view data) {
+                data_promise.set_value(bstring{data});
+            };
+            server_endpoint = test_net.endpoint(server_local, default_gram, recv_dgram_cb);
+        }
+        SECTION("Pooled buffer callback")
+        {
+            dgram_data_pooled_callback recv_dgram_cb = [&](dgram_interface&, pooled_buffer data) {
+                data_promise.set_value(bstring{data.view()});
+            };
+            server_endpoint = test_net.endpoint(server_local, default_gram, recv_dgram_cb);
+        }
+
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client = test_net.endpoint(client_local, default_gram, client_established);
+        auto conn_interface = client->connect(client_remote, client_tls);
+
+        REQUIRE(client_established.wait());
+
+        conn_interface->send_datagram(msg);
+
+        require_future(data_future);
+        REQUIRE(data_future.get() == msg);
+    };
+
     TEST_CASE("007 - Datagram support: Execute, Packet Splitting Enabled", "[007][datagrams][execute][split][simple]")
     {
         SECTION("Simple datagram transmission")
@@ -635,4 +730,222 @@ namespace oxen::quic::test
             REQUIRE(flip_flop_count < (int)n);
         };
     };
+
+    TEST_CASE("007 - Datagram support: Fragmentation", "[007][datagrams][execute][fragment]")
+    {
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        Network test_net{};
+
+        bool fec = false, pooled = false;
+        SECTION("Without parity") {}
+        SECTION("With parity")
+        {
+            fec = true;
+        }
+        SECTION("With parity, pooled buffer callback")
+        {
+            // The reassembled datagrams don't fit into the endpoint's pooled receive buffers
+            fec = pooled = true;
+        }
+        opt::fragment_datagrams frag_dgram{8, fec};
+
+        std::vector<bstring> msgs;
+        msgs.emplace_back(100, std::byte{'a'});  // sent whole
+        for (size_t size : {2000, 5001, 8000})
+        {
+            auto& m = msgs.emplace_back(size, std::byte{0});
+            for (size_t i = 0; i < size; i++)
+                m[i] = static_cast<std::byte>(i % 251);
+        }
+
+        std::atomic<size_t> index{0};
+        std::vector<std::promise<bstring>> data_promises{msgs.size()};
+        std::vector<std::future<bstring>> data_futures;
+        for (auto& p : data_promises)
+            data_futures.push_back(p.get_future());
+
+        dgram_data_callback recv_dgram_cb = [&](dgram_interface&, bstring data) {
+            data_promises.at(index++).set_value(std::move(data));
+        };
+        dgram_data_pooled_callback recv_pooled_cb = [&](dgram_interface&, pooled_buffer data) {
+            data_promises.at(index++).set_value(bstring{data.view()});
+        };
+
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = pooled ? test_net.endpoint(server_local, frag_dgram, recv_pooled_cb)
+                                      : test_net.endpoint(server_local, frag_dgram, recv_dgram_cb);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client = test_net.endpoint(client_local, frag_dgram, client_established);
+        auto conn_interface = client->connect(client_remote, client_tls);
+
+        REQUIRE(client_established.wait());
+        REQUIRE(conn_interface->datagrams_enabled());
+        REQUIRE_FALSE(conn_interface->packet_splitting_enabled());
+        REQUIRE(conn_interface->get_max_datagram_size() > 8 * MIN_UDP_PAYLOAD / 2);
+
+        if (fec)
+        {
+            // Every fragmented datagram loses its first fragment, which has to be rebuilt from parity
+            auto server_ci = server_endpoint->get_all_conns(Direction::INBOUND).front();
+            TestHelper::enable_dgram_drop(*server_ci);
+        }
+
+        for (auto& m : msgs)
+            conn_interface->send_datagram(bstring_view{m});
+
+        for (size_t i = 0; i < msgs.size(); i++)
+        {
+            require_future(data_futures[i]);
+            REQUIRE(data_futures[i].get() == msgs[i]);
+        }
+    };
+
+    TEST_CASE("007 - Datagram support: Pooled receive of large datagrams", "[007][datagrams][execute][zerocopy]")
+    {
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        Network test_net{};
+
+        // Reassembled from fragments, and so larger than any buffer of the endpoint's pool (which
+        // hold two packets' worth)
+        bstring msg(3 * MAX_PMTUD_UDP_PAYLOAD, std::byte{0});
+        for (size_t i = 0; i < msg.size(); i++)
+            msg[i] = static_cast<std::byte>(i % 251);
+
+        std::promise<bstring> data_promise;
+        std::future<bstring> data_future = data_promise.get_future();
+        std::atomic<size_t> capacity{0};
+
+        dgram_data_pooled_callback recv_dgram_cb = [&](dgram_interface&, pooled_buffer data) {
+            capacity = data.capacity();
+            data_promise.set_value(bstring{data.view()});
+        };
+
+        opt::fragment_datagrams frag_dgram{8};
+
+        Address server_local{};
+        Address client_local{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(server_local, frag_dgram, recv_dgram_cb);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client = test_net.endpoint(client_local, frag_dgram, client_established);
+        auto conn_interface = client->connect(client_remote, client_tls);
+
+        REQUIRE(client_established.wait());
+        REQUIRE(conn_interface->get_max_datagram_size() >= msg.size());
+
+        conn_interface->send_datagram(bstring_view{msg});
+
+        require_future(data_future);
+        REQUIRE(data_future.get() == msg);
+        CHECK(capacity >= msg.size());
+    };
+
+    TEST_CASE("007 - Datagram support: Send sharing with streams", "[007][datagrams][execute][share]")
+    {
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        Network test_net{};
+
+        opt::enable_datagrams default_dgram{};
+
+        constexpr size_t n_dgrams = 100, dgram_size = 1000;
+        constexpr size_t stream_size = 4_Mi;
+
+        std::atomic<size_t> dgrams_received{0}, stream_received{0}, stream_at_last_dgram{0};
+        std::promise<void> dgrams_done, stream_done;
+        dgram_data_callback recv_dgram_cb = [&](dgram_interface&, bstring) {
+            if (++dgrams_received == n_dgrams)
+            {
+                stream_at_last_dgram = stream_received.load();
+                dgrams_done.set_value();
+            }
+        };
+        stream_data_callback stream_cb = [&](Stream&, bstring_view data) {
+            if ((stream_received += data.size()) == stream_size)
+                stream_done.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(Address{}, default_dgram, recv_dgram_cb);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, stream_cb));
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+        auto client = test_net.endpoint(Address{}, default_dgram, client_established);
+
+        REQUIRE_THROWS_AS(opt::send_share(DatagramShare::WEIGHTED, 1.5), std::invalid_argument);
+
+        opt::send_share share{};
+        bool datagrams_first = false;
+        bool weighted = false;
+        std::chrono::milliseconds min_dgram_time{0}, min_stream_time{0};
+
+        SECTION("Strict datagram priority")
+        {
+            share = opt::send_share{DatagramShare::STRICT};
+            datagrams_first = true;
+        }
+        SECTION("Weighted")
+        {
+            share = opt::send_share{DatagramShare::WEIGHTED, 0.75};
+            datagrams_first = true;
+            weighted = true;
+        }
+        SECTION("Datagram rate cap")
+        {
+            // 100kB at 200kB/s, less the initial burst
+            share = opt::send_share{DatagramShare::STRICT, 0.5, 200'000};
+            min_dgram_time = 400ms;
+        }
+        SECTION("Stream rate cap")
+        {
+            // 4MiB at 16MB/s, less the initial burst
+            share = opt::send_share{DatagramShare::ROUND_ROBIN, 0.5, 0, 16'000'000};
+            min_stream_time = 200ms;
+        }
+
+        auto conn = client->connect(client_remote, client_tls, share);
+        REQUIRE(client_established.wait());
+        auto stream = conn->open_stream();
+
+        // Queue everything at once, so that the first flush has both stream data and datagrams
+        auto started = std::chrono::steady_clock::now();
+        client->call_get([&] {
+            stream->send(bstring(stream_size, std::byte{'s'}));
+            for (size_t i = 0; i < n_dgrams; i++)
+                conn->send_datagram(bstring(dgram_size, std::byte{'d'}));
+        });
+
+        require_future(dgrams_done.get_future(), 5s);
+        auto dgram_time = std::chrono::steady_clock::now() - started;
+        require_future(stream_done.get_future(), 10s);
+        auto stream_time = std::chrono::steady_clock::now() - started;
+
+        if (datagrams_first)
+            // The datagrams didn't wait on the stream data queued ahead of them
+            CHECK(stream_at_last_dgram < stream_size / 2);
+        if (weighted)
+        {
+            // Each datagram takes a packet of its own, so by the time the last one arrived the
+            // stream should have had about a third as many packets (of 1.1-1.4kB of stream data
+            // each): well short of round robin's one each, but far more than STRICT's none.
+            CHECK(stream_at_last_dgram > n_dgrams / 5 * dgram_size);
+            CHECK(stream_at_last_dgram < n_dgrams / 2 * MAX_PMTUD_UDP_PAYLOAD);
+        }
+        CHECK(dgram_time >= min_dgram_time);
+        CHECK(stream_time >= min_stream_time);
+    };
 }  // namespace oxen::quic::test
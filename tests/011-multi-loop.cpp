@@ -0,0 +1,235 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers.hpp>
+#include <future>
+#include <map>
+#include <mutex>
+#include <oxen/quic.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <thread>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    using namespace std::literals;
+
+    TEST_CASE("011 - Multi-loop network", "[011][multiloop][execute]")
+    {
+        Network test_net{4};
+        REQUIRE(test_net.num_loops() == 4);
+
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+
+        std::shared_ptr<Endpoint> server_endpoint, client_endpoint;
+
+        std::promise<bool> d_promise;
+        std::future<bool> d_future = d_promise.get_future();
+
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view dat) {
+            log::debug(log_cat, "Calling server stream data callback... data received...");
+            REQUIRE(good_msg == dat);
+            d_promise.set_value(server_endpoint->in_event_loop() && !client_endpoint->in_event_loop());
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        client_endpoint = test_net.endpoint(client_local);
+
+        // Consecutive endpoints get pinned to different loops
+        REQUIRE(server_endpoint->loop_index() != client_endpoint->loop_index());
+
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        auto client_stream = conn_interface->open_stream();
+
+        REQUIRE_NOTHROW(client_stream->send(good_msg));
+
+        require_future(d_future);
+        REQUIRE(d_future.get());
+    };
+
+    TEST_CASE("011 - Event loop stats", "[011][multiloop][stats]")
+    {
+        Network test_net{2};
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+
+        // Totals over all reports, per loop
+        std::mutex m;
+        std::map<size_t, loop_stats> totals;
+        test_net.enable_loop_stats(
+                [&](const loop_stats& st) {
+                    std::lock_guard lock{m};
+                    auto& t = totals[st.loop_index];
+                    t.period += st.period;
+                    t.busy += st.busy;
+                    t.dispatch_us.count += st.dispatch_us.count;
+                    t.job_wait_us.count += st.job_wait_us.count;
+                    t.slow += st.slow;
+                    for (size_t i = 0; i < t.callbacks.size(); i++)
+                    {
+                        t.callbacks[i].calls += st.callbacks[i].calls;
+                        t.callbacks[i].total += st.callbacks[i].total;
+                    }
+                },
+                20ms,
+                2ms);
+
+        std::promise<void> d_promise;
+        auto d_future = d_promise.get_future();
+
+        // A slow callback, to be caught by the slow callback threshold
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view) {
+            std::this_thread::sleep_for(5ms);
+            d_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+        REQUIRE_NOTHROW(conn_interface->open_stream()->send(good_msg));
+        require_future(d_future);
+
+        // A job posted from outside the loop
+        client_endpoint->call_get([] {});
+
+        auto server_loop = server_endpoint->loop_index();
+        auto client_loop = client_endpoint->loop_index();
+        auto reported = [&] {
+            std::lock_guard lock{m};
+            return totals[server_loop][loop_callback::stream_data].calls > 0 &&
+                   totals[client_loop][loop_callback::connection].calls > 0 && totals[client_loop].job_wait_us.count > 0;
+        };
+        for (int i = 0; i < 100 && !reported(); i++)
+            std::this_thread::sleep_for(10ms);
+        REQUIRE(reported());
+
+        test_net.disable_loop_stats();
+
+        std::lock_guard lock{m};
+        auto& server = totals[server_loop];
+        CHECK(server.slow >= 1);
+        CHECK(server[loop_callback::stream_data].total >= 5ms);
+        CHECK(server.busy >= server[loop_callback::stream_data].total);
+        CHECK(server.busy <= server.period);
+        CHECK(server.dispatch_us.count > 0);
+
+        auto& client = totals[client_loop];
+        CHECK(client[loop_callback::job].calls > 0);
+        CHECK(client.dispatch_us.count > 0);
+    };
+
+    TEST_CASE("011 - Event loop stats toggling", "[011][multiloop][stats]")
+    {
+        // Enabling and disabling replaces each loop's collector from within a job that is itself
+        // being timed by it; this is mostly for the sanitizers' benefit.
+        std::atomic<int> reports{0};
+        {
+            Network test_net{2};
+            for (int i = 0; i < 20; i++)
+            {
+                test_net.enable_loop_stats([&](const loop_stats&) { reports++; }, 1ms);
+                test_net.enable_loop_stats([&](const loop_stats&) { reports++; }, 1ms);
+                std::this_thread::sleep_for(2ms);
+                test_net.disable_loop_stats();
+            }
+            test_net.enable_loop_stats([&](const loop_stats&) { reports++; }, 1ms);
+            std::this_thread::sleep_for(5ms);
+        }
+        CHECK(reports > 0);
+    };
+
+#ifdef __linux__
+    TEST_CASE("011 - SO_REUSEPORT endpoint group", "[011][multiloop][group]")
+    {
+        Network test_net{4};
+
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+        constexpr int n_clients = 8;
+
+        std::atomic<int> received{0};
+        std::promise<void> d_promise;
+        std::future<void> d_future = d_promise.get_future();
+
+        std::vector<std::shared_ptr<Endpoint>> group;
+
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view dat) {
+            REQUIRE(good_msg == dat);
+            // Every stream callback must be invoked on the loop of the member owning the connection
+            REQUIRE(s.endpoint.in_event_loop());
+            if (++received == n_clients)
+                d_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        group = test_net.endpoint_group(Address{"127.0.0.1"s, 0}, 4);
+        REQUIRE(group.size() == 4);
+
+        for (size_t i = 0; i < group.size(); i++)
+        {
+            REQUIRE(group[i]->in_group());
+            REQUIRE(group[i]->group_index() == i);
+            REQUIRE(group[i]->local() == group[0]->local());
+            REQUIRE_NOTHROW(group[i]->listen(server_tls, server_data_cb));
+        }
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, group[0]->local().port()};
+
+        std::vector<std::shared_ptr<Endpoint>> clients;
+        std::vector<std::shared_ptr<connection_interface>> conns;
+        std::vector<std::shared_ptr<Stream>> streams;
+
+        for (int i = 0; i < n_clients; i++)
+        {
+            auto& client = clients.emplace_back(test_net.endpoint(Address{}));
+            auto& conn = conns.emplace_back(client->connect(client_remote, client_tls));
+            auto& stream = streams.emplace_back(conn->open_stream());
+            REQUIRE_NOTHROW(stream->send(good_msg));
+        }
+
+        require_future(d_future, 5s);
+    };
+
+    TEST_CASE("011 - Loop thread pinning", "[011][multiloop][affinity]")
+    {
+        // Pin the loops to whichever CPU we're allowed to run on first
+        cpu_set_t allowed;
+        REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+        unsigned cpu = 0;
+        while (!CPU_ISSET(cpu, &allowed))
+            cpu++;
+
+        loop_thread_options opts;
+        opts.cpus = {{cpu}};
+        Network test_net{2, opts};
+
+        // Both loops share the single cpus entry
+        for (auto ep : {test_net.endpoint(Address{}), test_net.endpoint(Address{})})
+        {
+            bool pinned = ep->call_get([cpu] {
+                cpu_set_t set;
+                return pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 &&
+                       CPU_ISSET(cpu, &set);
+            });
+            CHECK(pinned);
+        }
+
+        opts.realtime_priority = 100;
+        CHECK_THROWS_AS((Network{1, opts}), std::invalid_argument);
+    };
+#endif
+}  // namespace oxen::quic::test
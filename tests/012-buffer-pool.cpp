@@ -0,0 +1,90 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    TEST_CASE("012 - Buffer pool", "[012][bufferpool]")
+    {
+        buffer_pool pool{1500, 4};
+        REQUIRE(pool.buffer_size() == 1500);
+        REQUIRE(pool.allocated() == 0);
+
+        SECTION("Buffers are recycled")
+        {
+            auto a = pool.acquire();
+            REQUIRE(a);
+            REQUIRE(a.capacity() == 1500);
+            REQUIRE(a.size() == 0);
+            REQUIRE(pool.allocated() == 4);
+            REQUIRE(pool.available() == 3);
+
+            auto* ptr = a.data();
+            a.reset();
+            REQUIRE_FALSE(a);
+            REQUIRE(pool.available() == 4);
+
+            auto b = pool.acquire();
+            REQUIRE(b.data() == ptr);
+            REQUIRE(pool.allocated() == 4);
+        }
+
+        SECTION("Pool grows by whole slabs")
+        {
+            std::vector<pooled_buffer> bufs;
+            for (int i = 0; i < 5; i++)
+                bufs.push_back(pool.acquire());
+            REQUIRE(pool.allocated() == 8);
+            REQUIRE(pool.available() == 3);
+
+            bufs.clear();
+            REQUIRE(pool.available() == 8);
+        }
+
+        SECTION("Copies share the buffer")
+        {
+            auto msg = "hello world"_bsv;
+            auto a = pool.copy(msg);
+            REQUIRE(a.view() == msg);
+            REQUIRE(a.use_count() == 1);
+
+            auto b = a;
+            REQUIRE(a.use_count() == 2);
+            REQUIRE(b.data() == a.data());
+
+            a.reset();
+            REQUIRE(b.use_count() == 1);
+            REQUIRE(b.view() == msg);
+            REQUIRE(pool.available() == 3);
+        }
+
+        SECTION("Oversized copies")
+        {
+            bstring big(1501, std::byte{'x'});
+            REQUIRE_THROWS_AS(pool.copy(big), std::length_error);
+            REQUIRE(pool.allocated() == 0);
+
+            // copy_any gives them a buffer of their own, outside the pool
+            auto a = pool.copy_any(big);
+            REQUIRE(a.view() == big);
+            REQUIRE(a.capacity() == big.size());
+            REQUIRE(pool.allocated() == 0);
+
+            auto b = pool.copy_any("small"_bsv);
+            REQUIRE(b.capacity() == 1500);
+            REQUIRE(pool.allocated() == 4);
+        }
+    }
+
+    TEST_CASE("012 - Buffers outlive their pool", "[012][bufferpool]")
+    {
+        pooled_buffer buf;
+        {
+            buffer_pool pool{64, 2};
+            buf = pool.copy("abc"_bsv);
+        }
+        REQUIRE(buf.view() == "abc"_bsv);
+        REQUIRE(buf.capacity() == 64);
+    }
+}  // namespace oxen::quic::test
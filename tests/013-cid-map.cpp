@@ -0,0 +1,131 @@
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+#include <oxen/quic/cid_map.hpp>
+#include <set>
+#include <thread>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    TEST_CASE("013 - CID lookup table", "[013][cidmap]")
+    {
+        cid_map<int> map;
+        REQUIRE(map.empty());
+
+        auto a = quic_cid::random();
+        auto b = quic_cid::random();
+        REQUIRE(map.find(a) == nullptr);
+        REQUIRE_FALSE(map.erase(a));
+
+        auto [v, inserted] = map.emplace(a, 1);
+        REQUIRE(inserted);
+        REQUIRE(*v == 1);
+        REQUIRE(map.size() == 1);
+
+        auto [v2, inserted2] = map.emplace(a, 2);
+        REQUIRE_FALSE(inserted2);
+        REQUIRE(*v2 == 1);
+
+        *map.insert_or_assign(a, 3) += 1;
+        REQUIRE(*map.find(a) == 4);
+        REQUIRE(map.find(b) == nullptr);
+
+        SECTION("CIDs of different lengths are distinct")
+        {
+            quic_cid shorter{a.data, a.datalen - 1};
+            REQUIRE(map.find(shorter) == nullptr);
+            map.emplace(shorter, 5);
+            REQUIRE(*map.find(shorter) == 5);
+            REQUIRE(*map.find(a) == 4);
+        }
+
+        SECTION("Every byte of a CID is hashed")
+        {
+            // The middle bytes of a maximum length CID are the ones not covered by its first and
+            // last 8 bytes
+            std::array<uint8_t, NGTCP2_MAX_CIDLEN> data{};
+            std::set<uint64_t> hashes;
+            for (int i = 0; i < 256; i++)
+            {
+                data[10] = static_cast<uint8_t>(i);
+                hashes.insert(TestHelper::cid_hash(map, quic_cid{data.data(), data.size()}));
+            }
+            REQUIRE(hashes.size() == 256);
+        }
+
+        SECTION("Erase")
+        {
+            REQUIRE(map.erase(a));
+            REQUIRE(map.find(a) == nullptr);
+            REQUIRE(map.empty());
+            REQUIRE_FALSE(map.erase(a));
+        }
+    }
+
+    TEST_CASE("013 - CID lookup table growth and churn", "[013][cidmap]")
+    {
+        cid_map<size_t> map;
+        std::vector<quic_cid> cids;
+        for (size_t i = 0; i < 5000; i++)
+        {
+            cids.push_back(quic_cid::random());
+            REQUIRE(map.emplace(cids.back(), i).second);
+        }
+        REQUIRE(map.size() == 5000);
+        REQUIRE(map.capacity() >= 5000);
+
+        for (size_t i = 0; i < cids.size(); i++)
+        {
+            auto* v = map.find(cids[i]);
+            REQUIRE(v);
+            REQUIRE(*v == i);
+        }
+
+        // Repeatedly replace half of the entries; tombstones must not make the table grow without
+        // bound or lose entries.
+        auto cap = map.capacity();
+        for (int round = 0; round < 20; round++)
+        {
+            for (size_t i = 0; i < cids.size(); i += 2)
+            {
+                REQUIRE(map.erase(cids[i]));
+                cids[i] = quic_cid::random();
+                REQUIRE(map.emplace(cids[i], i).second);
+            }
+        }
+        REQUIRE(map.size() == 5000);
+        REQUIRE(map.capacity() == cap);
+
+        for (size_t i = 0; i < cids.size(); i++)
+            REQUIRE(*map.find(cids[i]) == i);
+
+        map.clear();
+        REQUIRE(map.empty());
+        REQUIRE(map.find(cids[0]) == nullptr);
+    }
+
+    TEST_CASE("013 - Buffered random bytes", "[013][random]")
+    {
+        // Enough CIDs to go through the per-thread buffer several times
+        std::set<std::string> seen;
+        for (int i = 0; i < 1000; i++)
+            REQUIRE(seen.insert(quic_cid::random().to_string()).second);
+
+        // Requests too big for the buffer go straight to the RNG
+        std::array<unsigned char, 1000> big_a{}, big_b{};
+        REQUIRE(random_bytes(big_a.data(), big_a.size()));
+        REQUIRE(random_bytes(big_b.data(), big_b.size()));
+        CHECK(big_a != big_b);
+
+        // Each thread has its own buffer, so they must not hand out the same bytes
+        std::array<unsigned char, 32> here{}, there{};
+        REQUIRE(random_bytes(here.data(), here.size()));
+        bool ok = false;
+        std::thread t{[&] { ok = random_bytes(there.data(), there.size()); }};
+        t.join();
+        REQUIRE(ok);
+        CHECK(here != there);
+    }
+}  // namespace oxen::quic::test
@@ -0,0 +1,89 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    namespace
+    {
+        struct test_timer
+        {
+            std::optional<wheel_timer> timer;
+            std::chrono::steady_clock::time_point deadline;
+            std::optional<std::chrono::steady_clock::time_point> fired;
+            std::vector<int>* order;
+            int id;
+
+            static void fire(void* self_)
+            {
+                auto& self = *static_cast<test_timer*>(self_);
+                self.fired = get_time();
+                self.order->push_back(self.id);
+            }
+        };
+    }  // namespace
+
+    TEST_CASE("014 - Timer wheel", "[014][timerwheel]")
+    {
+        Network test_net;  // Sets up libevent threading, which the Loop needs
+        Loop loop;
+        std::vector<int> order;
+        std::deque<test_timer> timers;
+
+        // Delays spread across several wheel levels (the wheel tick is 250µs), given out of order
+        const std::vector<std::chrono::milliseconds> delays{40ms, 3ms, 0ms, 150ms, 20ms, 1ms, 700ms, 60ms};
+
+        std::promise<void> done;
+        test_timer last;
+
+        auto [scheduled, after_cancel] = loop.call_get([&] {
+            auto now = get_time();
+            for (size_t i = 0; i < delays.size(); i++)
+            {
+                auto& t = timers.emplace_back();
+                t.timer.emplace(loop.timers(), test_timer::fire, &t);
+                t.order = &order;
+                t.id = static_cast<int>(i);
+                t.deadline = now + delays[i];
+                t.timer->schedule(t.deadline);
+            }
+            auto n = loop.timers().size();
+
+            // Cancelled, and rescheduled timers
+            timers[1].timer->cancel();
+            timers[4].deadline = now + 90ms;
+            timers[4].timer->schedule(timers[4].deadline);
+            auto n2 = loop.timers().size();
+
+            last.timer.emplace(
+                    loop.timers(), [](void* p) { static_cast<std::promise<void>*>(p)->set_value(); }, &done);
+            last.timer->schedule(now + 800ms);
+            return std::make_pair(n, n2);
+        });
+        REQUIRE(scheduled == delays.size());
+        REQUIRE(after_cancel == delays.size() - 1);
+
+        REQUIRE(done.get_future().wait_for(5s) == std::future_status::ready);
+
+        auto remaining = loop.call_get([&] { return loop.timers().size(); });
+        REQUIRE(remaining == 0);
+        REQUIRE(order == std::vector<int>{2, 5, 0, 7, 4, 3, 6});
+        for (auto& t : timers)
+        {
+            if (t.id == 1)
+            {
+                REQUIRE_FALSE(t.fired);
+                continue;
+            }
+            REQUIRE(t.fired);
+            REQUIRE(*t.fired >= t.deadline);
+        }
+
+        loop.call_get([&] {
+            timers.clear();
+            last.timer.reset();
+        });
+        loop.stop();
+    }
+}  // namespace oxen::quic::test
@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    namespace
+    {
+        bstring_view as_view(const ngtcp2_vec& v)
+        {
+            return {reinterpret_cast<const std::byte*>(v.base), v.len};
+        }
+    }  // namespace
+
+    TEST_CASE("015 - Stream send buffer", "[015][streambuffer]")
+    {
+        stream_buffer buf;
+        std::array<ngtcp2_vec, 8> vecs;
+
+        REQUIRE(buf.empty());
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 0);
+
+        auto ka = std::make_shared<int>(42);
+        buf.append("hello"_bsv, ka);
+        buf.append(" "_bsv, nullptr);
+        buf.append("world"_bsv, nullptr);
+        REQUIRE(buf.size() == 11);
+        REQUIRE(buf.unsent() == 11);
+        REQUIRE(buf.num_buffers() == 3);
+        REQUIRE(ka.use_count() == 2);
+
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 3);
+        REQUIRE(as_view(vecs[0]) == "hello"_bsv);
+        REQUIRE(as_view(vecs[2]) == "world"_bsv);
+        REQUIRE(buf.fill(vecs.data(), 2) == 2);
+
+        // Partially sent buffers are offered from the first unsent byte
+        buf.wrote(3);
+        REQUIRE(buf.unacked() == 3);
+        REQUIRE(buf.unsent() == 8);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 3);
+        REQUIRE(as_view(vecs[0]) == "lo"_bsv);
+
+        buf.wrote(3);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "world"_bsv);
+
+        // Acknowledging drops fully acked buffers (and their keep-alives) without moving the cursor
+        buf.acknowledge(2);
+        REQUIRE(buf.num_buffers() == 3);
+        buf.acknowledge(3);
+        REQUIRE(buf.num_buffers() == 2);
+        REQUIRE(ka.use_count() == 1);
+        REQUIRE(buf.unacked() == 1);
+        REQUIRE(buf.size() == 5 + 1);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "world"_bsv);
+
+        buf.append("!"_bsv, nullptr);
+        buf.wrote(6);
+        REQUIRE(buf.unsent() == 0);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 0);
+
+        buf.acknowledge(7);
+        REQUIRE(buf.empty());
+        REQUIRE(buf.size() == 0);
+
+        buf.append("again"_bsv, nullptr);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "again"_bsv);
+    }
+
+    TEST_CASE("015 - Stream send buffer coalescing", "[015][streambuffer][coalesce]")
+    {
+        stream_buffer buf;
+        std::array<ngtcp2_vec, 8> vecs;
+
+        buf.set_coalescing(4);
+        REQUIRE(buf.coalescing() == 4);
+
+        // Small writes get copied (dropping the keep-alive right away) and merged together
+        auto ka = std::make_shared<int>(42);
+        buf.append("abc"_bsv, ka);
+        REQUIRE(ka.use_count() == 1);
+        buf.append("de"_bsv, nullptr);
+        REQUIRE(buf.num_buffers() == 1);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "abcde"_bsv);
+
+        // Larger writes are queued as-is, and break up the coalesced run
+        buf.append("fghij"_bsv, ka);
+        REQUIRE(ka.use_count() == 2);
+        buf.append("kl"_bsv, nullptr);
+        REQUIRE(buf.num_buffers() == 3);
+
+        // Partially sent buffers can still be extended
+        buf.wrote(5 + 5 + 1);
+        buf.append("mn"_bsv, nullptr);
+        REQUIRE(buf.num_buffers() == 3);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "lmn"_bsv);
+
+        // ... but fully sent ones cannot
+        buf.wrote(3);
+        buf.append("o"_bsv, nullptr);
+        REQUIRE(buf.num_buffers() == 4);
+        REQUIRE(buf.fill(vecs.data(), vecs.size()) == 1);
+        REQUIRE(as_view(vecs[0]) == "o"_bsv);
+
+        buf.wrote(1);
+        buf.acknowledge(15);
+        REQUIRE(buf.empty());
+        REQUIRE(ka.use_count() == 1);
+
+        buf.set_coalescing(0);
+        buf.append("p"_bsv, ka);
+        REQUIRE(ka.use_count() == 2);
+    }
+}  // namespace oxen::quic::test
@@ -0,0 +1,386 @@
+#include <catch2/catch_test_macros.hpp>
+
+#ifdef __linux__
+extern "C"
+{
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+#endif
+
+#include <oxen/quic.hpp>
+#include <thread>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    TEST_CASE("016 - Multi-path UDP send batch", "[016][udp][egress]")
+    {
+        Network test_net;  // Sets up libevent threading, which the Loop needs
+        Loop loop;
+
+        std::mutex m;
+        std::array<std::vector<std::string>, 2> received;
+        std::promise<void> all_received;
+        size_t n_received = 0;
+
+        auto recv_into = [&](size_t i) {
+            return [&, i](Packet&& pkt) {
+                std::lock_guard lock{m};
+                received[i].emplace_back(reinterpret_cast<const char*>(pkt.data.data()), pkt.data.size());
+                if (++n_received == 6)
+                    all_received.set_value();
+            };
+        };
+
+        std::unique_ptr<UDPSocket> a, b, sender;
+        auto [rv, sent] = loop.call_get([&] {
+            auto* ev = loop.loop().get();
+            a = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, recv_into(0));
+            b = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, recv_into(1));
+            sender = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, [](Packet&&) {});
+
+            // Runs of various lengths and sizes, alternating between two destinations
+            Path to_a{sender->address(), a->address()}, to_b{sender->address(), b->address()};
+            const std::string data = "aaaabbbbccccddddXYZ12345";
+            const std::array<size_t, 6> sizes{4, 4, 4, 4, 3, 5};
+            const std::array<UDPSocket::send_run, 4> runs{{{&to_a, 0, 2}, {&to_b, 0, 2}, {&to_a, 0, 1}, {&to_b, 0, 1}}};
+
+            return sender->send(runs.data(), runs.size(), reinterpret_cast<const std::byte*>(data.data()), sizes.data());
+        });
+
+        REQUIRE(rv.success());
+        REQUIRE(sent == 6);
+        require_future(all_received.get_future());
+        {
+            std::lock_guard lock{m};
+            REQUIRE(received[0] == std::vector<std::string>{"aaaa", "bbbb", "XYZ"});
+            REQUIRE(received[1] == std::vector<std::string>{"cccc", "dddd", "12345"});
+        }
+
+        loop.call_get([&] {
+            a.reset();
+            b.reset();
+            sender.reset();
+        });
+        loop.stop();
+    }
+
+    TEST_CASE("016 - UDP socket buffers and receive drop counting", "[016][udp][sockopts]")
+    {
+        Network test_net;
+        Loop loop;
+
+        std::atomic<size_t> n_received{0};
+        std::unique_ptr<UDPSocket> receiver, sender;
+        loop.call_get([&] {
+            auto* ev = loop.loop().get();
+            // A tiny receive buffer, so that a burst overflows it
+            receiver = std::make_unique<UDPSocket>(
+                    ev, Address{"127.0.0.1", 0}, [&](Packet&&) { n_received++; }, false, opt::socket_options{4096});
+            sender = std::make_unique<UDPSocket>(
+                    ev, Address{"127.0.0.1", 0}, [](Packet&&) {}, false, opt::socket_options{1_Mi, 1_Mi});
+        });
+
+        const Path path{sender->address(), receiver->address()};
+        const std::string data(1000, 'x');
+        const size_t size = data.size();
+        auto send_one = [&] { sender->send(path, reinterpret_cast<const std::byte*>(data.data()), &size, 0, 1); };
+
+        // The receiver can't read while we hold up its loop with the burst
+        loop.call_get([&] {
+            for (int i = 0; i < 200; i++)
+                send_one();
+        });
+
+        for (int i = 0; i < 100 && n_received == 0; i++)
+            std::this_thread::sleep_for(10ms);
+        REQUIRE(n_received > 0);
+        REQUIRE(n_received < 200);
+
+#ifdef __linux__
+        // The drops are reported along with the next packet to get through
+        loop.call_get(send_one);
+        for (int i = 0; i < 100 && receiver->stats().receive_dropped == 0; i++)
+            std::this_thread::sleep_for(10ms);
+        auto stats = receiver->stats();
+        CHECK(stats.receive_dropped > 0);
+        CHECK(stats.receive_dropped + stats.packets_received == 201);
+#endif
+
+        loop.call_get([&] {
+            receiver.reset();
+            sender.reset();
+        });
+        loop.stop();
+    }
+
+#ifdef __linux__
+    TEST_CASE("016 - UDP kernel receive timestamps", "[016][udp][timestamps]")
+    {
+        Network test_net;
+        Loop loop;
+
+        std::mutex m;
+        std::vector<std::chrono::nanoseconds> delays;
+        std::promise<void> all_received;
+        opt::socket_options sockopts{};
+        sockopts.rx_timestamps = RxTimestamps::SOFTWARE;
+
+        std::unique_ptr<UDPSocket> receiver, sender;
+        loop.call_get([&] {
+            auto* ev = loop.loop().get();
+            auto on_packet = [&](Packet&& pkt) {
+                std::lock_guard lock{m};
+                delays.push_back(pkt.received.count() ? get_timestamp() - pkt.received : 0ns);
+                if (delays.size() == 10)
+                    all_received.set_value();
+            };
+            receiver = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, on_packet, false, sockopts);
+            sender = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, [](Packet&&) {});
+        });
+
+        const Path path{sender->address(), receiver->address()};
+        const std::string data(100, 'x');
+        const size_t size = data.size();
+
+        // Hold up the receiver's loop after sending: the packets' timestamps should be from when
+        // they arrived, not from when we got around to reading them.
+        auto sent = get_timestamp();
+        loop.call_get([&] {
+            for (int i = 0; i < 10; i++)
+                sender->send(path, reinterpret_cast<const std::byte*>(data.data()), &size, 0, 1);
+            std::this_thread::sleep_for(50ms);
+        });
+
+        require_future(all_received.get_future());
+        auto elapsed = get_timestamp() - sent;
+        {
+            std::lock_guard lock{m};
+            for (auto d : delays)
+            {
+                CHECK(d >= 50ms);
+                CHECK(d <= elapsed);
+            }
+        }
+
+        auto stats = receiver->stats();
+        CHECK(stats.receive_delay_us.count == 10);
+        CHECK(stats.receive_delay_us.max >= 50'000);
+
+        loop.call_get([&] {
+            receiver.reset();
+            sender.reset();
+        });
+        loop.stop();
+    }
+
+    TEST_CASE("016 - QUIC transfer with kernel receive timestamps", "[016][udp][timestamps]")
+    {
+        Network test_net;
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        opt::socket_options sockopts{};
+        sockopts.rx_timestamps = RxTimestamps::SOFTWARE;
+
+        // Enough data, with slow enough handling of it, that packets routinely arrive while we're
+        // busy and get read (with their earlier receive times) after we've sent in the meantime.
+        constexpr size_t size = 1_Mi;
+        std::string msg(size, 'x');
+
+        std::atomic<size_t> echoed{0};
+        std::promise<void> all_echoed;
+        stream_data_callback client_data_cb = [&](Stream&, bstring_view data) {
+            if ((echoed += data.size()) == size)
+                all_echoed.set_value();
+        };
+        stream_data_callback server_data_cb = [&](Stream& s, bstring_view data) {
+            std::this_thread::sleep_for(100us);
+            s.send(bstring{data});
+        };
+
+        auto server = test_net.endpoint(Address{"127.0.0.1", 0}, sockopts);
+        REQUIRE_NOTHROW(server->listen(server_tls, server_data_cb));
+        auto client = test_net.endpoint(Address{"127.0.0.1", 0}, sockopts);
+
+        RemoteAddress server_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server->local().port()};
+        auto conn = client->connect(server_remote, client_tls, client_data_cb);
+        conn->open_stream()->send(std::move(msg));
+
+        require_future(all_echoed.get_future(), 10s);
+        CHECK(server->stats().socket.receive_delay_us.count > 0);
+        CHECK(client->stats().socket.receive_delay_us.count > 0);
+        CHECK(conn->stats().smoothed_rtt > 0ns);
+    }
+
+    TEST_CASE("016 - UDP GSO send failure falls back to sendmmsg", "[016][udp][gso]")
+    {
+        Network test_net;
+        Loop loop;
+
+        constexpr size_t n_pkts = 10, size = 1000;
+        std::mutex m;
+        std::vector<std::string> received;
+        std::promise<void> first_batch, second_batch;
+
+        std::unique_ptr<UDPSocket> receiver, sender;
+        loop.call_get([&] {
+            auto* ev = loop.loop().get();
+            receiver = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, [&](Packet&& pkt) {
+                std::lock_guard lock{m};
+                received.emplace_back(reinterpret_cast<const char*>(pkt.data.data()), pkt.data.size());
+                if (received.size() == n_pkts)
+                    first_batch.set_value();
+                else if (received.size() == 2 * n_pkts)
+                    second_batch.set_value();
+            });
+            sender = std::make_unique<UDPSocket>(ev, Address{"127.0.0.1", 0}, [](Packet&&) {});
+        });
+
+        auto cleanup = [&] {
+            loop.call_get([&] {
+                receiver.reset();
+                sender.reset();
+            });
+            loop.stop();
+        };
+        if (sender->send_backend() != SendBackend::GSO)
+        {
+            cleanup();
+            SKIP("UDP GSO is not available in this build or on this kernel");
+        }
+        if (sender->io_uring_enabled())
+        {
+            // io_uring reports the failure when the send completes, by which time that batch is
+            // lost; the fallback is only guaranteed not to drop anything for direct sends.
+            cleanup();
+            SKIP("GSO send failures are asynchronous with io_uring");
+        }
+
+        // The kernel still accepts UDP_SEGMENT, but now fails the actual GSO send
+        TestHelper::disable_udp_checksums(*sender);
+
+        const Path path{sender->address(), receiver->address()};
+        std::string data;
+        for (size_t i = 0; i < n_pkts; i++)
+            data.append(size, static_cast<char>('a' + i));
+        const std::vector<size_t> sizes(n_pkts, size);
+        auto send_all = [&] {
+            return loop.call_get([&] {
+                return sender->send(path, reinterpret_cast<const std::byte*>(data.data()), sizes.data(), 0, n_pkts);
+            });
+        };
+
+        auto [rv, sent] = send_all();
+        CHECK(rv.success());
+        CHECK(sent == n_pkts);
+        CHECK(sender->send_backend() == SendBackend::SENDMMSG);
+        require_future(first_batch.get_future());
+
+        // And it stays off GSO from then on
+        std::tie(rv, sent) = send_all();
+        CHECK(rv.success());
+        CHECK(sent == n_pkts);
+        CHECK(sender->send_backend() == SendBackend::SENDMMSG);
+        require_future(second_batch.get_future());
+
+        {
+            std::lock_guard lock{m};
+            REQUIRE(received.size() == 2 * n_pkts);
+            for (size_t i = 0; i < 2 * n_pkts; i++)
+                CHECK(received[i] == std::string(size, static_cast<char>('a' + i % n_pkts)));
+        }
+        CHECK(sender->stats().packets_sent == 2 * n_pkts);
+
+        cleanup();
+    }
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+    TEST_CASE("016 - UDP GRO receive splitting", "[016][udp][gro]")
+    {
+        Network test_net;
+        Loop loop;
+
+        // Ten full segments and a short one, each filled with its own index so that we can tell
+        // them apart (and that they came out in order) on the other side
+        constexpr size_t seg_size = 1000, n_full = 10, last_size = 300;
+        std::string data;
+        for (size_t i = 0; i <= n_full; i++)
+            data.append(i < n_full ? seg_size : last_size, static_cast<char>('a' + i));
+
+        std::mutex m;
+        std::vector<std::string> received;
+        std::vector<const std::byte*> starts;
+        std::promise<void> all_received;
+
+        std::unique_ptr<UDPSocket> receiver;
+        loop.call_get([&] {
+            receiver = std::make_unique<UDPSocket>(loop.loop().get(), Address{"127.0.0.1", 0}, [&](Packet&& pkt) {
+                std::lock_guard lock{m};
+                received.emplace_back(reinterpret_cast<const char*>(pkt.data.data()), pkt.data.size());
+                starts.push_back(pkt.data.data());
+                if (received.size() == n_full + 1)
+                    all_received.set_value();
+            });
+        });
+        if (!receiver->gro_enabled())
+        {
+            loop.call_get([&] { receiver.reset(); });
+            SKIP("UDP GRO is not supported by this kernel");
+        }
+
+        // Send everything with a single UDP_SEGMENT sendmsg (rather than through a UDPSocket,
+        // which never puts a short packet into a GSO batch): over loopback this reaches the GRO
+        // receiver as one coalesced buffer, with the segment size in a UDP_GRO cmsg.
+        int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        REQUIRE(fd >= 0);
+        Address dest = receiver->address();
+        iovec iov{data.data(), data.size()};
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(uint16_t))> control{};
+        msghdr hdr{};
+        hdr.msg_name = static_cast<sockaddr*>(dest);
+        hdr.msg_namelen = dest.socklen();
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control.data();
+        hdr.msg_controllen = control.size();
+        auto* cm = CMSG_FIRSTHDR(&hdr);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = seg_size;
+        std::memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        auto rv = ::sendmsg(fd, &hdr, 0);
+        int err = errno;
+        ::close(fd);
+        if (rv < 0 && (err == EIO || err == EINVAL || err == ENOPROTOOPT))
+        {
+            loop.call_get([&] { receiver.reset(); });
+            SKIP("UDP GSO is not supported by this kernel");
+        }
+        REQUIRE(rv == static_cast<ssize_t>(data.size()));
+
+        require_future(all_received.get_future());
+        {
+            std::lock_guard lock{m};
+            REQUIRE(received.size() == n_full + 1);
+            for (size_t i = 0; i <= n_full; i++)
+                CHECK(received[i] == std::string(i < n_full ? seg_size : last_size, static_cast<char>('a' + i)));
+
+            // They were all split out of the one receive buffer, rather than read one at a time
+            for (size_t i = 1; i <= n_full; i++)
+                CHECK(starts[i] == starts[i - 1] + seg_size);
+        }
+
+        auto stats = receiver->stats();
+        CHECK(stats.packets_received == n_full + 1);
+        CHECK(stats.bytes_received == data.size());
+
+        loop.call_get([&] { receiver.reset(); });
+        loop.stop();
+    }
+#endif
+#endif
+}  // namespace oxen::quic::test
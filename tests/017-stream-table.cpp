@@ -0,0 +1,113 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    namespace
+    {
+        std::vector<int64_t> ids(const stream_table<int64_t>& t)
+        {
+            std::vector<int64_t> out;
+            t.for_each([&out](const std::shared_ptr<int64_t>& s) { out.push_back(*s); });
+            return out;
+        }
+
+        void add(stream_table<int64_t>& t, int64_t id)
+        {
+            t.insert(id, std::make_shared<int64_t>(id));
+        }
+    }  // namespace
+
+    TEST_CASE("017 - Stream table", "[017][streamtable]")
+    {
+        stream_table<int64_t> t;
+        REQUIRE(t.empty());
+        REQUIRE(t.find(0) == nullptr);
+
+        // Streams of different types, inserted out of order
+        for (int64_t id : {8, 0, 1, 4, 5, 13})
+            add(t, id);
+        REQUIRE(t.size() == 6);
+        REQUIRE(ids(t) == std::vector<int64_t>{0, 4, 8, 1, 5, 13});
+        REQUIRE(**t.find(4) == 4);
+        REQUIRE(**t.find(13) == 13);
+        REQUIRE(t.find(9) == nullptr);
+        REQUIRE(t.find(12) == nullptr);
+        REQUIRE(*t.front() == 0);
+
+        REQUIRE(*t.extract(4) == 4);
+        REQUIRE(t.extract(4) == nullptr);
+        REQUIRE(t.find(4) == nullptr);
+        REQUIRE(*t.extract(0) == 0);
+        REQUIRE(*t.front() == 8);
+        REQUIRE(ids(t) == std::vector<int64_t>{8, 1, 5, 13});
+
+        t.clear();
+        REQUIRE(t.empty());
+        REQUIRE(t.slot_count() == 0);
+    }
+
+    TEST_CASE("017 - Stream table compaction", "[017][streamtable]")
+    {
+        stream_table<int64_t> t;
+
+        // A long-lived stream followed by a long run of short-lived ones shouldn't keep slots for
+        // all of the closed streams around.
+        add(t, 0);
+        for (int64_t id = 4; id < 4 * 10'000; id += 4)
+        {
+            add(t, id);
+            if (id >= 8)
+                REQUIRE(t.extract(id - 4) != nullptr);
+        }
+        REQUIRE(t.size() == 2);
+        REQUIRE(t.slot_count() <= stream_table<int64_t>::COMPACT_MIN + 2);
+        REQUIRE(ids(t) == std::vector<int64_t>{0, 4 * 9'999});
+        REQUIRE(**t.find(0) == 0);
+        REQUIRE(*t.front() == 0);
+
+        // Streams below the window still get found, and iterated in order
+        add(t, 40);
+        add(t, 4 * 9'990);
+        REQUIRE(ids(t) == std::vector<int64_t>{0, 40, 4 * 9'990, 4 * 9'999});
+        REQUIRE(**t.find(40) == 40);
+
+        for (int64_t id : {0, 40, 4 * 9'990, 4 * 9'999})
+            REQUIRE(*t.extract(id) == id);
+        REQUIRE(t.empty());
+        REQUIRE(t.slot_count() == 0);
+    }
+
+    TEST_CASE("017 - Stream table restarting a window above overflow streams", "[017][streamtable]")
+    {
+        stream_table<int64_t> t;
+
+        // Get a long-lived stream moved into the overflow map, then close everything after it
+        add(t, 400);
+        int64_t last = 404;
+        add(t, last);
+        for (int64_t id = 408; id < 4 * 1'000; id += 4)
+        {
+            add(t, id);
+            REQUIRE(t.extract(last) != nullptr);
+            last = id;
+        }
+        REQUIRE(t.extract(last) != nullptr);
+        REQUIRE(ids(t) == std::vector<int64_t>{400});
+
+        // New streams on either side of it must not start a window that covers it
+        add(t, 4);
+        add(t, 4 * 500);
+        add(t, 8);
+        REQUIRE(ids(t) == std::vector<int64_t>{4, 8, 400, 4 * 500});
+        for (int64_t id : {4, 8, 400, 4 * 500})
+            REQUIRE(**t.find(id) == id);
+        REQUIRE(*t.front() == 4);
+
+        for (int64_t id : {400, 4, 4 * 500, 8})
+            REQUIRE(*t.extract(id) == id);
+        REQUIRE(t.empty());
+    }
+}  // namespace oxen::quic::test
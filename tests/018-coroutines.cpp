@@ -0,0 +1,124 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+#include <oxen/quic/coro.hpp>
+
+#include "utils.hpp"
+
+// Built only into the C++20 `corotests` binary (see CMakeLists.txt)
+#ifdef __cpp_impl_coroutine
+
+namespace oxen::quic::test
+{
+    TEST_CASE("018 - Coroutine BT requests", "[018][coro][bparser]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        stream_constructor_callback server_constructor = [&](Connection& c, Endpoint& e, std::optional<int64_t>) {
+            auto s = e.make_shared<BTRequestStream>(c, e);
+            s->register_handler("echo"s, [](message msg) { msg.respond("re: {}"_format(msg.body())); });
+            return s;
+        };
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_constructor));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+
+        struct results
+        {
+            std::vector<std::string> responses;
+            bool timed_out = false;
+            bool drained = false;
+            bool on_loop = true;
+        };
+        std::promise<results> done_p;
+        auto done_f = done_p.get_future();
+
+        auto run = [&]() -> coro::task {
+            results r;
+            auto conn = co_await coro::connect(*client_endpoint, client_remote, client_tls);
+            r.on_loop &= client_endpoint->in_event_loop();
+
+            auto bt = conn->open_stream<BTRequestStream>();
+            for (int i = 0; i < 3; i++)
+            {
+                auto m = co_await coro::request(*bt, "echo", "{}"_format(i));
+                r.on_loop &= client_endpoint->in_event_loop();
+                r.responses.emplace_back(m.body());
+            }
+
+            // Nobody handles this one, so it times out
+            auto m = co_await coro::request(*bt, "nope", ""sv, 100ms);
+            r.timed_out = m.timed_out;
+
+            r.drained = co_await coro::drained(*bt);
+            r.on_loop &= client_endpoint->in_event_loop();
+            done_p.set_value(std::move(r));
+        };
+        run();
+
+        require_future(done_f);
+        auto r = done_f.get();
+        CHECK(r.responses == std::vector<std::string>{"re: 0", "re: 1", "re: 2"});
+        CHECK(r.timed_out);
+        CHECK(r.drained);
+        CHECK(r.on_loop);
+    }
+
+    TEST_CASE("018 - Coroutine stream reads", "[018][coro][stream]")
+    {
+        Network test_net{};
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        Address server_local{};
+        Address client_local{};
+
+        // The server echoes everything back, except that it closes the stream on "bye"
+        stream_data_callback server_data_cb = [](Stream& s, bstring_view data) {
+            if (data == "bye"_bsv)
+                s.close(42);
+            else
+                s.send(bstring{data});
+        };
+
+        auto server_endpoint = test_net.endpoint(server_local);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(client_local);
+        auto conn = client_endpoint->connect(client_remote, client_tls);
+
+        std::promise<std::pair<bstring, uint64_t>> done_p;
+        auto done_f = done_p.get_future();
+
+        auto run = [&]() -> coro::task {
+            co_await coro::on_loop(*client_endpoint);
+
+            coro::stream_reader reader;
+            auto s = conn->open_stream<Stream>(reader.data_callback(), reader.close_callback());
+            s->send("hello"s);
+            auto echo = co_await reader.read();
+
+            s->send("bye"s);
+            auto after_close = co_await reader.read();
+            done_p.set_value({echo.value_or(bstring{}), after_close ? 0 : reader.close_code()});
+        };
+        run();
+
+        require_future(done_f);
+        auto [received, code] = done_f.get();
+        CHECK(received == "hello"_bsv);
+        CHECK(code == 42);
+    }
+}  // namespace oxen::quic::test
+
+#endif
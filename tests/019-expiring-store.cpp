@@ -0,0 +1,109 @@
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+#include <oxen/quic/expiring_store.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    TEST_CASE("019 - Expiring store", "[019][expiringstore]")
+    {
+        using clock = std::chrono::steady_clock;
+        const auto t0 = clock::now();
+
+        expiring_store<ustring> store{10s, 100};
+        auto a = "key a"_usv;
+        auto b = "a somewhat longer key b"_usv;
+
+        REQUIRE(store.find(a, t0) == nullptr);
+        store.insert_or_assign(a, ustring{"1"_usv}, t0);
+        REQUIRE(store.find(a, t0));
+        CHECK(*store.find(a, t0) == "1"_usv);
+        CHECK(store.find(b, t0) == nullptr);
+
+        store.insert_or_assign(a, ustring{"2"_usv}, t0 + 1s);
+        CHECK(*store.find(a, t0 + 1s) == "2"_usv);
+        CHECK(store.size() == 1);
+
+        SECTION("Entries expire after one to two lifetimes")
+        {
+            store.insert_or_assign(b, ustring{"3"_usv}, t0 + 9s);
+
+            // After one lifetime both are still there, in the previous generation
+            CHECK(store.find(a, t0 + 10s));
+            CHECK(store.find(b, t0 + 19s));
+            CHECK(store.size() == 2);
+
+            // Both were stored in the first generation, so both go when it is dropped
+            CHECK(store.find(a, t0 + 20s) == nullptr);
+            CHECK(store.find(b, t0 + 20s) == nullptr);
+            CHECK(store.size() == 0);
+        }
+
+        SECTION("Everything expires after a long gap")
+        {
+            CHECK(store.find(a, t0 + 1h) == nullptr);
+            CHECK(store.size() == 0);
+        }
+
+        SECTION("Replacing moves an entry to the current generation")
+        {
+            store.insert_or_assign(a, ustring{"4"_usv}, t0 + 15s);
+            CHECK(store.size() == 1);
+            CHECK(*store.find(a, t0 + 25s) == "4"_usv);
+            CHECK(store.find(a, t0 + 30s) == nullptr);
+        }
+
+        SECTION("Erase")
+        {
+            store.erase(a);
+            CHECK(store.find(a, t0) == nullptr);
+        }
+
+        SECTION("Empty keys")
+        {
+            // Including one with no data pointer at all, as a default-constructed view has
+            ustring_view empty;
+            CHECK(store.find(empty, t0) == nullptr);
+            store.insert_or_assign(empty, ustring{"5"_usv}, t0);
+            REQUIRE(store.find(""_usv, t0));
+            CHECK(*store.find(""_usv, t0) == "5"_usv);
+            CHECK(*store.find(a, t0) == "2"_usv);
+            CHECK(store.size() == 2);
+        }
+    }
+
+    TEST_CASE("019 - Expiring store: Bounded", "[019][expiringstore][bounded]")
+    {
+        using clock = std::chrono::steady_clock;
+        const auto t0 = clock::now();
+
+        auto key = [](int i) { return ustring{to_usv("key {}"_format(i))}; };
+
+        SECTION("insert refuses new keys when full")
+        {
+            expiring_store<> seen{10s, 10};
+            for (int i = 0; i < 10; i++)
+                REQUIRE(seen.insert(key(i), {}, t0));
+            CHECK_FALSE(seen.insert(key(3), {}, t0));
+            CHECK_FALSE(seen.insert(key(10), {}, t0));
+            CHECK(seen.size() == 10);
+
+            // Once the generation rotates there is room again, and old keys are still remembered
+            CHECK(seen.insert(key(10), {}, t0 + 10s));
+            CHECK_FALSE(seen.insert(key(0), {}, t0 + 10s));
+            CHECK(seen.size() == 11);
+        }
+
+        SECTION("insert_or_assign drops the oldest entries when full")
+        {
+            expiring_store<int> store{10s, 10};
+            for (int i = 0; i < 25; i++)
+                store.insert_or_assign(key(i), i, t0);
+            CHECK(store.size() <= 20);
+            CHECK(store.find(key(0), t0) == nullptr);
+            REQUIRE(store.find(key(24), t0));
+            CHECK(*store.find(key(24), t0) == 24);
+        }
+    }
+}  // namespace oxen::quic::test
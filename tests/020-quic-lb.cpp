@@ -0,0 +1,138 @@
+#include <catch2/catch_test_macros.hpp>
+#include <future>
+#include <oxen/quic.hpp>
+#include <oxen/quic/cid_generator.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    using namespace std::literals;
+
+    TEST_CASE("020 - QUIC-LB connection IDs: Encoding", "[020][quiclb][encoding]")
+    {
+        auto server_id = "\x01\x02\x03"_usv;
+
+        SECTION("Plaintext")
+        {
+            quic_lb_cid_generator gen{2, server_id, 8};
+            REQUIRE(gen.length() == 12);
+
+            std::array<uint8_t, 12> a, b;
+            REQUIRE(gen.generate(a.data()));
+            REQUIRE(gen.generate(b.data()));
+
+            CHECK(a[0] >> 5 == 2);
+            CHECK(ustring_view{a.data() + 1, 3} == server_id);
+            CHECK(ustring_view{a.data() + 4, 8} != ustring_view{b.data() + 4, 8});
+            CHECK(gen.decode_server_id({a.data(), a.size()}) == ustring{server_id});
+
+            // Wrong config ID or length isn't ours
+            auto other = a;
+            other[0] ^= 0x20;
+            CHECK_FALSE(gen.decode_server_id({other.data(), other.size()}));
+            CHECK_FALSE(gen.decode_server_id({a.data(), a.size() - 1}));
+        }
+
+        SECTION("Self-encoded length")
+        {
+            quic_lb_cid_generator gen{0, server_id, 8, {}, true};
+            std::array<uint8_t, 12> cid;
+            REQUIRE(gen.generate(cid.data()));
+            CHECK(cid[0] == 11);
+        }
+
+        SECTION("Encrypted")
+        {
+            auto key = "0123456789abcdef"_usv;
+            quic_lb_cid_generator gen{1, server_id, 13, key};
+            REQUIRE(gen.length() == 17);
+
+            std::array<uint8_t, 17> a, b;
+            REQUIRE(gen.generate(a.data()));
+            REQUIRE(gen.generate(b.data()));
+
+            CHECK(a[0] >> 5 == 1);
+            // The server ID is hidden, and differs between CIDs
+            CHECK(ustring_view{a.data() + 1, 3} != server_id);
+            CHECK(ustring_view{a.data() + 1, 3} != ustring_view{b.data() + 1, 3});
+            CHECK(gen.decode_server_id({a.data(), a.size()}) == ustring{server_id});
+            CHECK(gen.decode_server_id({b.data(), b.size()}) == ustring{server_id});
+
+            quic_lb_cid_generator wrong_key{1, server_id, 13, "fedcba9876543210"_usv};
+            CHECK(wrong_key.decode_server_id({a.data(), a.size()}) != ustring{server_id});
+        }
+
+        SECTION("Invalid configurations")
+        {
+            CHECK_THROWS_AS((quic_lb_cid_generator{7, server_id, 8}), std::invalid_argument);
+            CHECK_THROWS_AS((quic_lb_cid_generator{0, ""_usv, 8}), std::invalid_argument);
+            CHECK_THROWS_AS((quic_lb_cid_generator{0, server_id, 3}), std::invalid_argument);
+            CHECK_THROWS_AS((quic_lb_cid_generator{0, server_id, 17}), std::invalid_argument);
+            CHECK_THROWS_AS((quic_lb_cid_generator{0, server_id, 8, "short key"_usv}), std::invalid_argument);
+            CHECK_THROWS_AS((quic_lb_cid_generator{0, server_id, 8, "0123456789abcdef"_usv}), std::invalid_argument);
+            CHECK_THROWS_AS(opt::connection_id_generator{nullptr}, std::invalid_argument);
+        }
+    }
+
+    TEST_CASE("020 - QUIC-LB connection IDs: Connections", "[020][quiclb][execute]")
+    {
+        Network test_net{};
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+        auto server_id = "\xaa\xbb\xcc\xdd"_usv;
+
+        std::shared_ptr<quic_lb_cid_generator> gen;
+        SECTION("Plaintext")
+        {
+            gen = std::make_shared<quic_lb_cid_generator>(3, server_id, 6);
+        }
+        SECTION("Encrypted")
+        {
+            gen = std::make_shared<quic_lb_cid_generator>(3, server_id, 12, "0123456789abcdef"_usv);
+        }
+
+        std::promise<void> d_promise;
+        auto d_future = d_promise.get_future();
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view dat) {
+            if (dat == good_msg)
+                d_promise.set_value();
+        };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_established = callback_waiter{[](connection_interface&) {}};
+        auto server_endpoint = test_net.endpoint(Address{}, opt::connection_id_generator{gen}, server_established);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls);
+
+        // Short header packets to the server carry its (non-default length) CIDs
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(good_msg));
+        require_future(d_future);
+        REQUIRE(server_established.wait());
+
+        auto server_conns = server_endpoint->get_all_conns(Direction::INBOUND);
+        REQUIRE(server_conns.size() == 1);
+        auto scids = TestHelper::get_scids(*server_conns.front());
+        REQUIRE(scids.size() > 1);
+        for (auto& cid : scids)
+        {
+            CHECK(cid.datalen == gen->length());
+            CHECK(gen->decode_server_id({cid.data, cid.datalen}) == ustring{server_id});
+        }
+    }
+
+    TEST_CASE("020 - QUIC-LB connection IDs: Endpoint groups", "[020][quiclb][group]")
+    {
+        Network test_net{};
+        auto gen = std::make_shared<quic_lb_cid_generator>(0, "\x01"_usv, 8);
+        CHECK_THROWS_AS(
+                test_net.endpoint_group(Address{"127.0.0.1"s, 0}, 2, opt::connection_id_generator{gen}),
+                std::invalid_argument);
+    }
+}  // namespace oxen::quic::test
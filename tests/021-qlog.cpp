@@ -0,0 +1,137 @@
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <oxen/quic.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <oxen/quic/qlog.hpp>
+#include <thread>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    using namespace std::literals;
+
+    // Makes a connection with qlog output through `writer` on both sides, and sends a message.
+    static void qlog_transmission(std::shared_ptr<qlog_writer> writer)
+    {
+        Network test_net{};
+        auto good_msg = "hello from the other siiiii-iiiiide"_bsv;
+
+        std::promise<void> d_promise;
+        auto d_future = d_promise.get_future();
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view) { d_promise.set_value(); };
+
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        auto server_endpoint = test_net.endpoint(Address{});
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls, server_data_cb, opt::qlog{writer}));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+
+        auto client_endpoint = test_net.endpoint(Address{});
+        auto conn_interface = client_endpoint->connect(client_remote, client_tls, opt::qlog{writer});
+
+        auto client_stream = conn_interface->open_stream();
+        REQUIRE_NOTHROW(client_stream->send(good_msg));
+        require_future(d_future);
+    }
+
+    TEST_CASE("021 - qlog output", "[021][qlog]")
+    {
+        SECTION("Callback")
+        {
+            std::mutex m;
+            std::map<std::string, std::string> traces;
+            std::map<std::string, int> fins;
+            int n_fins = 0;
+            std::promise<void> all_finished;
+
+            auto writer = std::make_shared<qlog_writer>([&](std::string_view id, std::string_view data, bool fin) {
+                std::lock_guard lock{m};
+                traces[std::string{id}] += data;
+                fins[std::string{id}] += fin;
+                if (fin && ++n_fins == 2)
+                    all_finished.set_value();
+            });
+
+            qlog_transmission(writer);
+            // Destroying the writer (now that the Network, and so the connections, are gone) doesn't
+            // wait, but leaves its thread to deliver the rest of the output
+            writer.reset();
+            require_future(all_finished.get_future());
+
+            std::lock_guard lock{m};
+            REQUIRE(traces.size() == 2);
+            auto& [client_id, client_trace] = *traces.begin();
+            auto& [server_id, server_trace] = *traces.rbegin();
+            // Both sides name the trace after the same original DCID
+            REQUIRE(client_id.size() > 7);
+            CHECK(client_id.substr(client_id.size() - 7) == "_client");
+            CHECK(server_id == client_id.substr(0, client_id.size() - 7) + "_server");
+
+            for (auto& [id, trace] : traces)
+            {
+                CHECK(fins[id] == 1);
+                REQUIRE_FALSE(trace.empty());
+                CHECK(trace.front() == '\x1e');  // JSON-SEQ record separator
+                CHECK(trace.find("qlog_version") != std::string::npos);
+            }
+        }
+
+        SECTION("Destruction doesn't wait for output")
+        {
+            std::promise<void> written;
+            auto writer = std::make_shared<qlog_writer>([&](std::string_view, std::string_view, bool fin) {
+                std::this_thread::sleep_for(200ms);
+                if (fin)
+                    written.set_value();
+            });
+
+            auto trace = writer->start_trace("slow");
+            trace->write("\x1e{}", 3, false);
+            trace->finish();
+            trace.reset();
+
+            auto started = std::chrono::steady_clock::now();
+            writer.reset();
+            CHECK(std::chrono::steady_clock::now() - started < 100ms);
+            require_future(written.get_future());
+        }
+
+        SECTION("Files")
+        {
+            auto dir = std::filesystem::temp_directory_path() / "libquic-021-qlog";
+            std::filesystem::remove_all(dir);
+            std::filesystem::create_directories(dir);
+
+            auto writer = std::make_shared<qlog_writer>(dir);
+            qlog_transmission(writer);
+            CHECK(writer->dropped() == 0);
+            writer.reset();
+
+            // The writer's thread finishes writing out the files in the background
+            auto count_written = [&] {
+                size_t n = 0;
+                for (auto& entry : std::filesystem::directory_iterator{dir})
+                    if (entry.path().extension() == ".sqlog" && entry.file_size() > 0)
+                        n++;
+                return n;
+            };
+            for (int i = 0; i < 100 && count_written() < 2; i++)
+                std::this_thread::sleep_for(10ms);
+
+            size_t n_files = 0;
+            for (auto& entry : std::filesystem::directory_iterator{dir})
+            {
+                n_files++;
+                CHECK(entry.path().extension() == ".sqlog");
+                CHECK(entry.file_size() > 0);
+            }
+            CHECK(n_files == 2);
+            std::filesystem::remove_all(dir);
+        }
+    }
+}  // namespace oxen::quic::test
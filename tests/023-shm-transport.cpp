@@ -0,0 +1,75 @@
+#include <catch2/catch_test_macros.hpp>
+#include <future>
+#include <oxen/quic.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <oxen/quic/shm.hpp>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    using namespace std::literals;
+
+    TEST_CASE("023 - Shared memory transport", "[023][shm]")
+    {
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+
+        // Enough to wrap around the (small) rings many times over, and to fill them up
+        constexpr size_t size = 4_Mi;
+        std::string msg(size, '\0');
+        for (size_t i = 0; i < size; i++)
+            msg[i] = static_cast<char>(i % 251);
+
+        std::string received;
+        std::promise<void> all_received;
+        stream_data_callback server_data_cb = [&](Stream&, bstring_view data) {
+            received.append(reinterpret_cast<const char*>(data.data()), data.size());
+            if (received.size() == size)
+                all_received.set_value();
+        };
+
+        shm_options small_rings{};
+        small_rings.ring_size = 256_ki;
+
+        auto transfer = [&](std::shared_ptr<Endpoint> server, std::shared_ptr<Endpoint> client, bool via_shm) {
+            REQUIRE_NOTHROW(server->listen(server_tls, server_data_cb));
+            RemoteAddress server_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server->local().port()};
+            auto conn = client->connect(server_remote, client_tls);
+            conn->open_stream()->send(std::string{msg});
+
+            require_future(all_received.get_future(), 10s);
+            CHECK(received == msg);
+            CHECK(client->stats().socket.packets_sent > 0);
+            CHECK(server->stats().socket.packets_received > 0);
+
+            // The packets have to have actually gone through the rings (or not)
+            auto client_stats = client->stats().socket, server_stats = server->stats().socket;
+            if (via_shm)
+            {
+                CHECK(client_stats.shm_packets_sent > 0);
+                CHECK(server_stats.shm_packets_received > 0);
+                CHECK(client_stats.shm_packets_sent * 2 > client_stats.packets_sent);
+            }
+            else
+            {
+                CHECK(client_stats.shm_packets_sent == 0);
+                CHECK(client_stats.shm_packets_received == 0);
+            }
+        };
+
+        SECTION("Between two shared memory endpoints")
+        {
+            auto server = test_net.endpoint(Address{}, shm_transport(small_rings));
+            auto client = test_net.endpoint(Address{}, shm_transport(small_rings));
+            transfer(server, client, true);
+        }
+
+        SECTION("Falls back to UDP for a peer without it")
+        {
+            auto server = test_net.endpoint(Address{});
+            auto client = test_net.endpoint(Address{}, shm_transport(small_rings));
+            transfer(server, client, false);
+        }
+    }
+}  // namespace oxen::quic::test
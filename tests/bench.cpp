@@ -0,0 +1,190 @@
+// Microbenchmarks of the data structures on the packet and stream hot paths.  These are built as
+// the separate `bench` target (not part of `alltests`), and run with e.g.:
+//
+//     ./tests/bench --reporter xml::out=bench.xml
+//
+// to get results that can be compared across releases.  Benchmarks that need connection state run
+// on a loopback connection, inside its event loop.
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <oxen/quic.hpp>
+#include <oxen/quic/cid_map.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace oxen::quic::test
+{
+    using namespace std::literals;
+
+    TEST_CASE("bench - Address", "[bench][address]")
+    {
+        const Address v4{"10.20.30.40", 4321}, v6{"2001:db8::1234:5678", 4321};
+        const std::hash<Address> hasher;
+
+        BENCHMARK("hash (IPv4)") { return hasher(v4); };
+        BENCHMARK("hash (IPv6)") { return hasher(v6); };
+        BENCHMARK("construct from string (IPv4)") { return Address{"10.20.30.40", 4321}; };
+        BENCHMARK("construct from string (IPv6)") { return Address{"2001:db8::1234:5678", 4321}; };
+        BENCHMARK("construct from ngtcp2_addr") { return Address{static_cast<const ngtcp2_addr&>(v6)}; };
+        BENCHMARK("to_string (IPv4)") { return v4.to_string(); };
+        BENCHMARK("to_string (IPv6)") { return v6.to_string(); };
+        BENCHMARK("compare") { return v4 == v6; };
+    }
+
+    TEST_CASE("bench - Connection ID lookup", "[bench][cidmap]")
+    {
+        // An endpoint's conn_lookup holds several CIDs per connection; these are a busy relay and a
+        // very busy one.
+        for (size_t n : {1'000, 100'000})
+        {
+            cid_map<Connection*> map;
+            std::vector<quic_cid> cids, missing;
+            for (size_t i = 0; i < n; i++)
+            {
+                cids.push_back(quic_cid::random());
+                map.emplace(cids.back(), nullptr);
+            }
+            for (size_t i = 0; i < 1024; i++)
+                missing.push_back(quic_cid::random());
+
+            BENCHMARK("find (hit, {} CIDs)"_format(n), i) { return map.find(cids[i % n]); };
+            BENCHMARK("find (miss, {} CIDs)"_format(n), i) { return map.find(missing[i % missing.size()]); };
+            BENCHMARK("erase + emplace ({} CIDs)"_format(n), i)
+            {
+                auto& cid = cids[i % n];
+                map.erase(cid);
+                return map.emplace(cid, nullptr).second;
+            };
+        }
+    }
+
+    TEST_CASE("bench - Datagram send queue", "[bench][datagrams]")
+    {
+        // Typical small (control message) and near-MTU datagrams, and the split datagrams that
+        // packet splitting sends as two halves
+        bstring small(64, std::byte{'a'}), full(1150, std::byte{'b'}), oversized(2000, std::byte{'c'});
+        constexpr size_t max_size = 1150;
+
+        BENCHMARK("emplace + prepare + drop_front (64B)")
+        {
+            buffer_que q;
+            q.emplace(small, 0, nullptr, dgram::STANDARD);
+            auto d = q.prepare(false, 0);
+            q.drop_front(false);
+            return d.bufs_len;
+        };
+
+        constexpr size_t queued = 32;
+        BENCHMARK_ADVANCED("prepare + drop_front, {} queued (1150B)"_format(queued))(Catch::Benchmark::Chronometer meter)
+        {
+            std::vector<buffer_que> qs(meter.runs());
+            for (auto& q : qs)
+                for (uint16_t id = 0; id < queued; id++)
+                    q.emplace(full, id * 4, nullptr, dgram::STANDARD);
+            meter.measure([&](int i) {
+                auto& q = qs[i];
+                size_t total = 0;
+                while (!q.empty())
+                {
+                    total += q.prepare(false, 0).bufs_len;
+                    q.drop_front(false);
+                }
+                return total;
+            });
+        };
+
+        BENCHMARK("emplace + prepare both halves (split 2000B)")
+        {
+            buffer_que q;
+            q.emplace(oversized, 2, nullptr, dgram::OVERSIZED, max_size);
+            size_t total = q.prepare(false, 1).bufs_len;
+            q.drop_front(false);
+            total += q.prepare(true, 1).bufs_len;
+            q.drop_front(true);
+            return total;
+        };
+    }
+
+    TEST_CASE("bench - Connection internals", "[bench][connection]")
+    {
+        Network test_net{};
+        auto [client_tls, server_tls] = defaults::tls_creds_from_ed_keys();
+        auto client_established = callback_waiter{[](connection_interface&) {}};
+
+        opt::enable_datagrams split_dgram{Splitting::ACTIVE};
+
+        auto server_endpoint = test_net.endpoint(Address{}, split_dgram);
+        REQUIRE_NOTHROW(server_endpoint->listen(server_tls));
+
+        RemoteAddress client_remote{defaults::SERVER_PUBKEY, "127.0.0.1"s, server_endpoint->local().port()};
+        auto client = test_net.endpoint(Address{}, split_dgram, client_established);
+        auto conn = client->connect(client_remote, client_tls);
+        REQUIRE(client_established.wait());
+
+        SECTION("Split datagram reassembly")
+        {
+            // Halves of split datagrams arriving in order, the first half of each waiting in the
+            // rotating buffer for the second
+            bstring half(600, std::byte{'x'});
+            client->call_get([&] {
+                auto& buf = TestHelper::get_recv_buffer(*conn);
+                uint16_t dgid = 2;
+                BENCHMARK("rotating_buffer::receive (pair of 600B halves)")
+                {
+                    auto first = buf.receive(half, dgid);
+                    auto second = buf.receive(half, static_cast<uint16_t>(dgid + 1));
+                    dgid += 4;
+                    return first.has_value() + second.has_value();
+                };
+            });
+        }
+
+        SECTION("Stream send buffers")
+        {
+            auto s = conn->open_stream();
+            for (size_t chunks : {1, 16, 256})
+            {
+                // Sent and measured within the same loop callback, so that nothing gets written
+                // to the connection in between
+                client->call_get([&] {
+                    for (size_t i = 0; i < chunks; i++)
+                        s->send(bstring(1200, std::byte{'s'}));
+                    std::array<ngtcp2_vec, 16> vecs;
+                    BENCHMARK("Stream::pending ({} x 1200B buffered)"_format(chunks))
+                    {
+                        return TestHelper::stream_pending(*s, vecs.data(), vecs.size());
+                    };
+                });
+            }
+        }
+
+        SECTION("Request stream parsing")
+        {
+            auto s = conn->open_stream<BTRequestStream>();
+            s->register_handler("bench", [](message) {});
+
+            for (size_t body : {16, 1024, 64 * 1024})
+            {
+                auto frame = client->call_get(
+                        [&] { return TestHelper::bt_encode_command(*s, "bench", 123, std::string(body, 'q')); });
+
+                client->call_get([&] {
+                    BENCHMARK("BTRequestStream::process_incoming ({}B body, whole)"_format(body))
+                    {
+                        TestHelper::bt_process_incoming(*s, frame);
+                    };
+
+                    // The same request arriving split over stream frames of a typical packet size
+                    BENCHMARK("BTRequestStream::process_incoming ({}B body, 1200B pieces)"_format(body))
+                    {
+                        for (size_t pos = 0; pos < frame.size(); pos += 1200)
+                            TestHelper::bt_process_incoming(*s, std::string_view{frame}.substr(pos, 1200));
+                    };
+                });
+            }
+        }
+    }
+}  // namespace oxen::quic::test
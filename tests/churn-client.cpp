@@ -0,0 +1,325 @@
+/*
+    Connection churn load generator: opens connections to a speedtest-server at a fixed rate, makes
+    a request/response exchange on each, and closes them again, reporting the handshake rate and
+    latencies achieved and the memory used by the open connections.
+*/
+
+#include <oxenc/endian.h>
+
+#include <CLI/Validators.hpp>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <future>
+#include <oxen/quic.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <thread>
+#include <unordered_map>
+
+#include "utils.hpp"
+
+using namespace oxen::quic;
+
+int main(int argc, char* argv[])
+{
+    CLI::App cli{"libQUIC connection churn load generator"};
+
+    std::string remote_addr = "127.0.0.1:5500";
+    cli.add_option("--remote", remote_addr, "Remote address to connect to")->type_name("IP:PORT")->capture_default_str();
+
+    std::string remote_pubkey;
+    cli.add_option("-p,--remote-pubkey", remote_pubkey, "Remote speedtest-server pubkey")
+            ->type_name("PUBKEY_HEX_OR_B64")
+            ->transform([](const std::string& val) -> std::string {
+                if (auto pk = decode_bytes(val))
+                    return std::move(*pk);
+                throw CLI::ValidationError{
+                        "Invalid value passed to --remote-pubkey: expected value encoded as hex or base64"};
+            })
+            ->required();
+
+    std::string local_addr = "";
+    cli.add_option("--local", local_addr, "Local bind address, if required")->type_name("IP:PORT")->capture_default_str();
+
+    double rate = 100;
+    cli.add_option("-r,--rate", rate, "Number of new connections to open per second")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+
+    double duration = 10;
+    cli.add_option("-d,--duration", duration, "How long to open new connections for, in seconds")->capture_default_str();
+
+    size_t max_open = 10'000;
+    cli.add_option(
+               "-m,--max-open",
+               max_open,
+               "Maximum number of connections to have open at once; connections that would be opened beyond this are "
+               "skipped (and counted as such) rather than delaying the ones that follow")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+
+    uint32_t request_size = 100, response_size = 100;
+    cli.add_option(
+               "--request-size",
+               request_size,
+               "Size of the request to send on each connection once it is established; 0 to just close the connection "
+               "after the handshake")
+            ->capture_default_str();
+    cli.add_option("--response-size", response_size, "Size of the server's response to the request")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+
+    double hold = 0;
+    cli.add_option(
+               "--hold",
+               hold,
+               "How long to keep each connection open once its exchange is done, in seconds.  Each connection then "
+               "stays open for about this long, so that about `--rate` × `--hold` are open at once.")
+            ->capture_default_str();
+
+    std::string log_file, log_level;
+    add_log_opts(cli, log_file, log_level);
+
+    try
+    {
+        cli.parse(argc, argv);
+    }
+    catch (const CLI::ParseError& e)
+    {
+        return cli.exit(e);
+    }
+
+    setup_logging(log_file, log_level);
+
+    auto [seed, pubkey] = generate_ed25519();
+    auto client_tls = GNUTLSCreds::make_from_ed_keys(seed, pubkey);
+
+    Network client_net{};
+
+    Address client_local{};
+    if (!local_addr.empty())
+    {
+        auto [a, p] = parse_addr(local_addr);
+        client_local = Address{a, p};
+    }
+
+    auto [server_a, server_p] = parse_addr(remote_addr);
+    RemoteAddress server_addr{remote_pubkey, server_a, server_p};
+
+    // The speedtest-server request/response mode header, followed by the single request
+    auto header = std::make_shared<std::string>(SPEEDTEST_RPC_HEADER, '\0');
+    oxenc::write_host_as_little(SPEEDTEST_RPC_MODE, header->data());
+    oxenc::write_host_as_little(request_size, header->data() + 8);
+    oxenc::write_host_as_little(response_size, header->data() + 12);
+    auto request = std::make_shared<std::string>(request_size, 'Q');
+
+    using clock = std::chrono::steady_clock;
+    const auto hold_time = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>{hold});
+
+    struct conn_state
+    {
+        std::shared_ptr<connection_interface> conn;
+        clock::time_point started;
+        clock::time_point established;
+        bool is_established = false;
+        bool exchanged = false;
+        size_t received = 0;
+    };
+
+    // All of the state below is only touched from the client endpoint's loop
+    std::unordered_map<ConnectionID, conn_state> open;
+    std::deque<std::pair<clock::time_point, ConnectionID>> to_close;
+    std::vector<std::chrono::nanoseconds> handshake_latencies, exchange_latencies;
+    size_t attempted = 0, skipped = 0, failed = 0, exchange_failed = 0;
+    size_t peak_open = 0, rss_at_peak = 0, resident_at_peak = 0;
+    bool running = true;
+    std::promise<void> finished;
+
+    std::shared_ptr<Endpoint> client;
+
+    auto done_with = [&](conn_state& c, const ConnectionID& rid) {
+        if (hold_time.count() > 0 && running)
+            to_close.emplace_back(clock::now() + hold_time, rid);
+        else
+            c.conn->close_connection();
+    };
+
+    stream_data_callback on_data = [&](Stream& s, bstring_view data) {
+        auto it = open.find(s.reference_id);
+        if (it == open.end() || it->second.exchanged)
+            return;
+        auto& c = it->second;
+        c.received += data.size();
+        if (c.received < response_size)
+            return;
+        c.exchanged = true;
+        exchange_latencies.push_back(clock::now() - c.established);
+        done_with(c, it->first);
+    };
+
+    connection_established_callback on_established = [&](connection_interface& ci) {
+        auto it = open.find(ci.reference_id());
+        if (it == open.end())
+            return;
+        auto& c = it->second;
+        c.established = clock::now();
+        c.is_established = true;
+        handshake_latencies.push_back(c.established - c.started);
+
+        if (request_size == 0)
+            return done_with(c, it->first);
+
+        auto s = ci.open_stream();
+        s->send(std::string_view{*header}, header);
+        s->send(std::string_view{*request}, request);
+    };
+
+    connection_closed_callback on_closed = [&](connection_interface& ci, uint64_t) {
+        auto it = open.find(ci.reference_id());
+        if (it == open.end())
+            return;
+        if (!it->second.is_established)
+            failed++;
+        else if (request_size > 0 && !it->second.exchanged)
+            exchange_failed++;
+        open.erase(it);
+        if (!running && open.empty())
+            finished.set_value();
+    };
+
+    client = client_net.endpoint(client_local, on_established, on_closed);
+
+    auto start_one = [&] {
+        attempted++;
+        auto started = clock::now();
+        auto conn = client->connect(server_addr, client_tls, on_data);
+        auto& c = open[conn->reference_id()];
+        c.conn = std::move(conn);
+        c.started = started;
+    };
+
+    // Called periodically from the loop: closes held connections that are due, and measures memory
+    // use whenever the number of open connections reaches a new high.
+    auto housekeeping = [&] {
+        auto now = clock::now();
+        while (!to_close.empty() && to_close.front().first <= now)
+        {
+            if (auto it = open.find(to_close.front().second); it != open.end())
+                it->second.conn->close_connection();
+            to_close.pop_front();
+        }
+
+        if (open.size() > peak_open)
+        {
+            peak_open = open.size();
+            rss_at_peak = current_rss();
+            resident_at_peak = 0;
+            for (auto& [rid, c] : open)
+                resident_at_peak += c.conn->resident_bytes();
+        }
+    };
+
+    const auto baseline_rss = current_rss();
+
+    log::warning(
+            test_cat,
+            "Opening {} connections/s to {} for {}s ({})...",
+            rate,
+            server_addr,
+            duration,
+            request_size ? "with a {}B/{}B exchange on each"_format(request_size, response_size) : "handshake only");
+
+    auto cpu_start = std::clock();
+    const auto start = clock::now();
+    const auto end = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>{duration});
+    auto last_housekeeping = start;
+
+    // Open-loop pacing: every tick, start however many connections we are behind the schedule by,
+    // regardless of how the previous ones are doing
+    for (auto now = start; now < end; now = clock::now())
+    {
+        const auto due = static_cast<size_t>(rate * std::chrono::duration<double>{now - start}.count()) + 1;
+        const bool do_housekeeping = now - last_housekeeping >= 10ms;
+        if (do_housekeeping)
+            last_housekeeping = now;
+
+        client->call_get([&] {
+            while (attempted + skipped < due)
+            {
+                if (open.size() >= max_open)
+                    skipped++;
+                else
+                    start_one();
+            }
+            if (do_housekeeping)
+                housekeeping();
+        });
+
+        std::this_thread::sleep_for(1ms);
+    }
+
+    auto [handshakes, attempts] = client->call_get([&] {
+        housekeeping();
+        running = false;
+        for (auto& [rid, c] : open)
+            c.conn->close_connection();
+        to_close.clear();
+        if (open.empty())
+            finished.set_value();
+        return std::make_pair(handshake_latencies.size(), attempted);
+    });
+
+    auto elapsed = std::chrono::duration<double>{clock::now() - start}.count();
+    double cpu = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    if (finished.get_future().wait_for(10s) != std::future_status::ready)
+        log::warning(test_cat, "Timed out waiting for open connections to close");
+
+    fmt::print(
+            "{} connections attempted ({} skipped at the --max-open limit): {} handshakes ({} failed) in {:.2f}s, "
+            "{:.1f} handshakes/s\n",
+            attempts,
+            skipped,
+            handshakes,
+            failed,
+            elapsed,
+            handshakes / elapsed);
+
+    auto millis = [](std::chrono::nanoseconds t) { return std::chrono::duration<double, std::milli>{t}.count(); };
+    auto print_latencies = [&](std::string_view what, std::vector<std::chrono::nanoseconds>& latencies) {
+        if (latencies.empty())
+            return;
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double q) {
+            return millis(latencies[std::min(latencies.size() - 1, static_cast<size_t>(q * latencies.size()))]);
+        };
+        fmt::print(
+                "{} latency: p50 {:.2f}ms, p90 {:.2f}ms, p99 {:.2f}ms, p99.9 {:.2f}ms, max {:.2f}ms\n",
+                what,
+                percentile(0.5),
+                percentile(0.9),
+                percentile(0.99),
+                percentile(0.999),
+                millis(latencies.back()));
+    };
+    print_latencies("Handshake", handshake_latencies);
+    if (request_size > 0)
+    {
+        fmt::print(
+                "{} exchanges completed ({} connections closed before completing one)\n",
+                exchange_latencies.size(),
+                exchange_failed);
+        print_latencies("Exchange", exchange_latencies);
+    }
+
+    fmt::print(
+            "Peak {} connections open: RSS {:.1f}MB (peak {:.1f}MB); {:.1f}kB RSS and {:.1f}kB connection state per "
+            "connection\n",
+            peak_open,
+            rss_at_peak / 1e6,
+            peak_rss() / 1e6,
+            peak_open && rss_at_peak > baseline_rss ? (rss_at_peak - baseline_rss) / 1e3 / peak_open : 0.0,
+            peak_open ? resident_at_peak / 1e3 / peak_open : 0.0);
+    fmt::print("{:.2f}s of CPU: {:.1f} handshakes per CPU-second (client side)\n", cpu, cpu > 0 ? handshakes / cpu : 0.0);
+}
@@ -0,0 +1,147 @@
+/*
+    Handshake benchmark: measures how many complete handshakes per second (and per second of CPU
+    time) a server and client running in this process can do over localhost.
+*/
+
+#include <CLI/Validators.hpp>
+#include <chrono>
+#include <ctime>
+#include <future>
+#include <oxen/quic.hpp>
+#include <oxen/quic/gnutls_crypto.hpp>
+#include <thread>
+#include <unordered_set>
+
+#include "utils.hpp"
+
+using namespace oxen::quic;
+
+int main(int argc, char* argv[])
+{
+    CLI::App cli{"libQUIC handshake benchmark"};
+
+    double duration = 10;
+    cli.add_option("-d,--duration", duration, "How long to run for, in seconds")->capture_default_str();
+
+    size_t concurrency = 64;
+    cli.add_option("-c,--concurrency", concurrency, "Number of handshakes to keep in progress at once")
+            ->check(CLI::Range(1, 10000))
+            ->capture_default_str();
+
+    bool verify = false;
+    cli.add_flag("-V,--verify", verify, "Give the server a key verify callback (that accepts every key)");
+
+    bool verify_cache = false;
+    cli.add_flag("-C,--verify-cache", verify_cache, "Enable the server's verified key cache (implies --verify)");
+
+    bool same_loop = false;
+    cli.add_flag(
+            "-L,--same-loop",
+            same_loop,
+            "Run client and server on the same event loop (one core) instead of one loop (thread) each");
+
+    std::string log_file, log_level;
+    add_log_opts(cli, log_file, log_level);
+
+    try
+    {
+        cli.parse(argc, argv);
+    }
+    catch (const CLI::ParseError& e)
+    {
+        return cli.exit(e);
+    }
+
+    setup_logging(log_file, log_level);
+
+    auto [server_seed, server_pubkey] = generate_ed25519();
+    auto [client_seed, client_pubkey] = generate_ed25519();
+    auto server_tls = GNUTLSCreds::make_from_ed_keys(server_seed, server_pubkey);
+    auto client_tls = GNUTLSCreds::make_from_ed_keys(client_seed, client_pubkey);
+
+    if (verify || verify_cache)
+        server_tls->set_key_verify_callback([](const ustring_view&, const ustring_view&) { return true; });
+    if (verify_cache)
+        server_tls->enable_key_verify_cache();
+
+    Network server_net{};
+    std::optional<Network> client_net_storage;
+    if (!same_loop)
+        client_net_storage.emplace();
+    Network& client_net = same_loop ? server_net : *client_net_storage;
+
+    auto server = server_net.endpoint(Address{"127.0.0.1", 0});
+    server->listen(server_tls);
+
+    RemoteAddress server_addr{server_pubkey, "127.0.0.1", server->local().port()};
+
+    // All of the client-side state below is only touched from the client endpoint's loop
+    std::unordered_set<ConnectionID> established;
+    size_t handshakes = 0, failures = 0, in_flight = 0;
+    bool running = true;
+    std::promise<void> finished;
+
+    std::shared_ptr<Endpoint> client;
+
+    auto start_one = [&] {
+        in_flight++;
+        client->connect(server_addr, client_tls);
+    };
+
+    connection_established_callback on_established = [&](connection_interface& ci) {
+        established.insert(ci.reference_id());
+        handshakes++;
+        ci.close_connection();
+    };
+    connection_closed_callback on_closed = [&](connection_interface& ci, uint64_t) {
+        if (!established.erase(ci.reference_id()))
+            failures++;
+        in_flight--;
+        if (running)
+            start_one();
+        else if (in_flight == 0)
+            finished.set_value();
+    };
+
+    client = client_net.endpoint(Address{"127.0.0.1", 0}, on_established, on_closed);
+
+    log::warning(
+            test_cat,
+            "Running {} concurrent handshakes for {}s ({})...",
+            concurrency,
+            duration,
+            same_loop ? "client and server on one loop" : "client and server on separate loops");
+
+    auto cpu_start = std::clock();
+    auto start = std::chrono::steady_clock::now();
+
+    client->call_get([&] {
+        for (size_t i = 0; i < concurrency; i++)
+            start_one();
+    });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>{duration});
+
+    auto [done, failed] = client->call_get([&] {
+        running = false;
+        if (in_flight == 0)
+            finished.set_value();
+        return std::make_pair(handshakes, failures);
+    });
+
+    auto elapsed = std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count();
+    double cpu = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    if (finished.get_future().wait_for(5s) != std::future_status::ready)
+        log::warning(test_cat, "Timed out waiting for in-progress handshakes to finish");
+
+    fmt::print(
+            "{} handshakes ({} failed) in {:.2f}s: {:.1f} handshakes/s; {:.2f}s of CPU, {:.1f} handshakes per "
+            "CPU-second (client and server combined)\n",
+            done,
+            failed,
+            elapsed,
+            done / elapsed,
+            cpu,
+            cpu > 0 ? done / cpu : 0.0);
+}
@@ -5,8 +5,11 @@
 #include <oxenc/endian.h>
 
 #include <CLI/Validators.hpp>
+#include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <future>
+#include <numeric>
 #include <oxen/quic.hpp>
 #include <oxen/quic/gnutls_crypto.hpp>
 #include <random>
@@ -40,10 +43,48 @@ int main(int argc, char* argv[])
     std::string log_file, log_level;
     add_log_opts(cli, log_file, log_level);
 
+    congestion_opts cc;
+    add_congestion_opts(cli, cc);
+
+    size_t max_udp_payload = MAX_PMTUD_UDP_PAYLOAD;
+    cli.add_option(
+               "--max-udp-payload",
+               max_udp_payload,
+               "Largest UDP payload to send, for networks with an MTU above 1500 (e.g. 8952 for 9000-byte jumbo frames, or "
+               "on localhost).  Should be specified on the server as well.")
+            ->check(CLI::Range(MIN_UDP_PAYLOAD, MAX_JUMBO_UDP_PAYLOAD))
+            ->capture_default_str();
+
+    size_t connections = 1;
+    cli.add_option("-c,--connections", connections, "Number of simultaneous connections to make")
+            ->check(CLI::Range(1, 10000))
+            ->capture_default_str();
+
     size_t parallel = 1;
-    cli.add_option("-j,--parallel", parallel, "Number of simultaneous streams to send (currently max 32)")
+    cli.add_option("-j,--parallel", parallel, "Number of simultaneous streams to send on each connection (currently max 32)")
             ->check(CLI::Range(1, 32));
 
+    bool rpc = false;
+    cli.add_flag(
+            "-r,--rpc",
+            rpc,
+            "Request/response mode: instead of a bulk transfer, each stream sends a request and waits for the server's "
+            "response before sending the next one, and the request latencies are reported.  --size, --pregenerate, "
+            "--no-hash, --no-checksum, and the --stream-chunk options are ignored in this mode.");
+
+    size_t requests = 10'000;
+    cli.add_option("-n,--requests", requests, "Number of requests to make on each stream in --rpc mode")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+
+    uint32_t request_size = 100, response_size = 100;
+    cli.add_option("--request-size", request_size, "Size of each request in --rpc mode")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+    cli.add_option("--response-size", response_size, "Size of the server's response to each request in --rpc mode")
+            ->check(CLI::PositiveNumber)
+            ->capture_default_str();
+
     bool receive = false;
     cli.add_option(
             "-R,--receive",
@@ -57,8 +98,8 @@ int main(int argc, char* argv[])
     cli.add_option(
             "-S,--size",
             size,
-            "Amount of data to transfer (if using --bidir, this amount is in each direction).  When using --parallel the "
-            "data is divided equally across streams.");
+            "Amount of data to transfer (if using --bidir, this amount is in each direction).  When using --parallel "
+            "and/or --connections the data is divided equally across all streams.");
 
     bool pregenerate = false;
     cli.add_flag("-g,--pregenerate", pregenerate, "Pregenerate all stream data to send into RAM before starting");
@@ -84,7 +125,8 @@ int main(int argc, char* argv[])
     cli.add_option(
             "--rng-seed",
             rng_seed,
-            "RNG seed to use for data generation; with --parallel we use this, this+1, ... for the different threads.");
+            "RNG seed to use for data generation; with --parallel/--connections we use this, this+1, ... for the "
+            "different streams.");
 
     try
     {
@@ -131,77 +173,159 @@ int main(int argc, char* argv[])
         }
     };
 
+    // State of a stream in --rpc mode.  Only touched from the endpoint's loop until `finished` is
+    // ready.
+    struct rpc_stream
+    {
+        std::shared_ptr<Stream> stream;
+        size_t remaining;     // Requests not yet sent
+        size_t received = 0;  // Bytes of the current response received so far
+        std::chrono::steady_clock::time_point sent_at;
+        std::vector<std::chrono::nanoseconds> latencies;
+        bool failed = false;
+        bool done = false;
+        std::promise<void> done_prom;
+        std::future<void> finished = done_prom.get_future();
+
+        explicit rpc_stream(size_t requests) : remaining{requests} { latencies.reserve(requests); }
+    };
+
     setup_logging(log_file, log_level);
 
+    const size_t total_streams = connections * parallel;
+
+    // Every request is the same (the server doesn't look at the content); this has to outlive the
+    // Network because it is sent without a copy.
+    const std::string request(request_size, 'Q');
+
+    std::vector<std::unique_ptr<stream_data>> streams;
+    std::vector<std::unique_ptr<rpc_stream>> rpc_streams;
+    if (rpc)
+        rpc_streams.reserve(total_streams);
+    else
+        streams.reserve(total_streams);
+
     Network client_net{};
 
     auto [seed, pubkey] = generate_ed25519();
     auto client_tls = GNUTLSCreds::make_from_ed_keys(seed, pubkey);
 
-    std::vector<std::unique_ptr<stream_data>> streams;
-    streams.reserve(parallel);
-
     stream_close_callback stream_closed = [&](Stream& s, uint64_t errcode) {
         size_t i = s.stream_id() >> 2;
         log::critical(test_cat, "Stream {} (rawid={}) closed (error={})", i, s.stream_id(), errcode);
     };
 
-    stream_data_callback on_stream_data = [&](Stream& s, bstring_view data) {
+    // Stream i of connection c is streams[c * parallel + i] (or rpc_streams[...], in --rpc mode)
+    auto stream_index = [&](size_t c, const Stream& s) -> std::optional<size_t> {
         size_t i = s.stream_id() >> 2;
         if (i >= parallel)
         {
             log::critical(test_cat, "Something getting wrong: got unexpected stream id {}", s.stream_id());
-            return;
+            return std::nullopt;
         }
+        return c * parallel + i;
+    };
 
-        auto& sd = *streams[i];
-        if (sd.done)
-        {
-            log::error(
-                    test_cat, "Already got a hash from the other side of stream {}, what is this nonsense‽", s.stream_id());
-            return;
-        }
+    auto bulk_data_callback = [&](size_t c) -> stream_data_callback {
+        return [&, c](Stream& s, bstring_view data) {
+            auto i = stream_index(c, s);
+            if (!i)
+                return;
 
-        if (!sd.done_sending)
-        {
-            log::error(
-                    test_cat,
-                    "Got a stream (stream {}) response ({}B) before we were done sending data!",
-                    s.stream_id(),
-                    data.size());
-            sd.failed = true;
-        }
-        else if (data.size() != 33)
-        {
-            log::error(test_cat, "Got unexpected data from the other side: {}B != 32B", data.size());
-            sd.failed = true;
-        }
-        else if (data.substr(0, 32) != sd.hash)
-        {
-            log::critical(
-                    test_cat,
-                    "Hash mismatch: other size said {}, we say {}",
-                    oxenc::to_hex(data.begin(), data.end()),
-                    oxenc::to_hex(sd.hash.begin(), sd.hash.end()));
-            sd.failed = true;
-        }
-        else if (static_cast<uint8_t>(data[32]) != sd.checksum)
-        {
-            log::critical(test_cat, "Checksum mismatch: other size said {}, we say {}", data[32], sd.checksum);
-            sd.failed = true;
-        }
-        else
-        {
-            sd.failed = false;
-            log::critical(
-                    test_cat,
-                    "Hashes matched ({}, {}), hurray!\n",
-                    oxenc::to_hex(sd.hash.begin(), sd.hash.end()),
-                    sd.checksum);
-        }
+            auto& sd = *streams[*i];
+            if (sd.done)
+            {
+                log::error(
+                        test_cat,
+                        "Already got a hash from the other side of stream {}, what is this nonsense‽",
+                        s.stream_id());
+                return;
+            }
 
-        sd.done = true;
-        sd.run_prom.set_value();
+            if (!sd.done_sending)
+            {
+                log::error(
+                        test_cat,
+                        "Got a stream (stream {}) response ({}B) before we were done sending data!",
+                        s.stream_id(),
+                        data.size());
+                sd.failed = true;
+            }
+            else if (data.size() != 33)
+            {
+                log::error(test_cat, "Got unexpected data from the other side: {}B != 32B", data.size());
+                sd.failed = true;
+            }
+            else if (data.substr(0, 32) != sd.hash)
+            {
+                log::critical(
+                        test_cat,
+                        "Hash mismatch: other size said {}, we say {}",
+                        oxenc::to_hex(data.begin(), data.end()),
+                        oxenc::to_hex(sd.hash.begin(), sd.hash.end()));
+                sd.failed = true;
+            }
+            else if (static_cast<uint8_t>(data[32]) != sd.checksum)
+            {
+                log::critical(test_cat, "Checksum mismatch: other size said {}, we say {}", data[32], sd.checksum);
+                sd.failed = true;
+            }
+            else
+            {
+                sd.failed = false;
+                log::critical(
+                        test_cat,
+                        "Hashes matched ({}, {}), hurray!\n",
+                        oxenc::to_hex(sd.hash.begin(), sd.hash.end()),
+                        sd.checksum);
+            }
+
+            sd.done = true;
+            sd.run_prom.set_value();
+        };
+    };
+
+    auto rpc_data_callback = [&](size_t c) -> stream_data_callback {
+        return [&, c](Stream& s, bstring_view data) {
+            auto i = stream_index(c, s);
+            if (!i)
+                return;
+
+            auto& r = *rpc_streams[*i];
+            if (r.done)
+            {
+                log::error(test_cat, "Got {}B of unexpected data on finished stream {}", data.size(), s.stream_id());
+                return;
+            }
+
+            r.received += data.size();
+            if (r.received < response_size)
+                return;
+
+            r.latencies.push_back(std::chrono::steady_clock::now() - r.sent_at);
+            if (r.received > response_size)
+            {
+                log::error(
+                        test_cat,
+                        "Got an oversized response on stream {}: {}B > {}B",
+                        s.stream_id(),
+                        r.received,
+                        response_size);
+                r.failed = true;
+            }
+            r.received = 0;
+
+            if (r.failed || r.remaining == 0)
+            {
+                r.done = true;
+                r.done_prom.set_value();
+                return;
+            }
+
+            r.remaining--;
+            r.sent_at = std::chrono::steady_clock::now();
+            s.send(std::string_view{request});
+        };
     };
 
     Address client_local{};
@@ -214,12 +338,27 @@ int main(int argc, char* argv[])
     auto [server_a, server_p] = parse_addr(remote_addr);
     RemoteAddress server_addr{remote_pubkey, server_a, server_p};
 
-    log::debug(test_cat, "Constructing endpoint on {}", client_local);
-    auto client = client_net.endpoint(client_local);
-    log::debug(test_cat, "Connecting to {}...", server_addr);
-    auto client_ci = client->connect(server_addr, client_tls, on_stream_data, stream_closed);
+    // Only touched from the endpoint's loop
+    size_t n_established = 0;
+    std::promise<void> all_established;
+    connection_established_callback on_established = [&](connection_interface&) {
+        if (++n_established == connections)
+            all_established.set_value();
+    };
 
-    auto per_stream = size / parallel;
+    log::debug(test_cat, "Constructing endpoint on {}", client_local);
+    auto client = client_net.endpoint(client_local, on_established, opt::max_udp_payload{max_udp_payload});
+    log::debug(test_cat, "Connecting to {} ({} connection(s))...", server_addr, connections);
+    std::vector<std::shared_ptr<connection_interface>> conns;
+    conns.reserve(connections);
+    for (size_t c = 0; c < connections; c++)
+        conns.push_back(client->connect(
+                server_addr,
+                client_tls,
+                rpc ? rpc_data_callback(c) : bulk_data_callback(c),
+                stream_closed,
+                cc.congestion_control(),
+                cc.max_receive_window()));
 
     auto gen_data =
             [no_hash, no_checksum](
@@ -261,107 +400,198 @@ int main(int argc, char* argv[])
                     gnutls_hash(hasher, reinterpret_cast<unsigned char*>(data.data()), data.size());
             };
 
-    if (pregenerate)
+    if (!rpc)
     {
-        log::warning(test_cat, "Pregenerating data...");
-    }
+        auto per_stream = size / total_streams;
 
-    for (size_t i = 0; i < parallel; i++)
-    {
-        uint64_t my_data = per_stream + (i == 0 ? size % parallel : 0);
-        auto& s = *streams.emplace_back(std::make_unique<stream_data>(
-                my_data, rng_seed + i, pregenerate ? my_data : chunk_size, pregenerate ? 1 : chunk_num));
+        if (pregenerate)
+        {
+            log::warning(test_cat, "Pregenerating data...");
+        }
+
+        for (size_t i = 0; i < total_streams; i++)
+        {
+            uint64_t my_data = per_stream + (i == 0 ? size % total_streams : 0);
+            auto& s = *streams.emplace_back(std::make_unique<stream_data>(
+                    my_data, rng_seed + i, pregenerate ? my_data : chunk_size, pregenerate ? 1 : chunk_num));
 
+            if (pregenerate)
+            {
+                gen_data(s.rng, my_data, s.bufs[0], s.sent_hasher, s.checksum);
+                s.hash.resize(32);
+                gnutls_hash_output(s.sent_hasher, reinterpret_cast<unsigned char*>(s.hash.data()));
+            }
+        }
         if (pregenerate)
         {
-            gen_data(s.rng, my_data, s.bufs[0], s.sent_hasher, s.checksum);
-            s.hash.resize(32);
-            gnutls_hash_output(s.sent_hasher, reinterpret_cast<unsigned char*>(s.hash.data()));
+            log::warning(test_cat, "Data pregeneration done");
         }
     }
-    if (pregenerate)
+    else
     {
-        log::warning(test_cat, "Data pregeneration done");
+        for (size_t i = 0; i < total_streams; i++)
+            rpc_streams.push_back(std::make_unique<rpc_stream>(requests));
+    }
+
+    // Measure from when all the connections are up, so that handshakes don't skew the results
+    if (all_established.get_future().wait_for(30s) != std::future_status::ready)
+    {
+        log::critical(
+                test_cat,
+                "Timed out waiting for connections to be established ({}/{} are)",
+                client->call_get([&] { return n_established; }),
+                connections);
+        return 1;
     }
 
     auto started_at = std::chrono::steady_clock::now();
+    auto cpu_start = std::clock();
+    uint64_t transferred;
+    bool all_good = true;
 
-    for (size_t i = 0; i < parallel; i++)
+    if (!rpc)
     {
-        auto& s = *streams[i];
-        s.stream = client_ci->open_stream();
-        std::string remaining_str;
-        remaining_str.resize(8);
-        oxenc::write_host_as_little(s.remaining, remaining_str.data());
-        s.stream->send(std::move(remaining_str));
-        if (pregenerate)
+        for (size_t i = 0; i < total_streams; i++)
         {
-            s.remaining = 0;
-            s.done_sending = true;
-            s.stream->send(bstring_view{s.bufs[0].data(), s.bufs[0].size()});
+            auto& s = *streams[i];
+            s.stream = conns[i / parallel]->open_stream();
+            std::string remaining_str;
+            remaining_str.resize(8);
+            oxenc::write_host_as_little(s.remaining, remaining_str.data());
+            s.stream->send(std::move(remaining_str));
+            if (pregenerate)
+            {
+                s.remaining = 0;
+                s.done_sending = true;
+                s.stream->send(bstring_view{s.bufs[0].data(), s.bufs[0].size()});
+            }
+            else
+            {
+                s.stream->send_chunks(
+                        [&, i](const Stream&) -> std::vector<std::byte>* {
+                            auto& sd = *streams[i];
+                            auto& data = sd.bufs[sd.next_buf++];
+                            sd.next_buf %= sd.bufs.size();
+
+                            const auto size = std::min(sd.remaining, chunk_size);
+                            if (size == 0)
+                                return nullptr;
+
+                            gen_data(sd.rng, size, data, sd.sent_hasher, sd.checksum);
+
+                            sd.remaining -= size;
+
+                            if (sd.remaining == 0)
+                            {
+                                sd.hash.resize(32);
+                                gnutls_hash_output(sd.sent_hasher, reinterpret_cast<unsigned char*>(sd.hash.data()));
+                                sd.done_sending = true;
+                            }
+
+                            return &data;
+                        },
+                        nullptr,
+                        chunk_num);
+            }
         }
-        else
+
+        for (auto& s : streams)
         {
-            s.stream->send_chunks(
-                    [&, i](const Stream&) -> std::vector<std::byte>* {
-                        auto& sd = *streams[i];
-                        auto& data = sd.bufs[sd.next_buf++];
-                        sd.next_buf %= sd.bufs.size();
-
-                        const auto size = std::min(sd.remaining, chunk_size);
-                        if (size == 0)
-                            return nullptr;
-
-                        gen_data(sd.rng, size, data, sd.sent_hasher, sd.checksum);
-
-                        sd.remaining -= size;
-
-                        if (sd.remaining == 0)
-                        {
-                            sd.hash.resize(32);
-                            gnutls_hash_output(sd.sent_hasher, reinterpret_cast<unsigned char*>(sd.hash.data()));
-                            sd.done_sending = true;
-                        }
-
-                        return &data;
-                    },
-                    nullptr,
-                    chunk_num);
+            s->running.wait();
+            if (s->failed)
+                all_good = false;
         }
-    }
 
-    for (;;)
+        transferred = size;
+    }
+    else
     {
-        bool all_done = true;
-        for (auto& s : streams)
-        {
-            if (!s->done)
+        client->call_get([&] {
+            std::string header;
+            header.resize(SPEEDTEST_RPC_HEADER);
+            oxenc::write_host_as_little(SPEEDTEST_RPC_MODE, header.data());
+            oxenc::write_host_as_little(request_size, header.data() + 8);
+            oxenc::write_host_as_little(response_size, header.data() + 12);
+
+            for (size_t i = 0; i < total_streams; i++)
             {
-                all_done = false;
-                s->running.get();
-                break;
+                auto& r = *rpc_streams[i];
+                r.stream = conns[i / parallel]->open_stream();
+                r.stream->send(std::string{header});
+                r.remaining--;
+                r.sent_at = std::chrono::steady_clock::now();
+                r.stream->send(std::string_view{request});
             }
-        }
-        if (all_done)
-            break;
-    }
+        });
 
-    bool all_good = true;
-    for (auto& s : streams)
-    {
-        if (s->failed)
+        std::vector<std::chrono::nanoseconds> latencies;
+        latencies.reserve(total_streams * requests);
+        for (auto& r : rpc_streams)
         {
-            all_good = false;
-            break;
+            r->finished.wait();
+            if (r->failed)
+                all_good = false;
+            latencies.insert(latencies.end(), r->latencies.begin(), r->latencies.end());
         }
+
+        auto elapsed = std::chrono::duration<double>{std::chrono::steady_clock::now() - started_at}.count();
+        std::sort(latencies.begin(), latencies.end());
+        auto micros = [](std::chrono::nanoseconds t) { return std::chrono::duration<double, std::micro>{t}.count(); };
+        auto percentile = [&](double q) {
+            return micros(latencies[std::min(latencies.size() - 1, static_cast<size_t>(q * latencies.size()))]);
+        };
+        auto total = std::accumulate(latencies.begin(), latencies.end(), std::chrono::nanoseconds{0});
+
+        fmt::print(
+                "{} requests ({}B requests, {}B responses) on {} streams: {:.1f} requests/s\n",
+                latencies.size(),
+                request_size,
+                response_size,
+                total_streams,
+                latencies.size() / elapsed);
+        fmt::print(
+                "Latency: mean {:.1f}µs, p50 {:.1f}µs, p99 {:.1f}µs, p99.9 {:.1f}µs, max {:.1f}µs\n",
+                micros(total) / latencies.size(),
+                percentile(0.5),
+                percentile(0.99),
+                percentile(0.999),
+                micros(latencies.back()));
+
+        transferred = latencies.size() * (uint64_t{request_size} + response_size);
     }
 
     if (!all_good)
         fmt::print("OMG failed!\n");
 
     auto elapsed = std::chrono::duration<double>{std::chrono::steady_clock::now() - started_at}.count();
+    double cpu = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
     fmt::print("Elapsed time: {:.3f}s\n", elapsed);
-    fmt::print("Speed: {:.3f}MB/s\n", size / 1'000'000.0 / elapsed);
+    fmt::print("Speed: {:.3f}MB/s\n", transferred / 1'000'000.0 / elapsed);
+    // This is just the client process; the server logs its own CPU usage once the connections close
+    fmt::print("CPU time: {:.3f}s ({:.3f} CPU-s/GB)\n", cpu, cpu / (transferred / 1'000'000'000.0));
+
+    // For comparing congestion control settings (which need to be given to the server as well for
+    // --receive/--bidir, where it does the sending)
+    for (size_t c = 0; c < conns.size(); c++)
+    {
+        auto st = conns[c]->stats();
+        fmt::print(
+                "Connection {} ({}): cwnd {}B, smoothed RTT {:.1f}ms (min {:.1f}ms), {} of {} packets sent lost, "
+                "{}B max UDP payload\n",
+                c,
+                cc.algorithm,
+                st.cwnd,
+                std::chrono::duration<double, std::milli>{st.smoothed_rtt}.count(),
+                std::chrono::duration<double, std::milli>{st.min_rtt}.count(),
+                st.packets_lost,
+                st.packets_sent,
+                st.max_udp_payload);
+    }
+
+    for (auto& c : conns)
+        c->close_connection();
+    // Give the connection closes a moment to go out, so that the server sees them
+    std::this_thread::sleep_for(100ms);
 
     return 0;
 }
@@ -7,10 +7,12 @@
 #include <oxenc/hex.h>
 
 #include <CLI/Validators.hpp>
+#include <ctime>
 #include <future>
 #include <oxen/quic.hpp>
 #include <oxen/quic/gnutls_crypto.hpp>
 #include <thread>
+#include <unordered_set>
 
 #include "utils.hpp"
 
@@ -27,6 +29,18 @@ int main(int argc, char* argv[])
     std::string log_file, log_level;
     add_log_opts(cli, log_file, log_level);
 
+    congestion_opts cc;
+    add_congestion_opts(cli, cc);
+
+    size_t max_udp_payload = MAX_PMTUD_UDP_PAYLOAD;
+    cli.add_option(
+               "--max-udp-payload",
+               max_udp_payload,
+               "Largest UDP payload to send, for networks with an MTU above 1500 (e.g. 8952 for 9000-byte jumbo frames, or "
+               "on localhost).  Should be specified on the client as well.")
+            ->check(CLI::Range(MIN_UDP_PAYLOAD, MAX_JUMBO_UDP_PAYLOAD))
+            ->capture_default_str();
+
     bool no_hash = false;
     cli.add_flag(
             "-H,--no-hash",
@@ -73,12 +87,74 @@ int main(int argc, char* argv[])
         unsigned char checksum = 0;
         gnutls_hash_hd_t hasher;
 
+        // Request/response mode: the size of each request, and the response to send for it
+        size_t request_size = 0;
+        std::shared_ptr<std::string> response;
+
         ~stream_info() { gnutls_hash_deinit(hasher, nullptr); }
     };
 
     std::map<ConnectionID, std::map<int64_t, stream_info>> csd;
 
+    // Totals over each busy period (from the first connection being established until none are
+    // left), reported at the end of it.  Only touched from the endpoint's loop.
+    std::unordered_set<ConnectionID> established;
+    uint64_t period_conns = 0, period_bytes = 0;
+    std::clock_t period_cpu_start = 0;
+    std::chrono::steady_clock::time_point period_start;
+    // The most connections open at once during the period, and the memory in use when there were
+    size_t peak_conns = 0, baseline_rss = 0, rss_at_peak = 0;
+
+    connection_established_callback on_established = [&](connection_interface& ci) {
+        if (established.empty())
+        {
+            period_conns = period_bytes = 0;
+            period_cpu_start = std::clock();
+            period_start = std::chrono::steady_clock::now();
+            peak_conns = 0;
+            baseline_rss = rss_at_peak = current_rss();
+        }
+        established.insert(ci.reference_id());
+        period_conns++;
+        if (established.size() > peak_conns)
+        {
+            peak_conns = established.size();
+            rss_at_peak = current_rss();
+        }
+    };
+
+    connection_closed_callback on_closed = [&](connection_interface& ci, uint64_t) {
+        csd.erase(ci.reference_id());
+        if (!established.erase(ci.reference_id()) || !established.empty())
+            return;
+
+        auto elapsed = std::chrono::duration<double>{std::chrono::steady_clock::now() - period_start}.count();
+        double cpu = static_cast<double>(std::clock() - period_cpu_start) / CLOCKS_PER_SEC;
+        log_level_lowerer enable_info{log::Level::info, test_cat.name};
+        log::info(
+                test_cat,
+                "All connections closed: {} connections over {:.3f}s transferred {}B ({:.3f}MB/s) using {:.3f}s of CPU "
+                "({:.3f} CPU-s/GB)",
+                period_conns,
+                elapsed,
+                period_bytes,
+                period_bytes / 1'000'000.0 / elapsed,
+                cpu,
+                period_bytes ? cpu / (period_bytes / 1'000'000'000.0) : 0.0);
+        log::info(
+                test_cat,
+                "Accepted {:.1f} connections/s; peak {} open at once, using {:.1f}kB of RSS each ({:.1f}MB total, peak "
+                "RSS {:.1f}MB)",
+                period_conns / elapsed,
+                peak_conns,
+                rss_at_peak > baseline_rss ? (rss_at_peak - baseline_rss) / 1e3 / peak_conns : 0.0,
+                rss_at_peak / 1e6,
+                peak_rss() / 1e6);
+    };
+
     stream_data_callback stream_data = [&](Stream& s, bstring_view data) {
+        period_bytes += data.size();
+
         auto& sd = csd[s.reference_id];
         auto it = sd.find(s.stream_id());
         if (it == sd.end())
@@ -89,13 +165,47 @@ int main(int argc, char* argv[])
                 return;
             }
             auto size = oxenc::load_little_to_host<uint64_t>(data.data());
-            data.remove_prefix(sizeof(uint64_t));
-            it = sd.emplace(s.stream_id(), size).first;
-            log::warning(test_cat, "First data from new stream {}, expecting {}B!", s.stream_id(), size);
+            if (size == SPEEDTEST_RPC_MODE)
+            {
+                if (data.size() < SPEEDTEST_RPC_HEADER)
+                {
+                    log::critical(test_cat, "Request/response mode header is truncated ({}B)", data.size());
+                    return;
+                }
+                auto req_size = oxenc::load_little_to_host<uint32_t>(data.data() + 8);
+                auto resp_size = oxenc::load_little_to_host<uint32_t>(data.data() + 12);
+                data.remove_prefix(SPEEDTEST_RPC_HEADER);
+                it = sd.emplace(s.stream_id(), 0).first;
+                it->second.request_size = std::max<size_t>(req_size, 1);
+                it->second.response = std::make_shared<std::string>(std::max<size_t>(resp_size, 1), 'R');
+                log::warning(
+                        test_cat,
+                        "New request/response stream {}: {}B requests, {}B responses",
+                        s.stream_id(),
+                        req_size,
+                        resp_size);
+            }
+            else
+            {
+                data.remove_prefix(sizeof(uint64_t));
+                it = sd.emplace(s.stream_id(), size).first;
+                log::warning(test_cat, "First data from new stream {}, expecting {}B!", s.stream_id(), size);
+            }
         }
 
         auto& [ignore, info] = *it;
 
+        if (info.response)
+        {
+            // Answer every complete request (the client normally only has one outstanding)
+            for (info.received += data.size(); info.received >= info.request_size; info.received -= info.request_size)
+            {
+                s.send(std::string_view{*info.response}, info.response);
+                period_bytes += info.response->size();
+            }
+            return;
+        }
+
         bool need_more = info.received < info.expected;
         info.received += data.size();
         if (info.received > info.expected)
@@ -142,8 +252,9 @@ int main(int argc, char* argv[])
     try
     {
         log::debug(test_cat, "Starting up endpoint");
-        auto _server = server_net.endpoint(server_local);
-        _server->listen(server_tls, stream_opened, stream_data);
+        auto _server =
+                server_net.endpoint(server_local, on_established, on_closed, opt::max_udp_payload{max_udp_payload});
+        _server->listen(server_tls, stream_opened, stream_data, cc.congestion_control(), cc.max_receive_window());
     }
     catch (const std::exception& e)
     {
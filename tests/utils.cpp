@@ -2,14 +2,24 @@
 
 #include <nettle/eddsa.h>
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <system_error>
+
 namespace oxen::quic
 {
     void TestHelper::migrate_connection(Connection& conn, Address new_bind)
     {
-        auto& current_sock = const_cast<std::unique_ptr<UDPSocket>&>(conn._endpoint.get_socket());
-        auto new_sock = std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
-            conn._endpoint.handle_packet(std::move(packet));
-        });
+        auto& current_sock = const_cast<std::unique_ptr<PacketTransport>&>(conn._endpoint.get_socket());
+        std::unique_ptr<PacketTransport> new_sock =
+                std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
+                    conn._endpoint.handle_packet(std::move(packet));
+                });
 
         auto& new_addr = new_sock->address();
         Path new_path{new_addr, conn._path.remote};
@@ -24,10 +34,11 @@ namespace oxen::quic
 
     void TestHelper::migrate_connection_immediate(Connection& conn, Address new_bind)
     {
-        auto& current_sock = const_cast<std::unique_ptr<UDPSocket>&>(conn._endpoint.get_socket());
-        auto new_sock = std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
-            conn._endpoint.handle_packet(std::move(packet));
-        });
+        auto& current_sock = const_cast<std::unique_ptr<PacketTransport>&>(conn._endpoint.get_socket());
+        std::unique_ptr<PacketTransport> new_sock =
+                std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
+                    conn._endpoint.handle_packet(std::move(packet));
+                });
 
         auto& new_addr = new_sock->address();
         Path new_path{new_addr, conn._path.remote};
@@ -42,10 +53,11 @@ namespace oxen::quic
 
     void TestHelper::nat_rebinding(Connection& conn, Address new_bind)
     {
-        auto& current_sock = const_cast<std::unique_ptr<UDPSocket>&>(conn._endpoint.get_socket());
-        auto new_sock = std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
-            conn._endpoint.handle_packet(std::move(packet));
-        });
+        auto& current_sock = const_cast<std::unique_ptr<PacketTransport>&>(conn._endpoint.get_socket());
+        std::unique_ptr<PacketTransport> new_sock =
+                std::make_unique<UDPSocket>(conn._endpoint.get_loop().get(), new_bind, [&](auto&& packet) {
+                    conn._endpoint.handle_packet(std::move(packet));
+                });
 
         auto& new_addr = new_sock->address();
         Path new_path{new_addr, conn._path.remote};
@@ -63,6 +75,39 @@ namespace oxen::quic
         return ep->get_conn(conn->_source_cid);
     }
 
+    rotating_buffer& TestHelper::get_recv_buffer(connection_interface& ci)
+    {
+        auto& conn = static_cast<Connection&>(ci);
+        assert(conn.datagrams);
+        return conn.datagrams->recv_buffer;
+    }
+
+    size_t TestHelper::stream_pending(Stream& s, ngtcp2_vec* bufs, size_t max)
+    {
+        return s.pending(bufs, max);
+    }
+
+    void TestHelper::bt_process_incoming(BTRequestStream& s, std::string_view data)
+    {
+        s.process_incoming(data);
+    }
+
+    std::string TestHelper::bt_encode_command(BTRequestStream& s, std::string_view ep, int64_t rid, std::string_view body)
+    {
+        auto header = s.encode_command(ep, rid, body.size());
+        return "{}:{}{}e"_format(header.size() + body.size() + 1, header, body);
+    }
+
+    std::vector<quic_cid> TestHelper::get_scids(connection_interface& ci)
+    {
+        auto& conn = static_cast<Connection&>(ci);
+        return conn._endpoint.call_get([&conn] {
+            std::vector<ngtcp2_cid> scids(ngtcp2_conn_get_scid(conn, nullptr));
+            ngtcp2_conn_get_scid(conn, scids.data());
+            return std::vector<quic_cid>{scids.begin(), scids.end()};
+        });
+    }
+
     void TestHelper::enable_dgram_drop(connection_interface& ci)
     {
         auto& conn = static_cast<Connection&>(ci);
@@ -112,6 +157,21 @@ namespace oxen::quic
         ep._next_rid += by;
     }
 
+    bool TestHelper::io_uring_enabled(Endpoint& ep)
+    {
+        auto* udp = dynamic_cast<UDPSocket*>(ep.socket.get());
+        return udp && udp->io_uring_enabled();
+    }
+
+#ifdef __linux__
+    void TestHelper::disable_udp_checksums(UDPSocket& s)
+    {
+        int on = 1;
+        if (setsockopt(s.sock_, SOL_SOCKET, SO_NO_CHECK, &on, sizeof(on)) != 0)
+            throw std::system_error{errno, std::system_category(), "setsockopt(SO_NO_CHECK)"};
+    }
+#endif
+
     std::pair<std::shared_ptr<GNUTLSCreds>, std::shared_ptr<GNUTLSCreds>> test::defaults::tls_creds_from_ed_keys()
     {
         auto client = GNUTLSCreds::make_from_ed_keys(CLIENT_SEED, CLIENT_PUBKEY);
@@ -165,6 +225,44 @@ namespace oxen::quic
         logger_config(out, type, lvl);
     }
 
+    void add_congestion_opts(CLI::App& cli, congestion_opts& opts)
+    {
+        opts.algorithm = "cubic";
+        opts.initial_rtt_ms = 0;
+        opts.max_window = 0;
+
+        cli.add_option("--cc", opts.algorithm, "Congestion controller for the data we send; one of cubic, reno, bbr")
+                ->type_name("ALGO")
+                ->capture_default_str()
+                ->check(CLI::IsMember({"cubic", "reno", "bbr"}));
+        cli.add_option(
+                   "--initial-rtt",
+                   opts.initial_rtt_ms,
+                   "Initial RTT estimate, in milliseconds, for the congestion controller; 0 for the default")
+                ->capture_default_str();
+        cli.add_option(
+                "--max-window",
+                opts.max_window,
+                "Maximum receive window (per stream and per connection) to allow ngtcp2 to grow to, in bytes; should be "
+                "at least the link's bandwidth-delay product");
+    }
+
+    opt::congestion_control congestion_opts::congestion_control() const
+    {
+        auto algo = algorithm == "bbr" ? CongestionControl::BBR
+                  : algorithm == "reno" ? CongestionControl::RENO
+                                        : CongestionControl::CUBIC;
+        auto rtt = std::chrono::duration<double, std::milli>{initial_rtt_ms};
+        return opt::congestion_control{algo, std::chrono::duration_cast<std::chrono::microseconds>(rtt)};
+    }
+
+    std::optional<opt::max_receive_window> congestion_opts::max_receive_window() const
+    {
+        if (!max_window)
+            return std::nullopt;
+        return opt::max_receive_window{max_window};
+    }
+
     std::pair<std::string, uint16_t> parse_addr(std::string_view addr, std::optional<uint16_t> default_port)
     {
         std::pair<std::string, uint16_t> result;
@@ -207,4 +305,29 @@ namespace oxen::quic
         return result;
     }
 
+    size_t current_rss()
+    {
+#ifdef __linux__
+        // The second field of statm is the resident page count
+        size_t pages = 0, rss = 0;
+        if (std::ifstream statm{"/proc/self/statm"}; statm >> pages >> rss)
+            return rss * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+        return 0;
+    }
+
+    size_t peak_rss()
+    {
+#ifndef _WIN32
+        rusage ru{};
+        if (getrusage(RUSAGE_SELF, &ru) == 0)
+#ifdef __APPLE__
+            return static_cast<size_t>(ru.ru_maxrss);  // Already in bytes on macOS
+#else
+            return static_cast<size_t>(ru.ru_maxrss) * 1024;
+#endif
+#endif
+        return 0;
+    }
+
 }  // namespace oxen::quic
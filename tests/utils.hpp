@@ -9,6 +9,7 @@
 #include <optional>
 #include <oxen/log.hpp>
 #include <oxen/log/format.hpp>
+#include <oxen/quic/btstream.hpp>
 #include <oxen/quic/endpoint.hpp>
 #include <oxen/quic/format.hpp>
 #include <oxen/quic/gnutls_crypto.hpp>
@@ -33,6 +34,12 @@ namespace oxen::quic
     inline const std::string TEST_ENDPOINT = "test_endpoint"s;
     inline const std::string TEST_BODY = "test_body"s;
 
+    // speedtest-client opens a stream with this (in place of the 8-byte size of a bulk transfer)
+    // to request request/response mode; it is followed by the 4-byte little-endian request size,
+    // and the 4-byte response size the server answers each request with.
+    inline constexpr uint64_t SPEEDTEST_RPC_MODE = ~uint64_t{0};
+    inline constexpr size_t SPEEDTEST_RPC_HEADER = 16;
+
     class TestHelper
     {
       public:
@@ -54,7 +61,34 @@ namespace oxen::quic
         // which in log output.
         static void increment_ref_id(Endpoint& ep, uint64_t by = 1);
 
+        // True if the endpoint is bound to a UDP socket whose I/O is driven by io_uring
+        static bool io_uring_enabled(Endpoint& ep);
+
+#ifdef __linux__
+        // Turns off UDP checksums for the socket's outgoing packets, which makes the kernel reject
+        // any GSO send on it with EINVAL (as happens on a NIC without checksum offload).
+        static void disable_udp_checksums(UDPSocket& s);
+#endif
+
         static Connection* get_conn(std::shared_ptr<Endpoint>& ep, std::shared_ptr<connection_interface>& conn);
+
+        // Returns the local (source) connection IDs the connection currently has.
+        static std::vector<quic_cid> get_scids(connection_interface& conn);
+
+        // Internals exercised directly by the microbenchmarks (bench.cpp).  These must be called
+        // from within the connection's event loop.
+        static rotating_buffer& get_recv_buffer(connection_interface& conn);
+        static size_t stream_pending(Stream& s, ngtcp2_vec* bufs, size_t max);
+        static void bt_process_incoming(BTRequestStream& s, std::string_view data);
+        // Returns a complete encoded command, as BTRequestStream::command would send it
+        static std::string bt_encode_command(BTRequestStream& s, std::string_view ep, int64_t rid, std::string_view body);
+
+        // The (seeded) hash that `map` stores `cid` under
+        template <typename T>
+        static uint64_t cid_hash(const cid_map<T>& map, const quic_cid& cid)
+        {
+            return map.hash(cid);
+        }
     };
 
     namespace test::defaults
@@ -89,6 +123,21 @@ namespace oxen::quic
 
     void setup_logging(std::string out, const std::string& level);
 
+    // Congestion control settings of the speedtest tools, set with the options that
+    // add_congestion_opts adds, so that different settings can be compared.
+    struct congestion_opts
+    {
+        std::string algorithm;
+        double initial_rtt_ms;
+        uint64_t max_window;
+
+        opt::congestion_control congestion_control() const;
+        // nullopt if --max-window was not given
+        std::optional<opt::max_receive_window> max_receive_window() const;
+    };
+
+    void add_congestion_opts(CLI::App& cli, congestion_opts& opts);
+
     /// RAII class that resets the log level for the given category while the object is alive, then
     /// resets it to what it was at construction when the object is destroyed.
     struct log_level_override
@@ -135,6 +184,11 @@ namespace oxen::quic
 
     std::pair<std::string, uint16_t> parse_addr(std::string_view addr, std::optional<uint16_t> default_port = std::nullopt);
 
+    // Returns the process's current and peak resident set sizes, in bytes, or 0 where we don't know
+    // how to get them on this platform.
+    size_t current_rss();
+    size_t peak_rss();
+
 #define _require_future2(f, timeout) REQUIRE(f.wait_for(timeout) == std::future_status::ready)
 #define _require_future1(f) _require_future2(f, 1s)
 #define GET_REQUIRE_FUTURE_MACRO(_1, _2, NAME, ...) NAME